@@ -0,0 +1,453 @@
+/**
+ * @file checkpoint.c
+ * @brief Binary checkpoints of running P colonies
+ * A checkpoint is a header followed by sections that start at multiples of 8 bytes: the (object, count) items of the four environments,
+ * the n object ids of each agent and, if the programs are stored, the number of programs of each agent, the number of rules of each program
+ * and the rules. The sections are read directly from the mapped file, so restoring only costs the changes of the multisets.
+ */
+#define _POSIX_C_SOURCE 200809L //for fileno, fsync and mmap with -std=c99
+#include "checkpoint.h"
+#include "debug_print.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define CHECKPOINT_MAGIC "LULUCKPT"
+// written in the byte order of the machine, so checkpoints of machines with a different byte order are rejected
+#define CHECKPOINT_BYTE_ORDER 0x0102
+// the sections start at multiples of 8 bytes
+#define CHECKPOINT_ALIGN(size) (((size) + 7) & ~((size_t) 7))
+// nr of environments stored in a checkpoint (env, global_env, in_global_env, out_global_env)
+#define CHECKPOINT_NR_ENVS 4
+
+/**
+ * @brief Header of a checkpoint file
+ */
+typedef struct _checkpoint_header {
+    char magic[8]; // CHECKPOINT_MAGIC (without the terminating 0)
+    uint16_t version, // CHECKPOINT_VERSION
+             byte_order; // CHECKPOINT_BYTE_ORDER
+    uint32_t size; // size of the checkpoint in bytes
+    uint64_t step_nr; // nr of simulation steps made before the checkpoint
+    uint32_t rng_state; // state of the random number generator of the colony
+    uint32_t nr_items[CHECKPOINT_NR_ENVS]; // nr of (object, count) items of each environment
+    uint32_t nr_programs, // total nr of programs of all agents (0 if the programs are not stored)
+             nr_rules; // total nr of rules of all programs
+    uint16_t nr_A;
+    uint8_t nr_agents,
+            n,
+            random_agent_order,
+            with_programs; // the programs of the agents are stored
+    uint8_t reserved[6]; // 0, pads the header to 64 bytes
+} checkpoint_header_t;
+
+/**
+ * @brief Count of an object of an environment
+ */
+typedef struct _checkpoint_item {
+    uint32_t obj,
+             nr;
+} checkpoint_item_t;
+
+/**
+ * @brief Rule of a program (Rule_t with fixed width fields)
+ */
+typedef struct _checkpoint_rule {
+    uint16_t type,
+             lhs,
+             rhs,
+             alt_lhs,
+             alt_rhs;
+} checkpoint_rule_t;
+
+/**
+ * @brief Positions of the sections of a checkpoint (offsets from the start of the checkpoint)
+ */
+typedef struct _checkpoint_layout {
+    size_t items, // checkpoint_item_t[nr_items[0] + ... + nr_items[3]]
+           agent_objects, // uint16_t[nr_agents * n]
+           nr_programs, // uint8_t[nr_agents]
+           nr_rules, // uint8_t[nr_programs]
+           rules, // checkpoint_rule_t[nr_rules]
+           size; // total size
+} checkpoint_layout_t;
+
+/**
+ * @brief Compute the positions of the sections of a checkpoint
+ *
+ * @param header The header of the checkpoint
+ * @param layout Will store the positions of the sections
+ */
+static void getCheckpointLayout(checkpoint_header_t *header, checkpoint_layout_t *layout) {
+    size_t nr_items = 0;
+
+    for (uint8_t env = 0; env < CHECKPOINT_NR_ENVS; env++)
+        nr_items += header->nr_items[env];
+
+    layout->items = CHECKPOINT_ALIGN(sizeof(checkpoint_header_t));
+    layout->agent_objects = layout->items + CHECKPOINT_ALIGN(sizeof(checkpoint_item_t) * nr_items);
+    layout->nr_programs = layout->agent_objects + CHECKPOINT_ALIGN(sizeof(uint16_t) * header->nr_agents * header->n);
+    //the program sections are empty if the programs are not stored
+    layout->nr_rules = layout->nr_programs;
+    layout->rules = layout->nr_programs;
+    layout->size = layout->nr_programs;
+    if (header->with_programs) {
+        layout->nr_rules = layout->nr_programs + CHECKPOINT_ALIGN(sizeof(uint8_t) * header->nr_agents);
+        layout->rules = layout->nr_rules + CHECKPOINT_ALIGN(sizeof(uint8_t) * header->nr_programs);
+        layout->size = layout->rules + CHECKPOINT_ALIGN(sizeof(checkpoint_rule_t) * header->nr_rules);
+    }
+}
+
+/**
+ * @brief Get the environments of a P colony in the order in which they are stored in a checkpoint
+ *
+ * @param pcol The P colony
+ * @param envs Will store the environments
+ */
+static void getCheckpointEnvs(Pcolony_t *pcol, multiset_env_t **envs) {
+    envs[0] = &pcol->env;
+    envs[1] = &pcol->swarm->global_env;
+    envs[2] = &pcol->swarm->in_global_env;
+    envs[3] = &pcol->swarm->out_global_env;
+}
+
+/**
+ * @brief Store the objects of an agent as a list of n object ids (NO_OBJECT for empty places)
+ *
+ * @param agent The agent
+ * @param ids Space for pcolony->n ids
+ */
+static void getAgentObjectIds(Agent_t *agent, uint16_t *ids) {
+    uint8_t nr_ids = 0;
+    multiset_obj_t *obj = &agent->obj;
+
+#ifdef MULTISET_OBJ_COUNTED
+    for (uint8_t run = 0; run < obj->nr_runs; run++)
+        for (multiset_count_t i = 0; i < obj->items[run].nr && nr_ids < agent->pcolony->n; i++)
+            ids[nr_ids++] = obj->items[run].id;
+#else
+    for (uint8_t i = 0; i < obj->size && nr_ids < agent->pcolony->n; i++)
+        if (obj->items[i] != NO_OBJECT)
+            ids[nr_ids++] = obj->items[i];
+#endif
+    while (nr_ids < agent->pcolony->n)
+        ids[nr_ids++] = NO_OBJECT;
+}
+
+bool pcolony_writeCheckpoint(Pcolony_t *pcol, uint64_t step_nr, bool with_programs, const char *path) {
+    checkpoint_header_t header;
+    checkpoint_layout_t layout;
+    multiset_env_t *envs[CHECKPOINT_NR_ENVS];
+    checkpoint_item_t *items;
+    uint16_t *agent_objects;
+    uint8_t *buffer;
+    char *temporary_path;
+    FILE *file;
+    bool written;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, CHECKPOINT_MAGIC, sizeof(header.magic));
+    header.version = CHECKPOINT_VERSION;
+    header.byte_order = CHECKPOINT_BYTE_ORDER;
+    header.step_nr = step_nr;
+    header.rng_state = pcol->rng_state;
+    header.nr_A = pcol->nr_A;
+    header.nr_agents = pcol->nr_agents;
+    header.n = pcol->n;
+    header.random_agent_order = pcol->random_agent_order;
+    header.with_programs = with_programs;
+
+    //in both environment layouts an item holds an object whose id is not NO_OBJECT
+    getCheckpointEnvs(pcol, envs);
+    for (uint8_t env = 0; env < CHECKPOINT_NR_ENVS; env++)
+        for (object_id_t i = 0; i < envs[env]->size; i++)
+            if (envs[env]->items[i].id != NO_OBJECT && envs[env]->items[i].nr > 0)
+                header.nr_items[env]++;
+    if (with_programs)
+        for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++) {
+            header.nr_programs += pcol->agents[agent_nr].nr_programs;
+            for (uint8_t prg_nr = 0; prg_nr < pcol->agents[agent_nr].nr_programs; prg_nr++)
+                header.nr_rules += pcol->agents[agent_nr].programs[prg_nr].nr_rules;
+        }
+    getCheckpointLayout(&header, &layout);
+    header.size = (uint32_t) layout.size;
+
+    //the checkpoint is built in memory (including the padding of the sections) and written at once
+    buffer = (uint8_t *) LULU_MALLOC(layout.size);
+    memset(buffer, 0, layout.size);
+    memcpy(buffer, &header, sizeof(header));
+
+    items = (checkpoint_item_t *) (buffer + layout.items);
+    for (uint8_t env = 0; env < CHECKPOINT_NR_ENVS; env++)
+        for (object_id_t i = 0; i < envs[env]->size; i++)
+            if (envs[env]->items[i].id != NO_OBJECT && envs[env]->items[i].nr > 0) {
+                items->obj = envs[env]->items[i].id;
+                items->nr = envs[env]->items[i].nr;
+                items++;
+            }
+
+    agent_objects = (uint16_t *) (buffer + layout.agent_objects);
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++)
+        getAgentObjectIds(&pcol->agents[agent_nr], &agent_objects[agent_nr * pcol->n]);
+
+    if (with_programs) {
+        uint8_t *nr_programs = buffer + layout.nr_programs,
+                *nr_rules = buffer + layout.nr_rules;
+        checkpoint_rule_t *rules = (checkpoint_rule_t *) (buffer + layout.rules);
+
+        for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++) {
+            Agent_t *agent = &pcol->agents[agent_nr];
+
+            *nr_programs++ = agent->nr_programs;
+            for (uint8_t prg_nr = 0; prg_nr < agent->nr_programs; prg_nr++) {
+                *nr_rules++ = agent->programs[prg_nr].nr_rules;
+                for (uint8_t rule_nr = 0; rule_nr < agent->programs[prg_nr].nr_rules; rule_nr++) {
+                    Rule_t *rule = &agent->programs[prg_nr].rules[rule_nr];
+
+                    rules->type = rule->type;
+                    rules->lhs = rule->lhs;
+                    rules->rhs = rule->rhs;
+                    rules->alt_lhs = rule->alt_lhs;
+                    rules->alt_rhs = rule->alt_rhs;
+                    rules++;
+                }
+            }
+        }
+    }
+
+    //the previous checkpoint is only replaced by a complete one
+    temporary_path = (char *) LULU_MALLOC(strlen(path) + 5);
+    strcpy(temporary_path, path);
+    strcat(temporary_path, ".tmp");
+    file = fopen(temporary_path, "wb");
+    written = file != NULL &&
+        fwrite(buffer, 1, layout.size, file) == layout.size &&
+        fflush(file) == 0 &&
+        fsync(fileno(file)) == 0;
+    if (file != NULL && fclose(file) != 0)
+        written = FALSE;
+    if (written && rename(temporary_path, path) != 0)
+        written = FALSE;
+    if (!written) {
+        printe("Could not write the checkpoint %s", path);
+        remove(temporary_path);
+    }
+
+    LULU_FREE(temporary_path);
+    LULU_FREE(buffer);
+
+    return written;
+}
+
+/**
+ * @brief Checkpoint file mapped into memory
+ */
+typedef struct _checkpoint_map {
+    uint8_t *data;
+    size_t size;
+    checkpoint_header_t *header;
+    checkpoint_layout_t layout;
+} checkpoint_map_t;
+
+/**
+ * @brief Check the environment objects of a mapped checkpoint
+ * Each environment stores every object at most once, so a repeated object is as invalid as an object outside of the alphabet
+ *
+ * @param map The mapped checkpoint (with a valid header and layout)
+ *
+ * @return TRUE if all of the objects are part of the alphabet, are not repeated in their environment and have a valid count
+ */
+static bool areCheckpointItemsValid(checkpoint_map_t *map) {
+    checkpoint_item_t *items = (checkpoint_item_t *) (map->data + map->layout.items);
+    size_t seen_size = ((size_t) map->header->nr_A + 7) / 8;
+    uint8_t *seen = (uint8_t *) LULU_MALLOC(seen_size + 1);
+    bool valid = TRUE;
+
+    for (uint8_t env = 0; env < CHECKPOINT_NR_ENVS && valid; env++) {
+        memset(seen, 0, seen_size);
+        for (uint32_t i = 0; i < map->header->nr_items[env] && valid; i++, items++) {
+            if (items->obj == NO_OBJECT || items->obj >= map->header->nr_A || items->nr > MULTISET_COUNT_MAX ||
+                    (seen[items->obj / 8] & (1 << (items->obj % 8))))
+                valid = FALSE;
+            else
+                seen[items->obj / 8] |= 1 << (items->obj % 8);
+        }
+    }
+
+    LULU_FREE(seen);
+    return valid;
+}
+
+/**
+ * @brief Map a checkpoint file into memory and check that it's header and sections are valid
+ *
+ * @param map The mapping that will be initialized
+ * @param path Path of the checkpoint file
+ *
+ * @return TRUE if the file was mapped and is a valid checkpoint, FALSE otherwise (nothing is mapped)
+ */
+static bool mapCheckpoint(checkpoint_map_t *map, const char *path) {
+    struct stat status;
+    int fd = open(path, O_RDONLY);
+    uint16_t *agent_objects;
+
+    if (fd < 0) {
+        printe("Could not open the checkpoint %s", path);
+        return FALSE;
+    }
+    if (fstat(fd, &status) != 0 || status.st_size < (off_t) sizeof(checkpoint_header_t)) {
+        printe("%s is not a checkpoint", path);
+        close(fd);
+        return FALSE;
+    }
+    map->size = (size_t) status.st_size;
+    map->data = (uint8_t *) mmap(NULL, map->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    //the mapping stays valid after the file is closed
+    close(fd);
+    if (map->data == MAP_FAILED) {
+        printe("Could not map the checkpoint %s", path);
+        return FALSE;
+    }
+
+    map->header = (checkpoint_header_t *) map->data;
+    if (memcmp(map->header->magic, CHECKPOINT_MAGIC, sizeof(map->header->magic)) != 0 ||
+            map->header->byte_order != CHECKPOINT_BYTE_ORDER || map->header->version != CHECKPOINT_VERSION) {
+        printe("%s is not a checkpoint of version %d", path, CHECKPOINT_VERSION);
+        munmap(map->data, map->size);
+        return FALSE;
+    }
+    getCheckpointLayout(map->header, &map->layout);
+    if (map->header->size != map->size || map->layout.size != map->size) {
+        printe("The checkpoint %s is truncated", path);
+        munmap(map->data, map->size);
+        return FALSE;
+    }
+
+    //all of the objects are checked before the colony is modified
+    if (!areCheckpointItemsValid(map)) {
+        printe("The checkpoint %s has an invalid environment object", path);
+        munmap(map->data, map->size);
+        return FALSE;
+    }
+    agent_objects = (uint16_t *) (map->data + map->layout.agent_objects);
+    for (uint32_t i = 0; i < (uint32_t) map->header->nr_agents * map->header->n; i++)
+        if (agent_objects[i] >= map->header->nr_A) {
+            printe("The checkpoint %s has an invalid agent object", path);
+            munmap(map->data, map->size);
+            return FALSE;
+        }
+
+    return TRUE;
+}
+
+/**
+ * @brief Replace the configuration of a P colony with the one stored in a mapped checkpoint
+ *
+ * @param pcol The P colony (with the alphabet, agents and capacity of the checkpoint)
+ * @param map The mapped checkpoint
+ */
+static void restoreCheckpointConfiguration(Pcolony_t *pcol, checkpoint_map_t *map) {
+    multiset_env_t *envs[CHECKPOINT_NR_ENVS];
+    checkpoint_item_t *items = (checkpoint_item_t *) (map->data + map->layout.items);
+    uint16_t *agent_objects = (uint16_t *) (map->data + map->layout.agent_objects);
+
+    //the multiset functions update the presence bits, the hashes and the changed objects, so incremental selection stays valid
+    getCheckpointEnvs(pcol, envs);
+    for (uint8_t env = 0; env < CHECKPOINT_NR_ENVS; env++) {
+        clearMultisetEnv(envs[env]);
+        for (uint32_t i = 0; i < map->header->nr_items[env]; i++, items++)
+            setObjectCountFromMultisetEnv(envs[env], (object_id_t) items->obj, (multiset_count_t) items->nr);
+    }
+
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++) {
+        clearMultisetObj(&pcol->agents[agent_nr].obj);
+        for (uint8_t i = 0; i < pcol->n; i++)
+            if (agent_objects[agent_nr * pcol->n + i] != NO_OBJECT)
+                addObjectToMultisetObj(&pcol->agents[agent_nr].obj, (object_id_t) agent_objects[agent_nr * pcol->n + i]);
+        pcol->agents[agent_nr].chosenProgramNr = NO_PROGRAM;
+    }
+
+    pcol->rng_state = map->header->rng_state;
+    pcol->random_agent_order = map->header->random_agent_order;
+#ifdef CONFIG_HASH
+    //the configurations visited before the checkpoint are not known
+    if (pcol->history_size > 0)
+        pcolony_setHistorySize(pcol, pcol->history_size);
+#endif
+}
+
+bool pcolony_restoreCheckpoint(Pcolony_t *pcol, uint64_t *step_nr, const char *path) {
+    checkpoint_map_t map;
+
+    if (!mapCheckpoint(&map, path))
+        return FALSE;
+    if (map.header->nr_A != pcol->nr_A || map.header->nr_agents != pcol->nr_agents || map.header->n != pcol->n) {
+        printe("The checkpoint %s was made by a different P colony", path);
+        munmap(map.data, map.size);
+        return FALSE;
+    }
+
+    restoreCheckpointConfiguration(pcol, &map);
+    *step_nr = map.header->step_nr;
+    munmap(map.data, map.size);
+
+    return TRUE;
+}
+
+bool initPcolonyFromCheckpoint(Pcolony_t *pcol, uint64_t *step_nr, const char *path) {
+    checkpoint_map_t map;
+    uint8_t *nr_programs, *nr_rules;
+    checkpoint_rule_t *rules;
+    uint32_t total_programs = 0, total_rules = 0;
+
+    if (!mapCheckpoint(&map, path))
+        return FALSE;
+    nr_programs = map.data + map.layout.nr_programs;
+    nr_rules = map.data + map.layout.nr_rules;
+    rules = (checkpoint_rule_t *) (map.data + map.layout.rules);
+
+    //the program counts have to match the number of stored programs and rules
+    if (map.header->with_programs) {
+        for (uint8_t agent_nr = 0; agent_nr < map.header->nr_agents; agent_nr++)
+            total_programs += nr_programs[agent_nr];
+        for (uint32_t i = 0; i < total_programs && total_programs == map.header->nr_programs; i++)
+            total_rules += nr_rules[i];
+    }
+    if (!map.header->with_programs || total_programs != map.header->nr_programs || total_rules != map.header->nr_rules) {
+        printe("The checkpoint %s does not contain the programs of the P colony", path);
+        munmap(map.data, map.size);
+        return FALSE;
+    }
+    //an invalid type would index the conditional rule tables (see getFirstRuleTypeFromConditional()) out of bounds
+    for (uint32_t i = 0; i < total_rules; i++)
+        if (!isValidRuleType(rules[i].type) || rules[i].lhs >= map.header->nr_A || rules[i].rhs >= map.header->nr_A ||
+                rules[i].alt_lhs >= map.header->nr_A || rules[i].alt_rhs >= map.header->nr_A) {
+            printe("The checkpoint %s has an invalid rule", path);
+            munmap(map.data, map.size);
+            return FALSE;
+        }
+
+    initPcolony(pcol, map.header->nr_A, map.header->nr_agents, map.header->n);
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++) {
+        Agent_t *agent = &pcol->agents[agent_nr];
+
+        initAgent(agent, pcol, nr_programs[agent_nr]);
+        for (uint8_t prg_nr = 0; prg_nr < agent->nr_programs; prg_nr++, nr_rules++) {
+            initProgram(&agent->programs[prg_nr], *nr_rules);
+            for (uint8_t rule_nr = 0; rule_nr < *nr_rules; rule_nr++, rules++)
+                initRule(&agent->programs[prg_nr].rules[rule_nr], (rule_type_t) rules->type,
+                        (object_id_t) rules->lhs, (object_id_t) rules->rhs, (object_id_t) rules->alt_lhs, (object_id_t) rules->alt_rhs);
+        }
+        agent->init_program_nr = agent->nr_programs;
+    }
+
+    restoreCheckpointConfiguration(pcol, &map);
+    *step_nr = map.header->step_nr;
+    munmap(map.data, map.size);
+
+    return TRUE;
+}
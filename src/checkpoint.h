@@ -0,0 +1,60 @@
+// vim:filetype=c
+/**
+ * @file checkpoint.h
+ * @brief Binary checkpoints of running P colonies, used to resume long simulations after a crash
+ * A checkpoint stores the step number, the state of the random number generator, the contents of all environments (as (object, count)
+ * pairs of the present objects) and the objects of each agent. The programs of the agents are optional: a checkpoint without programs
+ * can only be restored into a colony initialized from the same instance, a checkpoint with programs can also initialize a new colony.
+ * The contents do not depend on the multiset layout of the library, only on the byte order of the machine.
+ * Only available for the PC build.
+ */
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "lulu.h"
+
+// version of the checkpoint format, incremented whenever the layout changes (older checkpoints are rejected)
+#define CHECKPOINT_VERSION 1
+
+/**
+ * @brief Write a checkpoint of a P colony between two simulation steps
+ * The checkpoint is written to a temporary file that replaces the file at path only once it is complete, so a crash during the write
+ * leaves the previous checkpoint intact. The global environments are the ones seen by the colony (those of it's swarm, if it belongs to one).
+ *
+ * @param pcol The P colony
+ * @param step_nr Number of simulation steps made so far (returned by the restore functions)
+ * @param with_programs If TRUE the programs of the agents are stored too (see initPcolonyFromCheckpoint())
+ * @param path Path of the checkpoint file
+ *
+ * @return TRUE if the checkpoint was written, FALSE otherwise
+ */
+bool pcolony_writeCheckpoint(Pcolony_t *pcol, uint64_t step_nr, bool with_programs, const char *path);
+
+/**
+ * @brief Restore the configuration stored in a checkpoint into an initialized P colony
+ * The colony has to be built from the same instance as the one that was checkpointed (same alphabet, number of agents and capacity,
+ * the stored programs are not compared). The environments, the objects of the agents and the random number generator are replaced,
+ * the history of visited configurations is cleared (see pcolony_setHistorySize()). The file is mapped into memory and read in place.
+ *
+ * @param pcol The P colony (initialized, expanded and possibly packed)
+ * @param step_nr Will store the step number of the checkpoint
+ * @param path Path of the checkpoint file
+ *
+ * @return TRUE if the configuration was restored, FALSE if the file is not a valid checkpoint of this colony (pcol is not modified)
+ */
+bool pcolony_restoreCheckpoint(Pcolony_t *pcol, uint64_t *step_nr, const char *path);
+
+/**
+ * @brief Initialize a P colony from a checkpoint that stores the programs of the agents
+ * The colony gets the alphabet, agents and programs of the checkpointed colony and the configuration stored in the checkpoint,
+ * without the instance that it was built from. It has to be destroyed with destroyPcolony().
+ *
+ * @param pcol The P colony that will be initialized
+ * @param step_nr Will store the step number of the checkpoint
+ * @param path Path of the checkpoint file
+ *
+ * @return TRUE if the colony was initialized, FALSE if the file is not a valid checkpoint with programs (pcol is not initialized)
+ */
+bool initPcolonyFromCheckpoint(Pcolony_t *pcol, uint64_t *step_nr, const char *path);
+
+#endif
@@ -0,0 +1,194 @@
+/**
+ * @file ensemble.c
+ * @brief Ensembles of independent replicas of one P colony
+ * The replicas do not share any mutable state, so they can be stepped by different threads without synchronization.
+ */
+#include "ensemble.h"
+#include <stdlib.h>
+
+/**
+ * @brief Derive the seed of a replica from the seed of the ensemble
+ * The golden ratio increment gives distinct values for all replicas and the finalizer of MurmurHash3 decorrelates
+ * the generators of neighbouring replicas
+ *
+ * @param seed The seed of the ensemble
+ * @param replica_nr The number of the replica
+ *
+ * @return The seed of the replica
+ */
+static uint32_t getReplicaSeed(uint32_t seed, uint32_t replica_nr) {
+    uint32_t x = seed + replica_nr * 0x9E3779B9;
+
+    x ^= x >> 16;
+    x *= 0x85EBCA6B;
+    x ^= x >> 13;
+    x *= 0xC2B2AE35;
+    x ^= x >> 16;
+
+    return x;
+}
+
+/**
+ * @brief Move the items of an environment multiset to the storage provided by the ensemble
+ *
+ * @param multiset The environment multiset
+ * @param storage Space for multiset->size items
+ */
+static void moveEnvItems(multiset_env_t *multiset, multiset_env_item_t *storage) {
+    for (object_id_t i = 0; i < multiset->size; i++)
+        storage[i] = multiset->items[i];
+    LULU_FREE(multiset->items);
+    multiset->items = storage;
+}
+
+/**
+ * @brief Return an environment multiset of a P colony
+ *
+ * @param pcol The P colony
+ * @param target One of the environment targets (MULTISET_TARGET_ENV ... MULTISET_TARGET_OUT_GLOBAL_ENV)
+ *
+ * @return Pointer to the environment multiset
+ */
+static multiset_env_t* getPcolonyEnv(Pcolony_t *pcol, multiset_target_t target) {
+    switch (target) {
+        case MULTISET_TARGET_GLOBAL_ENV:
+            return &pcol->pswarm.global_env;
+        case MULTISET_TARGET_IN_GLOBAL_ENV:
+            return &pcol->pswarm.in_global_env;
+        case MULTISET_TARGET_OUT_GLOBAL_ENV:
+            return &pcol->pswarm.out_global_env;
+        default:
+            return &pcol->env;
+    }
+}
+
+void initEnsemble(Ensemble_t *ensemble, Pcolony_t *pcol, uint32_t nr_replicas, uint32_t seed) {
+    uint32_t env_stride = nr_replicas * (uint32_t) pcol->nr_A;
+
+    ensemble->nr_replicas = nr_replicas;
+    ensemble->nr_running = nr_replicas;
+    ensemble->replicas = (Pcolony_t *) LULU_MALLOC(sizeof(Pcolony_t) * nr_replicas);
+    ensemble->env_items = (multiset_env_item_t *) LULU_MALLOC(sizeof(multiset_env_item_t) * (MULTISET_TARGET_NONE - MULTISET_TARGET_ENV) * env_stride);
+    ensemble->results = (sim_step_result_t *) LULU_MALLOC(sizeof(sim_step_result_t) * nr_replicas);
+    ensemble->nr_steps = (uint32_t *) LULU_MALLOC(sizeof(uint32_t) * nr_replicas);
+    ensemble->step_limits = (uint32_t *) LULU_MALLOC(sizeof(uint32_t) * nr_replicas);
+#ifdef LULU_THREADS
+    ensemble->thread_pool = NULL;
+#endif
+
+    for (uint32_t replica_nr = 0; replica_nr < nr_replicas; replica_nr++) {
+        Pcolony_t *replica = &ensemble->replicas[replica_nr];
+
+        copyPcolony(replica, pcol);
+        pcolony_setSeed(replica, getReplicaSeed(seed, replica_nr));
+        for (multiset_target_t target = MULTISET_TARGET_ENV; target < MULTISET_TARGET_NONE; target++)
+            moveEnvItems(getPcolonyEnv(replica, target),
+                    &ensemble->env_items[(target - MULTISET_TARGET_ENV) * env_stride + replica_nr * pcol->nr_A]);
+
+        ensemble->results[replica_nr] = SIM_STEP_RESULT_FINISHED;
+        ensemble->nr_steps[replica_nr] = 0;
+    }
+}
+
+void destroyEnsemble(Ensemble_t *ensemble) {
+#ifdef LULU_THREADS
+    ensemble_setThreads(ensemble, 0);
+#endif
+
+    for (uint32_t replica_nr = 0; replica_nr < ensemble->nr_replicas; replica_nr++) {
+        //the environment items belong to env_items
+        for (multiset_target_t target = MULTISET_TARGET_ENV; target < MULTISET_TARGET_NONE; target++)
+            getPcolonyEnv(&ensemble->replicas[replica_nr], target)->items = NULL;
+        destroyPcolony(&ensemble->replicas[replica_nr]);
+    }
+
+    LULU_FREE(ensemble->replicas);
+    LULU_FREE(ensemble->env_items);
+    LULU_FREE(ensemble->results);
+    LULU_FREE(ensemble->nr_steps);
+    LULU_FREE(ensemble->step_limits);
+    ensemble->replicas = NULL;
+    ensemble->env_items = NULL;
+    ensemble->results = NULL;
+    ensemble->nr_steps = NULL;
+    ensemble->step_limits = NULL;
+    ensemble->nr_replicas = 0;
+    ensemble->nr_running = 0;
+}
+
+/**
+ * @brief Run simulation steps of one replica until it terminates or reaches it's step limit
+ *
+ * @param ensemble The ensemble
+ * @param replica_nr The number of the replica
+ */
+static void runReplica(Ensemble_t *ensemble, uint32_t replica_nr) {
+    while (ensemble->results[replica_nr] == SIM_STEP_RESULT_FINISHED && ensemble->nr_steps[replica_nr] < ensemble->step_limits[replica_nr]) {
+        ensemble->results[replica_nr] = pcolony_runSimulationStep(&ensemble->replicas[replica_nr]);
+        ensemble->nr_steps[replica_nr]++;
+#ifdef STEP_LEAPING
+        ensemble->nr_steps[replica_nr] += ensemble->replicas[replica_nr].nr_leaped_steps;
+#endif
+    }
+}
+
+/**
+ * @brief Run the replicas assigned to one worker (replicas worker_nr, worker_nr + nr_threads, ...)
+ * The replicas are interleaved between the workers, so that workers get similar amounts of work from replicas of similar cost
+ *
+ * @param context The ensemble
+ * @param worker_nr The number of the worker
+ * @param nr_threads The number of workers
+ */
+static void runWorkerReplicas(void *context, uint8_t worker_nr, uint8_t nr_threads) {
+    Ensemble_t *ensemble = (Ensemble_t *) context;
+
+    for (uint32_t replica_nr = worker_nr; replica_nr < ensemble->nr_replicas; replica_nr += nr_threads)
+        runReplica(ensemble, replica_nr);
+}
+
+#ifdef LULU_THREADS
+bool ensemble_setThreads(Ensemble_t *ensemble, uint8_t nr_threads) {
+    if (ensemble->thread_pool != NULL) {
+        destroyThreadPool(ensemble->thread_pool);
+        ensemble->thread_pool = NULL;
+    }
+    if (nr_threads <= 1)
+        return TRUE;
+
+    return createThreadPool(&ensemble->thread_pool, nr_threads, runWorkerReplicas, ensemble);
+}
+#endif
+
+uint32_t ensemble_run(Ensemble_t *ensemble, uint32_t max_steps) {
+    for (uint32_t replica_nr = 0; replica_nr < ensemble->nr_replicas; replica_nr++)
+        ensemble->step_limits[replica_nr] = ensemble->nr_steps[replica_nr] + max_steps;
+
+#ifdef LULU_THREADS
+    if (ensemble->thread_pool != NULL) {
+        //the first step of a replica compiles it's programs (heap allocations), so it is made by the calling thread
+        for (uint32_t replica_nr = 0; replica_nr < ensemble->nr_replicas; replica_nr++)
+            if (ensemble->nr_steps[replica_nr] == 0 && max_steps > 0 && ensemble->results[replica_nr] == SIM_STEP_RESULT_FINISHED) {
+                ensemble->results[replica_nr] = pcolony_runSimulationStep(&ensemble->replicas[replica_nr]);
+                ensemble->nr_steps[replica_nr]++;
+#ifdef STEP_LEAPING
+                ensemble->nr_steps[replica_nr] += ensemble->replicas[replica_nr].nr_leaped_steps;
+#endif
+            }
+        runThreadPool(ensemble->thread_pool);
+    }
+    else
+#endif
+        runWorkerReplicas(ensemble, 0, 1);
+
+    ensemble->nr_running = 0;
+    for (uint32_t replica_nr = 0; replica_nr < ensemble->nr_replicas; replica_nr++)
+        if (ensemble->results[replica_nr] == SIM_STEP_RESULT_FINISHED)
+            ensemble->nr_running++;
+
+    return ensemble->nr_running;
+}
+
+uint32_t ensemble_runSimulationStep(Ensemble_t *ensemble) {
+    return ensemble_run(ensemble, 1);
+}
@@ -0,0 +1,89 @@
+// vim:filetype=c
+/**
+ * @file ensemble.h
+ * @brief Ensembles of independent replicas of one P colony (e.g. for Monte Carlo studies with many seeds)
+ * The replicas are deep copies of an initialized P colony that only differ by the seed of their random number generator.
+ * The environment multisets of all replicas are stored in one array per environment (structure of arrays),
+ * so the counts of one environment of all replicas are contiguous in memory.
+ * Only available for the PC build.
+ */
+#ifndef ENSEMBLE_H
+#define ENSEMBLE_H
+
+#include "lulu.h"
+
+/**
+ * @brief Ensemble struct that holds the replicas of a P colony and their simulation results
+ */
+typedef struct _Ensemble {
+    uint32_t nr_replicas;
+    Pcolony_t *replicas; // replica array
+
+    // env_items[(target - MULTISET_TARGET_ENV) * nr_replicas * nr_A + replica_nr * nr_A + i] = items[i] of environment target of replica_nr
+    multiset_env_item_t *env_items;
+
+    sim_step_result_t *results; // result of the last simulation step of each replica (SIM_STEP_RESULT_FINISHED while it is running)
+    uint32_t *nr_steps; // nr of simulation steps made by each replica
+    uint32_t nr_running; // nr of replicas that have not terminated
+
+    uint32_t *step_limits; // step_limits[i] = value of nr_steps[i] at which replica i stops in the current call of ensemble_run()
+#ifdef LULU_THREADS
+    thread_pool_t *thread_pool; // workers that step the replicas in parallel (NULL for sequential stepping, see ensemble_setThreads())
+#endif
+} Ensemble_t;
+
+/**
+ * @brief Initialize an ensemble of replicas of a P colony
+ * Replica i is seeded with a seed derived from seed and i, so an ensemble is reproducible for a given seed
+ * The source colony is not modified and can be destroyed afterwards
+ *
+ * @param ensemble The ensemble that will be initialized
+ * @param pcol The (initialized and expanded) P colony that is replicated
+ * @param nr_replicas The number of replicas
+ * @param seed The seed of the ensemble
+ */
+void initEnsemble(Ensemble_t *ensemble, Pcolony_t *pcol, uint32_t nr_replicas, uint32_t seed);
+
+/**
+ * @brief Destroy an ensemble and all of it's replicas
+ *
+ * @param ensemble The ensemble that will be destroyed
+ */
+void destroyEnsemble(Ensemble_t *ensemble);
+
+#ifdef LULU_THREADS
+/**
+ * @brief Set the number of threads used to step the replicas of an ensemble
+ * Each replica is always stepped by a single thread and uses it's own random number generator, so the results do not depend on the
+ * number of threads
+ *
+ * @param ensemble The ensemble
+ * @param nr_threads Total number of threads, including the calling thread (0 or 1 for sequential stepping)
+ *
+ * @return TRUE if all of the threads were created, FALSE otherwise (the threads that were created are used)
+ */
+bool ensemble_setThreads(Ensemble_t *ensemble, uint8_t nr_threads);
+#endif
+
+/**
+ * @brief Run one simulation step of each replica that has not terminated (all of the replicas advance in lockstep)
+ *
+ * @param ensemble The ensemble
+ *
+ * @return The number of replicas that have not terminated
+ */
+uint32_t ensemble_runSimulationStep(Ensemble_t *ensemble);
+
+/**
+ * @brief Run each replica independently until it terminates or until it has made max_steps more simulation steps
+ * Replicas do not wait for each other between steps, so this is faster than repeated calls of ensemble_runSimulationStep()
+ * If leaping is enabled (see pcolony_setLeaping()) a replica may overshoot the limit by the steps of it's last leap
+ *
+ * @param ensemble The ensemble
+ * @param max_steps The maximum number of simulation steps made by each replica
+ *
+ * @return The number of replicas that have not terminated
+ */
+uint32_t ensemble_run(Ensemble_t *ensemble, uint32_t max_steps);
+
+#endif
@@ -0,0 +1,576 @@
+/**
+ * @file instance_image.c
+ * @brief Precompiled binary images of expanded P colonies
+ * An image is a header followed by sections that start at multiples of 8 bytes: the (object, count) items of the four environments,
+ * the n object ids of each agent, the number of programs of each agent, the number of rules of each program, the rules (stored as Rule_t,
+ * so that they can be used in place), the offsets of the names of the objects and agents and the names themselves.
+ */
+#define _POSIX_C_SOURCE 200809L //for fileno, fsync and mmap with -std=c99
+#include "instance_image.h"
+#include "debug_print.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define IMAGE_MAGIC "LULUIMAG"
+// written in the byte order of the machine, so images of machines with a different byte order are rejected
+#define IMAGE_BYTE_ORDER 0x0102
+// the sections start at multiples of 8 bytes
+#define IMAGE_ALIGN(size) (((size) + 7) & ~((size_t) 7))
+// nr of environments stored in an image (env, global_env, in_global_env, out_global_env)
+#define IMAGE_NR_ENVS 4
+// 64 bit FNV-1a parameters
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+/**
+ * @brief Header of an image file
+ */
+typedef struct _image_header {
+    char magic[8]; // IMAGE_MAGIC (without the terminating 0)
+    uint16_t version, // INSTANCE_IMAGE_VERSION
+             byte_order; // IMAGE_BYTE_ORDER
+    uint32_t size; // size of the image in bytes
+    uint64_t model_hash;
+    uint16_t robot_id,
+             nr_swarm_robots,
+             nr_A;
+    uint8_t nr_agents,
+            n;
+    uint32_t nr_items[IMAGE_NR_ENVS]; // nr of (object, count) items of each environment
+    uint32_t nr_programs, // total nr of programs of all agents
+             nr_rules, // total nr of rules of all programs
+             names_size; // size of the names section in bytes
+    uint8_t rule_size, // sizeof(Rule_t) of the build that wrote the image
+            object_id_bits; // OBJECT_ID_BITS of the build that wrote the image
+    uint8_t reserved[2]; // 0, pads the header to 64 bytes
+} image_header_t;
+
+/**
+ * @brief Count of an object of an environment
+ */
+typedef struct _image_item {
+    uint32_t obj,
+             nr;
+} image_item_t;
+
+/**
+ * @brief Positions of the sections of an image (offsets from the start of the image)
+ */
+typedef struct _image_layout {
+    size_t items, // image_item_t[nr_items[0] + ... + nr_items[3]]
+           agent_objects, // object_id_t[nr_agents * n]
+           nr_programs, // uint8_t[nr_agents]
+           nr_rules, // uint8_t[nr_programs]
+           rules, // Rule_t[nr_rules]
+           name_offsets, // uint32_t[nr_A + nr_agents], offsets of the names of the objects and of the agents in the names section
+           names, // char[names_size], names terminated by 0
+           size; // total size
+} image_layout_t;
+
+/**
+ * @brief Compute the positions of the sections of an image
+ *
+ * @param header The header of the image
+ * @param layout Will store the positions of the sections
+ */
+static void getImageLayout(image_header_t *header, image_layout_t *layout) {
+    size_t nr_items = 0;
+
+    for (uint8_t env = 0; env < IMAGE_NR_ENVS; env++)
+        nr_items += header->nr_items[env];
+
+    layout->items = IMAGE_ALIGN(sizeof(image_header_t));
+    layout->agent_objects = layout->items + IMAGE_ALIGN(sizeof(image_item_t) * nr_items);
+    layout->nr_programs = layout->agent_objects + IMAGE_ALIGN(sizeof(object_id_t) * header->nr_agents * header->n);
+    layout->nr_rules = layout->nr_programs + IMAGE_ALIGN(sizeof(uint8_t) * header->nr_agents);
+    layout->rules = layout->nr_rules + IMAGE_ALIGN(sizeof(uint8_t) * header->nr_programs);
+    layout->name_offsets = layout->rules + IMAGE_ALIGN(sizeof(Rule_t) * header->nr_rules);
+    layout->names = layout->name_offsets + IMAGE_ALIGN(sizeof(uint32_t) * ((size_t) header->nr_A + header->nr_agents));
+    layout->size = layout->names + IMAGE_ALIGN(header->names_size);
+}
+
+/**
+ * @brief Get the environments of a P colony in the order in which they are stored in an image
+ *
+ * @param pcol The P colony
+ * @param envs Will store the environments
+ */
+static void getImageEnvs(Pcolony_t *pcol, multiset_env_t **envs) {
+    envs[0] = &pcol->env;
+    envs[1] = &pcol->swarm->global_env;
+    envs[2] = &pcol->swarm->in_global_env;
+    envs[3] = &pcol->swarm->out_global_env;
+}
+
+/**
+ * @brief Store the objects of an agent as a list of n object ids (NO_OBJECT for empty places)
+ *
+ * @param agent The agent
+ * @param ids Space for pcolony->n ids
+ */
+static void getAgentObjectIds(Agent_t *agent, object_id_t *ids) {
+    uint8_t nr_ids = 0;
+    multiset_obj_t *obj = &agent->obj;
+
+#ifdef MULTISET_OBJ_COUNTED
+    for (uint8_t run = 0; run < obj->nr_runs; run++)
+        for (multiset_count_t i = 0; i < obj->items[run].nr && nr_ids < agent->pcolony->n; i++)
+            ids[nr_ids++] = obj->items[run].id;
+#else
+    for (uint8_t i = 0; i < obj->size && nr_ids < agent->pcolony->n; i++)
+        if (obj->items[i] != NO_OBJECT)
+            ids[nr_ids++] = obj->items[i];
+#endif
+    while (nr_ids < agent->pcolony->n)
+        ids[nr_ids++] = NO_OBJECT;
+}
+
+uint64_t getLuluModelHash(const char *text, size_t length, const char *colony_name) {
+    uint64_t hash = FNV_OFFSET_BASIS;
+
+    for (size_t i = 0; i < length; i++) {
+        hash ^= (uint8_t) text[i];
+        hash *= FNV_PRIME;
+    }
+    //the name is separated from the text by a 0, so that it cannot be confused with the end of the text
+    hash *= FNV_PRIME;
+    if (colony_name != NULL)
+        for (const char *c = colony_name; *c != 0; c++) {
+            hash ^= (uint8_t) *c;
+            hash *= FNV_PRIME;
+        }
+
+    return hash;
+}
+
+bool pcolony_writeImage(Pcolony_t *pcol, char **object_names, char **agent_names, instance_image_key_t *key, const char *path) {
+    image_header_t header;
+    image_layout_t layout;
+    multiset_env_t *envs[IMAGE_NR_ENVS];
+    image_item_t *items;
+    object_id_t *agent_objects;
+    uint8_t *nr_programs, *nr_rules;
+    Rule_t *rules;
+    uint32_t *name_offsets;
+    char *names;
+    uint8_t *buffer;
+    char *temporary_path;
+    FILE *file;
+    bool written;
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, IMAGE_MAGIC, sizeof(header.magic));
+    header.version = INSTANCE_IMAGE_VERSION;
+    header.byte_order = IMAGE_BYTE_ORDER;
+    header.model_hash = key->model_hash;
+    header.robot_id = key->robot_id;
+    header.nr_swarm_robots = key->nr_swarm_robots;
+    header.nr_A = pcol->nr_A;
+    header.nr_agents = pcol->nr_agents;
+    header.n = pcol->n;
+    header.rule_size = sizeof(Rule_t);
+    header.object_id_bits = OBJECT_ID_BITS;
+
+    //in both environment layouts an item holds an object whose id is not NO_OBJECT
+    getImageEnvs(pcol, envs);
+    for (uint8_t env = 0; env < IMAGE_NR_ENVS; env++)
+        for (object_id_t i = 0; i < envs[env]->size; i++)
+            if (envs[env]->items[i].id != NO_OBJECT && envs[env]->items[i].nr > 0)
+                header.nr_items[env]++;
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++) {
+        header.nr_programs += pcol->agents[agent_nr].nr_programs;
+        for (uint8_t prg_nr = 0; prg_nr < pcol->agents[agent_nr].nr_programs; prg_nr++)
+            header.nr_rules += pcol->agents[agent_nr].programs[prg_nr].nr_rules;
+        header.names_size += strlen(agent_names[agent_nr]) + 1;
+    }
+    for (object_id_t obj = 0; obj < pcol->nr_A; obj++)
+        header.names_size += strlen(object_names[obj]) + 1;
+    getImageLayout(&header, &layout);
+    header.size = (uint32_t) layout.size;
+
+    //the image is built in memory (including the padding of the sections and of the rules) and written at once
+    buffer = (uint8_t *) LULU_MALLOC(layout.size);
+    memset(buffer, 0, layout.size);
+    memcpy(buffer, &header, sizeof(header));
+
+    items = (image_item_t *) (buffer + layout.items);
+    for (uint8_t env = 0; env < IMAGE_NR_ENVS; env++)
+        for (object_id_t i = 0; i < envs[env]->size; i++)
+            if (envs[env]->items[i].id != NO_OBJECT && envs[env]->items[i].nr > 0) {
+                items->obj = envs[env]->items[i].id;
+                items->nr = envs[env]->items[i].nr;
+                items++;
+            }
+
+    agent_objects = (object_id_t *) (buffer + layout.agent_objects);
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++)
+        getAgentObjectIds(&pcol->agents[agent_nr], &agent_objects[agent_nr * pcol->n]);
+
+    nr_programs = buffer + layout.nr_programs;
+    nr_rules = buffer + layout.nr_rules;
+    rules = (Rule_t *) (buffer + layout.rules);
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++) {
+        Agent_t *agent = &pcol->agents[agent_nr];
+
+        *nr_programs++ = agent->nr_programs;
+        for (uint8_t prg_nr = 0; prg_nr < agent->nr_programs; prg_nr++) {
+            *nr_rules++ = agent->programs[prg_nr].nr_rules;
+            //the fields are copied one by one, so that the padding of the rules stays 0
+            for (uint8_t rule_nr = 0; rule_nr < agent->programs[prg_nr].nr_rules; rule_nr++, rules++) {
+                Rule_t *rule = &agent->programs[prg_nr].rules[rule_nr];
+
+                rules->type = rule->type;
+                rules->lhs = rule->lhs;
+                rules->rhs = rule->rhs;
+                rules->alt_lhs = rule->alt_lhs;
+                rules->alt_rhs = rule->alt_rhs;
+            }
+        }
+    }
+
+    name_offsets = (uint32_t *) (buffer + layout.name_offsets);
+    names = (char *) (buffer + layout.names);
+    for (uint32_t i = 0; i < (uint32_t) pcol->nr_A + pcol->nr_agents; i++) {
+        const char *name = (i < pcol->nr_A) ? object_names[i] : agent_names[i - pcol->nr_A];
+
+        name_offsets[i] = (uint32_t) (names - (char *) (buffer + layout.names));
+        strcpy(names, name);
+        names += strlen(name) + 1;
+    }
+
+    //the image is only replaced by a complete one, each writer uses it's own temporary file
+    temporary_path = (char *) LULU_MALLOC(strlen(path) + 32);
+    snprintf(temporary_path, strlen(path) + 32, "%s.%ld.tmp", path, (long) getpid());
+    file = fopen(temporary_path, "wb");
+    written = file != NULL &&
+        fwrite(buffer, 1, layout.size, file) == layout.size &&
+        fflush(file) == 0 &&
+        fsync(fileno(file)) == 0;
+    if (file != NULL && fclose(file) != 0)
+        written = FALSE;
+    if (written && rename(temporary_path, path) != 0)
+        written = FALSE;
+    if (!written) {
+        printe("Could not write the image %s", path);
+        remove(temporary_path);
+    }
+
+    LULU_FREE(temporary_path);
+    LULU_FREE(buffer);
+
+    return written;
+}
+
+/**
+ * @brief Check that the sections of a mapped image are consistent with it's header
+ *
+ * @param header The header of the image
+ * @param data The mapped image
+ * @param layout The positions of the sections
+ *
+ * @return TRUE if all of the counts, objects, rule types and names are valid, FALSE otherwise
+ */
+static bool isImageValid(image_header_t *header, uint8_t *data, image_layout_t *layout) {
+    image_item_t *items = (image_item_t *) (data + layout->items);
+    object_id_t *agent_objects = (object_id_t *) (data + layout->agent_objects);
+    uint8_t *nr_programs = data + layout->nr_programs,
+            *nr_rules = data + layout->nr_rules;
+    Rule_t *rules = (Rule_t *) (data + layout->rules);
+    uint32_t *name_offsets = (uint32_t *) (data + layout->name_offsets);
+    char *names = (char *) (data + layout->names);
+    uint32_t total_programs = 0, total_rules = 0;
+    size_t seen_size = ((size_t) header->nr_A + 7) / 8;
+    uint8_t *seen = (uint8_t *) LULU_MALLOC(seen_size + 1);
+    bool valid = TRUE;
+
+    //each environment stores every object at most once
+    for (uint8_t env = 0; env < IMAGE_NR_ENVS && valid; env++) {
+        memset(seen, 0, seen_size);
+        for (uint32_t i = 0; i < header->nr_items[env] && valid; i++, items++) {
+            if (items->obj == NO_OBJECT || items->obj >= header->nr_A || items->nr > MULTISET_COUNT_MAX ||
+                    (seen[items->obj / 8] & (1 << (items->obj % 8))))
+                valid = FALSE;
+            else
+                seen[items->obj / 8] |= 1 << (items->obj % 8);
+        }
+    }
+    LULU_FREE(seen);
+    if (!valid)
+        return FALSE;
+    for (uint32_t i = 0; i < (uint32_t) header->nr_agents * header->n; i++)
+        if (agent_objects[i] >= header->nr_A)
+            return FALSE;
+
+    //the program counts have to match the number of stored programs and rules
+    for (uint8_t agent_nr = 0; agent_nr < header->nr_agents; agent_nr++)
+        total_programs += nr_programs[agent_nr];
+    if (total_programs != header->nr_programs)
+        return FALSE;
+    for (uint32_t i = 0; i < total_programs; i++) {
+        if (nr_rules[i] > header->n)
+            return FALSE;
+        total_rules += nr_rules[i];
+    }
+    if (total_rules != header->nr_rules)
+        return FALSE;
+    //an invalid type would index the conditional rule tables (see getFirstRuleTypeFromConditional()) out of bounds
+    for (uint32_t i = 0; i < total_rules; i++)
+        if (!isValidRuleType(rules[i].type) || rules[i].lhs >= header->nr_A || rules[i].rhs >= header->nr_A ||
+                rules[i].alt_lhs >= header->nr_A || rules[i].alt_rhs >= header->nr_A)
+            return FALSE;
+
+    //every name starts inside the names section, which ends with a 0
+    if (header->names_size == 0 || names[header->names_size - 1] != 0)
+        return FALSE;
+    for (uint32_t i = 0; i < (uint32_t) header->nr_A + header->nr_agents; i++)
+        if (name_offsets[i] >= header->names_size)
+            return FALSE;
+
+    return TRUE;
+}
+
+bool initInstanceImage(InstanceImage_t *image, const char *path) {
+    struct stat status;
+    int fd = open(path, O_RDONLY);
+    image_header_t *header;
+    image_layout_t layout;
+    uint32_t *name_offsets;
+    char *names;
+
+    memset(image, 0, sizeof(InstanceImage_t));
+    if (fd < 0) {
+        printe("Could not open the image %s", path);
+        return FALSE;
+    }
+    if (fstat(fd, &status) != 0 || status.st_size < (off_t) sizeof(image_header_t)) {
+        printe("%s is not an image", path);
+        close(fd);
+        return FALSE;
+    }
+    image->size = (size_t) status.st_size;
+    image->data = (uint8_t *) mmap(NULL, image->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    //the mapping stays valid after the file is closed
+    close(fd);
+    if (image->data == MAP_FAILED) {
+        printe("Could not map the image %s", path);
+        image->data = NULL;
+        return FALSE;
+    }
+
+    header = (image_header_t *) image->data;
+    if (memcmp(header->magic, IMAGE_MAGIC, sizeof(header->magic)) != 0 || header->byte_order != IMAGE_BYTE_ORDER ||
+            header->version != INSTANCE_IMAGE_VERSION || header->rule_size != sizeof(Rule_t) || header->object_id_bits != OBJECT_ID_BITS) {
+        printe("%s is not an image of version %d for this build", path, INSTANCE_IMAGE_VERSION);
+        destroyInstanceImage(image);
+        return FALSE;
+    }
+    getImageLayout(header, &layout);
+    if (header->size != image->size || layout.size != image->size) {
+        printe("The image %s is truncated", path);
+        destroyInstanceImage(image);
+        return FALSE;
+    }
+    if (!isImageValid(header, image->data, &layout)) {
+        printe("The image %s is corrupted", path);
+        destroyInstanceImage(image);
+        return FALSE;
+    }
+
+    image->key.model_hash = header->model_hash;
+    image->key.robot_id = header->robot_id;
+    image->key.nr_swarm_robots = header->nr_swarm_robots;
+    image->nr_A = (object_id_t) header->nr_A;
+    image->nr_agents = header->nr_agents;
+
+    //only the tables of pointers to the names are allocated, the names stay in the mapped file
+    name_offsets = (uint32_t *) (image->data + layout.name_offsets);
+    names = (char *) (image->data + layout.names);
+    image->object_names = (char **) LULU_MALLOC(sizeof(char *) * ((size_t) image->nr_A + image->nr_agents));
+    image->agent_names = image->object_names + image->nr_A;
+    for (uint32_t i = 0; i < (uint32_t) image->nr_A + image->nr_agents; i++)
+        image->object_names[i] = names + name_offsets[i];
+
+    return TRUE;
+}
+
+void initPcolonyFromImage(Pcolony_t *pcol, InstanceImage_t *image) {
+    image_header_t *header = (image_header_t *) image->data;
+    image_layout_t layout;
+    multiset_env_t *envs[IMAGE_NR_ENVS];
+    image_item_t *items;
+    object_id_t *agent_objects;
+    uint8_t *nr_programs, *nr_rules;
+    Rule_t *rules;
+
+    getImageLayout(header, &layout);
+    items = (image_item_t *) (image->data + layout.items);
+    agent_objects = (object_id_t *) (image->data + layout.agent_objects);
+    nr_programs = image->data + layout.nr_programs;
+    nr_rules = image->data + layout.nr_rules;
+    rules = (Rule_t *) (image->data + layout.rules);
+
+    initPcolony(pcol, image->nr_A, header->nr_agents, header->n);
+    getImageEnvs(pcol, envs);
+    for (uint8_t env = 0; env < IMAGE_NR_ENVS; env++)
+        for (uint32_t i = 0; i < header->nr_items[env]; i++, items++)
+            setObjectCountFromMultisetEnv(envs[env], (object_id_t) items->obj, (multiset_count_t) items->nr);
+
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++) {
+        Agent_t *agent = &pcol->agents[agent_nr];
+
+        initAgent(agent, pcol, nr_programs[agent_nr]);
+        for (uint8_t i = 0; i < pcol->n; i++, agent_objects++)
+            if (*agent_objects != NO_OBJECT)
+                addObjectToMultisetObj(&agent->obj, *agent_objects);
+
+        for (uint8_t prg_nr = 0; prg_nr < agent->nr_programs; prg_nr++, nr_rules++) {
+#ifdef MAPPED_RULES
+            //the rules are immutable, so the programs use the ones of the mapped image
+            initProgramWithRules(&agent->programs[prg_nr], *nr_rules, rules);
+            rules += *nr_rules;
+#else
+            initProgram(&agent->programs[prg_nr], *nr_rules);
+            for (uint8_t rule_nr = 0; rule_nr < *nr_rules; rule_nr++, rules++)
+                initRule(&agent->programs[prg_nr].rules[rule_nr], (rule_type_t) rules->type,
+                        rules->lhs, rules->rhs, rules->alt_lhs, rules->alt_rhs);
+#endif
+        }
+        agent->init_program_nr = agent->nr_programs;
+    }
+}
+
+/**
+ * @brief Check whether an image file exists and is a valid image of a model, then map it
+ *
+ * @param image The image that will be initialized
+ * @param path Path of the image file
+ * @param key The model and robot that the image has to be built for
+ *
+ * @return TRUE if the image was mapped, FALSE otherwise (nothing is mapped)
+ */
+static bool mapCachedImage(InstanceImage_t *image, const char *path, instance_image_key_t *key) {
+    //a missing image is the normal case of the first start, so it is not reported
+    if (access(path, R_OK) != 0 || !initInstanceImage(image, path))
+        return FALSE;
+    if (image->key.model_hash != key->model_hash || image->key.robot_id != key->robot_id ||
+            image->key.nr_swarm_robots != key->nr_swarm_robots) {
+        printw("The image %s was built for a different model", path);
+        destroyInstanceImage(image);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Parse a Lulu model, expand it for a robot and write it's image
+ *
+ * @param image Stores the parse error (if any)
+ * @param text The Lulu text
+ * @param length The length of the text
+ * @param colony_name Name of the colony of a P swarm that will be parsed
+ * @param smallest_robot_uid The smallest kilo_uid from the swarm
+ * @param my_id The kilo_uid of the robot
+ * @param key The model and robot that the image is built for
+ * @param path Path of the image file
+ *
+ * @return TRUE if the image was written, FALSE otherwise
+ */
+static bool buildCachedImage(InstanceImage_t *image, const char *text, size_t length, const char *colony_name,
+        uint16_t smallest_robot_uid, uint16_t my_id, instance_image_key_t *key, const char *path) {
+    Pcolony_t pcol;
+    LuluInstance_t instance;
+    bool written;
+
+    if (!initPcolonyFromLuluText(&pcol, &instance, text, length, colony_name, smallest_robot_uid, key->nr_swarm_robots)) {
+        memcpy(image->error, instance.error, LULU_PARSER_ERROR_SIZE);
+        image->error_line = instance.error_line;
+        return FALSE;
+    }
+    if (instance.obj_with_id_size > 0 || instance.obj_with_any_size > 0)
+        luluInstance_expandPcolony(&instance, &pcol, my_id);
+
+    written = pcolony_writeImage(&pcol, instance.object_names, instance.agent_names, key, path);
+    if (!written)
+        snprintf(image->error, LULU_PARSER_ERROR_SIZE, "could not write the image %s", path);
+
+    destroyPcolony(&pcol);
+    destroyLuluInstance(&instance);
+
+    return written;
+}
+
+bool initPcolonyFromLuluCache(Pcolony_t *pcol, InstanceImage_t *image, const char *path, const char *colony_name,
+        uint16_t smallest_robot_uid, uint16_t nr_swarm_robots, uint16_t my_id, const char *cache_dir) {
+    struct stat status;
+    int fd = open(path, O_RDONLY);
+    const char *text = NULL;
+    size_t length = 0;
+    instance_image_key_t key;
+    char *image_path;
+    bool mapped;
+
+    memset(image, 0, sizeof(InstanceImage_t));
+    if (nr_swarm_robots == 0) {
+        snprintf(image->error, LULU_PARSER_ERROR_SIZE, "the swarm has no robots");
+        if (fd >= 0)
+            close(fd);
+        return FALSE;
+    }
+    //the Lulu file is mapped too, it is only read to compute it's hash unless the image has to be built
+    if (fd < 0 || fstat(fd, &status) != 0) {
+        snprintf(image->error, LULU_PARSER_ERROR_SIZE, "could not read %s", path);
+        if (fd >= 0)
+            close(fd);
+        return FALSE;
+    }
+    length = (size_t) status.st_size;
+    if (length > 0) {
+        text = (const char *) mmap(NULL, length, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (text == MAP_FAILED) {
+            snprintf(image->error, LULU_PARSER_ERROR_SIZE, "could not read %s", path);
+            close(fd);
+            return FALSE;
+        }
+    }
+    close(fd);
+
+    key.model_hash = getLuluModelHash(text, length, colony_name);
+    //the expansion only depends on the position of the robot in the swarm (robots that are not part of it are not expanded)
+    key.robot_id = (uint16_t) (my_id - smallest_robot_uid);
+    if (key.robot_id >= nr_swarm_robots)
+        key.robot_id = nr_swarm_robots;
+    key.nr_swarm_robots = nr_swarm_robots;
+    image_path = (char *) LULU_MALLOC(strlen(cache_dir) + 48);
+    snprintf(image_path, strlen(cache_dir) + 48, "%s/%016llx-%u-%u.img", cache_dir, (unsigned long long) key.model_hash,
+            (unsigned) key.robot_id, (unsigned) key.nr_swarm_robots);
+
+    mapped = mapCachedImage(image, image_path, &key);
+    if (!mapped && buildCachedImage(image, text, length, colony_name, smallest_robot_uid, my_id, &key, image_path)) {
+        mapped = initInstanceImage(image, image_path);
+        if (!mapped)
+            snprintf(image->error, LULU_PARSER_ERROR_SIZE, "could not map the image %s", image_path);
+    }
+    if (mapped)
+        initPcolonyFromImage(pcol, image);
+
+    if (text != NULL)
+        munmap((void *) text, length);
+    LULU_FREE(image_path);
+
+    return mapped;
+}
+
+void destroyInstanceImage(InstanceImage_t *image) {
+    LULU_FREE(image->object_names);
+    image->object_names = NULL;
+    image->agent_names = NULL;
+    if (image->data != NULL)
+        munmap(image->data, image->size);
+    image->data = NULL;
+    image->size = 0;
+}
@@ -0,0 +1,120 @@
+// vim:filetype=c
+/**
+ * @file instance_image.h
+ * @brief Precompiled binary images of expanded P colonies, mapped into memory and used in place
+ * An image stores the alphabet and the object names, the agent names, the programs and the initial multisets of a colony that was already
+ * expanded for one robot of a swarm. It only contains offsets, so it can be mapped at any address. If the library is built with MAPPED_RULES
+ * the programs of the colonies initialized from an image use it's rules in place, otherwise the rules are copied.
+ * Images are cached by initPcolonyFromLuluCache(), so that repeated starts of the same model skip the parser and the wildcard expansion.
+ * The layout depends on the byte order of the machine and on OBJECT_ID_BITS (images of other builds are rejected).
+ * Only available for the PC build.
+ */
+#ifndef INSTANCE_IMAGE_H
+#define INSTANCE_IMAGE_H
+
+#include "lulu.h"
+#include "lulu_parser.h"
+
+// version of the image format, incremented whenever the layout changes (older images are rejected and rebuilt by the cache)
+#define INSTANCE_IMAGE_VERSION 1
+
+/**
+ * @brief Identifies the model and the robot that an image was built for
+ */
+typedef struct _instance_image_key {
+    uint64_t model_hash; // hash of the Lulu text and of the name of the colony (see getLuluModelHash())
+    uint16_t robot_id, // symbolic id of the robot that the colony was expanded for (nr_swarm_robots if it is not part of the swarm)
+             nr_swarm_robots; // the number of robots that make up the swarm
+} instance_image_key_t;
+
+/**
+ * @brief Image file mapped into memory
+ */
+typedef struct _InstanceImage {
+    uint8_t *data; // the mapped file (read-only)
+    size_t size;
+    instance_image_key_t key;
+
+    // object_names[obj] and agent_names[agent_nr] point into the mapped file and must not be modified
+    char **object_names;
+    char **agent_names;
+    object_id_t nr_A;
+    uint8_t nr_agents;
+
+    char error[LULU_PARSER_ERROR_SIZE]; // description of the parse error if initPcolonyFromLuluCache() failed because of the Lulu file
+    uint32_t error_line; // line of the parse error (0 if the error has no line)
+} InstanceImage_t;
+
+/**
+ * @brief Compute the hash of a Lulu model (64 bit FNV-1a of the text and of the name of the parsed colony)
+ *
+ * @param text The Lulu text
+ * @param length The length of the text
+ * @param colony_name Name of the parsed colony of a P swarm (NULL for the first colony or for a single P colony)
+ *
+ * @return The hash of the model
+ */
+uint64_t getLuluModelHash(const char *text, size_t length, const char *colony_name);
+
+/**
+ * @brief Write an image of an initialized and expanded P colony
+ * The image is written to a temporary file that replaces the file at path only once it is complete, so concurrent writers of the same
+ * image never expose a partial file. The global environments are the ones seen by the colony.
+ *
+ * @param pcol The P colony (expanded, possibly packed, before it's first simulation step)
+ * @param object_names object_names[obj] is the name of obj
+ * @param agent_names agent_names[agent_nr] is the name of the agent
+ * @param key The model and robot that the colony was built for
+ * @param path Path of the image file
+ *
+ * @return TRUE if the image was written, FALSE otherwise
+ */
+bool pcolony_writeImage(Pcolony_t *pcol, char **object_names, char **agent_names, instance_image_key_t *key, const char *path);
+
+/**
+ * @brief Map an image file into memory and check that all of it's sections are valid
+ *
+ * @param image The image that will be initialized (destroyed with destroyInstanceImage())
+ * @param path Path of the image file
+ *
+ * @return TRUE if the image was mapped, FALSE if the file is not a valid image of this build (nothing is mapped)
+ */
+bool initInstanceImage(InstanceImage_t *image, const char *path);
+
+/**
+ * @brief Initialize a P colony from a mapped image
+ * The colony is already expanded, so it must not be expanded again. If the library is built with MAPPED_RULES it's programs use the
+ * rules of the image in place, so the image has to be destroyed after the colony (and it's clones and forks).
+ *
+ * @param pcol The P colony that will be initialized (destroyed with destroyPcolony())
+ * @param image The mapped image
+ */
+void initPcolonyFromImage(Pcolony_t *pcol, InstanceImage_t *image);
+
+/**
+ * @brief Initialize a P colony from the cached image of a Lulu model, building the image first if it is not cached yet
+ * The images are stored in cache_dir, named by their key (model hash, symbolic robot id and swarm size). An image that is missing or
+ * that was written by a different build is rebuilt by parsing the Lulu file and expanding the colony for the robot.
+ *
+ * @param pcol The P colony that will be initialized (destroyed with destroyPcolony())
+ * @param image Will store the mapped image (destroyed with destroyInstanceImage() after the colony)
+ * @param path Path of the Lulu input file
+ * @param colony_name Name of the colony of a P swarm that will be parsed (NULL for the first colony or for a single P colony)
+ * @param smallest_robot_uid The smallest kilo_uid from the swarm
+ * @param nr_swarm_robots The number of robots that make up the swarm (at least 1)
+ * @param my_id The kilo_uid of the robot
+ * @param cache_dir The directory that stores the images (has to exist)
+ *
+ * @return TRUE if the colony was initialized, FALSE otherwise (neither pcol nor image are initialized, see InstanceImage.error)
+ */
+bool initPcolonyFromLuluCache(Pcolony_t *pcol, InstanceImage_t *image, const char *path, const char *colony_name,
+        uint16_t smallest_robot_uid, uint16_t nr_swarm_robots, uint16_t my_id, const char *cache_dir);
+
+/**
+ * @brief Unmap an image (the colonies initialized from it have to be destroyed first)
+ *
+ * @param image The image that will be destroyed
+ */
+void destroyInstanceImage(InstanceImage_t *image);
+
+#endif
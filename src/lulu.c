@@ -6,58 +6,253 @@
  * @author Catalin Buiu
  * @date 2016-02-27
  */
+#ifdef LULU_THREADS
+    #define _POSIX_C_SOURCE 200809L //for pthreads with -std=c99
+    #include <pthread.h>
+#endif
 #include "lulu.h"
 #include "debug_print.h"
-#include <stdlib.h> //for rand() on PC and malloc on PC and AVR
+#include <stdlib.h> //for malloc on PC and AVR
+#ifdef PCOLONY_ARENA
+    #include <string.h> //for memcpy
+#endif
 
 //if building Pcolony simulator for AVR (Kilobot)
 #ifdef KILOBOT
-    #include "kilolib.h" //for rand_seed, rand_soft
+    #include "kilolib.h" //for rand_hard
 #else
     #include <time.h> //for time(0) used as seed in initPcolony
 #endif
 
+#ifdef LULU_COUNT_ALLOCS
+    uint32_t lulu_nr_allocs = 0, lulu_nr_frees = 0;
+#endif
+
 #ifdef DEBUG_PRINT
     //error messages that can be printed by agent_executeProgram()
-    const char* execErrMsgs[] = {"Obj %d req in AG rule %d NOT found",
-        "Obj %d req in ENV rule %d NOT found",
-        "Obj %d req in GLOBAL_ENV rule %d NOT found",
-        "Obj %d req in IN_GLOBAL_ENV rule %d NOT found",
-        "Obj %d req in OUT_GLOBAL_ENV rule %d NOT found"};
+    //execErrMsgs[target] = object not found in target, execErrMsgs[MULTISET_TARGET_NONE + target] = object not added to target
+    const char* execErrMsgs[] = {"Obj %d req in AG NOT found",
+        "Obj %d req in ENV NOT found",
+        "Obj %d req in GLOBAL_ENV NOT found",
+        "Obj %d req in IN_GLOBAL_ENV NOT found",
+        "Obj %d req in OUT_GLOBAL_ENV NOT found",
+        "Obj %d could NOT be added to AG",
+        "Obj %d could NOT be added to ENV",
+        "Obj %d could NOT be added to GLOBAL_ENV",
+        "Obj %d could NOT be added to IN_GLOBAL_ENV",
+        "Obj %d could NOT be added to OUT_GLOBAL_ENV"};
+#endif
+
+#ifdef MULTISET_PRESENCE
+/**
+ * @brief Set or clear the bit that corresponds to an object in a presence bitset
+ *
+ * @param presence The presence bitset
+ * @param obj The object whose bit will be modified
+ * @param present The new value of the bit
+ */
+static void setPresenceBit(presence_word_t *presence, object_id_t obj, bool present) {
+    if (present)
+        presence[obj / PRESENCE_WORD_BITS] |= ((presence_word_t) 1) << (obj % PRESENCE_WORD_BITS);
+    else
+        presence[obj / PRESENCE_WORD_BITS] &= ~(((presence_word_t) 1) << (obj % PRESENCE_WORD_BITS));
+}
+
+/**
+ * @brief Clear all of the bits of a presence bitset
+ *
+ * @param presence The presence bitset
+ * @param nr_A The number of bits of the bitset
+ */
+static void clearPresence(presence_word_t *presence, object_id_t nr_A) {
+    for (object_id_t i = 0; i < PRESENCE_NR_WORDS(nr_A); i++)
+        presence[i] = 0;
+}
+#endif
+
+#ifdef INCREMENTAL_SELECTION
+    //mark an object of a multiset as changed, so that the programs that use it are checked again in the next simulation step
+    #define MARK_OBJECT_CHANGED(multiset, obj) setPresenceBit((multiset)->changed, (obj), TRUE)
+
+/**
+ * @brief Mark all of the objects that are present in a multiset as changed (used before clearing the multiset)
+ *
+ * @param changed The bitset of changed objects of the multiset
+ * @param presence The presence bitset of the multiset
+ * @param nr_A The number of bits of the bitsets
+ */
+static void markPresentObjectsChanged(presence_word_t *changed, presence_word_t *presence, object_id_t nr_A) {
+    for (object_id_t i = 0; i < PRESENCE_NR_WORDS(nr_A); i++)
+        changed[i] |= presence[i];
+}
+#else
+    #define MARK_OBJECT_CHANGED(multiset, obj) do { } while(0)
+#endif
+
+#ifdef CONFIG_HASH
+/**
+ * @brief Mix a 64 bit value (finalizer of splitmix64)
+ *
+ * @param x The value
+ *
+ * @return The mixed value
+ */
+static uint64_t mixHash(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+/**
+ * @brief Get the Zobrist key of an object that appears nr times in a multiset
+ * The key is computed instead of being stored in a table because counts can be as large as MULTISET_COUNT_MAX
+ *
+ * @param obj The object
+ * @param nr The number of copies of the object
+ *
+ * @return The key (0 if the object is not present)
+ */
+static uint64_t getObjectHashKey(object_id_t obj, multiset_count_t nr) {
+    if (obj == NO_OBJECT || nr == 0)
+        return 0;
+    return mixHash(((uint64_t) obj << 32) | nr);
+}
+
+    //update the hash of a multiset after the count of obj changed from count to newCount
+    #define UPDATE_OBJECT_HASH(multiset, obj, count, newCount) \
+        ((multiset)->hash ^= getObjectHashKey((obj), (count)) ^ getObjectHashKey((obj), (newCount)))
+#else
+    #define UPDATE_OBJECT_HASH(multiset, obj, count, newCount) do { } while(0)
+#endif
+
+#ifdef PCOLONY_ARENA
+/**
+ * @brief Program tables shared by a forked P colony and all of it's forks (see forkPcolony())
+ */
+struct _pcolony_share {
+    uint32_t nr_colonies; // nr of colonies that use the tables
+    // arena of the colony that was forked first (packed by forkPcolony()), it stores all of the tables and is freed with the last colony
+    uint8_t *arena;
+    uint32_t arena_size;
+};
+
+/**
+ * @brief Check whether a heap block of a P colony is stored in the arena of the colony (see packPcolony()) or in the arena of the
+ * tables that it shares with it's forks (see forkPcolony())
+ *
+ * @param pcol The P colony (NULL for a block of a colony that is not packed)
+ * @param block The block
+ *
+ * @return TRUE if the block is part of an arena, FALSE otherwise
+ */
+static bool isArenaBlock(Pcolony_t *pcol, void *block) {
+    if (pcol == NULL)
+        return FALSE;
+    //a block of 0 bytes can start at the end of the arena
+    if (pcol->arena != NULL && (uint8_t *) block >= pcol->arena && (uint8_t *) block <= pcol->arena + pcol->arena_size)
+        return TRUE;
+    return pcol->share != NULL && (uint8_t *) block >= pcol->share->arena && (uint8_t *) block <= pcol->share->arena + pcol->share->arena_size;
+}
+
+    //the blocks stored in the arena of a packed colony are only released together with the arena, so clearing a table of a packed or
+    //forked colony only detaches it and the rebuilt table is a separate block of the colony
+    #define FREE_PCOLONY_BLOCK(pcol, block) do { if (!isArenaBlock((pcol), (block))) LULU_FREE(block); } while(0)
+#else
+    #define FREE_PCOLONY_BLOCK(pcol, block) LULU_FREE(block)
 #endif
 
-void initMultisetEnv(multiset_env_t *multiset, uint8_t size) {
-    multiset->items = (multiset_env_item_t *)malloc(sizeof(multiset_env_item_t) * size);
-    for (uint8_t i = 0; i < size; i++) {
+void initMultisetEnv(multiset_env_t *multiset, object_id_t size) {
+    multiset->items = (multiset_env_item_t *)LULU_MALLOC(sizeof(multiset_env_item_t) * size);
+    for (object_id_t i = 0; i < size; i++) {
         multiset->items[i].id = NO_OBJECT;
         multiset->items[i].nr = 0;
     }
     multiset->size = size;
+#ifdef CONFIG_HASH
+    multiset->hash = 0;
+#endif
+#ifdef MULTISET_PRESENCE
+    multiset->presence = (presence_word_t *)LULU_MALLOC(sizeof(presence_word_t) * PRESENCE_NR_WORDS(size));
+    clearPresence(multiset->presence, size);
+#endif
+#ifdef INCREMENTAL_SELECTION
+    multiset->changed = (presence_word_t *)LULU_MALLOC(sizeof(presence_word_t) * PRESENCE_NR_WORDS(size));
+    clearPresence(multiset->changed, size);
+#endif
 }
 
-void initMultisetObj(multiset_obj_t *multiset, uint8_t size) {
-    multiset->items = (uint8_t *)malloc(sizeof(uint8_t) * size);
+void initMultisetObj(multiset_obj_t *multiset, uint8_t size, object_id_t alphabet_size) {
+#ifdef MULTISET_OBJ_COUNTED
+    //there can be at most size different objects
+    multiset->items = (multiset_env_item_t *)LULU_MALLOC(sizeof(multiset_env_item_t) * size);
+    multiset->nr_runs = 0;
+    multiset->nr_objects = 0;
+#else
+    multiset->items = (object_id_t *)LULU_MALLOC(sizeof(object_id_t) * size);
     for (uint8_t i = 0; i < size; i++)
         multiset->items[i] = NO_OBJECT;
+#endif
     multiset->size = size;
+#ifdef CONFIG_HASH
+    multiset->hash = 0;
+#endif
+#ifdef MULTISET_PRESENCE
+    multiset->alphabet_size = alphabet_size;
+    multiset->presence = (presence_word_t *)LULU_MALLOC(sizeof(presence_word_t) * PRESENCE_NR_WORDS(alphabet_size));
+    clearPresence(multiset->presence, alphabet_size);
+#endif
+#ifdef INCREMENTAL_SELECTION
+    multiset->changed = (presence_word_t *)LULU_MALLOC(sizeof(presence_word_t) * PRESENCE_NR_WORDS(alphabet_size));
+    clearPresence(multiset->changed, alphabet_size);
+#endif
 }
 
 void clearMultisetEnv(multiset_env_t *multiset) {
-    for (uint8_t i = 0; i < multiset->size; i++) {
+    for (object_id_t i = 0; i < multiset->size; i++) {
         multiset->items[i].id = NO_OBJECT;
         multiset->items[i].nr = 0;
     }
+#ifdef CONFIG_HASH
+    multiset->hash = 0;
+#endif
+#ifdef INCREMENTAL_SELECTION
+    markPresentObjectsChanged(multiset->changed, multiset->presence, multiset->size);
+#endif
+#ifdef MULTISET_PRESENCE
+    clearPresence(multiset->presence, multiset->size);
+#endif
 }
 void clearMultisetObj(multiset_obj_t *multiset) {
+#ifdef MULTISET_OBJ_COUNTED
+    multiset->nr_runs = 0;
+    multiset->nr_objects = 0;
+#else
     for (uint8_t i = 0; i < multiset->size; i++)
         multiset->items[i] = NO_OBJECT;
+#endif
+#ifdef CONFIG_HASH
+    multiset->hash = 0;
+#endif
+#ifdef INCREMENTAL_SELECTION
+    markPresentObjectsChanged(multiset->changed, multiset->presence, multiset->alphabet_size);
+#endif
+#ifdef MULTISET_PRESENCE
+    clearPresence(multiset->presence, multiset->alphabet_size);
+#endif
 }
 
 void destroyMultisetEnv(multiset_env_t *multiset) {
     if (multiset->size <= 0)
         return; //the multiset may have already been cleaned so there is nothing to do
 
-    free(multiset->items);
+    LULU_FREE(multiset->items);
+#ifdef MULTISET_PRESENCE
+    LULU_FREE(multiset->presence);
+#endif
+#ifdef INCREMENTAL_SELECTION
+    LULU_FREE(multiset->changed);
+#endif
     multiset->size = 0;
 }
 
@@ -65,58 +260,284 @@ void destroyMultisetObj(multiset_obj_t *multiset) {
     if (multiset->size <= 0)
         return; //the multiset may have already been cleaned so there is nothing to do
 
-    free(multiset->items);
+    LULU_FREE(multiset->items);
+#ifdef MULTISET_PRESENCE
+    LULU_FREE(multiset->presence);
+#endif
+#ifdef INCREMENTAL_SELECTION
+    LULU_FREE(multiset->changed);
+#endif
     multiset->size = 0;
 }
 
-bool areObjectsInMultisetEnv(multiset_env_t *multiset, uint8_t obj1, uint8_t obj2) {
+void copyMultisetEnv(multiset_env_t *destination, multiset_env_t *source) {
+    initMultisetEnv(destination, source->size);
+    for (object_id_t i = 0; i < source->size; i++)
+        destination->items[i] = source->items[i];
+#ifdef CONFIG_HASH
+    destination->hash = source->hash;
+#endif
+#ifdef MULTISET_PRESENCE
+    for (object_id_t i = 0; i < PRESENCE_NR_WORDS(source->size); i++)
+        destination->presence[i] = source->presence[i];
+#endif
+#ifdef INCREMENTAL_SELECTION
+    for (object_id_t i = 0; i < PRESENCE_NR_WORDS(source->size); i++)
+        destination->changed[i] = source->changed[i];
+#endif
+}
+
+void copyMultisetObj(multiset_obj_t *destination, multiset_obj_t *source) {
+#ifdef MULTISET_PRESENCE
+    initMultisetObj(destination, source->size, source->alphabet_size);
+    for (object_id_t i = 0; i < PRESENCE_NR_WORDS(source->alphabet_size); i++)
+        destination->presence[i] = source->presence[i];
+#else
+    initMultisetObj(destination, source->size, 0);
+#endif
+#ifdef INCREMENTAL_SELECTION
+    for (object_id_t i = 0; i < PRESENCE_NR_WORDS(source->alphabet_size); i++)
+        destination->changed[i] = source->changed[i];
+#endif
+#ifdef MULTISET_OBJ_COUNTED
+    for (uint8_t i = 0; i < source->nr_runs; i++)
+        destination->items[i] = source->items[i];
+    destination->nr_runs = source->nr_runs;
+    destination->nr_objects = source->nr_objects;
+#else
+    for (uint8_t i = 0; i < source->size; i++)
+        destination->items[i] = source->items[i];
+#endif
+#ifdef CONFIG_HASH
+    destination->hash = source->hash;
+#endif
+}
+
+/**
+ * @brief Rebuild an environment multiset whose items were written directly as (id, nr) slots
+ * The pairs are read before the multiset is cleared and are then added back using the multiset functions, so that the dense layout,
+ * the presence bitset and the hash are consistent with the contents. Repeated ids are summed.
+ *
+ * @param multiset The multiset
+ *
+ * @return TRUE if all of the objects were added, FALSE if a count saturated or an id is not part of the alphabet
+ */
+static bool rebuildMultisetEnv(multiset_env_t *multiset) {
+    if (multiset->size <= 0)
+        return TRUE;
+
+    bool rebuilt = TRUE;
+    multiset_env_item_t *items = (multiset_env_item_t *) LULU_MALLOC(sizeof(multiset_env_item_t) * multiset->size);
+    for (object_id_t i = 0; i < multiset->size; i++)
+        items[i] = multiset->items[i];
+
+    clearMultisetEnv(multiset);
+    for (object_id_t i = 0; i < multiset->size; i++) {
+        if (items[i].id == NO_OBJECT || items[i].nr == 0)
+            continue;
+
+        multiset_count_t count = getObjectCountFromMultisetEnv(multiset, items[i].id);
+        if (items[i].nr > MULTISET_COUNT_MAX - count) {
+            printe("Count of object %d saturated at %lu, rebuild with a larger MULTISET_COUNT_BITS", items[i].id, (unsigned long) MULTISET_COUNT_MAX);
+            rebuilt = FALSE;
+        }
+        else if (!setObjectCountFromMultisetEnv(multiset, items[i].id, count + items[i].nr)) {
+            printe("Object %d could not be added to the multiset", items[i].id);
+            rebuilt = FALSE;
+        }
+    }
+
+    LULU_FREE(items);
+    return rebuilt;
+}
+
+#ifndef MULTISET_OBJ_COUNTED
+/**
+ * @brief Rebuild a (slot based) object multiset whose items were written directly, so that it's presence bitset and hash are consistent
+ *
+ * @param multiset The multiset
+ *
+ * @return TRUE if all of the objects were added, FALSE otherwise
+ */
+static bool rebuildMultisetObj(multiset_obj_t *multiset) {
+    if (multiset->size <= 0)
+        return TRUE;
+
+    bool rebuilt = TRUE;
+    object_id_t *items = (object_id_t *) LULU_MALLOC(sizeof(object_id_t) * multiset->size);
+    for (uint8_t i = 0; i < multiset->size; i++)
+        items[i] = multiset->items[i];
+
+    clearMultisetObj(multiset);
     for (uint8_t i = 0; i < multiset->size; i++)
+        if (items[i] != NO_OBJECT && !addObjectToMultisetObj(multiset, items[i]))
+            rebuilt = FALSE;
+
+    LULU_FREE(items);
+    return rebuilt;
+}
+#endif
+
+bool areObjectsInMultisetEnv(multiset_env_t *multiset, object_id_t obj1, object_id_t obj2) {
+#if defined(MULTISET_PRESENCE)
+    // there is no point in checking for NO_OBJECT as this is the initial value
+    return (obj1 != NO_OBJECT && obj1 < multiset->size && IS_PRESENCE_BIT_SET(multiset->presence, obj1)) ||
+           (obj2 != NO_OBJECT && obj2 < multiset->size && IS_PRESENCE_BIT_SET(multiset->presence, obj2));
+#elif defined(MULTISET_ENV_DENSE)
+    // the count of each object is stored at the index given by it's id
+    // there is no point in checking for NO_OBJECT as this is the initial value
+    return (obj1 != NO_OBJECT && obj1 < multiset->size && multiset->items[obj1].nr > 0) ||
+           (obj2 != NO_OBJECT && obj2 < multiset->size && multiset->items[obj2].nr > 0);
+#else
+    for (object_id_t i = 0; i < multiset->size; i++)
         // there is no point in checking for NO_OBJECT as this is the initial value
         if ((multiset->items[i].id == obj1 && obj1 != NO_OBJECT) ||
                 (multiset->items[i].id == obj2 && obj2 != NO_OBJECT))
             return TRUE;
 
     return FALSE;
+#endif
+}
+
+#ifdef MULTISET_OBJ_COUNTED
+/**
+ * @brief Search for the run of an object in a counted object multiset
+ *
+ * @param multiset The multiset that is searched (haystack)
+ * @param obj The object that is searched (needle)
+ * @param pos Will store the position of the run or the position where the run should be inserted (runs are sorted by id)
+ *
+ * @return TRUE / FALSE depending on the presence of the object in the multiset
+ */
+static bool findRunInMultisetObj(multiset_obj_t *multiset, object_id_t obj, uint8_t *pos) {
+    uint8_t i;
+    for (i = 0; i < multiset->nr_runs && multiset->items[i].id < obj; i++);
+
+    *pos = i;
+    return (i < multiset->nr_runs && multiset->items[i].id == obj);
+}
+
+/**
+ * @brief Change the count of an object of a counted object multiset in a single pass
+ * Runs are inserted or removed such that they remain sorted by id
+ *
+ * @param multiset The multiset that will be modified
+ * @param obj The target object
+ * @param newCount The new count of the object (0 removes the object)
+ *
+ * @return TRUE / FALSE depending on the success of the operation (the capacity of the multiset cannot be exceeded)
+ */
+static bool changeRunInMultisetObj(multiset_obj_t *multiset, object_id_t obj, uint8_t newCount) {
+    uint8_t pos, count = 0;
+    bool found = findRunInMultisetObj(multiset, obj, &pos);
+
+    if (found)
+        count = multiset->items[pos].nr;
+
+    if (obj == NO_OBJECT || newCount == count)
+        return FALSE; // There is no change in count so skip the operation
+
+    //the total number of objects cannot exceed the capacity
+    if (multiset->nr_objects - count + newCount > multiset->size)
+        return FALSE;
+    multiset->nr_objects = multiset->nr_objects - count + newCount;
+
+    if (newCount == 0) {
+        //remove the run of this object
+        multiset->nr_runs--;
+        for (uint8_t i = pos; i < multiset->nr_runs; i++)
+            multiset->items[i] = multiset->items[i + 1];
+    }
+    else if (found)
+        multiset->items[pos].nr = newCount;
+    else {
+        //insert a new run for this object
+        for (uint8_t i = multiset->nr_runs; i > pos; i--)
+            multiset->items[i] = multiset->items[i - 1];
+        multiset->items[pos].id = obj;
+        multiset->items[pos].nr = newCount;
+        multiset->nr_runs++;
+    }
+#ifdef MULTISET_PRESENCE
+    setPresenceBit(multiset->presence, obj, newCount > 0);
+#endif
+    MARK_OBJECT_CHANGED(multiset, obj);
+    UPDATE_OBJECT_HASH(multiset, obj, count, newCount);
+
+    return TRUE;
 }
+#endif
 
-bool areObjectsInMultisetObj(multiset_obj_t *multiset, uint8_t obj1, uint8_t obj2) {
+bool areObjectsInMultisetObj(multiset_obj_t *multiset, object_id_t obj1, object_id_t obj2) {
+#if defined(MULTISET_PRESENCE)
+    return (obj1 != NO_OBJECT && obj1 < multiset->alphabet_size && IS_PRESENCE_BIT_SET(multiset->presence, obj1)) ||
+           (obj2 != NO_OBJECT && obj2 < multiset->alphabet_size && IS_PRESENCE_BIT_SET(multiset->presence, obj2));
+#elif defined(MULTISET_OBJ_COUNTED)
+    uint8_t pos;
+    return (obj1 != NO_OBJECT && findRunInMultisetObj(multiset, obj1, &pos)) ||
+           (obj2 != NO_OBJECT && findRunInMultisetObj(multiset, obj2, &pos));
+#else
     for (uint8_t i = 0; i < multiset->size; i++)
         if ((multiset->items[i] == obj1 && obj1 != NO_OBJECT) ||
                 (multiset->items[i] == obj2 && obj2 != NO_OBJECT))
             return TRUE;
 
     return FALSE;
+#endif
 }
 
-uint8_t getObjectCountFromMultisetEnv(multiset_env_t *multiset, uint8_t obj) {
-    for (uint8_t i = 0; i < multiset->size; i++)
+multiset_count_t getObjectCountFromMultisetEnv(multiset_env_t *multiset, object_id_t obj) {
+#ifdef MULTISET_ENV_DENSE
+    if (obj == NO_OBJECT || obj >= multiset->size)
+        return 0;
+    return multiset->items[obj].nr;
+#else
+    for (object_id_t i = 0; i < multiset->size; i++)
         if (multiset->items[i].id == obj)
             return multiset->items[i].nr;
 
     return 0;
+#endif
 }
 
-uint8_t getObjectCountFromMultisetObj(multiset_obj_t *multiset, uint8_t obj) {
+uint8_t getObjectCountFromMultisetObj(multiset_obj_t *multiset, object_id_t obj) {
+#ifdef MULTISET_OBJ_COUNTED
+    uint8_t pos;
+    if (obj == NO_OBJECT || !findRunInMultisetObj(multiset, obj, &pos))
+        return 0;
+    return multiset->items[pos].nr;
+#else
     uint8_t count = 0;
     for (uint8_t i = 0; i < multiset->size; i++)
         if (multiset->items[i] == obj)
             count++;
 
     return count;
+#endif
 }
 
-bool setObjectCountFromMultisetEnv(multiset_env_t *multiset, uint8_t obj, uint8_t newCount) {
+bool setObjectCountFromMultisetEnv(multiset_env_t *multiset, object_id_t obj, multiset_count_t newCount) {
     //get current count of obj.
-    uint8_t count = getObjectCountFromMultisetEnv(multiset, obj);
-    if (newCount == COUNT_INCREMENT)
-        newCount = count + 1;
-    else if (newCount == COUNT_DECREMENT)
-        newCount = (count > 0)? count - 1: 0;
+    multiset_count_t count = getObjectCountFromMultisetEnv(multiset, obj);
 
     if (newCount == count)
         return FALSE; // There is no change in count so skip the operation
 
-    for (uint8_t i = 0; i < multiset->size; i++)
+#ifdef MULTISET_ENV_DENSE
+    if (obj == NO_OBJECT || obj >= multiset->size)
+        return FALSE; //the object is not part of the alphabet
+
+    //the slot of each object is fixed (index == id) so there is no need to search for it or for an empty slot
+    multiset->items[obj].id = (newCount > 0)? obj : NO_OBJECT;
+    multiset->items[obj].nr = newCount;
+#ifdef MULTISET_PRESENCE
+    setPresenceBit(multiset->presence, obj, newCount > 0);
+#endif
+    MARK_OBJECT_CHANGED(multiset, obj);
+    UPDATE_OBJECT_HASH(multiset, obj, count, newCount);
+    return TRUE;
+#else
+    for (object_id_t i = 0; i < multiset->size; i++)
         // if we are requested to delete an object from the multiset
         if (newCount <= 0) {
             // if i is the target object
@@ -132,31 +553,71 @@ bool setObjectCountFromMultisetEnv(multiset_env_t *multiset, uint8_t obj, uint8_
             if (count == 0 && multiset->items[i].nr == 0) {
                 multiset->items[i].id = obj;
                 multiset->items[i].nr = newCount;
+#ifdef MULTISET_PRESENCE
+                setPresenceBit(multiset->presence, obj, TRUE);
+#endif
+                MARK_OBJECT_CHANGED(multiset, obj);
+                UPDATE_OBJECT_HASH(multiset, obj, count, newCount);
                 return TRUE;
             }
             // if the object was in the multiset and we find it
             else if (count > 0 && multiset->items[i].id == obj) {
                 multiset->items[i].nr = newCount;
+                MARK_OBJECT_CHANGED(multiset, obj);
+                UPDATE_OBJECT_HASH(multiset, obj, count, newCount);
                 return TRUE;
             }
         }
 
+    //the object was deleted
+    if (newCount <= 0) {
+#ifdef MULTISET_PRESENCE
+        if (obj < multiset->size) {
+            setPresenceBit(multiset->presence, obj, FALSE);
+            MARK_OBJECT_CHANGED(multiset, obj);
+        }
+#endif
+        UPDATE_OBJECT_HASH(multiset, obj, count, 0);
+        return TRUE;
+    }
+
     return FALSE; //the multiset is full (no more empty slots available)
+#endif
+}
+
+bool incObjectCountFromMultisetEnv(multiset_env_t *multiset, object_id_t obj) {
+    multiset_count_t count = getObjectCountFromMultisetEnv(multiset, obj);
+
+    if (count == MULTISET_COUNT_MAX) {
+        printw("Count of object %d saturated at %lu, rebuild with a larger MULTISET_COUNT_BITS", obj, (unsigned long) count);
+        return FALSE;
+    }
+
+    return setObjectCountFromMultisetEnv(multiset, obj, count + 1);
+}
+
+bool decObjectCountFromMultisetEnv(multiset_env_t *multiset, object_id_t obj) {
+    multiset_count_t count = getObjectCountFromMultisetEnv(multiset, obj);
+
+    //the target obj was not found
+    if (count == 0)
+        return FALSE;
+
+    return setObjectCountFromMultisetEnv(multiset, obj, count - 1);
 }
 
-bool setObjectCountFromMultisetObj(multiset_obj_t *multiset, uint8_t obj, uint8_t newCount) {
+bool setObjectCountFromMultisetObj(multiset_obj_t *multiset, object_id_t obj, uint8_t newCount) {
     //get current count of obj.
-    uint8_t count_abs_diff = 0;
     uint8_t count = getObjectCountFromMultisetObj(multiset, obj);
-    if (newCount == COUNT_INCREMENT)
-        newCount = count + 1;
-    else if (newCount == COUNT_DECREMENT)
-        newCount = (count > 0)? count - 1: 0;
 
     if (newCount == count)
         return FALSE; // There is no change in count so skip the operation
 
-    count_abs_diff = (newCount > count)? newCount - count: count - newCount;
+#ifdef MULTISET_OBJ_COUNTED
+    //the count is changed directly, without repeated add / del operations
+    return changeRunInMultisetObj(multiset, obj, newCount);
+#else
+    uint8_t count_abs_diff = (newCount > count)? newCount - count: count - newCount;
 
     //repeat the add / del operation as many times as needed to make count == newCount
     for (uint8_t i = 0; i < count_abs_diff; i++)
@@ -173,35 +634,71 @@ bool setObjectCountFromMultisetObj(multiset_obj_t *multiset, uint8_t obj, uint8_
 
     //the operation finished succesfully
     return TRUE;
+#endif
 }
 
-bool addObjectToMultisetObj(multiset_obj_t *multiset, uint8_t obj) {
+bool addObjectToMultisetObj(multiset_obj_t *multiset, object_id_t obj) {
+#ifdef MULTISET_OBJ_COUNTED
+    return changeRunInMultisetObj(multiset, obj, getObjectCountFromMultisetObj(multiset, obj) + 1);
+#else
     for (uint8_t i = 0; i < multiset->size; i++)
         //if we find an empty slot
         if (multiset->items[i] == NO_OBJECT) {
             multiset->items[i] = obj;
+#ifdef MULTISET_PRESENCE
+            if (obj != NO_OBJECT) {
+                setPresenceBit(multiset->presence, obj, TRUE);
+                MARK_OBJECT_CHANGED(multiset, obj);
+            }
+#endif
+#ifdef CONFIG_HASH
+            {
+                uint8_t count = getObjectCountFromMultisetObj(multiset, obj);
+                UPDATE_OBJECT_HASH(multiset, obj, count - 1, count);
+            }
+#endif
             return TRUE;
         }
 
     //the target obj was not found (or no empty slot)
     return FALSE;
+#endif
 }
 
-bool delObjectFromMultisetObj(multiset_obj_t *multiset, uint8_t obj) {
+bool delObjectFromMultisetObj(multiset_obj_t *multiset, object_id_t obj) {
+#ifdef MULTISET_OBJ_COUNTED
+    uint8_t count = getObjectCountFromMultisetObj(multiset, obj);
+    //the target obj was not found
+    if (count == 0)
+        return FALSE;
+    return changeRunInMultisetObj(multiset, obj, count - 1);
+#else
     for (uint8_t i = 0; i < multiset->size; i++)
         // if i is the target object
         if (multiset->items[i] == obj) {
             //mark this position as empty from now on
             multiset->items[i] = NO_OBJECT;
+#ifdef MULTISET_PRESENCE
+            //other instances of this object may still be present
+            setPresenceBit(multiset->presence, obj, getObjectCountFromMultisetObj(multiset, obj) > 0);
+            MARK_OBJECT_CHANGED(multiset, obj);
+#endif
+#ifdef CONFIG_HASH
+            {
+                uint8_t count = getObjectCountFromMultisetObj(multiset, obj);
+                UPDATE_OBJECT_HASH(multiset, obj, count + 1, count);
+            }
+#endif
             return TRUE;
         }
 
     //the target obj was not found
     return FALSE;
+#endif
 }
 
 bool isMultisetEnvIncluded(multiset_env_t *parent, multiset_env_t *child) {
-    for (uint8_t i = 0; i < child->size; i++) {
+    for (object_id_t i = 0; i < child->size; i++) {
         // if child[i] object does not appear at least as many times in parent multiset as it does in the child
         if (getObjectCountFromMultisetEnv(parent, child->items[i].id) < child->items[i].nr)
             return FALSE;
@@ -210,6 +707,19 @@ bool isMultisetEnvIncluded(multiset_env_t *parent, multiset_env_t *child) {
 }
 
 bool isMultisetObjIncluded(multiset_obj_t *parent, multiset_obj_t *child) {
+#ifdef MULTISET_OBJ_COUNTED
+    uint8_t p = 0;
+    //both run lists are sorted by id so they can be compared in a single pass
+    for (uint8_t c = 0; c < child->nr_runs; c++) {
+        while (p < parent->nr_runs && parent->items[p].id < child->items[c].id)
+            p++;
+        // if child[c] object does not appear at least as many times in parent multiset as it does in the child
+        if (p >= parent->nr_runs || parent->items[p].id != child->items[c].id || parent->items[p].nr < child->items[c].nr)
+            return FALSE;
+    }
+
+    return TRUE;
+#else
     for (uint8_t i = 0; i < child->size; i++)
         // if child[i] is not NO_OBJECT and
         //  child[i] object does not appear in parent multiset
@@ -218,12 +728,66 @@ bool isMultisetObjIncluded(multiset_obj_t *parent, multiset_obj_t *child) {
             return FALSE;
 
     return TRUE;
+#endif
 }
 
-bool replaceObjInMultisetEnv(multiset_env_t *multiset, uint8_t initial_obj, uint8_t final_obj) {
-    for (uint8_t i = 0; i < multiset->size; i++)
+#if defined(CONFIG_HASH) && !defined(MULTISET_ENV_DENSE)
+/**
+ * @brief Compute the hash of a (slot based) environment multiset from scratch (used after replacing objects)
+ *
+ * @param multiset The multiset
+ */
+static void rehashMultisetEnv(multiset_env_t *multiset) {
+    multiset->hash = 0;
+    for (object_id_t i = 0; i < multiset->size; i++)
+        if (multiset->items[i].id != NO_OBJECT)
+            multiset->hash ^= getObjectHashKey(multiset->items[i].id, multiset->items[i].nr);
+}
+#endif
+
+bool replaceObjInMultisetEnv(multiset_env_t *multiset, object_id_t initial_obj, object_id_t final_obj) {
+#ifdef MULTISET_ENV_DENSE
+    if (final_obj == NO_OBJECT || final_obj >= multiset->size ||
+            !areObjectsInMultisetEnv(multiset, initial_obj, NO_OBJECT))
+        return FALSE; //the initial object was not found
+    else if (initial_obj == final_obj)
+        return TRUE;
+    else if (multiset->items[final_obj].nr > MULTISET_COUNT_MAX - multiset->items[initial_obj].nr) {
+        printw("Count of object %d saturated at %lu, rebuild with a larger MULTISET_COUNT_BITS", final_obj, (unsigned long) multiset->items[final_obj].nr);
+        return FALSE;
+    }
+
+    //move the count of the initial object into the slot of the final object
+    UPDATE_OBJECT_HASH(multiset, final_obj, multiset->items[final_obj].nr, multiset->items[final_obj].nr + multiset->items[initial_obj].nr);
+    UPDATE_OBJECT_HASH(multiset, initial_obj, multiset->items[initial_obj].nr, 0);
+    multiset->items[final_obj].id = final_obj;
+    multiset->items[final_obj].nr += multiset->items[initial_obj].nr;
+    multiset->items[initial_obj].id = NO_OBJECT;
+    multiset->items[initial_obj].nr = 0;
+#ifdef MULTISET_PRESENCE
+    setPresenceBit(multiset->presence, initial_obj, FALSE);
+    setPresenceBit(multiset->presence, final_obj, TRUE);
+#endif
+    MARK_OBJECT_CHANGED(multiset, initial_obj);
+    MARK_OBJECT_CHANGED(multiset, final_obj);
+    return TRUE;
+#else
+    for (object_id_t i = 0; i < multiset->size; i++)
         if (multiset->items[i].id == initial_obj) {
             multiset->items[i].id = final_obj;
+#ifdef MULTISET_PRESENCE
+            if (initial_obj < multiset->size) {
+                setPresenceBit(multiset->presence, initial_obj, FALSE);
+                MARK_OBJECT_CHANGED(multiset, initial_obj);
+            }
+            if (final_obj != NO_OBJECT && final_obj < multiset->size) {
+                setPresenceBit(multiset->presence, final_obj, TRUE);
+                MARK_OBJECT_CHANGED(multiset, final_obj);
+            }
+#endif
+#ifdef CONFIG_HASH
+            rehashMultisetEnv(multiset);
+#endif
             // we replaced the initial_obj and there should be no other entry in the multiset with
             // this id, so we return
             return TRUE;
@@ -231,9 +795,46 @@ bool replaceObjInMultisetEnv(multiset_env_t *multiset, uint8_t initial_obj, uint
 
     //the initial object was not found
     return FALSE;
+#endif
+}
+
+#if defined(CONFIG_HASH) && !defined(MULTISET_OBJ_COUNTED)
+/**
+ * @brief Compute the hash of a (slot based) object multiset from scratch (used after replacing objects)
+ *
+ * @param multiset The multiset
+ */
+static void rehashMultisetObj(multiset_obj_t *multiset) {
+    multiset->hash = 0;
+    for (uint8_t i = 0; i < multiset->size; i++) {
+        bool first = TRUE;
+
+        //each object is hashed once, at it's first slot
+        for (uint8_t j = 0; j < i && first; j++)
+            first = (multiset->items[j] != multiset->items[i]);
+        if (first)
+            multiset->hash ^= getObjectHashKey(multiset->items[i], getObjectCountFromMultisetObj(multiset, multiset->items[i]));
+    }
 }
+#endif
 
-bool replaceObjInMultisetObj(multiset_obj_t *multiset, uint8_t initial_obj, uint8_t final_obj) {
+bool replaceObjInMultisetObj(multiset_obj_t *multiset, object_id_t initial_obj, object_id_t final_obj) {
+#ifdef MULTISET_OBJ_COUNTED
+    uint8_t count = getObjectCountFromMultisetObj(multiset, initial_obj);
+
+    //the initial object was not found
+    if (count == 0)
+        return FALSE;
+    else if (initial_obj == final_obj)
+        return TRUE;
+
+    //all instances of the initial_obj are moved to the run of the final_obj
+    changeRunInMultisetObj(multiset, initial_obj, 0);
+    //replacing with NO_OBJECT is equivalent to a deletion
+    if (final_obj == NO_OBJECT)
+        return TRUE;
+    return changeRunInMultisetObj(multiset, final_obj, getObjectCountFromMultisetObj(multiset, final_obj) + count);
+#else
     bool initialObjectFound = FALSE;
 
     for (uint8_t i = 0; i < multiset->size; i++)
@@ -243,785 +844,2043 @@ bool replaceObjInMultisetObj(multiset_obj_t *multiset, uint8_t initial_obj, uint
             //replace all instaces of the inital_obj
         }
 
+#ifdef MULTISET_PRESENCE
+    if (initialObjectFound && initial_obj != final_obj) {
+        if (initial_obj != NO_OBJECT) {
+            setPresenceBit(multiset->presence, initial_obj, FALSE);
+            MARK_OBJECT_CHANGED(multiset, initial_obj);
+        }
+        if (final_obj != NO_OBJECT) {
+            setPresenceBit(multiset->presence, final_obj, TRUE);
+            MARK_OBJECT_CHANGED(multiset, final_obj);
+        }
+    }
+#endif
+#ifdef CONFIG_HASH
+    if (initialObjectFound)
+        rehashMultisetObj(multiset);
+#endif
+
     //the initial object was not found
     return initialObjectFound;
+#endif
 }
 
-bool replaceOneObjInMultisetObj(multiset_obj_t *multiset, uint8_t initial_obj, uint8_t final_obj) {
+bool replaceOneObjInMultisetObj(multiset_obj_t *multiset, object_id_t initial_obj, object_id_t final_obj) {
+#ifdef MULTISET_OBJ_COUNTED
+    if (initial_obj == final_obj)
+        return areObjectsInMultisetObj(multiset, initial_obj, NO_OBJECT);
+
+    //the initial object was not found
+    if (!delObjectFromMultisetObj(multiset, initial_obj))
+        return FALSE;
 
+    //replacing with NO_OBJECT is equivalent to a deletion
+    return (final_obj == NO_OBJECT) || addObjectToMultisetObj(multiset, final_obj);
+#else
     for (uint8_t i = 0; i < multiset->size; i++)
         if (multiset->items[i] == initial_obj) {
             multiset->items[i] = final_obj;
+#ifdef MULTISET_PRESENCE
+            //other instances of the initial object may still be present
+            if (initial_obj != NO_OBJECT) {
+                setPresenceBit(multiset->presence, initial_obj, getObjectCountFromMultisetObj(multiset, initial_obj) > 0);
+                MARK_OBJECT_CHANGED(multiset, initial_obj);
+            }
+            if (final_obj != NO_OBJECT) {
+                setPresenceBit(multiset->presence, final_obj, TRUE);
+                MARK_OBJECT_CHANGED(multiset, final_obj);
+            }
+#endif
+#ifdef CONFIG_HASH
+            rehashMultisetObj(multiset);
+#endif
             return TRUE;
         }
 
     //the initial object was not found
     return FALSE;
+#endif
 }
 
-bool agent_choseProgram(Agent_t *agent) {
+#ifdef MULTISET_PRESENCE
+/**
+ * @brief Build the presence masks of a program (the objects that have to be present in each multiset for the program to be executable)
+ * The masks are part of the compiled program (see compileProgram())
+ * Only non-conditional rules are part of the masks because a conditional rule can be executed using any of it's two alternatives
+ *
+ * @param program The program whose masks are built
+ * @param pcol The P colony of the agent that owns the program
+ */
+static void initProgramPresenceMask(Program_t *program, Pcolony_t *pcol) {
+    object_id_t nr_words = PRESENCE_NR_WORDS(pcol->nr_A);
     Rule_t *rule;
-    multiset_env_t required_env, required_global_env, required_in_global_env, required_out_global_env;
-    multiset_obj_t required_obj;
-    uint8_t chosen_prg_count = 0, last_chosen_prg_nr = 0;
-    //possiblePrograms[2] = True -> program[2] is executable
-    bool possiblePrograms[agent->nr_programs];
-
-    //init the entire array to FALSE
-    initArray(possiblePrograms, agent->nr_programs, FALSE);
 
-    initMultisetObj(&required_obj, agent->pcolony->n);
-    initMultisetEnv(&required_env, agent->pcolony->nr_A);
-    initMultisetEnv(&required_global_env, agent->pcolony->nr_A);
-    initMultisetEnv(&required_in_global_env, agent->pcolony->nr_A);
-    initMultisetEnv(&required_out_global_env, agent->pcolony->nr_A);
+    program->presence_mask = (presence_word_t *)LULU_MALLOC(sizeof(presence_word_t) * nr_words * MULTISET_TARGET_NONE);
+    for (object_id_t i = 0; i < nr_words * MULTISET_TARGET_NONE; i++)
+        program->presence_mask[i] = 0;
 
-    for (uint8_t prg_nr = 0; prg_nr < agent->nr_programs; prg_nr++) {
-        bool executable = TRUE;
-        //by clearing the multisets before checking each program, we fix the bug related to required_env failed for more than one program
-        clearMultisetObj(&required_obj);
-        clearMultisetEnv(&required_env);
-        clearMultisetEnv(&required_global_env);
-        clearMultisetEnv(&required_in_global_env);
-        clearMultisetEnv(&required_out_global_env);
-
-        //if this program contains less rules than the P colony capacity, then the missing rules were e->e
-        //so it is safe to assume that we need one e object in required_obj for each missing rule
-        for (uint8_t i = 0; i < (agent->pcolony->n - agent->programs[prg_nr].nr_rules); i++)
-            setObjectCountFromMultisetObj(&required_obj, OBJECT_ID_E, COUNT_INCREMENT);
-
-        for (uint8_t rule_nr = 0; rule_nr < agent->programs[prg_nr].nr_rules; rule_nr++) {
-            rule = &agent->programs[prg_nr].rules[rule_nr];
-
-            //if rule is a simple, non-conditional rule
-            if (rule->type < RULE_TYPE_CONDITIONAL_EVOLUTION_EVOLUTION) {
-
-                //all types of rules require the left hand side obj to be available in the agent
-                //if (rule.lhs not in self.obj):
-                if (!areObjectsInMultisetObj(&agent->obj, rule->lhs, NO_OBJECT)) {
-                    executable = FALSE;
-                    break; //stop checking
-                }
-
-                //communication rules require the right hand side obj to be available in the environement
-                //if (rule.main_type == RuleType.communication and rule.rhs not in self.colony.env):
-                if (rule->type == RULE_TYPE_COMMUNICATION &&
-                        !areObjectsInMultisetEnv(&agent->pcolony->env, rule->rhs, NO_OBJECT)) {
-                    executable = FALSE;
-                    break; //stop checking
-                }
+    //the missing rules of the program are e->e rules
+    if (program->nr_rules < pcol->n)
+        setPresenceBit(&program->presence_mask[MULTISET_TARGET_OBJ * nr_words], OBJECT_ID_E, TRUE);
 
-                //exteroceptive rules require the right hand side obj to be available in the global Pswarm environment
-                //if (rule.main_type == RuleType.exteroceptive and rule.rhs not in self.colony.parentSwarm.global_env):
-                if (rule->type == RULE_TYPE_EXTEROCEPTIVE &&
-                        !areObjectsInMultisetEnv(&agent->pcolony->pswarm.global_env, rule->rhs, NO_OBJECT)) {
-                    executable = FALSE;
-                    break; //stop checking
-                }
+    for (uint8_t rule_nr = 0; rule_nr < program->nr_rules; rule_nr++) {
+        rule = &program->rules[rule_nr];
+        if (rule->type >= RULE_TYPE_CONDITIONAL_EVOLUTION_EVOLUTION)
+            continue;
+
+        //all types of rules require the left hand side obj to be available in the agent
+        setPresenceBit(&program->presence_mask[MULTISET_TARGET_OBJ * nr_words], rule->lhs, TRUE);
+        //communication and {,in_,out_}exteroceptive rules require the right hand side obj to be available in an environment
+        if (getRuleTypeTarget(rule->type) != MULTISET_TARGET_NONE)
+            setPresenceBit(&program->presence_mask[getRuleTypeTarget(rule->type) * nr_words], rule->rhs, TRUE);
+    }
+}
 
-                //in_exteroceptive rules require the right hand side obj to be available in the INPUT global Pswarm environment
-                //if (rule.main_type == RuleType.in_exteroceptive and rule.rhs not in self.colony.parentSwarm.in_global_env):
-                if (rule->type == RULE_TYPE_IN_EXTEROCEPTIVE &&
-                        !areObjectsInMultisetEnv(&agent->pcolony->pswarm.in_global_env, rule->rhs, NO_OBJECT)) {
-                    executable = FALSE;
-                    break; //stop checking
-                }
+#ifndef GUARD_TREE
+/**
+ * @brief Check that all objects from the presence masks of a program are present in the multisets accessed by an agent
+ * (not needed if GUARD_TREE is defined because the guard tree already checks each requirement once for all programs)
+ *
+ * @param agent The agent that owns the program
+ * @param program The program that is checked
+ *
+ * @return TRUE if all of the objects from the masks are present, FALSE otherwise (the program is not executable)
+ */
+static bool isProgramPresenceMaskMet(Agent_t *agent, Program_t *program) {
+    object_id_t nr_words = PRESENCE_NR_WORDS(agent->pcolony->nr_A);
+    presence_word_t *mask = program->presence_mask;
 
-                //out_exteroceptive rules require the right hand side obj to be available in the OUTPUT global Pswarm environment
-                //if (rule.main_type == RuleType.out_exteroceptive and rule.rhs not in self.colony.parentSwarm.out_global_env):
-                if (rule->type == RULE_TYPE_OUT_EXTEROCEPTIVE &&
-                        !areObjectsInMultisetEnv(&agent->pcolony->pswarm.out_global_env, rule->rhs, NO_OBJECT)) {
-                    executable = FALSE;
-                    break; //stop checking
-                }
+    for (object_id_t i = 0; i < nr_words; i++)
+        if (mask[i] & ~agent->obj.presence[i])
+            return FALSE;
 
-                rule->exec_rule_nr = RULE_EXEC_OPTION_FIRST; //the only option available
+    for (multiset_target_t target = MULTISET_TARGET_ENV; target < MULTISET_TARGET_NONE; target++) {
+        presence_word_t *presence = getAgentTargetEnv(agent, target)->presence;
+        mask += nr_words;
+        for (object_id_t i = 0; i < nr_words; i++)
+            if (mask[i] & ~presence[i])
+                return FALSE;
+    }
 
-                //if we reach this step, then the rule is executable
-                //required_obj[rule.lhs] += 1 //all rules need the lhs to be in obj
-                setObjectCountFromMultisetObj(&required_obj, rule->lhs, COUNT_INCREMENT); //all rules need the lhs to be in obj
+    return TRUE;
+}
+#endif
+#endif
 
-                if (rule->type == RULE_TYPE_COMMUNICATION)
-                    //required_env[rule.rhs] += 1 //rhs part of the rule has to be in the Pcolony environment
-                    setObjectCountFromMultisetEnv(&required_env, rule->rhs, COUNT_INCREMENT); //rhs part of the rule has to be in the Pcolony environment
+/**
+ * @brief Add one object to the requirements of a program
+ * Requirements of e objects from environments are not accumulated because there are always enough e objects in an environment
+ * (but at least one has to be present)
+ *
+ * @param requirements The requirements list
+ * @param nr_requirements Pointer to the number of valid requirements (updated if a new requirement is added)
+ * @param target The multiset that has to provide the object
+ * @param obj The required object
+ */
+static void addRequirement(requirement_t *requirements, uint8_t *nr_requirements, multiset_target_t target, object_id_t obj) {
+    for (uint8_t i = 0; i < *nr_requirements; i++)
+        if (requirements[i].target == target && requirements[i].obj == obj) {
+            if (target == MULTISET_TARGET_OBJ || obj != OBJECT_ID_E)
+                requirements[i].nr++;
+            return;
+        }
 
-                if (rule->type == RULE_TYPE_EXTEROCEPTIVE)
-                    //required_global_env[rule.rhs] += 1 //rhs part of the rule has to be in the Pswarm global environment
-                    setObjectCountFromMultisetEnv(&required_global_env, rule->rhs, COUNT_INCREMENT); //rhs part of the rule has to be in the Pswarm global environment
+    requirements[*nr_requirements].obj = obj;
+    requirements[*nr_requirements].nr = 1;
+    requirements[*nr_requirements].target = target;
+    (*nr_requirements)++;
+}
 
-                if (rule->type == RULE_TYPE_IN_EXTEROCEPTIVE)
-                    //required_in_global_env[rule.rhs] += 1 //rhs part of the rule has to be in the INPUT Pswarm global environment
-                    setObjectCountFromMultisetEnv(&required_in_global_env, rule->rhs, COUNT_INCREMENT); //rhs part of the rule has to be in the INPUT Pswarm global environment
+/**
+ * @brief Fill the lhs / rhs requirements of one rule
+ *
+ * @param requirement Array of 2 requirements (lhs, rhs)
+ * @param type A non-conditional rule type
+ * @param lhs The left hand side object of the rule
+ * @param rhs The right hand side object of the rule
+ */
+static void initRuleRequirements(requirement_t *requirement, rule_type_t type, object_id_t lhs, object_id_t rhs) {
+    //all types of rules require the left hand side obj to be available in the agent
+    requirement[0].obj = lhs;
+    requirement[0].nr = 1;
+    requirement[0].target = MULTISET_TARGET_OBJ;
+    //communication and {,in_,out_}exteroceptive rules require the right hand side obj to be available in an environment
+    requirement[1].obj = rhs;
+    requirement[1].nr = 1;
+    requirement[1].target = getRuleTypeTarget(type);
+}
 
-                if (rule->type == RULE_TYPE_OUT_EXTEROCEPTIVE)
-                    //required_out_global_env[rule.rhs] += 1 //rhs part of the rule has to be in the OUTPUT Pswarm global environment
-                    setObjectCountFromMultisetEnv(&required_out_global_env, rule->rhs, COUNT_INCREMENT); //rhs part of the rule has to be in the OUTPUT Pswarm global environment
-            }
+/**
+ * @brief Add the change of the count of one object to a list of delta operations (merged with the previous change of the same object)
+ * e objects are never taken from or added to an environment, so they are skipped for environments
+ *
+ * @param ops The list of operations
+ * @param nr_ops Pointer to the number of operations (updated if a new operation is added)
+ * @param target The multiset that is changed
+ * @param obj The object whose count is changed
+ * @param delta The change of the count
+ */
+static void addDeltaOp(delta_op_t *ops, uint8_t *nr_ops, multiset_target_t target, object_id_t obj, int16_t delta) {
+    if (target != MULTISET_TARGET_OBJ && obj == OBJECT_ID_E)
+        return;
+
+    for (uint8_t i = 0; i < *nr_ops; i++)
+        if (ops[i].target == target && ops[i].obj == obj) {
+            ops[i].delta += delta;
+            return;
+        }
 
-            // if this is a conditional rule
-            else {
+    ops[*nr_ops].obj = obj;
+    ops[*nr_ops].delta = delta;
+    ops[*nr_ops].target = target;
+    (*nr_ops)++;
+}
 
-                //we first check the first part of the conditional rule (as a normal rule)
+/**
+ * @brief Add the delta operations of one (non-conditional) rule to a list of operations
+ *
+ * @param ops The list of operations (at least 4 more free entries)
+ * @param nr_ops Pointer to the number of operations (updated)
+ * @param type A non-conditional rule type
+ * @param lhs The left hand side object of the rule
+ * @param rhs The right hand side object of the rule
+ */
+static void addRuleDeltaOps(delta_op_t *ops, uint8_t *nr_ops, rule_type_t type, object_id_t lhs, object_id_t rhs) {
+    multiset_target_t target = getRuleTypeTarget(type);
+
+    //lhs leaves the agent and rhs enters the agent
+    addDeltaOp(ops, nr_ops, MULTISET_TARGET_OBJ, lhs, -1);
+    addDeltaOp(ops, nr_ops, MULTISET_TARGET_OBJ, rhs, 1);
+    //communication and {,in_,out_}exteroceptive rules swap lhs and rhs with an environment
+    if (target != MULTISET_TARGET_NONE) {
+        addDeltaOp(ops, nr_ops, target, rhs, -1);
+        addDeltaOp(ops, nr_ops, target, lhs, 1);
+    }
+}
 
-                //all types of rules require the left hand side obj to be available in the agent
-                //if (rule.lhs not in self.obj):
-                if (!areObjectsInMultisetObj(&agent->obj, rule->lhs, NO_OBJECT)) {
-                    executable = FALSE;
-                }
+/**
+ * @brief Remove the operations that do not change any count and place the operations with negative deltas first
+ * (so that objects are removed from an agent before new objects are added to it)
+ *
+ * @param ops The list of operations
+ * @param nr_ops Pointer to the number of operations (updated)
+ */
+static void finishDeltaOps(delta_op_t *ops, uint8_t *nr_ops) {
+    uint8_t nr_negative = 0, nr_kept = 0;
+    delta_op_t op;
+
+    for (uint8_t i = 0; i < *nr_ops; i++) {
+        if (ops[i].delta == 0)
+            continue;
+        op = ops[i];
+        //shift the positive operations to make room for the negative one (the lists are short)
+        if (op.delta < 0) {
+            for (uint8_t j = nr_kept; j > nr_negative; j--)
+                ops[j] = ops[j - 1];
+            ops[nr_negative++] = op;
+        }
+        else
+            ops[nr_kept] = op;
+        nr_kept++;
+    }
+    *nr_ops = nr_kept;
+}
 
-                //communication rules require the right hand side obj to be available in the environement
-                //if (rule.main_type == RuleType.communication and rule.rhs not in self.colony.env):
-                if (getFirstRuleTypeFromConditional(rule->type) == RULE_TYPE_COMMUNICATION &&
-                        !areObjectsInMultisetEnv(&agent->pcolony->env, rule->rhs, NO_OBJECT)) {
-                    executable = FALSE;
-                }
+/**
+ * @brief Get the sizes of the compiled tables of a program
+ * The conditional rules are counted exactly, the requirements and operations of the non-conditional rules are merged while they are
+ * compiled, so only their maximum numbers are known in advance
+ *
+ * @param program The program
+ * @param pcol The P colony of the agent that owns the program
+ * @param max_requirements Will store the maximum number of requirements
+ * @param nr_conditionals Will store the number of conditional rules
+ * @param max_ops Will store the maximum number of delta operations
+ */
+static void getProgramTableSizes(Program_t *program, Pcolony_t *pcol, uint16_t *max_requirements, uint8_t *nr_conditionals, uint16_t *max_ops) {
+    *nr_conditionals = 0;
+    for (uint8_t rule_nr = 0; rule_nr < program->nr_rules; rule_nr++)
+        if (program->rules[rule_nr].type >= RULE_TYPE_CONDITIONAL_EVOLUTION_EVOLUTION)
+            (*nr_conditionals)++;
+
+    //two requirements and 4 count changes for each non-conditional rule and one requirement for the e objects of the missing e->e rules
+    *max_requirements = 2 * (program->nr_rules - *nr_conditionals) + (program->nr_rules < pcol->n);
+    *max_ops = 4 * (program->nr_rules - *nr_conditionals);
+}
 
-                //exteroceptive rules require the right hand side obj to be available in the global Pswarm environment
-                //if (rule.main_type == RuleType.exteroceptive and rule.rhs not in self.colony.parentSwarm.global_env):
-                if (getFirstRuleTypeFromConditional(rule->type) == RULE_TYPE_EXTEROCEPTIVE &&
-                        !areObjectsInMultisetEnv(&agent->pcolony->pswarm.global_env, rule->rhs, NO_OBJECT)) {
-                    executable = FALSE;
-                }
+/**
+ * @brief Fill the compiled tables of a program (requirements, conditional rules and delta operations)
+ * The tables have to be large enough for the program (see getProgramTableSizes())
+ *
+ * @param program The program
+ * @param pcol The P colony of the agent that owns the program
+ */
+static void fillProgramTables(Program_t *program, Pcolony_t *pcol) {
+    Rule_t *rule;
 
-                //in exteroceptive rules require the right hand side obj to be available in the global Pswarm environment
-                //if (rule.main_type == RuleType.exteroceptive and rule.rhs not in self.colony.parentSwarm.global_env):
-                if (getFirstRuleTypeFromConditional(rule->type) == RULE_TYPE_IN_EXTEROCEPTIVE &&
-                        !areObjectsInMultisetEnv(&agent->pcolony->pswarm.in_global_env, rule->rhs, NO_OBJECT)) {
-                    executable = FALSE;
-                }
+    program->nr_requirements = 0;
+    program->nr_conditionals = 0;
+    program->nr_ops = 0;
 
-                //out exteroceptive rules require the right hand side obj to be available in the global Pswarm environment
-                //if (rule.main_type == RuleType.exteroceptive and rule.rhs not in self.colony.parentSwarm.global_env):
-                if (getFirstRuleTypeFromConditional(rule->type) == RULE_TYPE_OUT_EXTEROCEPTIVE &&
-                        !areObjectsInMultisetEnv(&agent->pcolony->pswarm.out_global_env, rule->rhs, NO_OBJECT)) {
-                    executable = FALSE;
-                }
+    //if this program contains less rules than the P colony capacity, then the missing rules were e->e
+    //so we need one e object in obj for each missing rule
+    for (uint8_t i = program->nr_rules; i < pcol->n; i++)
+        addRequirement(program->requirements, &program->nr_requirements, MULTISET_TARGET_OBJ, OBJECT_ID_E);
+
+    for (uint8_t rule_nr = 0; rule_nr < program->nr_rules; rule_nr++) {
+        rule = &program->rules[rule_nr];
+
+        //if rule is a simple, non-conditional rule
+        if (rule->type < RULE_TYPE_CONDITIONAL_EVOLUTION_EVOLUTION) {
+            addRequirement(program->requirements, &program->nr_requirements, MULTISET_TARGET_OBJ, rule->lhs);
+            if (getRuleTypeTarget(rule->type) != MULTISET_TARGET_NONE)
+                addRequirement(program->requirements, &program->nr_requirements, getRuleTypeTarget(rule->type), rule->rhs);
+            addRuleDeltaOps(program->ops, &program->nr_ops, rule->type, rule->lhs, rule->rhs);
+        }
+        // if this is a conditional rule, then the alternative is chosen by agent_choseProgram()
+        else {
+            conditional_requirement_t *conditional = &program->conditionals[program->nr_conditionals++];
+
+            conditional->rule_nr = rule_nr;
+            initRuleRequirements(conditional->first, getFirstRuleTypeFromConditional(rule->type), rule->lhs, rule->rhs);
+            initRuleRequirements(conditional->second, getSecondRuleTypeFromConditional(rule->type), rule->alt_lhs, rule->alt_rhs);
+            conditional->nr_ops[0] = conditional->nr_ops[1] = 0;
+            addRuleDeltaOps(conditional->ops[0], &conditional->nr_ops[0], getFirstRuleTypeFromConditional(rule->type), rule->lhs, rule->rhs);
+            addRuleDeltaOps(conditional->ops[1], &conditional->nr_ops[1], getSecondRuleTypeFromConditional(rule->type), rule->alt_lhs, rule->alt_rhs);
+            finishDeltaOps(conditional->ops[0], &conditional->nr_ops[0]);
+            finishDeltaOps(conditional->ops[1], &conditional->nr_ops[1]);
+        }
+    }
+    finishDeltaOps(program->ops, &program->nr_ops);
+}
+
+#ifdef PRECOMPILED_PROGRAMS
+/**
+ * @brief Shrink a compiled table to the number of bytes that are used
+ *
+ * @param table The table
+ * @param size The number of bytes that are used
+ *
+ * @return The shrunk table (NULL if no bytes are used)
+ */
+static void* shrinkProgramTable(void *table, size_t size) {
+    if (size == 0) {
+        LULU_FREE(table);
+        return NULL;
+    }
+    return LULU_REALLOC(table, size);
+}
 
-                //if the first part of the conditional rule was executable
-                if (executable) {
-                    rule->exec_rule_nr = RULE_EXEC_OPTION_FIRST; //the only option available
+void compileProgram(Program_t *program, Pcolony_t *pcol) {
+    uint16_t max_requirements, max_ops;
+    uint8_t nr_conditionals;
+
+    clearCompiledProgram(program, pcol);
+    getProgramTableSizes(program, pcol, &max_requirements, &nr_conditionals, &max_ops);
+    program->requirements = (max_requirements > 0) ? (requirement_t *) LULU_MALLOC(sizeof(requirement_t) * max_requirements) : NULL;
+    program->conditionals = (nr_conditionals > 0) ? (conditional_requirement_t *) LULU_MALLOC(sizeof(conditional_requirement_t) * nr_conditionals) : NULL;
+    program->ops = (max_ops > 0) ? (delta_op_t *) LULU_MALLOC(sizeof(delta_op_t) * max_ops) : NULL;
+
+    fillProgramTables(program, pcol);
+    //merged requirements and operations leave entries unused
+    if (program->nr_requirements < max_requirements)
+        program->requirements = (requirement_t *) shrinkProgramTable(program->requirements, sizeof(requirement_t) * program->nr_requirements);
+    if (program->nr_ops < max_ops)
+        program->ops = (delta_op_t *) shrinkProgramTable(program->ops, sizeof(delta_op_t) * program->nr_ops);
+
+#ifdef MULTISET_PRESENCE
+    initProgramPresenceMask(program, pcol);
+#endif
+    program->compiled = TRUE;
+}
+#else
+/**
+ * @brief Compile a program of an agent into the tables of the agent, which only store the last program compiled by the agent
+ * The tables are allocated by the first call, sized for the largest program of the agent
+ *
+ * @param agent The agent
+ * @param prg_nr The number of the program
+ */
+static void compileAgentProgram(Agent_t *agent, uint8_t prg_nr) {
+    Program_t *program = &agent->programs[prg_nr];
+
+    if (agent->compiled_conditionals == NULL) {
+        uint16_t max_requirements = 0, max_ops = 0, program_requirements, program_ops;
+        uint8_t max_conditionals = 0, program_conditionals;
+
+        for (uint8_t i = 0; i < agent->nr_programs; i++) {
+            getProgramTableSizes(&agent->programs[i], agent->pcolony, &program_requirements, &program_conditionals, &program_ops);
+            if (program_requirements > max_requirements)
+                max_requirements = program_requirements;
+            if (program_conditionals > max_conditionals)
+                max_conditionals = program_conditionals;
+            if (program_ops > max_ops)
+                max_ops = program_ops;
+        }
+        //a single block, with the conditional rules first (their alignment is the largest one)
+        agent->compiled_conditionals = (conditional_requirement_t *) LULU_MALLOC(sizeof(conditional_requirement_t) * max_conditionals +
+                sizeof(requirement_t) * max_requirements + sizeof(delta_op_t) * max_ops);
+        agent->compiled_requirements = (requirement_t *) (agent->compiled_conditionals + max_conditionals);
+        agent->compiled_ops = (delta_op_t *) (agent->compiled_requirements + max_requirements);
+    }
 
-                    //if we reach this step, then the rule is executable
-                    //required_obj[rule.lhs] += 1 //all rules need the lhs to be in obj
-                    setObjectCountFromMultisetObj(&required_obj, rule->lhs, COUNT_INCREMENT); //all rules need the lhs to be in obj
+    if (agent->compiled_program_nr != NO_PROGRAM)
+        clearCompiledProgram(&agent->programs[agent->compiled_program_nr], agent->pcolony);
+    program->requirements = agent->compiled_requirements;
+    program->conditionals = agent->compiled_conditionals;
+    program->ops = agent->compiled_ops;
+    fillProgramTables(program, agent->pcolony);
+    program->compiled = TRUE;
+    agent->compiled_program_nr = prg_nr;
+}
 
-                    if (getFirstRuleTypeFromConditional(rule->type) == RULE_TYPE_COMMUNICATION)
-                        //required_env[rule.rhs] += 1 //rhs part of the rule has to be in the Pcolony environment
-                        setObjectCountFromMultisetEnv(&required_env, rule->rhs, COUNT_INCREMENT); //rhs part of the rule has to be in the Pcolony environment
+/**
+ * @brief Free the tables of an agent (they are allocated again by the next call of compileAgentProgram())
+ *
+ * @param agent The agent (none of it's programs can use the tables anymore)
+ */
+static void clearAgentCompiledTables(Agent_t *agent) {
+    LULU_FREE(agent->compiled_conditionals);
+    agent->compiled_conditionals = NULL;
+    agent->compiled_requirements = NULL;
+    agent->compiled_ops = NULL;
+    agent->compiled_program_nr = NO_PROGRAM;
+}
+#endif
 
-                    if (getFirstRuleTypeFromConditional(rule->type) == RULE_TYPE_EXTEROCEPTIVE)
-                        //required_global_env[rule.rhs] += 1 //rhs part of the rule has to be in the Pswarm global environment
-                        setObjectCountFromMultisetEnv(&required_global_env, rule->rhs, COUNT_INCREMENT); //rhs part of the rule has to be in the Pswarm global environment
+/**
+ * @brief Get a program of an agent with it's compiled tables, compiling it if needed
+ *
+ * @param agent The agent
+ * @param prg_nr The number of the program
+ *
+ * @return The compiled program
+ */
+static Program_t* getCompiledProgram(Agent_t *agent, uint8_t prg_nr) {
+    Program_t *program = &agent->programs[prg_nr];
 
-                    if (getFirstRuleTypeFromConditional(rule->type) == RULE_TYPE_IN_EXTEROCEPTIVE)
-                        //required_global_env[rule.rhs] += 1 //rhs part of the rule has to be in the Pswarm global environment
-                        setObjectCountFromMultisetEnv(&required_in_global_env, rule->rhs, COUNT_INCREMENT); //rhs part of the rule has to be in the Pswarm IN global environment
+    //with PRECOMPILED_PROGRAMS the requirements are compiled only once, the first time that the program is checked
+    if (!program->compiled) {
+#ifdef PRECOMPILED_PROGRAMS
+        compileProgram(program, agent->pcolony);
+#else
+        compileAgentProgram(agent, prg_nr);
+#endif
+    }
+    return program;
+}
 
-                    if (getFirstRuleTypeFromConditional(rule->type) == RULE_TYPE_OUT_EXTEROCEPTIVE)
-                        //required_global_env[rule.rhs] += 1 //rhs part of the rule has to be in the Pswarm global environment
-                        setObjectCountFromMultisetEnv(&required_out_global_env, rule->rhs, COUNT_INCREMENT); //rhs part of the rule has to be in the Pswarm OUT global environment
-                }
-                // if not then check the alternative part of the conditional rule
-                else {
-                    //by clearing the multisets before checking each program, we fix potential bugs related to previously required objects
-                    clearMultisetObj(&required_obj);
-                    clearMultisetEnv(&required_env);
-                    clearMultisetEnv(&required_global_env);
-                    clearMultisetEnv(&required_in_global_env);
-                    clearMultisetEnv(&required_out_global_env);
-
-                    executable=TRUE;
-                    printd("Checking alternative of conditional for P%d", prg_nr);
-
-                    //all types of rules require the left hand side obj to be available in the agent
-                    //if (rule.alt_lhs not in self.obj):
-                    if (!areObjectsInMultisetObj(&agent->obj, rule->alt_lhs, NO_OBJECT)) {
-                        executable = FALSE;
-                        break; //stop checking
-                    }
-
-                    //communication rules require the right hand side obj to be available in the environement
-                    //if (rule.main_type == RuleType.communication and rule.alt_rhs not in self.colony.env):
-                    if (getSecondRuleTypeFromConditional(rule->type) == RULE_TYPE_COMMUNICATION &&
-                            !areObjectsInMultisetEnv(&agent->pcolony->env, rule->alt_rhs, NO_OBJECT)) {
-                        executable = FALSE;
-                        break; //stop checking
-                    }
-
-                    //exteroceptive rules require the right hand side obj to be available in the global Pswarm environment
-                    //if (rule.main_type == RuleType.exteroceptive and rule.alt_rhs not in self.colony.parentSwarm.global_env):
-                    if (getSecondRuleTypeFromConditional(rule->type) == RULE_TYPE_EXTEROCEPTIVE &&
-                            !areObjectsInMultisetEnv(&agent->pcolony->pswarm.global_env, rule->alt_rhs, NO_OBJECT)) {
-                        executable = FALSE;
-                        break; //stop checking
-                    }
-
-                    //IN exteroceptive rules require the right hand side obj to be available in the global IN Pswarm environment
-                    //if (rule.main_type == RuleType.in_exteroceptive and rule.alt_rhs not in self.colony.parentSwarm.global_env):
-                    if (getSecondRuleTypeFromConditional(rule->type) == RULE_TYPE_IN_EXTEROCEPTIVE &&
-                            !areObjectsInMultisetEnv(&agent->pcolony->pswarm.in_global_env, rule->alt_rhs, NO_OBJECT)) {
-                        executable = FALSE;
-                        break; //stop checking
-                    }
-
-                    //OUT exteroceptive rules require the right hand side obj to be available in the global OUT Pswarm environment
-                    //if (rule.main_type == RuleType.out_exteroceptive and rule.alt_rhs not in self.colony.parentSwarm.global_env):
-                    if (getSecondRuleTypeFromConditional(rule->type) == RULE_TYPE_OUT_EXTEROCEPTIVE &&
-                            !areObjectsInMultisetEnv(&agent->pcolony->pswarm.out_global_env, rule->alt_rhs, NO_OBJECT)) {
-                        executable = FALSE;
-                        break; //stop checking
-                    }
-
-                    rule->exec_rule_nr = RULE_EXEC_OPTION_SECOND; //the only option available
-
-                    //if we reach this step, then the rule is executable
-                    //required_obj[rule.alt_lhs] += 1 //all rules need the alt_lhs to be in obj
-                    setObjectCountFromMultisetObj(&required_obj, rule->alt_lhs, COUNT_INCREMENT); //all rules need the alt_lhs to be in obj
-
-                    if (getSecondRuleTypeFromConditional(rule->type) == RULE_TYPE_COMMUNICATION)
-                        //required_env[rule.alt_rhs] += 1 //alt_rhs part of the rule has to be in the Pcolony environment
-                        setObjectCountFromMultisetEnv(&required_env, rule->alt_rhs, COUNT_INCREMENT); //alt_rhs part of the rule has to be in the Pcolony environment
-
-                    if (getSecondRuleTypeFromConditional(rule->type) == RULE_TYPE_EXTEROCEPTIVE)
-                        //required_global_env[rule.alt_rhs] += 1 //alt_rhs part of the rule has to be in the Pswarm global environment
-                        setObjectCountFromMultisetEnv(&required_global_env, rule->alt_rhs, COUNT_INCREMENT); //alt_rhs part of the rule has to be in the Pswarm global environment
-
-                    //if (rule.alt_type == RuleType.in_exteroceptive):
-                    if (getSecondRuleTypeFromConditional(rule->type) == RULE_TYPE_IN_EXTEROCEPTIVE)
-                        //required_in_global_env[rule.alt_rhs] += 1 // alt_rhs part of the rule has to be in the INPUT Pswarm global environment
-                        setObjectCountFromMultisetEnv(&required_in_global_env, rule->alt_rhs, COUNT_INCREMENT); //alt_rhs part of the rule has to be in the INPUT Pswarm global environment
-
-                    //if (rule.alt_type == RuleType.out_exteroceptive):
-                    if (getSecondRuleTypeFromConditional(rule->type) == RULE_TYPE_OUT_EXTEROCEPTIVE)
-                        //required_out_global_env[rule.alt_rhs] += 1 // alt_rhs part of the rule has to be in the OUTPUT Pswarm global environment
-                        setObjectCountFromMultisetEnv(&required_out_global_env, rule->alt_rhs, COUNT_INCREMENT); //alt_rhs part of the rule has to be in the OUTPUT Pswarm global environment
-                }
-            }
-        //end for rule
+void clearCompiledProgram(Program_t *program, Pcolony_t *pcol) {
+    //without PRECOMPILED_PROGRAMS the tables are owned by the agent (see compileAgentProgram())
+#ifdef PRECOMPILED_PROGRAMS
+    if (program->compiled) {
+        FREE_PCOLONY_BLOCK(pcol, program->requirements);
+        FREE_PCOLONY_BLOCK(pcol, program->conditionals);
+        FREE_PCOLONY_BLOCK(pcol, program->ops);
+#ifdef MULTISET_PRESENCE
+        FREE_PCOLONY_BLOCK(pcol, program->presence_mask);
+#endif
+    }
+#endif
+    program->compiled = FALSE;
+    program->nr_requirements = 0;
+    program->nr_conditionals = 0;
+    program->nr_ops = 0;
+    program->requirements = NULL;
+    program->conditionals = NULL;
+    program->ops = NULL;
+#ifdef MULTISET_PRESENCE
+    program->presence_mask = NULL;
+#endif
+#ifdef INCREMENTAL_SELECTION
+    //the program has to be checked again after it is compiled
+    program->dirty = TRUE;
+#endif
+}
+
+void clearPcolonyProgramTables(Pcolony_t *pcol) {
+#ifndef PRECOMPILED_PROGRAMS
+    //the programs may have been moved or their largest one may have grown, so the tables of the agents are allocated again
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++) {
+        for (uint8_t prg_nr = 0; prg_nr < pcol->agents[agent_nr].nr_programs; prg_nr++)
+            clearCompiledProgram(&pcol->agents[agent_nr].programs[prg_nr], pcol);
+        clearAgentCompiledTables(&pcol->agents[agent_nr]);
+    }
+#endif
+#ifdef GUARD_TREE
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++)
+        clearAgentGuardTree(&pcol->agents[agent_nr]);
+#endif
+#ifdef INCREMENTAL_SELECTION
+    clearPcolonyDependencyIndex(pcol);
+#endif
+#ifdef STEP_LEAPING
+    clearPcolonyLeapLimits(pcol);
+#endif
+}
+
+/**
+ * @brief Get the number of copies of an object from an environment that are reserved by the agents that have already chosen a program
+ *
+ * @param pcol The P colony
+ * @param target The environment (any target except MULTISET_TARGET_OBJ)
+ * @param obj The object that is searched
+ *
+ * @return The number of reserved copies of obj
+ */
+static multiset_count_t getReservedCount(Pcolony_t *pcol, multiset_target_t target, object_id_t obj) {
+    for (uint16_t i = 0; i < pcol->nr_reservations; i++)
+        if (pcol->reservations[i].obj == obj && pcol->reservations[i].target == target)
+            return pcol->reservations[i].nr;
+
+    return 0;
+}
+
+/**
+ * @brief Get the number of copies of an object that are available to an agent in one of the multisets that it can access
+ * The copies from environments that were reserved by other agents in the current step are not available
+ *
+ * @param agent The agent that accesses the multiset
+ * @param target The multiset that is searched
+ * @param obj The object that is searched
+ *
+ * @return The number of available occurences of the object in the target multiset
+ */
+static multiset_count_t getAgentTargetCount(Agent_t *agent, multiset_target_t target, object_id_t obj) {
+    if (target == MULTISET_TARGET_OBJ)
+        return getObjectCountFromMultisetObj(&agent->obj, obj);
+
+    if (agent->pcolony->nr_reservations > 0) {
+        multiset_count_t count = getObjectCountFromMultisetEnv(getAgentTargetEnv(agent, target), obj),
+                         reserved = getReservedCount(agent->pcolony, target, obj);
+
+        //the count of a global object can drop below the reserved count when another process consumes it concurrently
+        return (count > reserved) ? count - reserved : 0;
+    }
+
+    return getObjectCountFromMultisetEnv(getAgentTargetEnv(agent, target), obj);
+}
+
+// size in bytes of the bitset of the alternatives chosen by an agent (one bit per rule of each program, see Agent.alternatives)
+#define ALTERNATIVES_SIZE(agent) (((uint16_t) (agent)->nr_programs * (agent)->pcolony->n + 7) / 8)
+
+/**
+ * @brief Check which alternative of a conditional rule was chosen by the last check of a program
+ *
+ * @param agent The agent that owns the program
+ * @param prg_nr The number of the program
+ * @param conditional_nr The number of the conditional rule (in program->conditionals)
+ *
+ * @return 0 if the first rule is executed, 1 if the second rule is executed
+ */
+static uint8_t getChosenAlternative(Agent_t *agent, uint8_t prg_nr, uint8_t conditional_nr) {
+    uint16_t bit = (uint16_t) prg_nr * agent->pcolony->n + conditional_nr;
+
+    return (agent->alternatives[bit / 8] >> (bit % 8)) & 1;
+}
+
+/**
+ * @brief Store the alternative of a conditional rule that will be executed if the program is chosen
+ *
+ * @param agent The agent that owns the program
+ * @param prg_nr The number of the program
+ * @param conditional_nr The number of the conditional rule (in program->conditionals)
+ * @param alternative 0 for the first rule, 1 for the second rule
+ */
+static void setChosenAlternative(Agent_t *agent, uint8_t prg_nr, uint8_t conditional_nr, uint8_t alternative) {
+    uint16_t bit = (uint16_t) prg_nr * agent->pcolony->n + conditional_nr;
+
+    if (alternative)
+        agent->alternatives[bit / 8] |= (uint8_t) (1 << (bit % 8));
+    else
+        agent->alternatives[bit / 8] &= (uint8_t) ~(1 << (bit % 8));
+}
+
+/**
+ * @brief Check that the objects of one alternative of a conditional rule are present (without taking into account other rules)
+ *
+ * @param agent The agent that owns the rule
+ * @param requirement Array of 2 requirements (lhs, rhs) of the alternative
+ *
+ * @return TRUE if the alternative can be used, FALSE otherwise
+ */
+static bool isAlternativeAvailable(Agent_t *agent, requirement_t *requirement) {
+    return getAgentTargetCount(agent, requirement[0].target, requirement[0].obj) > 0 &&
+        (requirement[1].target == MULTISET_TARGET_NONE || getAgentTargetCount(agent, requirement[1].target, requirement[1].obj) > 0);
+}
+
+/**
+ * @brief Compute the number of copies of an object that a program needs up to (and including) one of it's conditional rules
+ * The alternatives of the previous conditional rules have to be already chosen
+ *
+ * @param agent The agent that owns the program
+ * @param prg_nr The number of the program that is checked
+ * @param conditional_nr The number of the conditional rule (in program->conditionals)
+ * @param requirement The requirement of the chosen alternative of the conditional rule
+ *
+ * @return The total number of copies of requirement->obj that are needed from requirement->target
+ */
+static uint8_t getConditionalRequiredCount(Agent_t *agent, uint8_t prg_nr, uint8_t conditional_nr, requirement_t *requirement) {
+    Program_t *program = &agent->programs[prg_nr];
+    uint8_t count = 1;
+    requirement_t *previous;
+
+    //there are always enough e objects in an environment
+    if (requirement->target != MULTISET_TARGET_OBJ && requirement->obj == OBJECT_ID_E)
+        return 1;
+
+    for (uint8_t i = 0; i < program->nr_requirements; i++)
+        if (program->requirements[i].target == requirement->target && program->requirements[i].obj == requirement->obj)
+            count += program->requirements[i].nr;
+
+    for (uint8_t c = 0; c < conditional_nr; c++) {
+        previous = (getChosenAlternative(agent, prg_nr, c) == 0)? program->conditionals[c].first : program->conditionals[c].second;
+        for (uint8_t side = 0; side < 2; side++)
+            if (previous[side].target == requirement->target && previous[side].obj == requirement->obj)
+                count++;
+    }
+
+    return count;
+}
+
+/**
+ * @brief Offer an executable program to the random choice of an agent (reservoir sampling)
+ * The n-th executable program that is found replaces the chosen program with probability 1/n,
+ * so that after all of the programs are checked each executable program was chosen with equal probability
+ *
+ * @param agent The agent that owns the program
+ * @param prg_nr The number of the executable program
+ * @param nr_executable Number of executable programs found so far (updated)
+ * @param executable_list If not NULL, the program is only appended to this list and no choice is made (see pcolony_setThreads())
+ */
+static void offerExecutableProgram(Agent_t *agent, uint8_t prg_nr, uint8_t *nr_executable, uint8_t *executable_list) {
+    if (executable_list != NULL) {
+        executable_list[(*nr_executable)++] = prg_nr;
+        return;
+    }
+
+    (*nr_executable)++;
+    printd("exec prg %d", prg_nr);
+    //the choice depends on the random number generator, so the next configuration is not determined by the current one
+    if (*nr_executable > 1)
+        agent->pcolony->forced_step = FALSE;
+    if (*nr_executable == 1 || pcolony_rand(agent->pcolony) % *nr_executable == 0)
+        agent->chosenProgramNr = prg_nr;
+}
+
+/**
+ * @brief Choose the alternatives of the conditional rules of a program and check that their objects are available
+ * The requirements of the non-conditional rules of the program have to be already met
+ *
+ * @param agent The agent that owns the program
+ * @param prg_nr The number of the program that is checked
+ *
+ * @return TRUE if all of the conditional rules can be executed, FALSE otherwise
+ */
+static bool areConditionalRequirementsMet(Agent_t *agent, uint8_t prg_nr) {
+    Program_t *program = &agent->programs[prg_nr];
+    requirement_t *requirement;
+
+    // each conditional rule uses the first rule if it's objects are present or the alternative otherwise
+    for (uint8_t c = 0; c < program->nr_conditionals; c++) {
+        if (isAlternativeAvailable(agent, program->conditionals[c].first)) {
+            setChosenAlternative(agent, prg_nr, c, 0);
+            requirement = program->conditionals[c].first;
         }
+        else if (isAlternativeAvailable(agent, program->conditionals[c].second)) {
+            printd("Using alternative of conditional for P%d", prg_nr);
+            setChosenAlternative(agent, prg_nr, c, 1);
+            requirement = program->conditionals[c].second;
+        }
+        else
+            return FALSE;
 
-        // if all previous rule tests confirm that this program is executable
-        if (executable) {
-            // check that the Agent obj requirements of the program are met
-            //for k, v in required_obj.items():
-                //if (self.obj[k] < v):
-            if (!isMultisetObjIncluded(&agent->obj, &required_obj)) {
-                    printd("req_obj fail P%d", prg_nr);
-                    executable = FALSE; // this program is not executable, check another program
-                    continue;
+        // the chosen rule needs it's objects in addition to the ones required by the other rules
+        for (uint8_t side = 0; side < 2; side++)
+            if (requirement[side].target != MULTISET_TARGET_NONE &&
+                    getAgentTargetCount(agent, requirement[side].target, requirement[side].obj) < getConditionalRequiredCount(agent, prg_nr, c, &requirement[side])) {
+                printd("req fail P%d", prg_nr);
+                return FALSE;
             }
+    }
 
-            // if e object is among the required objects in the Pcolony environment
-            //if ('e' in required_env):
-                // ignore this requirement because in theory, there are always enough e objects in the environment
-                //del required_env['e']
-            setObjectCountFromMultisetEnv(&required_env, OBJECT_ID_E, 0);
-            // check that the Pcolony env requirements of the program are met
-            //for k, v in required_env.items():
-                //if (self.colony.env[k] < v):
-            if (!isMultisetEnvIncluded(&agent->pcolony->env, &required_env)) {
-                    printd("req_env fail P%d", prg_nr);
-                    executable = FALSE; // this program is not executable, check another program
-                    continue;
-            }
+    return TRUE;
+}
+
+#ifndef GUARD_TREE
+/**
+ * @brief Check whether a program of an agent is executable and mark the rules that will be executed
+ *
+ * @param agent The agent that owns the program
+ * @param prg_nr The number of the program that is checked
+ *
+ * @return TRUE if the program is executable, FALSE otherwise
+ */
+static bool isProgramExecutable(Agent_t *agent, uint8_t prg_nr) {
+    Program_t *program = getCompiledProgram(agent, prg_nr);
+
+#ifdef MULTISET_PRESENCE
+    //most non-executable programs are rejected here, using only a few word operations
+    if (!isProgramPresenceMaskMet(agent, program))
+        return FALSE;
+#endif
+
+    // check that the requirements of the non-conditional rules are met
+    for (uint8_t i = 0; i < program->nr_requirements; i++)
+        if (getAgentTargetCount(agent, program->requirements[i].target, program->requirements[i].obj) < program->requirements[i].nr) {
+            printd("req fail P%d", prg_nr);
+            return FALSE; // this program is not executable, check another program
+        }
+
+    return areConditionalRequirementsMet(agent, prg_nr);
+}
+#else
+/**
+ * @brief Check whether two requirements are identical (same object, number of copies and multiset)
+ */
+static bool isSameRequirement(requirement_t *a, requirement_t *b) {
+    return a->target == b->target && a->obj == b->obj && a->nr == b->nr;
+}
+
+/**
+ * @brief Count the programs of an agent that have a requirement identical to the one given
+ *
+ * @param agent The agent whose (compiled) programs are searched
+ * @param requirement The requirement that is searched
+ *
+ * @return The number of programs that share this requirement
+ */
+static uint8_t getRequirementUseCount(Agent_t *agent, requirement_t *requirement) {
+    uint8_t count = 0;
 
-            // if e object is among the required objects in the Pswarm global_environment
-            //if ('e' in required_global_env):
-                // ignore this requirement because in theory, there are always enough e objects in the global_environment
-                //del required_global_env['e']
-            setObjectCountFromMultisetEnv(&required_global_env, OBJECT_ID_E, 0);
-            // check that the Pswarm global_env requirements of the program are met
-            //for k, v in required_global_env.items():
-                //if (self.colony.parentSwarm.global_env[k] < v):
-            if (!isMultisetEnvIncluded(&agent->pcolony->pswarm.global_env, &required_global_env)) {
-                    printd("req_global_env fail P%d", prg_nr);
-                    executable = FALSE; // this program is not executable, check another program
-                    continue;
+    for (uint8_t prg_nr = 0; prg_nr < agent->nr_programs; prg_nr++)
+        for (uint8_t i = 0; i < agent->programs[prg_nr].nr_requirements; i++)
+            if (isSameRequirement(&agent->programs[prg_nr].requirements[i], requirement)) {
+                count++;
+                break;
             }
 
-            // if e object is among the required objects in the INPUT Pswarm global_environment
-            //if ('e' in required_in_global_env):
-                // ignore this requirement because in theory, there are always enough e objects in the INPUT global_environment
-                //del required_in_global_env['e']
-            setObjectCountFromMultisetEnv(&required_in_global_env, OBJECT_ID_E, 0);
-            // check that the INPUT Pswarm global_env requirements of the program are met
-            //for k, v in required_in_global_env.items():
-                //if (self.colony.parentSwarm.in_global_env[k] < v):
-            if (!isMultisetEnvIncluded(&agent->pcolony->pswarm.in_global_env, &required_in_global_env)) {
-                    printd("req_in_global_env fail P%d", prg_nr);
-                    executable = FALSE; // this program is not executable, check another program
-                    continue;
+    return count;
+}
+
+/**
+ * @brief Order used for the requirements of the guard tree: the requirements that are shared by more programs are tested first
+ * so that they end up closer to the root of the tree
+ *
+ * @param agent The agent that owns the requirements
+ * @param a The first requirement
+ * @param b The second requirement
+ *
+ * @return A negative value if a is tested before b, 0 if a and b are identical, a positive value otherwise
+ */
+static int16_t compareRequirements(Agent_t *agent, requirement_t *a, requirement_t *b) {
+    if (isSameRequirement(a, b))
+        return 0;
+    if (getRequirementUseCount(agent, a) != getRequirementUseCount(agent, b))
+        return (int16_t) getRequirementUseCount(agent, b) - getRequirementUseCount(agent, a);
+    if (a->target != b->target)
+        return (int16_t) a->target - b->target;
+    if (a->obj != b->obj)
+        return (a->obj < b->obj) ? -1 : 1;
+    return (int16_t) a->nr - b->nr;
+}
+
+/**
+ * @brief Compare the (sorted) requirement lists of two programs lexicographically
+ * A program whose requirements are a prefix of the requirements of the other program is placed first
+ *
+ * @param agent The agent that owns the programs
+ * @param a The first program
+ * @param b The second program
+ *
+ * @return A negative value if a is placed before b, 0 if the requirements are identical, a positive value otherwise
+ */
+static int16_t compareProgramRequirements(Agent_t *agent, Program_t *a, Program_t *b) {
+    for (uint8_t i = 0; i < a->nr_requirements && i < b->nr_requirements; i++) {
+        int16_t result = compareRequirements(agent, &a->requirements[i], &b->requirements[i]);
+        if (result != 0)
+            return result;
+    }
+
+    return (int16_t) a->nr_requirements - b->nr_requirements;
+}
+
+/**
+ * @brief Build the guard tree of an agent
+ * The requirements of each program are sorted and the programs are sorted by their requirement lists, so that programs that share
+ * a prefix of requirements are consecutive. The tree is stored in preorder, with the root (guard_nodes[0]) having no requirement.
+ * The programs whose last requirement is node i are guard_programs[guard_nodes[i].first_program] ... guard_programs[guard_nodes[i].end_program - 1]
+ *
+ * @param agent The agent whose programs are grouped
+ */
+static void buildAgentGuardTree(Agent_t *agent) {
+    uint16_t nr_nodes = 1, max_nr_nodes = 1;
+    uint8_t depth = 0, max_depth = 0;
+    uint16_t *path; // path[d] = node from depth d of the current branch
+    Program_t *program, *previous = NULL;
+
+    for (uint8_t prg_nr = 0; prg_nr < agent->nr_programs; prg_nr++) {
+        program = &agent->programs[prg_nr];
+        if (!program->compiled)
+            compileProgram(program, agent->pcolony);
+        max_nr_nodes += program->nr_requirements;
+        if (program->nr_requirements > max_depth)
+            max_depth = program->nr_requirements;
+    }
+
+    //sort the requirements of each program (insertion sort, the lists are short)
+    for (uint8_t prg_nr = 0; prg_nr < agent->nr_programs; prg_nr++) {
+        program = &agent->programs[prg_nr];
+        for (uint8_t i = 1; i < program->nr_requirements; i++) {
+            requirement_t requirement = program->requirements[i];
+            uint8_t j = i;
+
+            for (; j > 0 && compareRequirements(agent, &program->requirements[j - 1], &requirement) > 0; j--)
+                program->requirements[j] = program->requirements[j - 1];
+            program->requirements[j] = requirement;
+        }
+    }
+
+    //sort the programs by their requirement lists
+    agent->guard_programs = (uint8_t *) LULU_MALLOC(sizeof(uint8_t) * agent->nr_programs);
+    for (uint8_t i = 0; i < agent->nr_programs; i++) {
+        uint8_t j = i;
+
+        for (; j > 0 && compareProgramRequirements(agent, &agent->programs[agent->guard_programs[j - 1]], &agent->programs[i]) > 0; j--)
+            agent->guard_programs[j] = agent->guard_programs[j - 1];
+        agent->guard_programs[j] = i;
+    }
+
+    agent->guard_nodes = (guard_node_t *) LULU_MALLOC(sizeof(guard_node_t) * max_nr_nodes);
+    path = (uint16_t *) LULU_MALLOC(sizeof(uint16_t) * (max_depth + 1));
+    agent->guard_nodes[0].requirement.target = MULTISET_TARGET_NONE;
+    agent->guard_nodes[0].first_program = agent->guard_nodes[0].end_program = 0;
+    path[0] = 0;
+
+    for (uint8_t p = 0; p < agent->nr_programs; p++) {
+        uint8_t common = 0;
+
+        program = &agent->programs[agent->guard_programs[p]];
+        //the nodes of the requirements that are shared with the previous program are reused
+        if (previous != NULL)
+            while (common < depth && common < program->nr_requirements &&
+                    isSameRequirement(&previous->requirements[common], &program->requirements[common]))
+                common++;
+
+        //close the subtrees that are not shared
+        for (; depth > common; depth--)
+            agent->guard_nodes[path[depth]].skip = nr_nodes;
+
+        //add the remaining requirements as a new branch
+        for (; depth < program->nr_requirements; depth++) {
+            guard_node_t *node = &agent->guard_nodes[nr_nodes];
+
+            node->requirement = program->requirements[depth];
+            node->first_program = node->end_program = p;
+            path[depth + 1] = nr_nodes++;
+        }
+
+        //programs with identical requirement lists are consecutive so the programs of a node are consecutive
+        if (agent->guard_nodes[path[depth]].first_program == agent->guard_nodes[path[depth]].end_program)
+            agent->guard_nodes[path[depth]].first_program = p;
+        agent->guard_nodes[path[depth]].end_program = p + 1;
+        previous = program;
+    }
+
+    //close the last branch and the root
+    for (; depth > 0; depth--)
+        agent->guard_nodes[path[depth]].skip = nr_nodes;
+    agent->guard_nodes[0].skip = nr_nodes;
+    agent->nr_guard_nodes = nr_nodes;
+
+    LULU_FREE(path);
+}
+
+/**
+ * @brief Evaluate the guard tree of an agent
+ * Each requirement node is checked once for all of the programs that share it and it's whole subtree is skipped if it fails.
+ * If INCREMENTAL_SELECTION is defined the executable programs are marked (Program_t.executable), otherwise they are offered to
+ * offerExecutableProgram()
+ *
+ * @param agent The agent whose programs are checked
+ * @param nr_executable Number of executable programs found so far (updated)
+ * @param executable_list Passed to offerExecutableProgram()
+ */
+static void checkAgentGuardTree(Agent_t *agent, uint8_t *nr_executable, uint8_t *executable_list) {
+    if (agent->guard_nodes == NULL)
+        buildAgentGuardTree(agent);
+
+    for (uint16_t i = 0; i < agent->nr_guard_nodes;) {
+        guard_node_t *node = &agent->guard_nodes[i];
+
+        if (node->requirement.target != MULTISET_TARGET_NONE &&
+                getAgentTargetCount(agent, node->requirement.target, node->requirement.obj) < node->requirement.nr) {
+            printd("req fail node %d", i);
+            // none of the programs of this subtree are executable
+            i = node->skip;
+            continue;
+        }
+
+        // all of the requirements of the programs of this node are met
+        for (uint8_t p = node->first_program; p < node->end_program; p++)
+            if (areConditionalRequirementsMet(agent, agent->guard_programs[p])) {
+#ifdef INCREMENTAL_SELECTION
+                agent->programs[agent->guard_programs[p]].executable = TRUE;
+#else
+                offerExecutableProgram(agent, agent->guard_programs[p], nr_executable, executable_list);
+#endif
             }
+        i++;
+    }
+}
 
-            // if e object is among the required objects in the OUTPUT Pswarm global_environment
-            //if ('e' in required_out_global_env):
-                // ignore this requirement because in theory, there are always enough e objects in the out_global_environment
-                //del required_out_global_env['e']
-            setObjectCountFromMultisetEnv(&required_out_global_env, OBJECT_ID_E, 0);
-            // check that the Pswarm out_global_env requirements of the program are met
-            //for k, v in required_out_global_env.items():
-                //if (self.colony.parentSwarm.out_global_env[k] < v):
-            if (!isMultisetEnvIncluded(&agent->pcolony->pswarm.out_global_env, &required_out_global_env)) {
-                    printd("req_out_global_env fail P%d", prg_nr);
-                    executable = FALSE; // this program is not executable, check another program
-                    continue;
+void clearAgentGuardTree(Agent_t *agent) {
+    FREE_PCOLONY_BLOCK(agent->pcolony, agent->guard_nodes);
+    FREE_PCOLONY_BLOCK(agent->pcolony, agent->guard_programs);
+    agent->guard_nodes = NULL;
+    agent->guard_programs = NULL;
+    agent->nr_guard_nodes = 0;
+}
+#endif
+
+/**
+ * @brief Check the programs of an agent and offer the executable ones to offerExecutableProgram()
+ *
+ * @param agent The agent whose programs are checked
+ * @param executable_list Passed to offerExecutableProgram()
+ *
+ * @return The number of executable programs
+ */
+static uint8_t checkAgentPrograms(Agent_t *agent, uint8_t *executable_list) {
+    uint8_t nr_executable = 0;
+
+#if defined(GUARD_TREE) && defined(INCREMENTAL_SELECTION)
+    //the guard tree checks all of the programs of the agent at once, so it is evaluated again if any of them is dirty
+    for (uint8_t prg_nr = 0; prg_nr < agent->nr_programs; prg_nr++)
+        if (agent->programs[prg_nr].dirty) {
+            for (uint8_t i = 0; i < agent->nr_programs; i++) {
+                agent->programs[i].executable = FALSE;
+                agent->programs[i].dirty = FALSE;
             }
+            checkAgentGuardTree(agent, &nr_executable, executable_list);
+            break;
         }
+#elif defined(GUARD_TREE)
+    checkAgentGuardTree(agent, &nr_executable, executable_list);
+#endif
 
-        if (executable) {
-            // if we reach this step then this program is executable
-            //possiblePrograms.append(nr)
-            possiblePrograms[prg_nr] = TRUE;
-            last_chosen_prg_nr = prg_nr;
-            chosen_prg_count++;
+#if !defined(GUARD_TREE) || defined(INCREMENTAL_SELECTION)
+    for (uint8_t prg_nr = 0; prg_nr < agent->nr_programs; prg_nr++) {
+#if defined(GUARD_TREE)
+        if (agent->programs[prg_nr].executable)
+#elif defined(INCREMENTAL_SELECTION)
+        Program_t *program = &agent->programs[prg_nr];
+
+        //the result of the previous check is still valid if none of the objects used by the program have changed since then
+        if (program->dirty) {
+            program->executable = isProgramExecutable(agent, prg_nr);
+            program->dirty = FALSE;
         }
+        if (program->executable)
+#else
+        if (isProgramExecutable(agent, prg_nr))
+#endif
+            // if we reach this step then this program is executable
+            offerExecutableProgram(agent, prg_nr, &nr_executable, executable_list);
     }//end for program
+#endif
+
+    return nr_executable;
+}
 
-    //printd("possiblePrograms = %s" % possiblePrograms);
-    // if there is only 1 executable program
-    //if (len(possiblePrograms) == 1):
-    if (chosen_prg_count == 1) {
-        //self.chosenProgramNr = possiblePrograms[0];
-        agent->chosenProgramNr = last_chosen_prg_nr;
-        printd("chosen_prg=%d", agent->chosenProgramNr);
-
-        //release dinamically allocated variables
-        destroyMultisetObj(&required_obj);
-        destroyMultisetEnv(&required_env);
-        destroyMultisetEnv(&required_global_env);
-        destroyMultisetEnv(&required_in_global_env);
-        destroyMultisetEnv(&required_out_global_env);
+bool agent_choseProgram(Agent_t *agent) {
+    uint8_t nr_executable;
+
+    agent->chosenProgramNr = NO_PROGRAM; // no program chosen yet
+    nr_executable = checkAgentPrograms(agent, NULL);
 
+    if (nr_executable > 0) {
+        printd("chosen_prg=%d (nr_executable=%d)", agent->chosenProgramNr, nr_executable);
         return TRUE; // this agent has an executable program
     }
-    // there is more than 1 executable program
-    //elif (len(possiblePrograms) > 1)
-    else if (chosen_prg_count > 1) {
-        //define and construct a reduced array that contains the numbers of the executable programs
-        uint8_t aux[chosen_prg_count];
-        uint8_t c = 0, rand_value = 0;
-
-        printd("possiblePrgs(nr=%d)=", chosen_prg_count);
-        for (int p = 0; p < agent->nr_programs; p++)
-            // if program p was previously marked as executable
-            if (possiblePrograms[p]) {
-                printd("  %d", p);
-                aux[c++] = p; //store the program number in the aux array
+
+    printd("no exec prg");
+
+    return FALSE;
+}
+
+/**
+ * @brief Apply a list of delta operations to the multisets accessed by an agent
+ * The operations are not checked because agent_choseProgram() has already checked that the program is executable
+ * (unless LULU_CHECK_EXEC is defined), only count saturation and full multisets are reported
+ *
+ * @param agent The agent that executes the operations
+ * @param ops The operations (negative deltas first)
+ * @param nr_ops The number of operations
+ *
+ * @return TRUE if all of the operations were applied, FALSE otherwise
+ */
+static bool applyDeltaOps(Agent_t *agent, delta_op_t *ops, uint8_t nr_ops) {
+    for (uint8_t i = 0; i < nr_ops; i++) {
+        delta_op_t *op = &ops[i];
+
+        if (op->target == MULTISET_TARGET_OBJ) {
+            uint8_t count = getObjectCountFromMultisetObj(&agent->obj, op->obj);
+
+#ifdef LULU_CHECK_EXEC
+            if (op->delta < 0 && count < -op->delta) {
+                // this is an error, there was a bug in choseProgram() that shouldn't have chosen this program
+                printe(execErrMsgs[MULTISET_TARGET_OBJ], op->obj);
+                return FALSE;
             }
+#endif
+            if (!setObjectCountFromMultisetObj(&agent->obj, op->obj, count + op->delta)) {
+                printe(execErrMsgs[MULTISET_TARGET_NONE + MULTISET_TARGET_OBJ], op->obj);
+                return FALSE;
+            }
+        }
+        else {
+            multiset_env_t *env = getAgentTargetEnv(agent, op->target);
+            multiset_count_t count = getObjectCountFromMultisetEnv(env, op->obj);
 
-        //rand_value = random.randint(0, len(possiblePrograms) - 1)
-        #ifndef KILOBOT
-            //use rand() from stdlib.h
-            //rand_value in [0; chosen_prg_count-1] interval
-            rand_value = rand() % chosen_prg_count;
-        #else
-            //use rand_soft from kilolib.h
-            //rand_value in [0; chosen_prg_count-1] interval
-            rand_value = rand_soft() % chosen_prg_count;
-        #endif
-        //self.chosenProgramNr = possiblePrograms[rand_value];
-        agent->chosenProgramNr = aux[rand_value];
-        printd("rand_chosen_prg=%d", agent->chosenProgramNr);
-
-        //release dinamically allocated variables
-        destroyMultisetObj(&required_obj);
-        destroyMultisetEnv(&required_env);
-        destroyMultisetEnv(&required_global_env);
-        destroyMultisetEnv(&required_in_global_env);
-        destroyMultisetEnv(&required_out_global_env);
+#ifdef LULU_CHECK_EXEC
+            if (op->delta < 0 && count < (multiset_count_t) -op->delta) {
+                // this is an error, some other agent modified the environment
+                printe(execErrMsgs[op->target], op->obj);
+                return FALSE;
+            }
+#endif
+            if (op->delta > 0 && count > MULTISET_COUNT_MAX - op->delta) {
+                printw("Count of object %d saturated at %lu, rebuild with a larger MULTISET_COUNT_BITS", op->obj, (unsigned long) count);
+                return FALSE;
+            }
+            if (!setObjectCountFromMultisetEnv(env, op->obj, count + op->delta)) {
+                // the environment is full
+                printe(execErrMsgs[MULTISET_TARGET_NONE + op->target], op->obj);
+                return FALSE;
+            }
+        }
+    }
 
-        return TRUE; // this agent has an executable program
+    return TRUE;
+}
+
+/**
+ * @brief Get the delta operations of a program that are applied by agent_executeProgram()
+ * List 0 holds the merged non-conditional rules, list c + 1 the alternative of conditional c that was chosen by agent_choseProgram()
+ *
+ * @param agent The agent that has chosen the program
+ * @param program The chosen program
+ * @param list_nr The number of the list (0 ... nr_conditionals)
+ * @param nr_ops Will store the number of operations of the list
+ *
+ * @return The operations of the list
+ */
+static delta_op_t* getExecutedOps(Agent_t *agent, Program_t *program, uint8_t list_nr, uint8_t *nr_ops) {
+    conditional_requirement_t *conditional;
+    uint8_t option;
+
+    if (list_nr == 0) {
+        *nr_ops = program->nr_ops;
+        return program->ops;
+    }
+
+    conditional = &program->conditionals[list_nr - 1];
+    option = getChosenAlternative(agent, agent->chosenProgramNr, list_nr - 1);
+    *nr_ops = conditional->nr_ops[option];
+    return conditional->ops[option];
+}
+
+#ifdef CONCURRENT_ENVS
+    //the operation consumes objects from a global environment (which can be consumed by other processes at the same time)
+    #define IS_SHARED_CONSUMPTION(op) ((op)->target >= MULTISET_TARGET_GLOBAL_ENV && (op)->delta < 0)
+
+/**
+ * @brief Record the change made by an atomic update of the count of an object of a shared dense environment
+ * The hash and the changed bits are exact because xor and or commute. The id and the presence bit are only changed when the object
+ * appears or disappears, but concurrent changes of the same object can store them in any order (see syncSharedMultisetEnv())
+ *
+ * @param multiset The shared environment multiset
+ * @param obj The object
+ * @param count The count replaced by the atomic update
+ * @param newCount The count stored by the atomic update
+ */
+static void recordSharedObjectChange(multiset_env_t *multiset, object_id_t obj, multiset_count_t count, multiset_count_t newCount) {
+#ifdef MULTISET_PRESENCE
+    presence_word_t bit = ((presence_word_t) 1) << (obj % PRESENCE_WORD_BITS);
+#endif
+
+    if ((count == 0) != (newCount == 0)) {
+        __atomic_store_n(&multiset->items[obj].id, (newCount > 0) ? obj : NO_OBJECT, __ATOMIC_RELAXED);
+#ifdef MULTISET_PRESENCE
+        if (newCount > 0)
+            __atomic_fetch_or(&multiset->presence[obj / PRESENCE_WORD_BITS], bit, __ATOMIC_RELAXED);
+        else
+            __atomic_fetch_and(&multiset->presence[obj / PRESENCE_WORD_BITS], ~bit, __ATOMIC_RELAXED);
+#endif
+    }
+#ifdef INCREMENTAL_SELECTION
+    __atomic_fetch_or(&multiset->changed[obj / PRESENCE_WORD_BITS], bit, __ATOMIC_RELAXED);
+#endif
+#ifdef CONFIG_HASH
+    __atomic_fetch_xor(&multiset->hash, getObjectHashKey(obj, count) ^ getObjectHashKey(obj, newCount), __ATOMIC_RELAXED);
+#endif
+}
+
+/**
+ * @brief Atomically take nr copies of an object from a shared dense environment (compare-and-decrement)
+ *
+ * @param multiset The shared environment multiset
+ * @param obj The object
+ * @param nr The number of copies
+ *
+ * @return TRUE if the copies were taken, FALSE if there are less than nr copies (the multiset is not modified)
+ */
+static bool takeSharedObjects(multiset_env_t *multiset, object_id_t obj, multiset_count_t nr) {
+    multiset_count_t count = __atomic_load_n(&multiset->items[obj].nr, __ATOMIC_RELAXED);
+
+    do {
+        if (count < nr)
+            return FALSE;
+    } while (!__atomic_compare_exchange_n(&multiset->items[obj].nr, &count, count - nr, TRUE, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    recordSharedObjectChange(multiset, obj, count, count - nr);
+
+    return TRUE;
+}
+
+/**
+ * @brief Atomically add nr copies of an object to a shared dense environment
+ *
+ * @param multiset The shared environment multiset
+ * @param obj The object
+ * @param nr The number of copies
+ *
+ * @return TRUE if the copies were added, FALSE if the count would saturate (the multiset is not modified)
+ */
+static bool putSharedObjects(multiset_env_t *multiset, object_id_t obj, multiset_count_t nr) {
+    multiset_count_t count = __atomic_load_n(&multiset->items[obj].nr, __ATOMIC_RELAXED);
+
+    do {
+        if (count > MULTISET_COUNT_MAX - nr) {
+            printw("Count of object %d saturated at %lu, rebuild with a larger MULTISET_COUNT_BITS", obj, (unsigned long) count);
+            return FALSE;
+        }
+    } while (!__atomic_compare_exchange_n(&multiset->items[obj].nr, &count, count + nr, TRUE, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED));
+    recordSharedObjectChange(multiset, obj, count, count + nr);
+
+    return TRUE;
+}
+
+/**
+ * @brief Take the global objects consumed by the chosen program of an agent, in the order in which they are executed
+ *
+ * @param agent The agent
+ * @param program The chosen program
+ * @param nr_taken Will store the number of consumptions that were made
+ *
+ * @return TRUE if all of the consumptions were made, FALSE if another process has consumed one of the objects first
+ */
+static bool takeSharedConsumptions(Agent_t *agent, Program_t *program, uint16_t *nr_taken) {
+    *nr_taken = 0;
+    for (uint8_t list_nr = 0; list_nr <= program->nr_conditionals; list_nr++) {
+        uint8_t nr_ops;
+        delta_op_t *ops = getExecutedOps(agent, program, list_nr, &nr_ops);
+
+        for (uint8_t i = 0; i < nr_ops; i++) {
+            if (!IS_SHARED_CONSUMPTION(&ops[i]))
+                continue;
+            if (!takeSharedObjects(getAgentTargetEnv(agent, ops[i].target), ops[i].obj, (multiset_count_t) -ops[i].delta))
+                return FALSE;
+            (*nr_taken)++;
+        }
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief Put back the first nr_taken global objects taken by takeSharedConsumptions()
+ *
+ * @param agent The agent
+ * @param program The chosen program
+ * @param nr_taken The number of consumptions that are undone
+ */
+static void returnSharedConsumptions(Agent_t *agent, Program_t *program, uint16_t nr_taken) {
+    for (uint8_t list_nr = 0; list_nr <= program->nr_conditionals && nr_taken > 0; list_nr++) {
+        uint8_t nr_ops;
+        delta_op_t *ops = getExecutedOps(agent, program, list_nr, &nr_ops);
+
+        for (uint8_t i = 0; i < nr_ops && nr_taken > 0; i++)
+            if (IS_SHARED_CONSUMPTION(&ops[i])) {
+                //the count cannot saturate because the objects were taken from it
+                putSharedObjects(getAgentTargetEnv(agent, ops[i].target), ops[i].obj, (multiset_count_t) -ops[i].delta);
+                nr_taken--;
+            }
+    }
+}
+
+/**
+ * @brief Execute the chosen program of an agent whose global environments are updated by other processes at the same time
+ * The global consumptions are made first with atomic compare-and-decrement operations. If one of them fails, the objects taken so far
+ * are put back and nothing else is modified, so the program is rolled back without any lock. Otherwise the remaining operations are
+ * applied, the productions of global objects as atomic adds.
+ *
+ * @param agent The agent
+ * @param program The chosen program
+ *
+ * @return TRUE if the program was executed or rolled back, FALSE on errors
+ */
+static bool executeConcurrentProgram(Agent_t *agent, Program_t *program) {
+    Pswarm_t *swarm = agent->pcolony->swarm;
+    uint16_t nr_taken;
+
+    if (!takeSharedConsumptions(agent, program, &nr_taken)) {
+        returnSharedConsumptions(agent, program, nr_taken);
+        __atomic_fetch_add(&swarm->nr_rollbacks, 1, __ATOMIC_RELAXED);
+        printi("Rolled back P%d, a global object was consumed by another process", agent->chosenProgramNr);
+        return TRUE;
+    }
+
+    for (uint8_t list_nr = 0; list_nr <= program->nr_conditionals; list_nr++) {
+        uint8_t nr_ops;
+        delta_op_t *ops = getExecutedOps(agent, program, list_nr, &nr_ops);
+
+        for (uint8_t i = 0; i < nr_ops; i++) {
+            if (IS_SHARED_CONSUMPTION(&ops[i]))
+                continue; //already made
+            if (ops[i].target >= MULTISET_TARGET_GLOBAL_ENV) {
+                if (!putSharedObjects(getAgentTargetEnv(agent, ops[i].target), ops[i].obj, (multiset_count_t) ops[i].delta))
+                    return FALSE;
+            }
+            else if (!applyDeltaOps(agent, &ops[i], 1))
+                return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+void syncSharedMultisetEnv(multiset_env_t *multiset) {
+    for (object_id_t i = 0; i < multiset->size; i++) {
+        multiset->items[i].id = (multiset->items[i].nr > 0) ? i : NO_OBJECT;
+#ifdef MULTISET_PRESENCE
+        setPresenceBit(multiset->presence, i, multiset->items[i].nr > 0);
+#endif
+    }
+}
+#endif
+
+bool agent_executeProgram(Agent_t *agent) {
+    Program_t *program;
+
+    if (agent->chosenProgramNr == NO_PROGRAM)
+        return FALSE;
+
+    //the agent may have checked other programs after it's chosen program
+    program = getCompiledProgram(agent, agent->chosenProgramNr);
+#ifdef CONCURRENT_ENVS
+    if (agent->pcolony->swarm->concurrent)
+        return executeConcurrentProgram(agent, program);
+#endif
+    //the non-conditional rules are executed together, with identical objects merged and identity rules (e.g. e->e) removed (list 0)
+    //each conditional rule executes the alternative that was chosen by agent_choseProgram() (lists 1 ... nr_conditionals)
+    for (uint8_t list_nr = 0; list_nr <= program->nr_conditionals; list_nr++) {
+        uint8_t nr_ops;
+        delta_op_t *ops = getExecutedOps(agent, program, list_nr, &nr_ops);
+
+        if (!applyDeltaOps(agent, ops, nr_ops))
+            return FALSE;
+    }
+
+    // rule execution finished succesfully
+    return TRUE;
+}
+
+#ifdef INCREMENTAL_SELECTION
+/**
+ * @brief Call a function for each object of a program that can influence whether the program is executable
+ * (the objects of the requirements and of both alternatives of conditional rules)
+ *
+ * @param program A compiled program
+ * @param visit The function that is called for each (target, obj) pair
+ * @param pcol The P colony of the program
+ * @param ref The reference of the program (passed to visit)
+ */
+static void visitProgramDependencies(Program_t *program, void (*visit)(Pcolony_t*, multiset_target_t, object_id_t, program_ref_t),
+        Pcolony_t *pcol, program_ref_t ref) {
+    for (uint8_t i = 0; i < program->nr_requirements; i++)
+        visit(pcol, program->requirements[i].target, program->requirements[i].obj, ref);
+
+    for (uint8_t c = 0; c < program->nr_conditionals; c++)
+        for (uint8_t side = 0; side < 2; side++) {
+            if (program->conditionals[c].first[side].target != MULTISET_TARGET_NONE)
+                visit(pcol, program->conditionals[c].first[side].target, program->conditionals[c].first[side].obj, ref);
+            if (program->conditionals[c].second[side].target != MULTISET_TARGET_NONE)
+                visit(pcol, program->conditionals[c].second[side].target, program->conditionals[c].second[side].obj, ref);
+        }
+}
+
+//first pass of the index construction: count the programs that depend on each (target, obj) pair
+static void countDependency(Pcolony_t *pcol, multiset_target_t target, object_id_t obj, program_ref_t ref) {
+    (void) ref;
+    pcol->dependency_start[target * pcol->nr_A + obj + 1]++;
+}
+
+//second pass of the index construction: store the program in the slot of the (target, obj) pair
+static void storeDependency(Pcolony_t *pcol, multiset_target_t target, object_id_t obj, program_ref_t ref) {
+    pcol->dependent_programs[pcol->dependency_start[target * pcol->nr_A + obj]++] = ref;
+}
+
+/**
+ * @brief Build the object -> program dependency index of a P colony
+ * A program that uses the same object several times may appear several times in the list of that object
+ *
+ * @param pcol The P colony whose programs are indexed
+ */
+static void buildPcolonyDependencyIndex(Pcolony_t *pcol) {
+    uint32_t nr_keys = (uint32_t) MULTISET_TARGET_NONE * pcol->nr_A;
+    program_ref_t ref;
+
+    pcol->dependency_start = (uint32_t *) LULU_MALLOC(sizeof(uint32_t) * (nr_keys + 1));
+    for (uint32_t key = 0; key <= nr_keys; key++)
+        pcol->dependency_start[key] = 0;
+
+    for (ref.agent_nr = 0; ref.agent_nr < pcol->nr_agents; ref.agent_nr++)
+        for (ref.program_nr = 0; ref.program_nr < pcol->agents[ref.agent_nr].nr_programs; ref.program_nr++) {
+            Program_t *program = &pcol->agents[ref.agent_nr].programs[ref.program_nr];
+
+            if (!program->compiled)
+                compileProgram(program, pcol);
+            visitProgramDependencies(program, countDependency, pcol, ref);
+        }
+
+    //dependency_start[key + 1] = number of dependencies of key -> start of key + 1
+    for (uint32_t key = 0; key < nr_keys; key++)
+        pcol->dependency_start[key + 1] += pcol->dependency_start[key];
+
+    pcol->dependent_programs = (program_ref_t *) LULU_MALLOC(sizeof(program_ref_t) * pcol->dependency_start[nr_keys]);
+    //storeDependency() uses dependency_start[key] as the next free slot of key, so it will be advanced to the start of key + 1
+    for (ref.agent_nr = 0; ref.agent_nr < pcol->nr_agents; ref.agent_nr++)
+        for (ref.program_nr = 0; ref.program_nr < pcol->agents[ref.agent_nr].nr_programs; ref.program_nr++)
+            visitProgramDependencies(&pcol->agents[ref.agent_nr].programs[ref.program_nr], storeDependency, pcol, ref);
+
+    //shift the starts back to their original position
+    for (uint32_t key = nr_keys; key > 0; key--)
+        pcol->dependency_start[key] = pcol->dependency_start[key - 1];
+    pcol->dependency_start[0] = 0;
+}
+
+/**
+ * @brief Mark as dirty the programs that use any of the changed objects of a multiset and clear the changed bitset
+ *
+ * @param pcol The P colony
+ * @param target The multiset that contains the changed objects
+ * @param changed The bitset of changed objects of the multiset
+ * @param agent_nr For MULTISET_TARGET_OBJ, only the programs of this agent are marked (ignored for environments)
+ * @param clear If FALSE the bitset is not cleared (the multiset is shared with the colonies of a swarm)
+ */
+static void markDependentPrograms(Pcolony_t *pcol, multiset_target_t target, presence_word_t *changed, uint8_t agent_nr, bool clear) {
+    uint32_t *start = &pcol->dependency_start[target * pcol->nr_A];
+
+    for (object_id_t word = 0; word < PRESENCE_NR_WORDS(pcol->nr_A); word++) {
+        if (changed[word] == 0)
+            continue;
+        for (uint8_t bit = 0; bit < PRESENCE_WORD_BITS; bit++) {
+            object_id_t obj = word * PRESENCE_WORD_BITS + bit;
+
+            if (((changed[word] >> bit) & 1) == 0 || obj >= pcol->nr_A)
+                continue;
+            for (uint32_t i = start[obj]; i < start[obj + 1]; i++)
+                if (target != MULTISET_TARGET_OBJ || pcol->dependent_programs[i].agent_nr == agent_nr)
+                    pcol->agents[pcol->dependent_programs[i].agent_nr].programs[pcol->dependent_programs[i].program_nr].dirty = TRUE;
+        }
+        if (clear)
+            changed[word] = 0;
+    }
+}
+
+/**
+ * @brief Mark as dirty all of the programs that use objects that have changed since the previous simulation step
+ *
+ * @param pcol The P colony
+ */
+static void updateDirtyPrograms(Pcolony_t *pcol) {
+    if (pcol->dependency_start == NULL)
+        buildPcolonyDependencyIndex(pcol);
+
+    markDependentPrograms(pcol, MULTISET_TARGET_ENV, pcol->env.changed, 0, TRUE);
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++)
+        markDependentPrograms(pcol, MULTISET_TARGET_OBJ, pcol->agents[agent_nr].obj.changed, agent_nr, TRUE);
+#ifdef CONCURRENT_ENVS
+    //the changes of global environments that are updated concurrently are delivered by pcolony_markChangedObjects() (see swarm_process.c)
+    if (pcol->swarm->concurrent)
+        return;
+#endif
+    markDependentPrograms(pcol, MULTISET_TARGET_GLOBAL_ENV, pcol->swarm->global_env.changed, 0, TRUE);
+    markDependentPrograms(pcol, MULTISET_TARGET_IN_GLOBAL_ENV, pcol->swarm->in_global_env.changed, 0, TRUE);
+    markDependentPrograms(pcol, MULTISET_TARGET_OUT_GLOBAL_ENV, pcol->swarm->out_global_env.changed, 0, TRUE);
+}
+
+/**
+ * @brief Mark as dirty the programs of all colonies of a swarm that use objects of the global environments that have changed
+ * The changes are cleared afterwards, so they have to be propagated after each colony step
+ * (otherwise the next colony would clear them while updating only it's own programs)
+ *
+ * @param pswarm The swarm
+ */
+static void markSwarmDependentPrograms(Pswarm_t *pswarm) {
+    multiset_env_t *envs[] = {&pswarm->global_env, &pswarm->in_global_env, &pswarm->out_global_env};
+
+    for (uint8_t i = 0; i < 3; i++) {
+        for (uint16_t colony_nr = 0; colony_nr < pswarm->nr_colonies; colony_nr++)
+            pcolony_markChangedObjects(&pswarm->colonies[colony_nr], MULTISET_TARGET_GLOBAL_ENV + i, envs[i]->changed);
+        for (object_id_t word = 0; word < PRESENCE_NR_WORDS(envs[i]->size); word++)
+            envs[i]->changed[word] = 0;
+    }
+}
+
+void pcolony_markChangedObjects(Pcolony_t *pcol, multiset_target_t target, presence_word_t *changed) {
+    //the programs of a colony without dependency index are all dirty
+    if (pcol->dependency_start != NULL)
+        markDependentPrograms(pcol, target, changed, 0, FALSE);
+}
+
+void clearPcolonyDependencyIndex(Pcolony_t *pcol) {
+    FREE_PCOLONY_BLOCK(pcol, pcol->dependency_start);
+    FREE_PCOLONY_BLOCK(pcol, pcol->dependent_programs);
+    pcol->dependency_start = NULL;
+    pcol->dependent_programs = NULL;
+
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++)
+        for (uint8_t program_nr = 0; program_nr < pcol->agents[agent_nr].nr_programs; program_nr++)
+            pcol->agents[agent_nr].programs[program_nr].dirty = TRUE;
+}
+#endif
+
+/**
+ * @brief Reserve copies of an object from an environment for the agent that is currently choosing a program
+ *
+ * @param pcol The P colony
+ * @param target The environment (any target except MULTISET_TARGET_OBJ)
+ * @param obj The reserved object
+ * @param nr The number of reserved copies
+ */
+static void reserveObject(Pcolony_t *pcol, multiset_target_t target, object_id_t obj, multiset_count_t nr) {
+    uint16_t i = 0;
+
+    for (; i < pcol->nr_reservations; i++)
+        if (pcol->reservations[i].obj == obj && pcol->reservations[i].target == target)
+            break;
+    //each rule reserves at most one object, so there is always enough space (see initPcolony())
+    if (i == pcol->nr_reservations) {
+        pcol->reservations[i].obj = obj;
+        pcol->reservations[i].target = target;
+        pcol->reservations[i].nr = 0;
+        pcol->nr_reservations++;
+    }
+    pcol->reservations[i].nr += nr;
+
+#ifdef INCREMENTAL_SELECTION
+    //the programs that use this object have to be checked again by the following agents
+    //(there is no index if the programs are chosen outside of a simulation step, in which case all of them are checked anyway)
+    if (pcol->dependency_start == NULL)
+        return;
+    for (uint32_t d = pcol->dependency_start[target * pcol->nr_A + obj]; d < pcol->dependency_start[target * pcol->nr_A + obj + 1]; d++)
+        pcol->agents[pcol->dependent_programs[d].agent_nr].programs[pcol->dependent_programs[d].program_nr].dirty = TRUE;
+#endif
+}
+
+/**
+ * @brief Remove all of the reservations of a P colony
+ * The programs that were checked while an object was reserved are checked again in the next simulation step
+ * (their result may have depended on the reservation even if the count of the object did not change)
+ *
+ * @param pcol The P colony
+ */
+static void releaseReservations(Pcolony_t *pcol) {
+#ifdef INCREMENTAL_SELECTION
+    for (uint16_t i = 0; i < pcol->nr_reservations; i++) {
+        uint32_t key = pcol->reservations[i].target * pcol->nr_A + pcol->reservations[i].obj;
+
+        for (uint32_t d = pcol->dependency_start[key]; d < pcol->dependency_start[key + 1]; d++)
+            pcol->agents[pcol->dependent_programs[d].agent_nr].programs[pcol->dependent_programs[d].program_nr].dirty = TRUE;
+    }
+#endif
+    pcol->nr_reservations = 0;
+}
+
+/**
+ * @brief Reserve the objects from environments that will be consumed by the chosen program of an agent
+ * e objects are not reserved because they are never consumed from an environment
+ *
+ * @param agent The agent that has chosen a program
+ */
+static void reserveChosenProgramObjects(Agent_t *agent) {
+    Program_t *program = getCompiledProgram(agent, agent->chosenProgramNr);
+    requirement_t *requirement;
+
+    for (uint8_t i = 0; i < program->nr_requirements; i++)
+        if (program->requirements[i].target != MULTISET_TARGET_OBJ && program->requirements[i].obj != OBJECT_ID_E)
+            reserveObject(agent->pcolony, program->requirements[i].target, program->requirements[i].obj, program->requirements[i].nr);
+
+    for (uint8_t c = 0; c < program->nr_conditionals; c++) {
+        requirement = (getChosenAlternative(agent, agent->chosenProgramNr, c) == 0)? program->conditionals[c].first : program->conditionals[c].second;
+        if (requirement[1].target != MULTISET_TARGET_NONE && requirement[1].obj != OBJECT_ID_E)
+            reserveObject(agent->pcolony, requirement[1].target, requirement[1].obj, 1);
+    }
+}
+
+/**
+ * @brief Set the order in which the agents choose their programs in the current step (Pcolony.agent_order)
+ *
+ * @param pcol The P colony
+ */
+static void orderAgents(Pcolony_t *pcol) {
+    for (uint8_t i = 0; i < pcol->nr_agents; i++)
+        pcol->agent_order[i] = i;
+
+    if (!pcol->random_agent_order)
+        return;
+
+    //Fisher-Yates shuffle
+    for (uint8_t i = pcol->nr_agents; i > 1; i--) {
+        uint8_t j = pcolony_rand(pcol) % i;
+        uint8_t aux = pcol->agent_order[i - 1];
+
+        pcol->agent_order[i - 1] = pcol->agent_order[j];
+        pcol->agent_order[j] = aux;
+    }
+}
+
+#ifdef LULU_THREADS
+/**
+ * @brief Worker pool that runs the same job on nr_threads threads (used by pcolony_runSimulationStep() to check the programs
+ * of the agents in parallel and by ensembles to step their replicas in parallel)
+ * The calling thread is worker 0, so nr_threads - 1 threads are created
+ */
+typedef struct _worker {
+    thread_pool_t *pool;
+    uint8_t worker_nr;
+} worker_t;
+
+struct _thread_pool {
+    thread_job_t job; // function run by each worker in each phase
+    void *context; // argument of job
+    uint8_t nr_threads;
+    pthread_t *threads;
+    worker_t *workers; // argument of each thread
+    pthread_mutex_t mutex;
+    pthread_cond_t start, // signaled when a new phase starts (generation is incremented)
+                   done; // signaled when the last worker has finished the current phase
+    uint32_t generation; // nr of the current phase
+    uint8_t nr_busy; // nr of threads that have not finished the current phase
+    bool stop; // the threads have to exit
+};
+
+/**
+ * @brief Check the programs of the agents assigned to one worker (agents worker_nr, worker_nr + nr_threads, ...)
+ * The executable programs of each agent are stored in Agent.executable_programs without making a choice,
+ * so that no random numbers are used outside of the calling thread
+ *
+ * @param context The P colony
+ * @param worker_nr The number of the worker
+ * @param nr_threads The number of workers
+ */
+static void checkWorkerAgents(void *context, uint8_t worker_nr, uint8_t nr_threads) {
+    Pcolony_t *pcol = (Pcolony_t *) context;
+
+    for (uint16_t agent_nr = worker_nr; agent_nr < pcol->nr_agents; agent_nr += nr_threads) {
+        Agent_t *agent = &pcol->agents[agent_nr];
+
+        agent->nr_executable_programs = checkAgentPrograms(agent, agent->executable_programs);
+    }
+}
+
+static void *poolWorker(void *arg) {
+    thread_pool_t *pool = ((worker_t *) arg)->pool;
+    uint8_t worker_nr = ((worker_t *) arg)->worker_nr;
+    uint32_t generation = 0;
+
+    while (1) {
+        pthread_mutex_lock(&pool->mutex);
+        while (pool->generation == generation && !pool->stop)
+            pthread_cond_wait(&pool->start, &pool->mutex);
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->mutex);
+            return NULL;
+        }
+        generation = pool->generation;
+        pthread_mutex_unlock(&pool->mutex);
+
+        pool->job(pool->context, worker_nr, pool->nr_threads);
+
+        pthread_mutex_lock(&pool->mutex);
+        if (--pool->nr_busy == 0)
+            pthread_cond_signal(&pool->done);
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+void runThreadPool(thread_pool_t *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->nr_busy = pool->nr_threads - 1;
+    pool->generation++;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    pool->job(pool->context, 0, pool->nr_threads);
+
+    pthread_mutex_lock(&pool->mutex);
+    while (pool->nr_busy > 0)
+        pthread_cond_wait(&pool->done, &pool->mutex);
+    pthread_mutex_unlock(&pool->mutex);
+}
+
+/**
+ * @brief Check whether any of the objects that an agent takes from environments is reserved
+ *
+ * @param agent The agent (all of it's programs have to be compiled)
+ *
+ * @return TRUE if the programs of the agent have to be checked again taking into account the reservations
+ */
+static bool isAgentAffectedByReservations(Agent_t *agent) {
+    if (agent->pcolony->nr_reservations == 0)
+        return FALSE;
+
+    for (uint8_t prg_nr = 0; prg_nr < agent->nr_programs; prg_nr++) {
+        Program_t *program = &agent->programs[prg_nr];
+
+        for (uint8_t i = 0; i < program->nr_requirements; i++)
+            if (program->requirements[i].target != MULTISET_TARGET_OBJ &&
+                    getReservedCount(agent->pcolony, program->requirements[i].target, program->requirements[i].obj) > 0)
+                return TRUE;
+
+        for (uint8_t c = 0; c < program->nr_conditionals; c++)
+            if ((program->conditionals[c].first[1].target != MULTISET_TARGET_NONE &&
+                        getReservedCount(agent->pcolony, program->conditionals[c].first[1].target, program->conditionals[c].first[1].obj) > 0) ||
+                    (program->conditionals[c].second[1].target != MULTISET_TARGET_NONE &&
+                        getReservedCount(agent->pcolony, program->conditionals[c].second[1].target, program->conditionals[c].second[1].obj) > 0))
+                return TRUE;
+    }
+
+    return FALSE;
+}
+
+/**
+ * @brief Choose a program for an agent using the executable programs found by the worker pool
+ * The random choice is made in the same order and with the same random numbers as agent_choseProgram(), so the result is identical
+ * to the sequential selection. If the reservations of the previous agents affect this agent it's programs are checked again.
+ *
+ * @param agent The agent
+ *
+ * @return TRUE if the agent has chosen a program
+ */
+static bool agent_chosePrecheckedProgram(Agent_t *agent) {
+    uint8_t nr_executable = 0;
+
+    if (isAgentAffectedByReservations(agent))
+        return agent_choseProgram(agent);
+
+    agent->chosenProgramNr = NO_PROGRAM;
+    for (uint8_t i = 0; i < agent->nr_executable_programs; i++)
+        offerExecutableProgram(agent, agent->executable_programs[i], &nr_executable, NULL);
+
+    if (nr_executable > 0) {
+        printd("chosen_prg=%d (nr_executable=%d)", agent->chosenProgramNr, nr_executable);
+        return TRUE;
+    }
+
+    printd("no exec prg");
+
+    return FALSE;
+}
+
+/**
+ * @brief Compile the programs (and build the guard trees) of all agents, so that the workers do not allocate memory
+ *
+ * @param pcol The P colony
+ */
+static void prepareParallelSelection(Pcolony_t *pcol) {
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++) {
+        Agent_t *agent = &pcol->agents[agent_nr];
+
+        for (uint8_t prg_nr = 0; prg_nr < agent->nr_programs; prg_nr++)
+            if (!agent->programs[prg_nr].compiled)
+                compileProgram(&agent->programs[prg_nr], pcol);
+#ifdef GUARD_TREE
+        if (agent->guard_nodes == NULL)
+            buildAgentGuardTree(agent);
+#endif
+    }
+}
+
+void destroyThreadPool(thread_pool_t *pool) {
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = TRUE;
+    pthread_cond_broadcast(&pool->start);
+    pthread_mutex_unlock(&pool->mutex);
+
+    for (uint8_t i = 1; i < pool->nr_threads; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->start);
+    pthread_cond_destroy(&pool->done);
+    LULU_FREE(pool->threads);
+    LULU_FREE(pool->workers);
+    LULU_FREE(pool);
+}
+
+bool createThreadPool(thread_pool_t **pool_ptr, uint8_t nr_threads, thread_job_t job, void *context) {
+    thread_pool_t *pool;
+
+    pool = (thread_pool_t *) LULU_MALLOC(sizeof(thread_pool_t));
+    pool->job = job;
+    pool->context = context;
+    pool->nr_threads = nr_threads;
+    pool->generation = 0;
+    pool->nr_busy = 0;
+    pool->stop = FALSE;
+    pool->threads = (pthread_t *) LULU_MALLOC(sizeof(pthread_t) * nr_threads);
+    pool->workers = (worker_t *) LULU_MALLOC(sizeof(worker_t) * nr_threads);
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->start, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for (uint8_t i = 1; i < nr_threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].worker_nr = i;
+        if (pthread_create(&pool->threads[i], NULL, poolWorker, &pool->workers[i]) != 0) {
+            //use only the threads that were created
+            printe("Could not create thread %d", i);
+            pool->nr_threads = i;
+            break;
+        }
+    }
+
+    *pool_ptr = pool;
+    return pool->nr_threads == nr_threads;
+}
+
+bool pcolony_setThreads(Pcolony_t *pcol, uint8_t nr_threads) {
+    if (pcol->thread_pool != NULL) {
+        destroyThreadPool(pcol->thread_pool);
+        pcol->thread_pool = NULL;
+    }
+    if (nr_threads <= 1)
+        return TRUE;
+
+    return createThreadPool(&pcol->thread_pool, nr_threads, checkWorkerAgents, pcol);
+}
+#endif
+
+#ifdef CONFIG_HASH
+/**
+ * @brief Invalidate all of the entries of the configuration history of a P colony
+ *
+ * @param pcol The P colony
+ */
+static void clearHistory(Pcolony_t *pcol) {
+    pcol->nr_history = 0;
+    //the entries are stamped with a generation, so only a wrap of the generation requires clearing the table
+    if (++pcol->history_generation == 0) {
+        for (uint32_t i = 0; i < pcol->history_size; i++)
+            pcol->history[i].generation = 0;
+        pcol->history_generation = 1;
+    }
+}
+
+/**
+ * @brief Look up the current configuration in the history and add it if it was not visited
+ *
+ * @param pcol The P colony (with the history enabled)
+ *
+ * @return TRUE if the configuration was visited (Pcolony.cycle_start / cycle_period are set), FALSE otherwise
+ */
+static bool isConfigurationRepeated(Pcolony_t *pcol) {
+    config_hash_t hash = pcolony_getHash(pcol);
+    uint32_t mask = pcol->history_size - 1,
+             i = (uint32_t) hash & mask;
+
+    //linear probing
+    for (; pcol->history[i].generation == pcol->history_generation; i = (i + 1) & mask)
+        if (pcol->history[i].hash == hash) {
+            pcol->cycle_start = pcol->history[i].step_nr;
+            pcol->cycle_period = pcol->history_step_nr - pcol->history[i].step_nr;
+            printi("Configuration of step %lu repeated (cycle of period %lu)", (unsigned long) pcol->cycle_start, (unsigned long) pcol->cycle_period);
+            return TRUE;
+        }
+
+    //keep the table at most half full so that probe sequences remain short
+    if (2 * (pcol->nr_history + 1) > pcol->history_size) {
+        clearHistory(pcol);
+        i = (uint32_t) hash & mask;
     }
+    pcol->history[i].hash = hash;
+    pcol->history[i].step_nr = pcol->history_step_nr;
+    pcol->history[i].generation = pcol->history_generation;
+    pcol->nr_history++;
 
-    agent->chosenProgramNr = -1; // no program can be executed
-    printd("no exec prg");
+    return FALSE;
+}
 
-    //release dinamically allocated variables
-    destroyMultisetObj(&required_obj);
-    destroyMultisetEnv(&required_env);
-    destroyMultisetEnv(&required_global_env);
-    destroyMultisetEnv(&required_in_global_env);
-    destroyMultisetEnv(&required_out_global_env);
+config_hash_t pcolony_getHash(Pcolony_t *pcol) {
+    //each multiset hash is mixed with it's position, so that moving objects between multisets changes the hash
+    config_hash_t hash = mixHash(pcol->env.hash) ^
+        mixHash(pcol->swarm->global_env.hash + 1) ^
+        mixHash(pcol->swarm->in_global_env.hash + 2) ^
+        mixHash(pcol->swarm->out_global_env.hash + 3);
 
-    return FALSE;
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++)
+        hash ^= mixHash(pcol->agents[agent_nr].obj.hash + 4 + agent_nr);
+
+    return hash;
 }
 
-bool agent_executeProgram(Agent_t *agent) {
-    Program_t *program;
-    Rule_t *rule;
+void pcolony_setHistorySize(Pcolony_t *pcol, uint32_t size) {
+    uint32_t history_size = 0;
+
+    if (size > 0)
+        for (history_size = 2; history_size < size; history_size <<= 1);
+
+    FREE_PCOLONY_BLOCK(pcol, pcol->history);
+    pcol->history = (history_size > 0) ? (history_entry_t *) LULU_MALLOC(sizeof(history_entry_t) * history_size) : NULL;
+    pcol->history_size = history_size;
+    for (uint32_t i = 0; i < history_size; i++)
+        pcol->history[i].generation = 0;
+    pcol->history_generation = 1;
+    pcol->nr_history = 0;
+    pcol->history_step_nr = 0;
+    pcol->cycle_start = 0;
+    pcol->cycle_period = 0;
+}
+#endif
 
-    if (agent->chosenProgramNr < 0)
-        return FALSE;
+#ifdef STEP_LEAPING
+/**
+ * @brief Add a change of the count of an object to the scratch space of a leap
+ *
+ * @param pcol The P colony
+ * @param key target * nr_A + obj
+ * @param delta The change of the count
+ * @param nr_keys Number of keys stored in Pcolony.leap_keys (updated)
+ */
+static void addLeapDelta(Pcolony_t *pcol, uint32_t key, int32_t delta, uint32_t *nr_keys) {
+    if (pcol->leap_deltas[key] == 0)
+        pcol->leap_keys[(*nr_keys)++] = key;
+    pcol->leap_deltas[key] += delta;
+}
 
-    program = &agent->programs[agent->chosenProgramNr];
-    for (uint8_t rule_nr = 0; rule_nr < program->nr_rules; rule_nr++) {
-        rule = &program->rules[rule_nr];
-        // if this is a non-conditional or the first rule of a conditional rule was chosen
-        //if (rule.exec_rule_nr == RuleExecOption.first):
-        if (rule->exec_rule_nr == RULE_EXEC_OPTION_FIRST) {
-
-            // if the rule.lhs object is not in obj any more
-            //if (self.obj[rule.lhs] <= 0):
-            //if (getObjectCountFromMultiset(&agent->obj, rule->lhs))
-            if (!areObjectsInMultisetObj(&agent->obj, rule->lhs, NO_OBJECT)) {
-                // this is an error, there was a bug in choseProgram() that shouldn't have chosen this program
-                printe(execErrMsgs[0], rule->lhs, rule_nr);
-                return FALSE;
-            }
-            // remove one instance of rule.lhs from obj
-            // evolution and communication and {,in_,out_}exteroceptive need this part
-            //self.obj[rule.lhs] -= 1;
-            setObjectCountFromMultisetObj(&agent->obj, rule->lhs, COUNT_DECREMENT);
-
-            //THE OBJECT DELETION IS HANDLED BY setObjectCountFromMultiset()
-
-            // 0 counts are allowed so if this is the case
-            //if (self.obj[rule.lhs] == 0):
-                // remove the entry from the obj counter
-                //del self.obj[rule.lhs]
-
-            //if (rule.type == RuleType.evolution):
-            if (rule->type == RULE_TYPE_EVOLUTION || getFirstRuleTypeFromConditional(rule->type) == RULE_TYPE_EVOLUTION)
-                // add the rule.rhs object to obj
-                //self.obj[rule.rhs] += 1
-                setObjectCountFromMultisetObj(&agent->obj, rule->rhs, COUNT_INCREMENT);
-
-            //elif (rule.type == RuleType.communication):
-            else if (rule->type == RULE_TYPE_COMMUNICATION || getFirstRuleTypeFromConditional(rule->type) == RULE_TYPE_COMMUNICATION) {
-                // if the rule.rhs object is not in the environement any more
-                //if (self.colony.env[rule.rhs] <= 0):
-                if (!areObjectsInMultisetEnv(&agent->pcolony->env, rule->rhs, NO_OBJECT)) {
-                    // this is an error, some other agent modified the environement
-                    printe(execErrMsgs[1], rule->rhs, rule_nr);
-                    return FALSE;
-                }
-                // remove one instance of rule.rhs from env only if it is not 'e'
-                // 'e' object should remain constant in the environment
-                //if (rule.rhs != self.colony.e):
-                if (rule->rhs != OBJECT_ID_E) {
-                    // remove one instance of rule.rhs from env
-                    //self.colony.env[rule.rhs] -= 1;
-                    setObjectCountFromMultisetEnv(&agent->pcolony->env, rule->rhs, COUNT_DECREMENT);
-                    //THE OBJECT DELETION IS HANDLED BY setObjectCountFromMultiset()
-
-                    // 0 counts are allowed so if this is the case
-                    //if (self.colony.env[rule.rhs] == 0):
-                        // remove the entry from the env counter
-                        //del self.colony.env[rule.rhs]
-                }
-                // only modify the environment if the lhs object is not e
-                //if (rule.lhs != self.colony.e):
-                if (rule->lhs != OBJECT_ID_E)
-                    // transfer object from agent.obj to environment
-                    //self.colony.env[rule.lhs] += 1
-                    setObjectCountFromMultisetEnv(&agent->pcolony->env, rule->lhs, COUNT_INCREMENT);
-
-                // transfer object from environment to agent.obj
-                //self.obj[rule.rhs] += 1
-                setObjectCountFromMultisetObj(&agent->obj, rule->rhs, COUNT_INCREMENT);
-            }
+/**
+ * @brief Build the leap limits of a P colony (the maximum number of copies of each object of each environment that a program can require)
+ * and the scratch space used by leapPcolony()
+ *
+ * @param pcol The P colony
+ */
+static void buildPcolonyLeapLimits(Pcolony_t *pcol) {
+    uint32_t nr_keys_total = (uint32_t) MULTISET_TARGET_NONE * pcol->nr_A,
+             nr_keys;
+
+    pcol->leap_limits = (uint8_t *) LULU_MALLOC(sizeof(uint8_t) * nr_keys_total);
+    pcol->leap_deltas = (int32_t *) LULU_MALLOC(sizeof(int32_t) * nr_keys_total);
+    //each rule changes at most 4 counts
+    pcol->leap_keys = (uint32_t *) LULU_MALLOC(sizeof(uint32_t) * pcol->nr_agents * 4 * pcol->n);
+    for (uint32_t key = 0; key < nr_keys_total; key++) {
+        pcol->leap_limits[key] = 0;
+        pcol->leap_deltas[key] = 0;
+    }
 
-            //elif (rule.type == RuleType.exteroceptive):
-            else if (rule->type == RULE_TYPE_EXTEROCEPTIVE || getFirstRuleTypeFromConditional(rule->type) == RULE_TYPE_EXTEROCEPTIVE) {
-                // if the rule.rhs object is not in the global swarm environement any more
-                //if (self.colony.parentSwarm.global_env[rule.rhs] <= 0):
-                if (!areObjectsInMultisetEnv(&agent->pcolony->pswarm.global_env, rule->rhs, NO_OBJECT)) {
-                    // this is an error, some other agent modified the environement
-                    printe(execErrMsgs[2], rule->rhs, rule_nr);
-                    return FALSE;
-                }
-                // remove one instance of rule.rhs from global swarm env only if it not 'e'
-                // 'e' object should remain constant in the environment
-                //if (rule.rhs != self.colony.e):
-                if (rule->rhs != OBJECT_ID_E) {
-                    // remove one instance of rule.rhs from global swarm env
-                    //self.colony.parentSwarm.global_env[rule.rhs] -= 1;
-                    setObjectCountFromMultisetEnv(&agent->pcolony->pswarm.global_env, rule->rhs, COUNT_DECREMENT);
-                    //THE OBJECT DELETION IS HANDLED BY setObjectCountFromMultiset()
-
-                    // 0 counts are allowed so if this is the case
-                    //if (self.colony.parentSwarm.global_env[rule.rhs] == 0):
-                        // remove the entry from the env counter
-                        //del self.colony.parentSwarm.global_env[rule.rhs]
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++)
+        for (uint8_t prg_nr = 0; prg_nr < pcol->agents[agent_nr].nr_programs; prg_nr++) {
+            Program_t *program = &pcol->agents[agent_nr].programs[prg_nr];
+
+            if (!program->compiled)
+                compileProgram(program, pcol);
+
+            //the required count of an object is at most the sum of the non-conditional requirements and of the uses by any of the alternatives
+            nr_keys = 0;
+            for (uint8_t i = 0; i < program->nr_requirements; i++)
+                if (program->requirements[i].target != MULTISET_TARGET_OBJ)
+                    addLeapDelta(pcol, program->requirements[i].target * pcol->nr_A + program->requirements[i].obj, program->requirements[i].nr, &nr_keys);
+            for (uint8_t c = 0; c < program->nr_conditionals; c++)
+                for (uint8_t side = 0; side < 2; side++) {
+                    if (program->conditionals[c].first[side].target != MULTISET_TARGET_OBJ && program->conditionals[c].first[side].target != MULTISET_TARGET_NONE)
+                        addLeapDelta(pcol, program->conditionals[c].first[side].target * pcol->nr_A + program->conditionals[c].first[side].obj, 1, &nr_keys);
+                    if (program->conditionals[c].second[side].target != MULTISET_TARGET_OBJ && program->conditionals[c].second[side].target != MULTISET_TARGET_NONE)
+                        addLeapDelta(pcol, program->conditionals[c].second[side].target * pcol->nr_A + program->conditionals[c].second[side].obj, 1, &nr_keys);
                 }
-                // only modify the global swarm environment if the lhs object is not e
-                //if (rule.lhs != self.colony.e):
-                if (rule->lhs != OBJECT_ID_E)
-                    // transfer object from agent.obj to global swarm environment
-                    //self.colony.parentSwarm.global_env[rule.lhs] += 1
-                    setObjectCountFromMultisetEnv(&agent->pcolony->pswarm.global_env, rule->lhs, COUNT_INCREMENT);
-
-                // transfer object from global swarm environment to agent.obj
-                //self.obj[rule.rhs] += 1
-                setObjectCountFromMultisetObj(&agent->obj, rule->rhs, COUNT_INCREMENT);
-            }
 
-            //elif (rule.type == RuleType.in_exteroceptive):
-            else if (rule->type == RULE_TYPE_IN_EXTEROCEPTIVE || getFirstRuleTypeFromConditional(rule->type) == RULE_TYPE_IN_EXTEROCEPTIVE) {
-                // if the rule.rhs object is not in the INPUT global swarm environement any more
-                //if (self.colony.parentSwarm.in_global_env[rule.rhs] <= 0):
-                if (!areObjectsInMultisetEnv(&agent->pcolony->pswarm.in_global_env, rule->rhs, NO_OBJECT)) {
-                    // this is an error, some other agent modified the environement
-                    printe(execErrMsgs[3], rule->rhs, rule_nr);
-                    return FALSE;
-                }
-                // remove one instance of rule.rhs from INPUT global swarm env only if it not 'e'
-                // 'e' object should remain constant in the environment
-                //if (rule.rhs != self.colony.e):
-                if (rule->rhs != OBJECT_ID_E) {
-                    // remove one instance of rule.rhs from INPUT global swarm env
-                    //self.colony.parentSwarm.in_global_env[rule.rhs] -= 1;
-                    setObjectCountFromMultisetEnv(&agent->pcolony->pswarm.in_global_env, rule->rhs, COUNT_DECREMENT);
-                    //THE OBJECT DELETION IS HANDLED BY setObjectCountFromMultiset()
-
-                    // 0 counts are allowed so if this is the case
-                    //if (self.colony.parentSwarm.in_global_env[rule.rhs] == 0):
-                        // remove the entry from the env counter
-                        //del self.colony.parentSwarm.in_global_env[rule.rhs]
-                }
-                // only modify the INPUT global swarm environment if the lhs object is not e
-                //if (rule.lhs != self.colony.e):
-                if (rule->lhs != OBJECT_ID_E)
-                    // transfer object from agent.obj to INPUT global swarm environment
-                    //self.colony.parentSwarm.in_global_env[rule.lhs] += 1
-                    setObjectCountFromMultisetEnv(&agent->pcolony->pswarm.in_global_env, rule->lhs, COUNT_INCREMENT);
-
-                // transfer object from INPUT global swarm environment to agent.obj
-                //self.obj[rule.rhs] += 1
-                setObjectCountFromMultisetObj(&agent->obj, rule->rhs, COUNT_INCREMENT);
-            }
+            for (uint32_t i = 0; i < nr_keys; i++) {
+                uint32_t key = pcol->leap_keys[i];
 
-            //elif (rule.type == RuleType.out_exteroceptive):
-            else if (rule->type == RULE_TYPE_OUT_EXTEROCEPTIVE || getFirstRuleTypeFromConditional(rule->type) == RULE_TYPE_OUT_EXTEROCEPTIVE) {
-                // if the rule.rhs object is not in the OUTPUT global swarm environement any more
-                //if (self.colony.parentSwarm.out_global_env[rule.rhs] <= 0):
-                if (!areObjectsInMultisetEnv(&agent->pcolony->pswarm.out_global_env, rule->rhs, NO_OBJECT)) {
-                    // this is an error, some other agent modified the environement
-                    printe(execErrMsgs[4], rule->rhs, rule_nr);
-                    return FALSE;
-                }
-                // remove one instance of rule.rhs from OUTPUT global swarm env only if it not 'e'
-                // 'e' object should remain constant in the environment
-                //if (rule.rhs != self.colony.e):
-                if (rule->rhs != OBJECT_ID_E) {
-                    // remove one instance of rule.rhs from OUTPUT global swarm env
-                    //self.colony.parentSwarm.out_global_env[rule.rhs] -= 1;
-                    setObjectCountFromMultisetEnv(&agent->pcolony->pswarm.out_global_env, rule->rhs, COUNT_DECREMENT);
-                    //THE OBJECT DELETION IS HANDLED BY setObjectCountFromMultiset()
-
-                    // 0 counts are allowed so if this is the case
-                    //if (self.colony.parentSwarm.out_global_env[rule.rhs] == 0):
-                        // remove the entry from the env counter
-                        //del self.colony.parentSwarm.out_global_env[rule.rhs]
-                }
-                // only modify the OUTPUT global swarm environment if the lhs object is not e
-                //if (rule.lhs != self.colony.e):
-                if (rule->lhs != OBJECT_ID_E)
-                    // transfer object from agent.obj to OUTPUT global swarm environment
-                    //self.colony.parentSwarm.out_global_env[rule.lhs] += 1
-                    setObjectCountFromMultisetEnv(&agent->pcolony->pswarm.out_global_env, rule->lhs, COUNT_INCREMENT);
-
-                // transfer object from OUTPUT global swarm environment to agent.obj
-                //self.obj[rule.rhs] += 1
-                setObjectCountFromMultisetObj(&agent->obj, rule->rhs, COUNT_INCREMENT);
+                if (pcol->leap_deltas[key] > pcol->leap_limits[key])
+                    pcol->leap_limits[key] = (pcol->leap_deltas[key] < UINT8_MAX) ? pcol->leap_deltas[key] : UINT8_MAX;
+                pcol->leap_deltas[key] = 0;
             }
         }
-        // if this is a conditional rule and the second rule was chosen for execution
-        //elif (rule.exec_rule_nr == RuleExecOption.second):
-        else if (rule->exec_rule_nr == RULE_EXEC_OPTION_SECOND) {
+}
 
-            // if the rule.alt_lhs object is not in obj any more
-            //if (self.obj[rule.alt_lhs] <= 0):
-            if (!areObjectsInMultisetObj(&agent->obj, rule->alt_lhs, NO_OBJECT)) {
-                // this is an error, there was a bug in choseProgram() that shouldn't have chosen this program
-                printe(execErrMsgs[0], rule->alt_lhs, rule_nr);
-                return FALSE;
-            }
-            // remove one instance of rule.alt_lhs from obj
-            // evolution and communication and {,in_,out_}exteroceptive need this part
-            //self.obj[rule.alt_lhs] -= 1;
-            setObjectCountFromMultisetObj(&agent->obj, rule->alt_lhs, COUNT_DECREMENT);
-
-            //THE OBJECT DELETION IS HANDLED BY setObjectCountFromMultiset()
-            // 0 counts are allowed so if this is the case
-            //if (self.obj[rule.alt_lhs] == 0):
-                // remove the entry from the obj counter
-                //del self.obj[rule.alt_lhs]
-
-            //if (rule.alt_type == RuleType.evolution):
-            if (getSecondRuleTypeFromConditional(rule->type) == RULE_TYPE_EVOLUTION)
-                // add the rule.alt_rhs object to obj
-                //self.obj[rule.alt_rhs] += 1
-                setObjectCountFromMultisetObj(&agent->obj, rule->alt_rhs, COUNT_INCREMENT);
-
-            //elif (rule.alt_type == RuleType.communication):
-            else if (getSecondRuleTypeFromConditional(rule->type) == RULE_TYPE_COMMUNICATION) {
-                // if the rule.alt_rhs object is not in the environement any more
-                //if (self.colony.env[rule.alt_rhs] <= 0):
-                if (!areObjectsInMultisetEnv(&agent->pcolony->env, rule->alt_rhs, NO_OBJECT)) {
-                    // this is an error, some other agent modified the environement
-                    printe(execErrMsgs[1], rule->alt_rhs, rule_nr);
-                    return FALSE;
-                }
-                // remove one instance of rule.alt_rhs from env only if it not 'e'
-                // 'e' object should remain constant in the environment
-                //if (rule.alt_rhs != self.colony.e):
-                if (rule->alt_rhs != OBJECT_ID_E) {
-                    // remove one instance of rule.alt_rhs from env
-                    //self.colony.env[rule.alt_rhs] -= 1;
-                    setObjectCountFromMultisetEnv(&agent->pcolony->env, rule->alt_rhs, COUNT_DECREMENT);
-                    //THE OBJECT DELETION IS HANDLED BY setObjectCountFromMultiset()
-
-                    // 0 counts are allowed so if this is the case
-                    //if (self.colony.env[rule.alt_rhs] == 0):
-                        // remove the entry from the env counter
-                        //del self.colony.env[rule.alt_rhs]
-                }
-                // transfer object from environment to agent.obj
-                //self.obj[rule.alt_rhs] += 1
-                setObjectCountFromMultisetObj(&agent->obj, rule->alt_rhs, COUNT_INCREMENT);
-
-                // only modify the environment if the alt_lhs object is not e
-                //if (rule.alt_lhs != self.colony.e):
-                if (rule->alt_lhs != OBJECT_ID_E)
-                    // transfer object from agent.obj to environment
-                    //self.colony.env[rule.alt_lhs] += 1
-                    setObjectCountFromMultisetEnv(&agent->pcolony->env, rule->alt_lhs, COUNT_INCREMENT);
-            }
+/**
+ * @brief Compute the number of additional steps for which the last step (with forced choices) can be repeated and apply them
+ * The objects of the agents must not change and for each changed environment count c (before the step) with change d,
+ * limit l and reserved count r, all of the checks of the programs give the same result while c + j * d >= l + r (j = 0 .. k),
+ * so k more steps are equivalent to adding k * d to each changed count
+ *
+ * @param pcol The P colony (after the execution of the step and before the reservations are released)
+ */
+static void leapPcolony(Pcolony_t *pcol) {
+    uint32_t nr_keys = 0,
+             leap = pcol->max_leap;
+    bool leap_possible = TRUE,
+         changed = FALSE;
+
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents && leap_possible; agent_nr++) {
+        Agent_t *agent = &pcol->agents[agent_nr];
+        Program_t *program;
+        uint32_t first_key = nr_keys;
+
+        if (!pcol->runnable_agents[agent_nr])
+            continue;
+        program = &agent->programs[agent->chosenProgramNr];
+        for (uint8_t i = 0; i < program->nr_ops; i++)
+            addLeapDelta(pcol, program->ops[i].target * pcol->nr_A + program->ops[i].obj, program->ops[i].delta, &nr_keys);
+        for (uint8_t c = 0; c < program->nr_conditionals; c++) {
+            uint8_t option = getChosenAlternative(agent, agent->chosenProgramNr, c);
+
+            for (uint8_t i = 0; i < program->conditionals[c].nr_ops[option]; i++)
+                addLeapDelta(pcol, program->conditionals[c].ops[option][i].target * pcol->nr_A + program->conditionals[c].ops[option][i].obj,
+                        program->conditionals[c].ops[option][i].delta, &nr_keys);
+        }
 
-            //elif (rule.alt_type == RuleType.exteroceptive):
-            else if (getSecondRuleTypeFromConditional(rule->type) == RULE_TYPE_EXTEROCEPTIVE) {
-                // if the rule.alt_rhs object is not in the global swarm environement any more
-                //if (self.colony.parentSwarm.global_env[rule.alt_rhs] <= 0):
-                if (!areObjectsInMultisetEnv(&agent->pcolony->pswarm.global_env, rule->alt_rhs, NO_OBJECT)) {
-                    // this is an error, some other agent modified the environement
-                    printe(execErrMsgs[2], rule->alt_rhs, rule_nr);
-                    return FALSE;
-                }
+        //the objects of the agent have to be the same after the step (the OBJ keys of different agents are not mixed)
+        for (uint32_t i = first_key; i < nr_keys; i++)
+            if (pcol->leap_keys[i] < pcol->nr_A && pcol->leap_deltas[pcol->leap_keys[i]] != 0)
+                leap_possible = FALSE;
+        for (uint32_t i = first_key; i < nr_keys; i++)
+            if (pcol->leap_keys[i] < pcol->nr_A)
+                pcol->leap_deltas[pcol->leap_keys[i]] = 0;
+    }
 
-                // remove one instance of rule.alt_rhs from global swarm env only if it not 'e'
-                // 'e' object should remain constant in the environment
-                //if (rule.alt_rhs != self.colony.e):
-                if (rule->alt_rhs != OBJECT_ID_E) {
-                    // remove one instance of rule.alt_rhs from global swarm env
-                    //self.colony.parentSwarm.global_env[rule.alt_rhs] -= 1;
-                    setObjectCountFromMultisetEnv(&agent->pcolony->pswarm.global_env, rule->alt_rhs, COUNT_DECREMENT);
-                    //THE OBJECT DELETION IS HANDLED BY setObjectCountFromMultiset()
-
-                    // 0 counts are allowed so if this is the case
-                    //if (self.colony.parentSwarm.global_env[rule.alt_rhs] == 0):
-                        // remove the entry from the env counter
-                        //del self.colony.parentSwarm.global_env[rule.alt_rhs]
-                }
-                // transfer object from environment to agent.obj
-                //self.obj[rule.alt_rhs] += 1
-                setObjectCountFromMultisetObj(&agent->obj, rule->alt_rhs, COUNT_INCREMENT);
-
-                // only modify the global swarm environment if the alt_lhs object is not e
-                //if (rule.alt_lhs != self.colony.e):
-                if (rule->alt_lhs != OBJECT_ID_E)
-                    // transfer object from agent.obj to environment
-                    //self.colony.parentSwarm.global_env[rule.alt_lhs] += 1
-                    setObjectCountFromMultisetEnv(&agent->pcolony->pswarm.global_env, rule->alt_lhs, COUNT_INCREMENT);
-            }
+    for (uint32_t i = 0; i < nr_keys && leap_possible; i++) {
+        uint32_t key = pcol->leap_keys[i];
+        multiset_target_t target = (multiset_target_t) (key / pcol->nr_A);
+        object_id_t obj = key % pcol->nr_A;
+        int32_t delta = pcol->leap_deltas[key];
+        int64_t count, previous, margin;
+
+        if (target == MULTISET_TARGET_OBJ || delta == 0)
+            continue;
+        changed = TRUE;
+        count = getObjectCountFromMultisetEnv(getAgentTargetEnv(&pcol->agents[0], target), obj);
+        previous = count - delta;
+        margin = previous - pcol->leap_limits[key] - getReservedCount(pcol, target, obj);
+
+        //the count before the step has to be above all of the values that could change the result of a check
+        //(and the object has to already be in the multiset, which can not be full)
+        if (margin < 0 || previous == 0)
+            leap_possible = FALSE;
+        else if (delta < 0) {
+            if (margin / -delta < leap)
+                leap = margin / -delta;
+        }
+        else if ((MULTISET_COUNT_MAX - count) / delta < leap)
+            leap = (MULTISET_COUNT_MAX - count) / delta;
+    }
 
-            //elif (rule.alt_type == RuleType.in_exteroceptive):
-            else if (getSecondRuleTypeFromConditional(rule->type) == RULE_TYPE_IN_EXTEROCEPTIVE) {
-                // if the rule.alt_rhs object is not in the INPUT global swarm environement any more
-                //if (self.colony.parentSwarm.in_global_env[rule.alt_rhs] <= 0):
-                if (!areObjectsInMultisetEnv(&agent->pcolony->pswarm.in_global_env, rule->alt_rhs, NO_OBJECT)) {
-                    // this is an error, some other agent modified the environement
-                    printe(execErrMsgs[3], rule->alt_rhs, rule_nr);
-                    return FALSE;
-                }
+    //a step that does not change any count is a fixed point, repeating it would not change the configuration
+    if (leap_possible && changed && leap > 0) {
+        for (uint32_t i = 0; i < nr_keys; i++) {
+            uint32_t key = pcol->leap_keys[i];
+            multiset_target_t target = (multiset_target_t) (key / pcol->nr_A);
+            multiset_env_t *env;
+
+            if (target == MULTISET_TARGET_OBJ || pcol->leap_deltas[key] == 0)
+                continue;
+            env = getAgentTargetEnv(&pcol->agents[0], target);
+            setObjectCountFromMultisetEnv(env, key % pcol->nr_A,
+                    getObjectCountFromMultisetEnv(env, key % pcol->nr_A) + (int64_t) leap * pcol->leap_deltas[key]);
+        }
+        pcol->nr_leaped_steps = leap;
+        printi("Leaped %lu steps", (unsigned long) leap);
+    }
 
-                // remove one instance of rule.alt_rhs from INPUT global swarm env only if it not 'e'
-                // 'e' object should remain constant in the environment
-                //if (rule.alt_rhs != self.colony.e):
-                if (rule->alt_rhs != OBJECT_ID_E) {
-                    // remove one instance of rule.alt_rhs from INPUT global swarm env
-                    //self.colony.parentSwarm.in_global_env[rule.alt_rhs] -= 1;
-                    setObjectCountFromMultisetEnv(&agent->pcolony->pswarm.in_global_env, rule->alt_rhs, COUNT_DECREMENT);
-                    //THE OBJECT DELETION IS HANDLED BY setObjectCountFromMultiset()
-
-                    // 0 counts are allowed so if this is the case
-                    //if (self.colony.parentSwarm.in_global_env[rule.alt_rhs] == 0):
-                        // remove the entry from the env counter
-                        //del self.colony.parentSwarm.in_global_env[rule.alt_rhs]
-                }
-                // transfer object from environment to agent.obj
-                //self.obj[rule.alt_rhs] += 1
-                setObjectCountFromMultisetObj(&agent->obj, rule->alt_rhs, COUNT_INCREMENT);
-
-                // only modify the INPUT global swarm environment if the alt_lhs object is not e
-                //if (rule.alt_lhs != self.colony.e):
-                if (rule->alt_lhs != OBJECT_ID_E)
-                    // transfer object from agent.obj to environment
-                    //self.colony.parentSwarm.in_global_env[rule.alt_lhs] += 1
-                    setObjectCountFromMultisetEnv(&agent->pcolony->pswarm.in_global_env, rule->alt_lhs, COUNT_INCREMENT);
-            }
+    for (uint32_t i = 0; i < nr_keys; i++)
+        pcol->leap_deltas[pcol->leap_keys[i]] = 0;
+}
 
-            //elif (rule.alt_type == RuleType.out_exteroceptive):
-            else if (getSecondRuleTypeFromConditional(rule->type) == RULE_TYPE_OUT_EXTEROCEPTIVE) {
-                // if the rule.alt_rhs object is not in the OUTPUT global swarm environement any more
-                //if (self.colony.parentSwarm.out_global_env[rule.alt_rhs] <= 0):
-                if (!areObjectsInMultisetEnv(&agent->pcolony->pswarm.out_global_env, rule->alt_rhs, NO_OBJECT)) {
-                    // this is an error, some other agent modified the environement
-                    printe(execErrMsgs[4], rule->alt_rhs, rule_nr);
-                    return FALSE;
-                }
+void pcolony_setLeaping(Pcolony_t *pcol, uint32_t max_leap) {
+    pcol->max_leap = max_leap;
+}
 
-                // remove one instance of rule.alt_rhs from OUTPUT global swarm env only if it not 'e'
-                // 'e' object should remain constant in the environment
-                //if (rule.alt_rhs != self.colony.e):
-                if (rule->alt_rhs != OBJECT_ID_E) {
-                    // remove one instance of rule.alt_rhs from OUTPUT global swarm env
-                    //self.colony.parentSwarm.out_global_env[rule.alt_rhs] -= 1;
-                    setObjectCountFromMultisetEnv(&agent->pcolony->pswarm.out_global_env, rule->alt_rhs, COUNT_DECREMENT);
-                    //THE OBJECT DELETION IS HANDLED BY setObjectCountFromMultiset()
-
-                    // 0 counts are allowed so if this is the case
-                    //if (self.colony.parentSwarm.out_global_env[rule.alt_rhs] == 0):
-                        // remove the entry from the env counter
-                        //del self.colony.parentSwarm.out_global_env[rule.alt_rhs]
-                }
-                // transfer object from environment to agent.obj
-                //self.obj[rule.alt_rhs] += 1
-                setObjectCountFromMultisetObj(&agent->obj, rule->alt_rhs, COUNT_INCREMENT);
-
-                // only modify the OUTPUT global swarm environment if the alt_lhs object is not e
-                //if (rule.alt_lhs != self.colony.e):
-                if (rule->alt_lhs != OBJECT_ID_E)
-                    // transfer object from agent.obj to environment
-                    //self.colony.parentSwarm.out_global_env[rule.alt_lhs] += 1
-                    setObjectCountFromMultisetEnv(&agent->pcolony->pswarm.out_global_env, rule->alt_lhs, COUNT_INCREMENT);
-            }
-        }    // end elif exec_rule_nr == second
-    }
-    // rule execution finished succesfully
-    return TRUE;
+void clearPcolonyLeapLimits(Pcolony_t *pcol) {
+    FREE_PCOLONY_BLOCK(pcol, pcol->leap_limits);
+    FREE_PCOLONY_BLOCK(pcol, pcol->leap_deltas);
+    FREE_PCOLONY_BLOCK(pcol, pcol->leap_keys);
+    pcol->leap_limits = NULL;
+    pcol->leap_deltas = NULL;
+    pcol->leap_keys = NULL;
 }
+#endif
 
 sim_step_result_t pcolony_runSimulationStep(Pcolony_t *pcolony) {
     //runnableAgents = [] // the list of agents that have an executable program
     uint8_t executable_agents_count = 0;
-    //possiblePrograms[2] = True -> program[2] is executable
-    bool runnableAgents[pcolony->nr_agents];
+    //runnableAgents[2] = True -> agent[2] has an executable program
+    bool *runnableAgents = pcolony->runnable_agents;
     Agent_t *agent;
 
+#ifdef CONFIG_HASH
+    if (pcolony->history_size > 0 && isConfigurationRepeated(pcolony))
+        return SIM_STEP_RESULT_CYCLE; // the following configurations are already known
+#endif
+    //a random order of the agents is a random choice
+    pcolony->forced_step = !pcolony->random_agent_order || pcolony->nr_agents < 2;
     initArray(runnableAgents, pcolony->nr_agents, FALSE);
+#ifdef INCREMENTAL_SELECTION
+    //only the programs that use changed objects have to be checked again
+    updateDirtyPrograms(pcolony);
+#endif
+    //a previous step may have stopped before releasing it's reservations
+    releaseReservations(pcolony);
+#ifdef STEP_LEAPING
+    pcolony->nr_leaped_steps = 0;
+    if (pcolony->max_leap > 0 && pcolony->leap_limits == NULL)
+        buildPcolonyLeapLimits(pcolony);
+#endif
 
+    //the agents choose their programs one after the other and each agent reserves the objects that it will take from the environments
+    //so an object can not be chosen by two agents (the following agents choose between the programs that are still executable)
+    orderAgents(pcolony);
+#ifdef LULU_THREADS
+    //the programs of all agents are checked in parallel against the environments without reservations
+    //and afterwards each agent chooses (in order) between it's executable programs
+    if (pcolony->thread_pool != NULL) {
+        prepareParallelSelection(pcolony);
+        runThreadPool(pcolony->thread_pool);
+    }
+#endif
     //for agent_name, agent in self.agents.items():
-    for (uint8_t agent_nr = 0; agent_nr < pcolony->nr_agents; agent_nr++) {
+    for (uint8_t i = 0; i < pcolony->nr_agents; i++) {
+        uint8_t agent_nr = pcolony->agent_order[i];
+        bool chosen;
+
         agent = &pcolony->agents[agent_nr];
         printd("Check AG%d", agent_nr);
+#ifdef LULU_THREADS
+        if (pcolony->thread_pool != NULL)
+            chosen = agent_chosePrecheckedProgram(agent);
+        else
+#endif
+            chosen = agent_choseProgram(agent);
         // if the agent choses 1 program to execute
         //if (agent.choseProgram()) {
-        if (agent_choseProgram(agent)) {
+        if (chosen) {
             printi("AG%d runnable", agent_nr);
             //runnableAgents.append(agent_name)
             runnableAgents[agent_nr] = TRUE;
             executable_agents_count++;
+            reserveChosenProgramObjects(agent);
         }
     }
     printi("%d runnable ag", executable_agents_count);
@@ -1043,11 +2902,94 @@ sim_step_result_t pcolony_runSimulationStep(Pcolony_t *pcolony) {
                 return SIM_STEP_RESULT_ERROR;
             }
         }
+#ifdef STEP_LEAPING
+    //the reservations are the objects consumed by the step
+    if (pcolony->max_leap > 0 && pcolony->forced_step && pcolony->swarm == &pcolony->pswarm)
+        leapPcolony(pcolony);
+#endif
+    //the reserved objects were consumed by the execution of the programs
+    releaseReservations(pcolony);
+#ifdef CONFIG_HASH
+    //the configurations visited before a random choice may be followed by different configurations when they are visited again
+    if (pcolony->history_size > 0) {
+        if (!pcolony->forced_step)
+            clearHistory(pcolony);
+        pcolony->history_step_nr++;
+#ifdef STEP_LEAPING
+        pcolony->history_step_nr += pcolony->nr_leaped_steps;
+#endif
+    }
+#endif
     printi("Sim_step_ok");
     //return SimStepResult.finished
     return SIM_STEP_RESULT_FINISHED;
 }
 
+sim_step_result_t pswarm_runSimulationStep(Pswarm_t *pswarm) {
+    bool executed = FALSE;
+
+#ifdef INCREMENTAL_SELECTION
+    //the global environments may have been changed directly since the previous step
+    markSwarmDependentPrograms(pswarm);
+#endif
+    for (uint16_t colony_nr = 0; colony_nr < pswarm->nr_colonies; colony_nr++) {
+        sim_step_result_t result;
+
+        printi("Running colony %d", colony_nr);
+        result = pcolony_runSimulationStep(&pswarm->colonies[colony_nr]);
+#ifdef INCREMENTAL_SELECTION
+        //the programs of the other colonies that use the objects changed by this colony have to be checked again
+        markSwarmDependentPrograms(pswarm);
+#endif
+        if (result == SIM_STEP_RESULT_ERROR) {
+            printe("Colony %d failed, STOP_SIM", colony_nr);
+            return SIM_STEP_RESULT_ERROR;
+        }
+        if (result == SIM_STEP_RESULT_FINISHED)
+            executed = TRUE;
+    }
+
+    if (!executed)
+        return SIM_STEP_RESULT_NO_MORE_EXECUTABLES; // no colony can continue
+
+    return SIM_STEP_RESULT_FINISHED;
+}
+
+multiset_target_t getRuleTypeTarget(rule_type_t type) {
+    switch (type) {
+        case RULE_TYPE_COMMUNICATION:
+            return MULTISET_TARGET_ENV;
+        case RULE_TYPE_EXTEROCEPTIVE:
+            return MULTISET_TARGET_GLOBAL_ENV;
+        case RULE_TYPE_IN_EXTEROCEPTIVE:
+            return MULTISET_TARGET_IN_GLOBAL_ENV;
+        case RULE_TYPE_OUT_EXTEROCEPTIVE:
+            return MULTISET_TARGET_OUT_GLOBAL_ENV;
+        default:
+            return MULTISET_TARGET_NONE;
+    }
+}
+
+bool isValidRuleType(uint32_t type) {
+    //the values between the simple and the conditional rule types are not used
+    return (type >= RULE_TYPE_EVOLUTION && type <= RULE_TYPE_OUT_EXTEROCEPTIVE) ||
+        (type >= RULE_TYPE_CONDITIONAL_EVOLUTION_EVOLUTION && type <= RULE_TYPE_CONDITIONAL_OUT_EXTEROCEPTIVE_OUT_EXTEROCEPTIVE);
+}
+
+multiset_env_t* getAgentTargetEnv(Agent_t *agent, multiset_target_t target) {
+    switch (target) {
+        case MULTISET_TARGET_ENV:
+            return &agent->pcolony->env;
+        case MULTISET_TARGET_GLOBAL_ENV:
+            return &agent->pcolony->swarm->global_env;
+        case MULTISET_TARGET_IN_GLOBAL_ENV:
+            return &agent->pcolony->swarm->in_global_env;
+        case MULTISET_TARGET_OUT_GLOBAL_ENV:
+            return &agent->pcolony->swarm->out_global_env;
+        default:
+            return NULL;
+    }
+}
 
 rule_type_t getFirstRuleTypeFromConditional(rule_type_t rule) {
     // if this is not a conditional rule
@@ -1073,15 +3015,32 @@ void initArray(uint8_t *array, uint8_t array_size, uint8_t default_value) {
 }
 
 
-void initPcolony(Pcolony_t *pcol, uint8_t nr_A, uint8_t nr_agents, uint8_t n) {
-    //generate and set a seed for random number generation
-    //using methods specific to the platform
+void pcolony_setSeed(Pcolony_t *pcol, uint32_t seed) {
+    //0 is a fixed point of xorshift, so it is replaced with an arbitrary non-zero seed
+    pcol->rng_state = (seed != 0) ? seed : 0x9E3779B9;
+}
+
+uint32_t pcolony_rand(Pcolony_t *pcol) {
+    //xorshift32 (Marsaglia, 2003)
+    uint32_t x = pcol->rng_state;
+
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    pcol->rng_state = x;
+
+    return x;
+}
+
+void initPcolony(Pcolony_t *pcol, object_id_t nr_A, uint8_t nr_agents, uint8_t n) {
+    //generate and set a seed for the random number generator of the colony
+    //using methods specific to the platform (pcolony_setSeed() can be used afterwards for reproducible runs)
     #ifndef KILOBOT
         //on PC we use the time in seconds since the epoch as seed
-        srand(time(NULL));
+        pcolony_setSeed(pcol, (uint32_t) time(NULL));
     #else
         //on the kilobot we use the battery voltage as seed
-        rand_seed(rand_hard());
+        pcolony_setSeed(pcol, rand_hard());
     #endif
     pcol->nr_A = nr_A;
     pcol->nr_agents = nr_agents;
@@ -1095,18 +3054,559 @@ void initPcolony(Pcolony_t *pcol, uint8_t nr_A, uint8_t nr_agents, uint8_t n) {
     initMultisetEnv(&pcol->pswarm.in_global_env, pcol->nr_A);
     //init pswarm OUTPUT global environment
     initMultisetEnv(&pcol->pswarm.out_global_env, pcol->nr_A);
+    //the colony does not belong to a swarm
+    pcol->pswarm.colonies = NULL;
+    pcol->pswarm.nr_colonies = 0;
+    pcol->pswarm.max_colonies = 0;
+#ifdef CONCURRENT_ENVS
+    pcol->pswarm.concurrent = FALSE;
+    pcol->pswarm.nr_rollbacks = 0;
+#endif
+    pcol->swarm = &pcol->pswarm;
     //init agents
-    pcol->agents = (Agent_t *) malloc(sizeof(Agent_t) * pcol->nr_agents);
+    pcol->agents = (Agent_t *) LULU_MALLOC(sizeof(Agent_t) * pcol->nr_agents);
+
+    //init simulation step scratch space
+    pcol->runnable_agents = (bool *) LULU_MALLOC(sizeof(bool) * pcol->nr_agents);
+    pcol->agent_order = (uint8_t *) LULU_MALLOC(sizeof(uint8_t) * pcol->nr_agents);
+    pcol->random_agent_order = FALSE;
+    //each rule of an agent reserves at most one object
+    pcol->reservations = (reservation_t *) LULU_MALLOC(sizeof(reservation_t) * pcol->nr_agents * pcol->n);
+    pcol->nr_reservations = 0;
+#ifdef LULU_THREADS
+    pcol->thread_pool = NULL;
+#endif
+#ifdef PCOLONY_ARENA
+    pcol->arena = NULL;
+    pcol->arena_size = 0;
+    pcol->share = NULL;
+#endif
+#ifdef CONFIG_HASH
+    pcol->history = NULL;
+    pcolony_setHistorySize(pcol, 0);
+#endif
+#ifdef STEP_LEAPING
+    pcol->max_leap = 0;
+    pcol->nr_leaped_steps = 0;
+    pcol->leap_limits = NULL;
+    pcol->leap_deltas = NULL;
+    pcol->leap_keys = NULL;
+#endif
+#ifdef INCREMENTAL_SELECTION
+    pcol->dependency_start = NULL;
+    pcol->dependent_programs = NULL;
+#endif
+}
+
+bool rebuildPcolonyMultisets(Pcolony_t *pcol) {
+    bool rebuilt = rebuildMultisetEnv(&pcol->env);
+    rebuilt &= rebuildMultisetEnv(&pcol->pswarm.global_env);
+    rebuilt &= rebuildMultisetEnv(&pcol->pswarm.in_global_env);
+    rebuilt &= rebuildMultisetEnv(&pcol->pswarm.out_global_env);
+#ifndef MULTISET_OBJ_COUNTED
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++)
+        rebuilt &= rebuildMultisetObj(&pcol->agents[agent_nr].obj);
+#endif
+    return rebuilt;
+}
+
+void copyPcolony(Pcolony_t *destination, Pcolony_t *source) {
+    initPcolony(destination, source->nr_A, source->nr_agents, source->n);
+    destination->rng_state = source->rng_state;
+    destination->random_agent_order = source->random_agent_order;
+#ifdef CONFIG_HASH
+    pcolony_setHistorySize(destination, source->history_size);
+#endif
+#ifdef STEP_LEAPING
+    destination->max_leap = source->max_leap;
+#endif
+
+    //initPcolony() has allocated empty multisets, so they are replaced by copies
+    destroyMultisetEnv(&destination->env);
+    destroyMultisetEnv(&destination->pswarm.global_env);
+    destroyMultisetEnv(&destination->pswarm.in_global_env);
+    destroyMultisetEnv(&destination->pswarm.out_global_env);
+    copyMultisetEnv(&destination->env, &source->env);
+    //the copy does not belong to the swarm of the source, so it gets a copy of the global environments seen by the source
+    copyMultisetEnv(&destination->pswarm.global_env, &source->swarm->global_env);
+    copyMultisetEnv(&destination->pswarm.in_global_env, &source->swarm->in_global_env);
+    copyMultisetEnv(&destination->pswarm.out_global_env, &source->swarm->out_global_env);
+
+    for (uint8_t agent_nr = 0; agent_nr < source->nr_agents; agent_nr++) {
+        Agent_t *agent = &destination->agents[agent_nr];
+
+        initAgent(agent, destination, source->agents[agent_nr].nr_programs);
+        agent->init_program_nr = source->agents[agent_nr].init_program_nr;
+        destroyMultisetObj(&agent->obj);
+        copyMultisetObj(&agent->obj, &source->agents[agent_nr].obj);
+        for (uint8_t prg_nr = 0; prg_nr < agent->nr_programs; prg_nr++)
+            copyProgram(&agent->programs[prg_nr], &source->agents[agent_nr].programs[prg_nr]);
+    }
+}
+
+#ifdef PCOLONY_ARENA
+//the blocks of an arena start at multiples of 8 bytes (the alignment of config_hash_t and of pointers on PC)
+#define ARENA_ALIGN(size) (((size) + 7) & ~((uint32_t) 7))
+
+/**
+ * @brief Function called by visitPcolonyBlocks() for each heap block of a P colony
+ *
+ * @param context The context of the visit
+ * @param block The block (NULL if it is not allocated)
+ * @param size The number of bytes of the block that are used
+ *
+ * @return The new address of the block
+ */
+typedef void* (*block_visitor_t)(void *context, void *block, uint32_t size);
+
+/**
+ * @brief Visit the heap blocks of an environment multiset
+ *
+ * @param multiset The multiset
+ * @param visit The function called for each block
+ * @param context Passed to visit
+ */
+static void visitMultisetEnvBlocks(multiset_env_t *multiset, block_visitor_t visit, void *context) {
+    multiset->items = (multiset_env_item_t *) visit(context, multiset->items, sizeof(multiset_env_item_t) * multiset->size);
+#ifdef MULTISET_PRESENCE
+    multiset->presence = (presence_word_t *) visit(context, multiset->presence, sizeof(presence_word_t) * PRESENCE_NR_WORDS(multiset->size));
+#endif
+#ifdef INCREMENTAL_SELECTION
+    multiset->changed = (presence_word_t *) visit(context, multiset->changed, sizeof(presence_word_t) * PRESENCE_NR_WORDS(multiset->size));
+#endif
+}
+
+/**
+ * @brief Visit the heap blocks of an agent (objects, guard tree, programs and their rules and compiled requirements)
+ *
+ * @param agent The agent
+ * @param visit The function called for each block of mutable state
+ * @param visit_tables The function called for each block of the program tables (rules, compiled programs and guard tree)
+ * @param context Passed to visit and visit_tables
+ */
+static void visitAgentBlocks(Agent_t *agent, block_visitor_t visit, block_visitor_t visit_tables, void *context) {
+#ifdef MULTISET_OBJ_COUNTED
+    agent->obj.items = (multiset_env_item_t *) visit(context, agent->obj.items, sizeof(multiset_env_item_t) * agent->obj.size);
+#else
+    agent->obj.items = (object_id_t *) visit(context, agent->obj.items, sizeof(object_id_t) * agent->obj.size);
+#endif
+#ifdef MULTISET_PRESENCE
+    agent->obj.presence = (presence_word_t *) visit(context, agent->obj.presence, sizeof(presence_word_t) * PRESENCE_NR_WORDS(agent->obj.alphabet_size));
+#endif
+#ifdef INCREMENTAL_SELECTION
+    agent->obj.changed = (presence_word_t *) visit(context, agent->obj.changed, sizeof(presence_word_t) * PRESENCE_NR_WORDS(agent->obj.alphabet_size));
+#endif
+#ifdef GUARD_TREE
+    agent->guard_nodes = (guard_node_t *) visit_tables(context, agent->guard_nodes, sizeof(guard_node_t) * agent->nr_guard_nodes);
+    agent->guard_programs = (uint8_t *) visit_tables(context, agent->guard_programs, sizeof(uint8_t) * agent->nr_programs);
+#endif
+
+    agent->alternatives = (uint8_t *) visit(context, agent->alternatives, ALTERNATIVES_SIZE(agent));
+    agent->programs = (Program_t *) visit(context, agent->programs, sizeof(Program_t) * agent->nr_programs);
+    for (uint8_t prg_nr = 0; prg_nr < agent->nr_programs; prg_nr++) {
+        Program_t *program = &agent->programs[prg_nr];
+
+#ifdef MAPPED_RULES
+        //mapped rules stay where they are in the packed colony and in all of it's clones and forks
+        if (!program->mapped_rules)
+#endif
+        program->rules = (Rule_t *) visit_tables(context, program->rules, sizeof(Rule_t) * program->nr_rules);
+        if (!program->compiled)
+            continue;
+        program->requirements = (requirement_t *) visit_tables(context, program->requirements, sizeof(requirement_t) * program->nr_requirements);
+        program->conditionals = (conditional_requirement_t *) visit_tables(context, program->conditionals,
+                sizeof(conditional_requirement_t) * program->nr_conditionals);
+        program->ops = (delta_op_t *) visit_tables(context, program->ops, sizeof(delta_op_t) * program->nr_ops);
+#ifdef MULTISET_PRESENCE
+        program->presence_mask = (presence_word_t *) visit_tables(context, program->presence_mask,
+                sizeof(presence_word_t) * PRESENCE_NR_WORDS(agent->pcolony->nr_A) * MULTISET_TARGET_NONE);
+#endif
+    }
+#ifdef LULU_THREADS
+    agent->executable_programs = (uint8_t *) visit(context, agent->executable_programs, sizeof(uint8_t) * agent->nr_programs);
+#endif
+}
+
+/**
+ * @brief Visit all of the heap blocks of a P colony in the order in which a simulation step traverses them
+ * A block is only visited after the block that points to it has been visited (and possibly moved)
+ *
+ * @param pcol The P colony
+ * @param visit The function called for each block of mutable state
+ * @param visit_tables The function called for each block of the program tables (see forkPcolony())
+ * @param context Passed to visit and visit_tables
+ */
+static void visitPcolonyBlocks(Pcolony_t *pcol, block_visitor_t visit, block_visitor_t visit_tables, void *context) {
+    pcol->agent_order = (uint8_t *) visit(context, pcol->agent_order, sizeof(uint8_t) * pcol->nr_agents);
+    pcol->agents = (Agent_t *) visit(context, pcol->agents, sizeof(Agent_t) * pcol->nr_agents);
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++)
+        visitAgentBlocks(&pcol->agents[agent_nr], visit, visit_tables, context);
+    pcol->runnable_agents = (bool *) visit(context, pcol->runnable_agents, sizeof(bool) * pcol->nr_agents);
+    pcol->reservations = (reservation_t *) visit(context, pcol->reservations, sizeof(reservation_t) * pcol->nr_agents * pcol->n);
+
+    visitMultisetEnvBlocks(&pcol->env, visit, context);
+    visitMultisetEnvBlocks(&pcol->pswarm.global_env, visit, context);
+    visitMultisetEnvBlocks(&pcol->pswarm.in_global_env, visit, context);
+    visitMultisetEnvBlocks(&pcol->pswarm.out_global_env, visit, context);
+
+#ifdef INCREMENTAL_SELECTION
+    {
+        uint32_t nr_keys = (uint32_t) MULTISET_TARGET_NONE * pcol->nr_A;
+
+        pcol->dependency_start = (uint32_t *) visit_tables(context, pcol->dependency_start, sizeof(uint32_t) * (nr_keys + 1));
+        pcol->dependent_programs = (program_ref_t *) visit_tables(context, pcol->dependent_programs,
+                sizeof(program_ref_t) * ((pcol->dependency_start != NULL) ? pcol->dependency_start[nr_keys] : 0));
+    }
+#endif
+#ifdef STEP_LEAPING
+    pcol->leap_limits = (uint8_t *) visit_tables(context, pcol->leap_limits, sizeof(uint8_t) * MULTISET_TARGET_NONE * pcol->nr_A);
+    pcol->leap_deltas = (int32_t *) visit(context, pcol->leap_deltas, sizeof(int32_t) * MULTISET_TARGET_NONE * pcol->nr_A);
+    pcol->leap_keys = (uint32_t *) visit(context, pcol->leap_keys, sizeof(uint32_t) * pcol->nr_agents * 4 * pcol->n);
+#endif
+#ifdef CONFIG_HASH
+    pcol->history = (history_entry_t *) visit(context, pcol->history, sizeof(history_entry_t) * pcol->history_size);
+#endif
+}
+
+//block visitor of packPcolony(): add the size of the block to the size of the arena (context = uint32_t size)
+static void* addArenaBlockSize(void *context, void *block, uint32_t size) {
+    if (block != NULL)
+        *(uint32_t *) context += ARENA_ALIGN(size);
+    return block;
+}
+
+/**
+ * @brief Position in the new arena of packPcolony() and the colony that is packed (with it's previous arena, if it was already packed)
+ */
+typedef struct _arena_move {
+    Pcolony_t *pcol;
+    uint8_t *next;
+} arena_move_t;
+
+//block visitor of packPcolony(): move the block to the next free position of the arena (context = arena_move_t)
+//only the blocks that are not stored in the previous arena are freed, the previous arena is freed as a whole afterwards
+static void* moveBlockToArena(void *context, void *block, uint32_t size) {
+    arena_move_t *move = (arena_move_t *) context;
+    uint8_t *space = move->next;
+
+    if (block == NULL)
+        return NULL;
+
+    memcpy(space, block, size);
+    if (!isArenaBlock(move->pcol, block))
+        LULU_FREE(block);
+    move->next += ARENA_ALIGN(size);
+    return space;
+}
+
+/**
+ * @brief Arenas of the source and of the destination of clonePcolony()
+ */
+typedef struct _arena_rebase {
+    Pcolony_t *source;
+    uint8_t *arena;
+} arena_rebase_t;
+
+//block visitor of clonePcolony(): translate a block of the arena of the source to the same offset of the copied arena
+//the blocks that are not stored in the arena of the source were (re)built after packing and are copied to separate blocks of the copy,
+//which are freed by destroyPcolony() like the ones of the source
+static void* rebaseArenaBlock(void *context, void *block, uint32_t size) {
+    arena_rebase_t *rebase = (arena_rebase_t *) context;
+    void *copy;
+
+    if (block == NULL)
+        return NULL;
+    if (isArenaBlock(rebase->source, block))
+        return rebase->arena + ((uint8_t *) block - rebase->source->arena);
+
+    copy = LULU_MALLOC(size);
+    memcpy(copy, block, size);
+    return copy;
+}
+
+//block visitor of destroyPcolony(): free the blocks of a packed colony that are not stored in it's arena or in the arena of the tables
+//that it shares with it's forks (context = Pcolony_t)
+static void* freeOutsideArena(void *context, void *block, uint32_t size) {
+    if (block == NULL || isArenaBlock((Pcolony_t *) context, block))
+        return block;
+    LULU_FREE(block);
+    return NULL;
+}
+
+/**
+ * @brief Arena of the fork made by forkPcolony() and the tables that the fork shares with it's source
+ */
+typedef struct _arena_fork {
+    pcolony_share_t *share;
+    uint8_t *next; // next free position of the arena of the fork
+    uint32_t size; // size of the arena of the fork
+} arena_fork_t;
+
+/**
+ * @brief Check whether a table of a forked P colony is stored in the arena of the shared tables
+ * The tables that a colony rebuilt after they were cleared are it's own and are not shared
+ *
+ * @param share The shared tables
+ * @param block The table
+ *
+ * @return TRUE if the table is shared, FALSE otherwise
+ */
+static bool isSharedTable(pcolony_share_t *share, void *block) {
+    return (uint8_t *) block >= share->arena && (uint8_t *) block <= share->arena + share->arena_size;
+}
+
+//block visitor of forkPcolony(): add the size of the block to the size of the arena of the fork (context = arena_fork_t)
+static void* addForkBlockSize(void *context, void *block, uint32_t size) {
+    return addArenaBlockSize(&((arena_fork_t *) context)->size, block, size);
+}
+
+//block visitor of forkPcolony(): add the size of a table that is not shared to the size of the arena of the fork (context = arena_fork_t)
+static void* addForkTableSize(void *context, void *block, uint32_t size) {
+    if (block == NULL || isSharedTable(((arena_fork_t *) context)->share, block))
+        return block;
+    return addForkBlockSize(context, block, size);
+}
+
+//block visitor of forkPcolony(): copy the block to the next free position of the arena of the fork (context = arena_fork_t)
+static void* copyForkBlock(void *context, void *block, uint32_t size) {
+    arena_fork_t *fork = (arena_fork_t *) context;
+    uint8_t *space = fork->next;
+
+    if (block == NULL)
+        return NULL;
+
+    memcpy(space, block, size);
+    fork->next += ARENA_ALIGN(size);
+    return space;
+}
+
+//block visitor of forkPcolony(): copy a table that is not shared to the arena of the fork, the shared ones stay where they are
+//(context = arena_fork_t)
+static void* copyForkTable(void *context, void *block, uint32_t size) {
+    if (block == NULL || isSharedTable(((arena_fork_t *) context)->share, block))
+        return block;
+    return copyForkBlock(context, block, size);
+}
+
+/**
+ * @brief Compile the programs of a P colony and build the structures that are otherwise built by the first simulation step
+ * (guard trees, dependency index and optionally the leap limits)
+ *
+ * @param pcol The P colony
+ * @param leap_limits TRUE if the leap limits are built even if leaping is disabled
+ */
+static void buildPcolonyTables(Pcolony_t *pcol, bool leap_limits) {
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++) {
+        Agent_t *agent = &pcol->agents[agent_nr];
+
+        for (uint8_t prg_nr = 0; prg_nr < agent->nr_programs; prg_nr++)
+            if (!agent->programs[prg_nr].compiled)
+                compileProgram(&agent->programs[prg_nr], pcol);
+#ifdef GUARD_TREE
+        if (agent->guard_nodes == NULL)
+            buildAgentGuardTree(agent);
+#endif
+    }
+#ifdef INCREMENTAL_SELECTION
+    if (pcol->dependency_start == NULL)
+        buildPcolonyDependencyIndex(pcol);
+#endif
+#ifdef STEP_LEAPING
+    if ((pcol->max_leap > 0 || leap_limits) && pcol->leap_limits == NULL)
+        buildPcolonyLeapLimits(pcol);
+#endif
+}
+
+void packPcolony(Pcolony_t *pcol) {
+    uint32_t size = 0;
+    uint8_t *arena,
+            *previous_arena = pcol->arena;
+    arena_move_t move;
+
+    //the tables of a forked colony are used by it's forks, so they cannot be moved
+    if (pcol->share != NULL)
+        return;
+
+    //build the structures of the first simulation step now, so that they are stored in the arena too
+    buildPcolonyTables(pcol, FALSE);
+    visitPcolonyBlocks(pcol, addArenaBlockSize, addArenaBlockSize, &size);
+    arena = (uint8_t *) LULU_MALLOC(size);
+    move.pcol = pcol;
+    move.next = arena;
+    //the blocks of a colony that is already packed are moved from it's previous arena together with the ones built afterwards
+    visitPcolonyBlocks(pcol, moveBlockToArena, moveBlockToArena, &move);
+    pcol->arena = arena;
+    pcol->arena_size = size;
+    if (previous_arena != NULL)
+        LULU_FREE(previous_arena);
 }
 
+/**
+ * @brief Attach the agents of a copy of a P colony whose arrays were copied by block visitors to the copy
+ * The copy does not belong to the swarm of the source, so it's own global environments get the contents of the global environments
+ * seen by the source
+ *
+ * @param destination The copy (with the same multiset sizes as the source)
+ * @param source The P colony that was copied
+ */
+static void attachCopiedPcolony(Pcolony_t *destination, Pcolony_t *source) {
+    multiset_env_t *envs[] = {&destination->pswarm.global_env, &destination->pswarm.in_global_env, &destination->pswarm.out_global_env},
+                   *source_envs[] = {&source->swarm->global_env, &source->swarm->in_global_env, &source->swarm->out_global_env};
+
+    for (uint8_t agent_nr = 0; agent_nr < destination->nr_agents; agent_nr++)
+        destination->agents[agent_nr].pcolony = destination;
+    destination->swarm = &destination->pswarm;
+    if (source->swarm != &source->pswarm)
+        for (uint8_t i = 0; i < 3; i++) {
+            for (object_id_t obj = 0; obj < envs[i]->size; obj++)
+                envs[i]->items[obj] = source_envs[i]->items[obj];
+#ifdef MULTISET_PRESENCE
+            for (object_id_t word = 0; word < PRESENCE_NR_WORDS(envs[i]->size); word++)
+                envs[i]->presence[word] = source_envs[i]->presence[word];
+#endif
+#ifdef INCREMENTAL_SELECTION
+            for (object_id_t word = 0; word < PRESENCE_NR_WORDS(envs[i]->size); word++)
+                envs[i]->changed[word] = source_envs[i]->changed[word];
+#endif
+#ifdef CONFIG_HASH
+            envs[i]->hash = source_envs[i]->hash;
+#endif
+        }
+#ifdef LULU_THREADS
+    destination->thread_pool = NULL;
+#endif
+}
+
+void clonePcolony(Pcolony_t *destination, Pcolony_t *source) {
+    arena_rebase_t rebase;
+
+    //the arena of a fork does not contain it's program tables
+    if (source->arena == NULL || source->share != NULL) {
+        copyPcolony(destination, source);
+        packPcolony(destination);
+        return;
+    }
+
+    *destination = *source;
+    destination->arena = (uint8_t *) LULU_MALLOC(source->arena_size);
+    memcpy(destination->arena, source->arena, source->arena_size);
+    rebase.source = source;
+    rebase.arena = destination->arena;
+    visitPcolonyBlocks(destination, rebaseArenaBlock, rebaseArenaBlock, &rebase);
+    attachCopiedPcolony(destination, source);
+#ifdef CONFIG_HASH
+    //the copy starts with an empty history, like the copies made by copyPcolony()
+    if (destination->history == NULL)
+        pcolony_setHistorySize(destination, source->history_size);
+    else
+        clearHistory(destination);
+#endif
+}
+
+void forkPcolony(Pcolony_t *destination, Pcolony_t *source) {
+    arena_fork_t fork;
+
+    if (source->share == NULL) {
+        //the tables are shared from now on, so everything that a simulation step could build later is built now and is (re)packed
+        //with the source, so that all of the shared tables are stored in the arena of the source and are never freed separately
+        buildPcolonyTables(source, TRUE);
+        packPcolony(source);
+        source->share = (pcolony_share_t *) LULU_MALLOC(sizeof(pcolony_share_t));
+        source->share->nr_colonies = 1;
+        source->share->arena = source->arena;
+        source->share->arena_size = source->arena_size;
+    }
+    source->share->nr_colonies++;
+
+    //the mutable state of the fork is stored in it's own arena, the shared tables stay where they are
+    //(the tables that the source rebuilt after they were cleared are it's own, so the fork gets a copy of them)
+    *destination = *source;
+    fork.share = source->share;
+    fork.size = 0;
+    visitPcolonyBlocks(destination, addForkBlockSize, addForkTableSize, &fork);
+    destination->arena = (uint8_t *) LULU_MALLOC(fork.size);
+    destination->arena_size = fork.size;
+    fork.next = destination->arena;
+    visitPcolonyBlocks(destination, copyForkBlock, copyForkTable, &fork);
+    attachCopiedPcolony(destination, source);
+}
+
+/**
+ * @brief Free the blocks of a P colony that shares it's program tables with other colonies (see forkPcolony())
+ * The shared tables are stored in the arena of the shared tables, which is freed with the last colony that uses them. The tables that
+ * the colony rebuilt after they were cleared are it's own blocks and are freed with it.
+ *
+ * @param pcol The P colony
+ */
+static void destroySharedPcolony(Pcolony_t *pcol) {
+    pcolony_share_t *share = pcol->share;
+    uint8_t *share_arena = share->arena;
+
+    share->nr_colonies--;
+    visitPcolonyBlocks(pcol, freeOutsideArena, freeOutsideArena, pcol);
+
+    //the arena of the colony that was forked first also stores tables
+    if (pcol->arena != share_arena)
+        LULU_FREE(pcol->arena);
+    if (share->nr_colonies == 0) {
+        LULU_FREE(share_arena);
+        LULU_FREE(share);
+    }
+    pcol->share = NULL;
+}
+#endif
+
 void destroyPcolony(Pcolony_t *pcol) {
+#ifdef LULU_THREADS
+    //stop the workers before the agents are destroyed
+    pcolony_setThreads(pcol, 0);
+#endif
+#ifdef PCOLONY_ARENA
+    if (pcol->share != NULL || pcol->arena != NULL) {
+        if (pcol->share != NULL)
+            destroySharedPcolony(pcol);
+        else {
+            //only the structures rebuilt after packPcolony() are stored outside of the arena
+            visitPcolonyBlocks(pcol, freeOutsideArena, freeOutsideArena, pcol);
+            LULU_FREE(pcol->arena);
+        }
+        pcol->arena = NULL;
+        pcol->arena_size = 0;
+        pcol->agents = NULL;
+        pcol->nr_agents = 0;
+        //the multisets are marked as destroyed (see destroyMultisetEnv())
+        pcol->env.size = 0;
+        pcol->pswarm.global_env.size = 0;
+        pcol->pswarm.in_global_env.size = 0;
+        pcol->pswarm.out_global_env.size = 0;
+        pcol->runnable_agents = NULL;
+        pcol->agent_order = NULL;
+        pcol->reservations = NULL;
+        pcol->nr_reservations = 0;
+#ifdef CONFIG_HASH
+        pcol->history = NULL;
+        pcol->history_size = 0;
+#endif
+#ifdef STEP_LEAPING
+        pcol->leap_limits = NULL;
+        pcol->leap_deltas = NULL;
+        pcol->leap_keys = NULL;
+#endif
+#ifdef INCREMENTAL_SELECTION
+        pcol->dependency_start = NULL;
+        pcol->dependent_programs = NULL;
+#endif
+        pcol->n = 0;
+        return;
+    }
+#endif
 
     //free agents
     if (pcol->nr_agents > 0) {
         for (uint8_t i = 0; i < pcol->nr_agents; i++)
             destroyAgent(&pcol->agents[i]);
         //free agent list
-        free(pcol->agents);
+        LULU_FREE(pcol->agents);
         pcol->nr_agents = 0;
     }
 
@@ -1115,41 +3615,157 @@ void destroyPcolony(Pcolony_t *pcol) {
     destroyMultisetEnv(&pcol->pswarm.in_global_env);
     destroyMultisetEnv(&pcol->pswarm.out_global_env);
 
+    LULU_FREE(pcol->runnable_agents);
+    LULU_FREE(pcol->agent_order);
+    LULU_FREE(pcol->reservations);
+    pcol->runnable_agents = NULL;
+    pcol->agent_order = NULL;
+    pcol->reservations = NULL;
+    pcol->nr_reservations = 0;
+#ifdef CONFIG_HASH
+    pcolony_setHistorySize(pcol, 0);
+#endif
+#ifdef STEP_LEAPING
+    clearPcolonyLeapLimits(pcol);
+#endif
+#ifdef INCREMENTAL_SELECTION
+    LULU_FREE(pcol->dependency_start);
+    LULU_FREE(pcol->dependent_programs);
+    pcol->dependency_start = NULL;
+    pcol->dependent_programs = NULL;
+#endif
+
     pcol->n = 0;
 }
 
+void initPswarm(Pswarm_t *pswarm, object_id_t nr_A, uint16_t max_colonies) {
+    initMultisetEnv(&pswarm->global_env, nr_A);
+    initMultisetEnv(&pswarm->in_global_env, nr_A);
+    initMultisetEnv(&pswarm->out_global_env, nr_A);
+    pswarm->colonies = (Pcolony_t *) LULU_MALLOC(sizeof(Pcolony_t) * max_colonies);
+    pswarm->nr_colonies = 0;
+    pswarm->max_colonies = max_colonies;
+#ifdef CONCURRENT_ENVS
+    pswarm->concurrent = FALSE;
+    pswarm->nr_rollbacks = 0;
+#endif
+}
+
+Pcolony_t* pswarm_addColony(Pswarm_t *pswarm, Pcolony_t *pcol) {
+    Pcolony_t *colony;
+
+    if (pswarm->nr_colonies == pswarm->max_colonies)
+        return NULL;
+
+    colony = &pswarm->colonies[pswarm->nr_colonies++];
+    copyPcolony(colony, pcol);
+    colony->swarm = pswarm;
+#ifdef CONFIG_HASH
+    pcolony_setHistorySize(colony, 0);
+#endif
+#ifdef STEP_LEAPING
+    pcolony_setLeaping(colony, 0);
+#endif
+
+    return colony;
+}
+
+void destroyPswarm(Pswarm_t *pswarm) {
+    for (uint16_t colony_nr = 0; colony_nr < pswarm->nr_colonies; colony_nr++)
+        destroyPcolony(&pswarm->colonies[colony_nr]);
+    LULU_FREE(pswarm->colonies);
+    pswarm->colonies = NULL;
+    pswarm->nr_colonies = 0;
+    pswarm->max_colonies = 0;
+
+    destroyMultisetEnv(&pswarm->global_env);
+    destroyMultisetEnv(&pswarm->in_global_env);
+    destroyMultisetEnv(&pswarm->out_global_env);
+}
+
 void initAgent(Agent_t *agent, Pcolony_t *pcol, uint8_t nr_programs) {
     agent->nr_programs = nr_programs;
-    agent->chosenProgramNr = -1;
+    agent->chosenProgramNr = NO_PROGRAM;
     agent->init_program_nr = 0;
 
     agent->pcolony = pcol;
-    agent->programs = (Program_t *) malloc(sizeof(Program_t) * agent->nr_programs);
+    agent->programs = (Program_t *) LULU_MALLOC(sizeof(Program_t) * agent->nr_programs);
 
     //initialize the agent's multiset at the size of the P colonies capacity
-    initMultisetObj(&agent->obj, pcol->n);
+    initMultisetObj(&agent->obj, pcol->n, pcol->nr_A);
+    agent->alternatives = (uint8_t *) LULU_MALLOC(ALTERNATIVES_SIZE(agent));
+    for (uint16_t i = 0; i < ALTERNATIVES_SIZE(agent); i++)
+        agent->alternatives[i] = 0;
+#ifdef LULU_THREADS
+    agent->executable_programs = (uint8_t *) LULU_MALLOC(sizeof(uint8_t) * agent->nr_programs);
+    agent->nr_executable_programs = 0;
+#endif
+#ifndef PRECOMPILED_PROGRAMS
+    agent->compiled_conditionals = NULL;
+    agent->compiled_requirements = NULL;
+    agent->compiled_ops = NULL;
+    agent->compiled_program_nr = NO_PROGRAM;
+#endif
+#ifdef GUARD_TREE
+    agent->guard_nodes = NULL;
+    agent->guard_programs = NULL;
+    agent->nr_guard_nodes = 0;
+#endif
 }
 
 void destroyAgent(Agent_t *agent) {
     destroyMultisetObj(&agent->obj);
 
     //destroy programs
-    if (agent->nr_programs > 0) {
-        for (uint8_t i = 0; i < agent->nr_programs; i++)
-            destroyProgram(&agent->programs[i]);
-        //free the programs list
-        free(agent->programs);
-        agent->nr_programs = 0;
-    }
+    for (uint8_t i = 0; i < agent->nr_programs; i++)
+        destroyProgram(&agent->programs[i]);
+    //free the programs list (initAgent() allocates it even for an agent without programs)
+    LULU_FREE(agent->programs);
+    agent->programs = NULL;
+    agent->nr_programs = 0;
+    LULU_FREE(agent->alternatives);
+    agent->alternatives = NULL;
+#ifndef PRECOMPILED_PROGRAMS
+    //the programs are already destroyed, so the tables are not used anymore
+    clearAgentCompiledTables(agent);
+#endif
+#ifdef GUARD_TREE
+    clearAgentGuardTree(agent);
+#endif
+#ifdef LULU_THREADS
+    LULU_FREE(agent->executable_programs);
+    agent->executable_programs = NULL;
+#endif
 
     agent->pcolony = 0;
-    agent->chosenProgramNr = -1;
+    agent->chosenProgramNr = NO_PROGRAM;
 }
 
 void initProgram(Program_t *program, uint8_t nr_rules) {
     program->nr_rules = nr_rules;
-    program->rules = (Rule_t *) malloc(sizeof(Rule_t) * program->nr_rules);
+    program->rules = (Rule_t *) LULU_MALLOC(sizeof(Rule_t) * program->nr_rules);
+#ifdef MAPPED_RULES
+    program->mapped_rules = FALSE;
+#endif
+    program->compiled = FALSE;
+    clearCompiledProgram(program, NULL);
+#ifdef INCREMENTAL_SELECTION
+    program->executable = FALSE;
+#endif
+}
+
+#ifdef MAPPED_RULES
+void initProgramWithRules(Program_t *program, uint8_t nr_rules, Rule_t *rules) {
+    program->nr_rules = nr_rules;
+    program->rules = rules;
+    program->mapped_rules = TRUE;
+    program->compiled = FALSE;
+    clearCompiledProgram(program, NULL);
+#ifdef INCREMENTAL_SELECTION
+    program->executable = FALSE;
+#endif
 }
+#endif
 
 void copyProgram(Program_t *destination, Program_t *source) {
     initProgram(destination, source->nr_rules);
@@ -1164,12 +3780,16 @@ void copyProgram(Program_t *destination, Program_t *source) {
 
 void destroyProgram(Program_t *program) {
     if (program->nr_rules > 0) {
-        free(program->rules);
+#ifdef MAPPED_RULES
+        if (!program->mapped_rules)
+#endif
+        LULU_FREE(program->rules);
         program->nr_rules = 0;
     }
+    clearCompiledProgram(program, NULL);
 }
 
-void initRule(Rule_t *rule, rule_type_t type, uint8_t lhs, uint8_t rhs, uint8_t alt_lhs, uint8_t alt_rhs) {
+void initRule(Rule_t *rule, rule_type_t type, object_id_t lhs, object_id_t rhs, object_id_t alt_lhs, object_id_t alt_rhs) {
     rule->type = type;
     rule->lhs = lhs;
     rule->rhs = rhs;
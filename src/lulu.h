@@ -17,23 +17,99 @@
 #define FALSE 0
 
 #define NO_OBJECT 0 // -1 is not available for uint
-
-#define COUNT_INCREMENT 254
-#define COUNT_DECREMENT 255
+#define NO_PROGRAM UINT8_MAX // value of Agent.chosenProgramNr when no program is chosen (an agent has at most UINT8_MAX programs)
 
 #define OBJECT_ID_E 1
 #define OBJECT_ID_F 2
 
 typedef uint8_t bool;
 
+// width (in bits) of object ids (8 / 16), an alphabet can have at most 2^OBJECT_ID_BITS - 1 objects
+#ifndef OBJECT_ID_BITS
+    #define OBJECT_ID_BITS 8
+#endif
+
+#if OBJECT_ID_BITS == 16
+    typedef uint16_t object_id_t;
+#elif OBJECT_ID_BITS == 8
+    typedef uint8_t object_id_t;
+#else
+    #error "OBJECT_ID_BITS must be 8 or 16"
+#endif
+
+// width (in bits) of the object counts stored in environment multisets (8 / 16 / 32)
+#ifndef MULTISET_COUNT_BITS
+    #define MULTISET_COUNT_BITS 8
+#endif
+
+#if MULTISET_COUNT_BITS == 32
+    typedef uint32_t multiset_count_t;
+    #define MULTISET_COUNT_MAX UINT32_MAX
+#elif MULTISET_COUNT_BITS == 16
+    typedef uint16_t multiset_count_t;
+    #define MULTISET_COUNT_MAX UINT16_MAX
+#elif MULTISET_COUNT_BITS == 8
+    typedef uint8_t multiset_count_t;
+    #define MULTISET_COUNT_MAX UINT8_MAX
+#else
+    #error "MULTISET_COUNT_BITS must be 8, 16 or 32"
+#endif
+
+#ifdef LULU_COUNT_ALLOCS
+    // number of heap allocations / deallocations made by the library (used to check that simulation steps do not allocate memory)
+    extern uint32_t lulu_nr_allocs, lulu_nr_frees;
+    #define LULU_MALLOC(size) (lulu_nr_allocs++, malloc(size))
+    // a realloc of an existing block counts as the allocation of the new block and the deallocation of the old one
+    #define LULU_REALLOC(ptr, size) (lulu_nr_allocs++, lulu_nr_frees += ((ptr) != NULL), realloc(ptr, size))
+    #define LULU_FREE(ptr) (lulu_nr_frees += ((ptr) != NULL), free(ptr))
+#else
+    #define LULU_MALLOC(size) malloc(size)
+    #define LULU_REALLOC(ptr, size) realloc(ptr, size)
+    #define LULU_FREE(ptr) free(ptr)
+#endif
+
+#ifdef MULTISET_PRESENCE
+    // each multiset keeps a bitset of nr_A bits where bit i is set if object i is present in the multiset
+    typedef uint32_t presence_word_t;
+    #define PRESENCE_WORD_BITS 32
+    // nr of presence_word_t words needed for a bitset of nr_A bits
+    #define PRESENCE_NR_WORDS(nr_A) (((nr_A) + PRESENCE_WORD_BITS - 1) / PRESENCE_WORD_BITS)
+    // check whether the bit of obj is set in the presence bitset
+    #define IS_PRESENCE_BIT_SET(presence, obj) (((presence)[(obj) / PRESENCE_WORD_BITS] >> ((obj) % PRESENCE_WORD_BITS)) & 1)
+#endif
+
+#ifdef CONFIG_HASH
+    // each multiset keeps a Zobrist hash of it's contents (xor of the keys of each (object, count) pair that is present)
+    typedef uint64_t config_hash_t;
+#endif
+
+#if defined(INCREMENTAL_SELECTION) && !defined(MULTISET_PRESENCE)
+    #error "INCREMENTAL_SELECTION requires MULTISET_PRESENCE"
+#endif
+
+// these options use the compiled tables of all of the programs of a colony at once
+#if !defined(PRECOMPILED_PROGRAMS) && (defined(MULTISET_PRESENCE) || defined(GUARD_TREE) || defined(PCOLONY_ARENA) || \
+        defined(STEP_LEAPING) || defined(LULU_THREADS))
+    #error "MULTISET_PRESENCE, GUARD_TREE, PCOLONY_ARENA, STEP_LEAPING and LULU_THREADS require PRECOMPILED_PROGRAMS"
+#endif
+
+#if defined(LULU_PROCESSES) && defined(MULTISET_ENV_DENSE)
+    // the global environments of a swarm can be updated by several processes at the same time (each count is a single word of the dense
+    // layout, so it can be changed with atomic operations, see Pswarm.concurrent)
+    #define CONCURRENT_ENVS
+#endif
+
 /**
- * @brief Enumeration of rule selection options (used mainly for marking the executable rule from a conditional rule)
+ * @brief Enumeration of the multisets that can be accessed by a rule of an agent
  */
-typedef enum _rule_exec_option {
-    RULE_EXEC_OPTION_NONE,
-    RULE_EXEC_OPTION_FIRST,
-    RULE_EXEC_OPTION_SECOND
-} rule_exec_option_t;
+typedef enum _multiset_target {
+    MULTISET_TARGET_OBJ, // Agent.obj
+    MULTISET_TARGET_ENV, // Pcolony.env
+    MULTISET_TARGET_GLOBAL_ENV, // Pswarm.global_env
+    MULTISET_TARGET_IN_GLOBAL_ENV, // Pswarm.in_global_env
+    MULTISET_TARGET_OUT_GLOBAL_ENV, // Pswarm.out_global_env
+    MULTISET_TARGET_NONE // the rule does not access any environment (also the number of valid targets)
+} multiset_target_t;
 
 /**
  * @brief Enumeration of possible results of running a simulation step
@@ -41,35 +117,78 @@ typedef enum _rule_exec_option {
 typedef enum _sim_step_result {
     SIM_STEP_RESULT_FINISHED,
     SIM_STEP_RESULT_NO_MORE_EXECUTABLES,
-    SIM_STEP_RESULT_ERROR
+    SIM_STEP_RESULT_ERROR,
+    SIM_STEP_RESULT_CYCLE // the configuration was already visited (only if CONFIG_HASH is defined, see pcolony_setHistorySize())
 } sim_step_result_t;
 
 /**
  * @brief Structure used to retain a symbolic object present in multiset containers such as Pcolony.env, Pswarm.global_env
  */
 typedef struct _multiset_env_item {
-    uint8_t id, // object id (index from alphabet)
-            nr; // nr of objects of this type
+    object_id_t id; // object id (index from alphabet)
+    multiset_count_t nr; // nr of objects of this type
 } multiset_env_item_t;
 
 /**
  * @brief Structure used to define a multiset that can hold simbolic objects and the number of times they appear for use with environment / global environment of P colonies or P swarms
  * This structure is adequate for environments because it eficiently stores the number of appereances of a symbolic object.
+ *
+ * If MULTISET_ENV_DENSE is defined, the multiset is a count vector indexed by object id (items[obj].nr is the count of obj,
+ * items[obj].id is obj or NO_OBJECT if the count is 0) so that lookups and updates do not need to search the items array.
+ * Otherwise, items is a list of slots where each object can be stored in any free slot (smaller code for AVR).
+ * In both cases the multiset has to be modified only through the multiset functions.
  */
 typedef struct _multiset_env {
     multiset_env_item_t *items;
-    uint8_t size;
+    object_id_t size;
+#ifdef MULTISET_PRESENCE
+    presence_word_t *presence; // bitset of the objects that are present (size bits)
+#endif
+#ifdef INCREMENTAL_SELECTION
+    presence_word_t *changed; // bitset of the objects whose count changed since the last simulation step
+#endif
+#ifdef CONFIG_HASH
+    config_hash_t hash; // hash of the contents, updated by the multiset functions
+#endif
 } multiset_env_t;
 
 /**
  * @brief Multiset structure used for limited storage components such as the objects from an Agent (that are limited by the capacity of the P colony)
+ *
+ * If MULTISET_OBJ_COUNTED is defined, the objects are stored as a list of (id, nr) runs sorted by id,
+ * which allows single pass count changes and a linear time inclusion test.
+ * Otherwise, each object occupies one slot of the items array (NO_OBJECT marks an empty slot).
  */
 typedef struct _multiset_obj {
-    uint8_t *items;
-    uint8_t size;
+#ifdef MULTISET_OBJ_COUNTED
+    multiset_env_item_t *items; // runs of objects sorted by id (only the first nr_runs are valid)
+    uint8_t nr_runs, // nr of distinct objects
+            nr_objects; // total nr of objects (sum of all counts)
+#else
+    object_id_t *items;
+#endif
+    uint8_t size; // capacity of the multiset
+#ifdef MULTISET_PRESENCE
+    object_id_t alphabet_size; // nr of objects from the alphabet (nr of bits of the presence bitset)
+    presence_word_t *presence; // bitset of the objects that are present
+#endif
+#ifdef INCREMENTAL_SELECTION
+    presence_word_t *changed; // bitset of the objects whose count changed since the last simulation step
+#endif
+#ifdef CONFIG_HASH
+    config_hash_t hash; // hash of the contents, updated by the multiset functions
+#endif
 } multiset_obj_t;
 
 typedef struct _Pswarm Pswarm_t;
+#ifdef LULU_THREADS
+typedef struct _thread_pool thread_pool_t;
+// job run by each worker of a thread pool (worker_nr = 0 .. nr_threads - 1, worker 0 is the calling thread)
+typedef void (*thread_job_t)(void *context, uint8_t worker_nr, uint8_t nr_threads);
+#endif
+#ifdef PCOLONY_ARENA
+typedef struct _pcolony_share pcolony_share_t;
+#endif
 typedef struct _Pcolony Pcolony_t;
 typedef struct _Agent Agent_t;
 typedef struct _Program Program_t;
@@ -77,59 +196,237 @@ typedef struct _Rule Rule_t;
 
 /**
  * @brief Rule struct used to represent rules that compose a program.
+ * Rules are not modified by the simulation, the alternatives chosen for conditional rules are stored by the agent (see Agent.alternatives)
  */
 struct _Rule {
-    rule_type_t type; // defines the type of the entire rule (including conditional combinations) using rule_type_t
-    rule_exec_option_t exec_rule_nr; // retains the rule marked for execution (none, first, second)
-    uint8_t lhs, // Left Hand Side operand
+    uint8_t type; // defines the type of the entire rule (including conditional combinations) using rule_type_t (one byte even without -fshort-enums)
+    object_id_t lhs, // Left Hand Side operand
             rhs, // Right Hand Side operand
             alt_lhs, // Left Hand Side operand for alternative rule
             alt_rhs; // Right Hand Side operand for alternative rule
 };
 
+/**
+ * @brief Number of copies of an object that a program needs from one of the multisets accessed by an agent
+ */
+typedef struct _requirement {
+    object_id_t obj; // required object
+    uint8_t nr; // nr of copies of obj that are needed
+    multiset_target_t target; // multiset that has to contain the objects
+} requirement_t;
+
+/**
+ * @brief Change of the count of one object in one of the multisets accessed by an agent, used to execute compiled programs
+ */
+typedef struct _delta_op {
+    object_id_t obj; // object whose count is changed
+    int16_t delta; // change of the count (negative if objects are removed)
+    multiset_target_t target; // multiset that is changed
+} delta_op_t;
+
+/**
+ * @brief Requirements of both alternatives of a conditional rule
+ * The lhs requirement ([0]) always targets MULTISET_TARGET_OBJ, the rhs requirement ([1]) of an evolution rule targets MULTISET_TARGET_NONE
+ */
+typedef struct _conditional_requirement {
+    uint8_t rule_nr; // position of the conditional rule in the program
+    requirement_t first[2], // lhs / rhs requirements of the first rule
+                  second[2]; // lhs / rhs requirements of the second (alternative) rule
+    delta_op_t ops[2][4]; // changes made by the first ([0]) / second ([1]) rule
+    uint8_t nr_ops[2];
+} conditional_requirement_t;
+
 /**
  * @brief Program struct used to encapsulate a list o rules.
  */
 struct _Program {
     uint8_t nr_rules;
     Rule_t *rules;
+
+#ifdef MAPPED_RULES
+    bool mapped_rules; // the rules are stored in memory that is not owned by the program (see initProgramWithRules())
+#endif
+
+    // the requirements are compiled by compileProgram() before the first check of this program in agent_choseProgram()
+    // without PRECOMPILED_PROGRAMS only the last program compiled by an agent is compiled, in the tables of the agent
+    bool compiled;
+    uint8_t nr_requirements, // nr of requirements of the non-conditional rules (one per object and multiset)
+            nr_conditionals; // nr of conditional rules
+    requirement_t *requirements; // requirements of the non-conditional rules (including the e->e rules that are not stored)
+    conditional_requirement_t *conditionals; // requirements of the conditional rules
+    uint8_t nr_ops; // nr of delta operations of the non-conditional rules
+    delta_op_t *ops; // changes made by the non-conditional rules (identical objects merged, no-op changes removed, negative deltas first)
+#ifdef MULTISET_PRESENCE
+    // objects that have to be present in each multiset (MULTISET_TARGET_NONE masks of nr_A bits) for the program to be executable
+    presence_word_t *presence_mask;
+#endif
+#ifdef INCREMENTAL_SELECTION
+    bool dirty, // TRUE if the program has to be checked again by agent_choseProgram() because one of it's objects has changed
+         executable; // result of the last check of the program
+#endif
 };
 
+/**
+ * @brief Reference to a program of an agent, used by the dependency index of a P colony
+ */
+typedef struct _program_ref {
+    uint8_t agent_nr,
+            program_nr;
+} program_ref_t;
+
+/**
+ * @brief Number of copies of an object from an environment that are reserved by agents during the selection phase of a simulation step
+ */
+typedef struct _reservation {
+    object_id_t obj; // reserved object
+    multiset_count_t nr; // nr of reserved copies of obj
+    multiset_target_t target; // environment that contains the objects
+} reservation_t;
+
+#ifdef CONFIG_HASH
+/**
+ * @brief Entry of the configuration history of a P colony
+ */
+typedef struct _history_entry {
+    config_hash_t hash; // hash of the configuration
+    uint32_t step_nr, // simulation step that started from this configuration
+             generation; // the entry is valid only if it is equal to Pcolony.history_generation
+} history_entry_t;
+#endif
+
+#ifdef GUARD_TREE
+/**
+ * @brief Node of the guard tree of an agent, that groups the programs of the agent by their shared requirements
+ * A program is executable only if the requirements of all of the nodes from the root to the node of the program are met
+ */
+typedef struct _guard_node {
+    requirement_t requirement; // requirement checked by this node (MULTISET_TARGET_NONE for the root)
+    uint16_t skip; // index of the first node that follows the subtree of this node (used when the requirement is not met)
+    uint8_t first_program, // the programs whose requirements end at this node are guard_programs[first_program] ...
+            end_program; // ... guard_programs[end_program - 1]
+} guard_node_t;
+#endif
+
 /**
  * @brief Agent struct used to represent a P colony agent.
  */
 struct _Agent {
     uint8_t nr_programs,
-            chosenProgramNr, // the program number that was chosen for execution
+            chosenProgramNr, // the program number that was chosen for execution (NO_PROGRAM if none)
             init_program_nr; //the number of programs that were initialized
     Pcolony_t *pcolony; // reference to my parent colony (for acces to env)
 
     //we could have used Program_t programs[] but in struct we are only alowed ONE variable lenght array
     Program_t *programs; // list of programs (each program is a list of n  Rule_t structs)
     multiset_obj_t obj; // objects stored by the agent (stored as a multiset using a pair id - nr_objects)
+    // bit (prg_nr * n + c) is set if conditional rule c of program prg_nr uses it's second rule (set by agent_choseProgram())
+    uint8_t *alternatives;
+
+#ifdef LULU_THREADS
+    // programs found executable by the worker pool in the current step, in the order in which agent_choseProgram() finds them
+    uint8_t *executable_programs;
+    uint8_t nr_executable_programs;
+#endif
+
+#ifndef PRECOMPILED_PROGRAMS
+    // compiled tables of the program that was checked last, sized for the largest program of the agent (allocated by the first check)
+    conditional_requirement_t *compiled_conditionals; // start of the single block that also stores the other tables
+    requirement_t *compiled_requirements;
+    delta_op_t *compiled_ops;
+    uint8_t compiled_program_nr; // the program that uses the tables (NO_PROGRAM if none)
+#endif
+
+#ifdef GUARD_TREE
+    // guard tree stored in preorder, built by agent_choseProgram() before the first check of the programs (NULL until then)
+    guard_node_t *guard_nodes;
+    uint16_t nr_guard_nodes;
+    uint8_t *guard_programs; // program numbers, ordered by their requirements
+#endif
 };
 
 /**
  * @brief Pswarm class that holds all the components of an Pswarm (colony of colonies)
+ * Each P colony embeds a Pswarm that only holds the global environments seen by it's agents when the colony is simulated alone.
+ * A swarm initialized with initPswarm() owns it's colonies and all of them use it's global environments.
  */
 struct _Pswarm {
     multiset_env_t global_env, // store the objects from the global (swarm) environemnt
                    in_global_env, // store the objects from the INPUT global (swarm) environemnt
                    out_global_env; // store the objects from the OUTPUT global (swarm) environemnt
+    Pcolony_t *colonies; // colony array (NULL for the Pswarm embedded in a P colony)
+    uint16_t nr_colonies, // nr of colonies added with pswarm_addColony()
+             max_colonies; // size of the colony array
+#ifdef CONCURRENT_ENVS
+    bool concurrent; // the programs update the global environments with atomic operations (several processes execute programs at the same time)
+    uint32_t nr_rollbacks; // nr of programs that were not executed because another process consumed one of their global objects first
+#endif
 };
 
 /**
  * @brief Pcolony struct that holds all the components of a P colony.
  */
 struct _Pcolony {
-   uint8_t  nr_A, // nr of alphabet elements
-            nr_agents,
+   object_id_t nr_A; // nr of alphabet elements
+   uint8_t  nr_agents,
             n; // capacity
 
     //we could have used multiset_env_item_t env[] but in struct we are only alowed ONE variable lenght array
     multiset_env_t env; // store array of objects found in the environment (stored as a multiset using a pair id - nr_objects)
     Agent_t *agents; // agent array
     Pswarm_t pswarm; //reference to Pswarm
+    Pswarm_t *swarm; // swarm whose global environments are used by the agents (&pswarm unless the colony belongs to a swarm)
+
+    // scratch space of the simulation step, allocated during initialization so that simulation steps do not allocate memory
+    bool *runnable_agents; // runnable_agents[i] = TRUE -> agent i has chosen a program in the current step
+    uint8_t *agent_order; // order in which the agents choose their programs in the current step
+    reservation_t *reservations; // objects from environments reserved by the agents that have chosen a program in the current step
+    uint16_t nr_reservations; // nr of valid reservations (at most nr_agents * n)
+
+    bool random_agent_order; // if TRUE the agents choose their programs in a random order in each step, otherwise in the order of their numbers (default)
+    bool forced_step; // TRUE if no random choice was made in the current simulation step
+
+#ifdef LULU_THREADS
+    thread_pool_t *thread_pool; // workers that check the programs of the agents in parallel (NULL for sequential selection, see pcolony_setThreads())
+#endif
+
+    uint32_t rng_state; // state of the random number generator used to choose between executable programs (see pcolony_setSeed())
+
+#ifdef CONFIG_HASH
+    // hash table of the configurations visited since the last step that made a random choice (see pcolony_setHistorySize())
+    history_entry_t *history;
+    uint32_t history_size, // capacity of the history (power of 2, 0 if the history is disabled)
+             nr_history, // nr of valid entries
+             history_generation, // incremented to clear the history
+             history_step_nr; // nr of simulation steps since the history was enabled
+    uint32_t cycle_start, // first step of the detected cycle
+             cycle_period; // length of the detected cycle (1 for a fixed point, 0 if no cycle was detected)
+#endif
+
+#ifdef STEP_LEAPING
+    uint32_t max_leap, // maximum nr of steps added by a leap (0 if leaping is disabled, see pcolony_setLeaping())
+             nr_leaped_steps; // nr of steps that were added by the last call of pcolony_runSimulationStep() (after the step itself)
+    // leap_limits[target * nr_A + obj] = maximum number of copies of obj from environment target that a program can require
+    // it is built by pcolony_runSimulationStep() before the first simulation step (NULL until then)
+    uint8_t *leap_limits;
+    int32_t *leap_deltas; // scratch space: change of the count of each object of each multiset made by the current step
+    uint32_t *leap_keys; // scratch space: the target * nr_A + obj indexes of leap_deltas that were modified
+#endif
+
+#ifdef PCOLONY_ARENA
+    // single heap block that stores all of the arrays of the colony in traversal order (NULL if the colony is not packed, see packPcolony())
+    uint8_t *arena;
+    uint32_t arena_size;
+    // program tables shared by a forked colony and all of it's forks (NULL if the colony was never forked, see forkPcolony())
+    pcolony_share_t *share;
+#endif
+
+#ifdef INCREMENTAL_SELECTION
+    // dependency index: the programs that use object obj from multiset target are
+    // dependent_programs[dependency_start[target * nr_A + obj]] ... dependent_programs[dependency_start[target * nr_A + obj + 1] - 1]
+    // it is built by pcolony_runSimulationStep() before the first simulation step (NULL until then)
+    uint32_t *dependency_start;
+    program_ref_t *dependent_programs;
+#endif
 };
 
 /******************************************************************************************************************************/
@@ -144,15 +441,16 @@ struct _Pcolony {
  * @param multiset Pointer to the multiset that will be initialized
  * @param size The number of objects that this multiset will hold
  */
-void initMultisetEnv(multiset_env_t *multiset, uint8_t size);
+void initMultisetEnv(multiset_env_t *multiset, object_id_t size);
 
 /**
  * @brief Create an object multiset of the specified size
  *
  * @param multiset Pointer to the multiset that will be initialized
  * @param size The number of objects that this multiset will hold
+ * @param alphabet_size The number of objects from the alphabet (the ids of the objects are < alphabet_size)
  */
-void initMultisetObj(multiset_obj_t *multiset, uint8_t size);
+void initMultisetObj(multiset_obj_t *multiset, uint8_t size, object_id_t alphabet_size);
 
 /**
  * @brief Clear an initialized multiset by setting all objects to NO_OBJECT and count 0
@@ -182,6 +480,22 @@ void destroyMultisetEnv(multiset_env_t *multiset);
  */
 void destroyMultisetObj(multiset_obj_t *multiset);
 
+/**
+ * @brief Create a deep-copy of the source multiset and store it into the (uninitialized) destination multiset
+ *
+ * @param destination Multiset where the copy will be stored
+ * @param source Multiset that will be copied
+ */
+void copyMultisetEnv(multiset_env_t *destination, multiset_env_t *source);
+
+/**
+ * @brief Create a deep-copy of the source multiset and store it into the (uninitialized) destination multiset
+ *
+ * @param destination Multiset where the copy will be stored
+ * @param source Multiset that will be copied
+ */
+void copyMultisetObj(multiset_obj_t *destination, multiset_obj_t *source);
+
 /**
  * @brief Check that at least one of the provided symbolic objects is present in the multiset
  * This method is a optimization motivated compromise that allows to simultaneously check
@@ -195,7 +509,7 @@ void destroyMultisetObj(multiset_obj_t *multiset);
  *
  * @return TRUE / FALSE
  */
-bool areObjectsInMultisetEnv(multiset_env_t *multiset, uint8_t obj1, uint8_t obj2);
+bool areObjectsInMultisetEnv(multiset_env_t *multiset, object_id_t obj1, object_id_t obj2);
 
 /**
  * @brief Check that at least one of the provided symbolic objects is present in the multiset
@@ -210,7 +524,7 @@ bool areObjectsInMultisetEnv(multiset_env_t *multiset, uint8_t obj1, uint8_t obj
  *
  * @return TRUE / FALSE
  */
-bool areObjectsInMultisetObj(multiset_obj_t *multiset, uint8_t obj1, uint8_t obj2);
+bool areObjectsInMultisetObj(multiset_obj_t *multiset, object_id_t obj1, object_id_t obj2);
 
 /**
  * @brief Get the number of occurences of a symbolic object in a multiset
@@ -220,7 +534,7 @@ bool areObjectsInMultisetObj(multiset_obj_t *multiset, uint8_t obj1, uint8_t obj
  *
  * @return The number of occurences of the object in the multiset
  */
-uint8_t getObjectCountFromMultisetEnv(multiset_env_t *multiset, uint8_t obj);
+multiset_count_t getObjectCountFromMultisetEnv(multiset_env_t *multiset, object_id_t obj);
 
 /**
  * @brief Get the number of occurences of a symbolic object in a multiset
@@ -230,7 +544,7 @@ uint8_t getObjectCountFromMultisetEnv(multiset_env_t *multiset, uint8_t obj);
  *
  * @return The number of occurences of the object in the multiset
  */
-uint8_t getObjectCountFromMultisetObj(multiset_obj_t *multiset, uint8_t obj);
+uint8_t getObjectCountFromMultisetObj(multiset_obj_t *multiset, object_id_t obj);
 
 /**
  * @brief Set the number of occurences of a symbolic object in a multiset (and optionally delete the object)
@@ -239,11 +553,31 @@ uint8_t getObjectCountFromMultisetObj(multiset_obj_t *multiset, uint8_t obj);
  * @param obj The target object
  * @param newCount The new count that will corespond to the object
  *          if <=0 then the object is removed from the multiset
- *          newCount can be COUNT_INCREMENT / COUNT_DECREMENT to simplify the respective operations
  *
  * @return TRUE / FALSE depending on the success of the operation
  */
-bool setObjectCountFromMultisetEnv(multiset_env_t *multiset, uint8_t obj, uint8_t newCount);
+bool setObjectCountFromMultisetEnv(multiset_env_t *multiset, object_id_t obj, multiset_count_t newCount);
+
+/**
+ * @brief Increment by one the number of occurences of a symbolic object in a multiset
+ *
+ * @param multiset The multiset that will be modified
+ * @param obj The target object
+ *
+ * @return TRUE / FALSE depending on the success of the operation
+ *          FALSE is also returned if the count of the object is already MULTISET_COUNT_MAX (the count saturates instead of wrapping)
+ */
+bool incObjectCountFromMultisetEnv(multiset_env_t *multiset, object_id_t obj);
+
+/**
+ * @brief Decrement by one the number of occurences of a symbolic object in a multiset (the object is removed when its count reaches 0)
+ *
+ * @param multiset The multiset that will be modified
+ * @param obj The target object
+ *
+ * @return TRUE / FALSE depending on the success of the operation (FALSE if the object was not in the multiset)
+ */
+bool decObjectCountFromMultisetEnv(multiset_env_t *multiset, object_id_t obj);
 
 /**
  * @brief Set the number of occurences of a symbolic object in a multiset (and optionally delete the object)
@@ -252,11 +586,10 @@ bool setObjectCountFromMultisetEnv(multiset_env_t *multiset, uint8_t obj, uint8_
  * @param obj The target object
  * @param newCount The new count that will corespond to the object
  *          if <=0 then the object is removed from the multiset
- *          newCount can be COUNT_INCREMENT / COUNT_DECREMENT to simplify the respective operations
  *
  * @return TRUE / FALSE depending on the success of the operation
  */
-bool setObjectCountFromMultisetObj(multiset_obj_t *multiset, uint8_t obj, uint8_t newCount);
+bool setObjectCountFromMultisetObj(multiset_obj_t *multiset, object_id_t obj, uint8_t newCount);
 
 
 /**
@@ -267,7 +600,7 @@ bool setObjectCountFromMultisetObj(multiset_obj_t *multiset, uint8_t obj, uint8_
  *
  * @return TRUE / FALSE depending on the success of the operation
  */
-bool addObjectToMultisetObj(multiset_obj_t *multiset, uint8_t obj);
+bool addObjectToMultisetObj(multiset_obj_t *multiset, object_id_t obj);
 
 /**
  * @brief Deletes one symbolic object from a multiset_obj
@@ -277,7 +610,7 @@ bool addObjectToMultisetObj(multiset_obj_t *multiset, uint8_t obj);
  *
  * @return TRUE / FALSE depending on the success of the operation
  */
-bool delObjectFromMultisetObj(multiset_obj_t *multiset, uint8_t obj);
+bool delObjectFromMultisetObj(multiset_obj_t *multiset, object_id_t obj);
 
 /**
  * @brief Check whether one multiset is included in a parent multiset
@@ -303,14 +636,15 @@ bool isMultisetObjIncluded(multiset_obj_t *parent, multiset_obj_t *child);
  * @brief Replaces one symbolic object from a multiset with another object
  * This method only changes the id of the initial object to the final one,
  * not the associated number of appearences. 
+ * If MULTISET_ENV_DENSE is defined and the final object is already present, the count of the initial object is added to it's count.
  *
  * @param multiset The multiset where the inital object resides
  * @param initial_obj The id of the symbolic object that will be replaced
  * @param final_obj The id of the symbolic object that will replace the initial object
  *
- * @return TRUE / FALSE depending on the success of the operation
+ * @return TRUE / FALSE depending on the success of the operation (FALSE if the merged count would exceed MULTISET_COUNT_MAX)
  */
-bool replaceObjInMultisetEnv(multiset_env_t *multiset, uint8_t initial_obj, uint8_t final_obj);
+bool replaceObjInMultisetEnv(multiset_env_t *multiset, object_id_t initial_obj, object_id_t final_obj);
 
 /**
  * @brief Replaces one symbolic object from a multiset with another object
@@ -322,7 +656,7 @@ bool replaceObjInMultisetEnv(multiset_env_t *multiset, uint8_t initial_obj, uint
  *
  * @return TRUE / FALSE depending on the success of the operation
  */
-bool replaceObjInMultisetObj(multiset_obj_t *multiset, uint8_t initial_obj, uint8_t final_obj);
+bool replaceObjInMultisetObj(multiset_obj_t *multiset, object_id_t initial_obj, object_id_t final_obj);
 
 /**
  * @brief Replace ONLY one symbolic object from a multiset with another object
@@ -334,12 +668,14 @@ bool replaceObjInMultisetObj(multiset_obj_t *multiset, uint8_t initial_obj, uint
  *
  * @return TRUE / FALSE depending on the success of the operation
  */
-bool replaceOneObjInMultisetObj(multiset_obj_t *multiset, uint8_t initial_obj, uint8_t final_obj);
+bool replaceOneObjInMultisetObj(multiset_obj_t *multiset, object_id_t initial_obj, object_id_t final_obj);
 /******************************************************************************************************************************/
 //end Multiset auxiliary functions
 
 /**
  * @brief Chose an executable program (or chose stochastically from a list of executable programs)
+ * The executable programs are found in a single pass and one of them is chosen uniformly using reservoir sampling
+ * and the random number generator of the agent's P colony
  *
  * @param agent Pointer to the agent that will chose one of it's programs for execution
  *
@@ -350,14 +686,22 @@ bool agent_choseProgram(Agent_t *agent);
 /**
  * @brief Execute the selected program and modify the agent and the environement according to the rules
  *
+ * If the global environments are updated concurrently (see Pswarm.concurrent) and another process has consumed one of the global objects
+ * of the program since it was chosen, the program is rolled back and the agent does not execute anything in this step
+ *
  * @param agent Pointer to the agent that will execute one of it's (previously chosen) programs
  *
- * @return TRUE / FALSE depending on the succesfull execution the program
+ * @return TRUE / FALSE depending on the succesfull execution the program (TRUE for a rolled back program)
  */
 bool agent_executeProgram(Agent_t *agent);
 
 /**
  * @brief Runs 1 simulation step consisting of chosing (if available) and executing a program for each agent in the colony
+ * The agents choose their programs one after the other (see Pcolony.random_agent_order) and each agent reserves the objects that
+ * it takes from the environments, so the following agents only choose between programs that can still be executed and
+ * agents never compete for the same objects during execution
+ * If INCREMENTAL_SELECTION is defined, only the programs that use objects that have changed since the previous step
+ * (by program execution or by direct changes of the multisets) are checked again
  *
  * @param pcolony Pointer to the P colony where the simulation will take place
  *
@@ -366,6 +710,18 @@ bool agent_executeProgram(Agent_t *agent);
  */
 sim_step_result_t pcolony_runSimulationStep(Pcolony_t *pcolony);
 
+/**
+ * @brief Runs 1 simulation step of a swarm, consisting of 1 simulation step of each colony (in the order in which they were added)
+ * The colonies share the global environments of the swarm, so each colony sees the objects that were put or taken
+ * by the colonies that were stepped before it in the same swarm step
+ *
+ * @param pswarm The swarm (initialized with initPswarm())
+ *
+ * @return SIM_STEP_RESULT_ERROR if the step of a colony failed (the following colonies are not stepped),
+ * SIM_STEP_RESULT_NO_MORE_EXECUTABLES if no agent of any colony had an executable program, SIM_STEP_RESULT_FINISHED otherwise
+ */
+sim_step_result_t pswarm_runSimulationStep(Pswarm_t *pswarm);
+
 /**
  * @brief Return the type of the first rule from a conditional rule
  *
@@ -384,6 +740,34 @@ rule_type_t getFirstRuleTypeFromConditional(rule_type_t rule);
  */
 rule_type_t getSecondRuleTypeFromConditional(rule_type_t rule);
 
+/**
+ * @brief Return the multiset that is accessed by the right hand side of a (non-conditional) rule type
+ *
+ * @param type A non-conditional rule type (the first or second rule type of a conditional rule)
+ *
+ * @return MULTISET_TARGET_ENV / GLOBAL_ENV / IN_GLOBAL_ENV / OUT_GLOBAL_ENV or MULTISET_TARGET_NONE for evolution rules
+ */
+multiset_target_t getRuleTypeTarget(rule_type_t type);
+
+/**
+ * @brief Check whether a value read from outside of the program (e.g. from a file) is a valid rule type
+ *
+ * @param type The value
+ *
+ * @return TRUE for RULE_TYPE_EVOLUTION .. RULE_TYPE_OUT_EXTEROCEPTIVE and for the conditional rule types, FALSE otherwise
+ */
+bool isValidRuleType(uint32_t type);
+
+/**
+ * @brief Return the environment multiset that corresponds to a target, as seen by an agent
+ *
+ * @param agent The agent that accesses the multiset
+ * @param target One of the environment targets (MULTISET_TARGET_ENV ... MULTISET_TARGET_OUT_GLOBAL_ENV)
+ *
+ * @return Pointer to the environment multiset or NULL if target is not an environment
+ */
+multiset_env_t* getAgentTargetEnv(Agent_t *agent, multiset_target_t target);
+
 /**
  * @brief Initialize an already defined array with a default value
  *
@@ -401,16 +785,220 @@ void initArray(uint8_t *array, uint8_t array_size, uint8_t default_value);
  * @param nr_agents The number of agents
  * @param n The capacity of the P colony (nr of objects contained in each agent)
  */
-void initPcolony(Pcolony_t *pcol, uint8_t nr_A, uint8_t nr_agents, uint8_t n);
+void initPcolony(Pcolony_t *pcol, object_id_t nr_A, uint8_t nr_agents, uint8_t n);
+
+/**
+ * @brief Rebuild the multisets of an initialized P colony whose items were written directly as slots (instances generated for the
+ * slot based layout, that set pcol->env.items[k].id / .nr and pcol->agents[agent_nr].obj.items[k])
+ * The objects are added again using the multiset functions, so that the dense environments, the presence bitsets and the hashes match
+ * the contents. Multisets that were filled using the multiset functions are not changed. Has to be called before the first simulation step.
+ * Agent objects stored as counted runs (MULTISET_OBJ_COUNTED) cannot be written as slots, so they are left unchanged.
+ *
+ * @param pcol The P colony
+ *
+ * @return TRUE if all of the objects were added back, FALSE if an object is not part of the alphabet or a count saturated
+ */
+bool rebuildPcolonyMultisets(Pcolony_t *pcol);
+
+/**
+ * @brief Create a deep-copy of the source P colony (multisets, agents and programs) and store it into the destination P colony
+ * The copy has the same configuration and random number generator state as the source, it does not share any memory with it
+ * and it does not have a thread pool. The programs of the copy are compiled again when they are first checked.
+ *
+ * @param destination P colony where the copy will be stored (uninitialized)
+ * @param source P colony that will be copied
+ */
+void copyPcolony(Pcolony_t *destination, Pcolony_t *source);
+
+#ifdef PCOLONY_ARENA
+/**
+ * @brief Move all of the arrays of a P colony (agents, programs, rules, compiled programs, multisets and scratch space) into a single
+ * heap block, laid out in the order in which a simulation step traverses them
+ * The programs are compiled and the structures that are otherwise built by the first simulation step (guard trees, dependency index,
+ * leap limits) are built first, so that they are stored in the block too. Structures that are rebuilt later are allocated separately.
+ * Has to be called after the colony is completely initialized (and expanded): the agents and programs of a packed colony cannot be
+ * initialized or destroyed individually, only the whole colony can be destroyed with destroyPcolony(). The clear functions
+ * (clearCompiledProgram(), clearAgentGuardTree(), clearPcolonyDependencyIndex(), clearPcolonyLeapLimits()) only detach the tables stored
+ * in the block; the tables rebuilt afterwards are separate blocks that are freed by destroyPcolony() or moved into the block by packing
+ * the colony again.
+ *
+ * @param pcol The P colony (packed again into a new block if it is already packed, nothing is done if it was forked, see forkPcolony())
+ */
+void packPcolony(Pcolony_t *pcol);
+
+/**
+ * @brief Copy a P colony into a packed P colony with a single allocation and a single copy of the arena of the source
+ * The copy has the same properties as one made by copyPcolony(), except that it's programs are already compiled. The tables that the
+ * source rebuilt outside of it's arena after they were cleared (see packPcolony()) are copied to separate blocks of the copy.
+ * A source that is not packed (or that is a fork, see forkPcolony()) is copied with copyPcolony() and packed afterwards.
+ *
+ * @param destination P colony where the copy will be stored (uninitialized)
+ * @param source P colony that will be copied
+ */
+void clonePcolony(Pcolony_t *destination, Pcolony_t *source);
+
+/**
+ * @brief Fork a P colony: the fork continues from the current configuration of the source, but shares it's program tables with it
+ * Only the mutable state (multisets, agents, chosen programs and alternatives, scratch space and history) is copied, into a single heap
+ * block. The rules, compiled programs, guard trees, dependency index and leap limits are built in the source if needed and are then
+ * shared by the source and all of it's forks (and forks of forks), so their rules must not be changed afterwards (e.g. by expand_pcolony()).
+ * Clearing a shared table (see packPcolony()) detaches it from one colony only, which then rebuilds it's own copy.
+ * The shared tables are stored in the arena of the source and are freed with the last of these colonies, in any order of destroyPcolony() calls.
+ * Like copyPcolony(), the fork gets a copy of the global environments seen by the source and does not have a thread pool.
+ *
+ * @param destination P colony where the fork will be stored (uninitialized)
+ * @param source P colony that is forked (completely initialized and expanded, it is packed again by the first fork, see packPcolony())
+ */
+void forkPcolony(Pcolony_t *destination, Pcolony_t *source);
+#endif
+
+/**
+ * @brief Seed the random number generator of a P colony
+ * initPcolony() seeds it from the time (PC) or the battery voltage (Kilobot), so this function has to be called
+ * after initPcolony() in order to obtain reproducible runs
+ *
+ * @param pcol The P colony whose generator is seeded
+ * @param seed The seed (0 is replaced by a fixed non-zero seed)
+ */
+void pcolony_setSeed(Pcolony_t *pcol, uint32_t seed);
+
+#ifdef LULU_THREADS
+/**
+ * @brief Set the number of threads used by pcolony_runSimulationStep() to check the programs of the agents
+ * The programs of all of the agents are checked in parallel and the agents then choose (in order, using the random number
+ * generator of the colony) between their executable programs, so the results are identical to the sequential selection.
+ * The threads are stopped by destroyPcolony().
+ *
+ * @param pcol The P colony
+ * @param nr_threads Total number of threads, including the calling thread (0 or 1 for sequential selection)
+ *
+ * @return TRUE if all of the threads were created, FALSE otherwise (the threads that were created are used)
+ */
+bool pcolony_setThreads(Pcolony_t *pcol, uint8_t nr_threads);
+
+/**
+ * @brief Create a pool of threads that run the same job (see runThreadPool())
+ *
+ * @param pool_ptr Pointer to the location where the pool is stored
+ * @param nr_threads Total number of threads, including the calling thread (at least 2)
+ * @param job The job run by each thread
+ * @param context The argument of the job
+ *
+ * @return TRUE if all of the threads were created, FALSE otherwise (the threads that were created are used)
+ */
+bool createThreadPool(thread_pool_t **pool_ptr, uint8_t nr_threads, thread_job_t job, void *context);
+
+/**
+ * @brief Run the job of a thread pool once on every thread (including the calling thread) and wait for all of them to finish
+ *
+ * @param pool The thread pool
+ */
+void runThreadPool(thread_pool_t *pool);
+
+/**
+ * @brief Stop the threads of a thread pool and free it
+ *
+ * @param pool The thread pool
+ */
+void destroyThreadPool(thread_pool_t *pool);
+#endif
+
+#ifdef STEP_LEAPING
+/**
+ * @brief Enable the leaping mode of a P colony
+ * After a simulation step in which each agent had at most one executable program and the objects of all agents were not
+ * changed, pcolony_runSimulationStep() computes how many more times the same step can be executed before one of the changed
+ * environment counts reaches a value that could change the executable programs, and applies these steps at once.
+ * The result (including the state of the random number generator) is identical to running the steps one by one.
+ * The number of added steps is stored in Pcolony.nr_leaped_steps.
+ *
+ * @param pcol The P colony
+ * @param max_leap Maximum number of steps added by one leap (0 disables leaping)
+ */
+void pcolony_setLeaping(Pcolony_t *pcol, uint32_t max_leap);
+
+/**
+ * @brief Discard the leap limits of a P colony (they are rebuilt by the next simulation step)
+ * The limits are computed from the count changes of the compiled programs, so they have to be discarded whenever a rule of
+ * any program is changed or a program is added after the first simulation step
+ *
+ * @param pcol The P colony whose limits are discarded
+ */
+void clearPcolonyLeapLimits(Pcolony_t *pcol);
+#endif
+
+#ifdef CONFIG_HASH
+/**
+ * @brief Get the hash of the configuration of a P colony (contents of all environments and agents)
+ * The hashes of the multisets are maintained by the multiset functions, so this only combines nr_agents + 4 values
+ *
+ * @param pcol The P colony
+ *
+ * @return The hash of the configuration
+ */
+config_hash_t pcolony_getHash(Pcolony_t *pcol);
+
+/**
+ * @brief Enable the detection of cycles: pcolony_runSimulationStep() returns SIM_STEP_RESULT_CYCLE instead of running a step that
+ * starts from an already visited configuration
+ * Only the configurations visited since the last step that made a random choice are remembered, so a detected cycle is repeated forever
+ * (as long as the host application does not modify the multisets). The first step and the length of the cycle are stored in
+ * Pcolony.cycle_start and Pcolony.cycle_period (a period of 1 is a fixed point).
+ * When the history is half full it is cleared, so cycles longer than size / 2 steps are not detected and cycle_start
+ * can be later than the actual start of the cycle.
+ *
+ * @param pcol The P colony
+ * @param size Maximum number of remembered configurations (rounded up to a power of 2, 0 disables the detection)
+ */
+void pcolony_setHistorySize(Pcolony_t *pcol, uint32_t size);
+#endif
+
+/**
+ * @brief Get the next number from the random number generator of a P colony (xorshift32)
+ * Each colony has it's own generator, so colonies do not share any global random state
+ *
+ * @param pcol The P colony whose generator is used
+ *
+ * @return A pseudo-random 32 bit number
+ */
+uint32_t pcolony_rand(Pcolony_t *pcol);
 
 /**
  * @brief Destroy a P colony object and deallocate all ocupied space
- * This method also destroys all of the contained agents
+ * This method also destroys all of the contained agents (a packed colony frees it's arena at once, see packPcolony())
  *
  * @param pcol The P colony that will be destroyed
  */
 void destroyPcolony(Pcolony_t *pcol);
 
+/**
+ * @brief Initialize a swarm without colonies and with empty global environments
+ *
+ * @param pswarm The swarm that will be initialized
+ * @param nr_A The size of the alphabet (nr of objects, equal to the size of the alphabet of all colonies)
+ * @param max_colonies The maximum number of colonies
+ */
+void initPswarm(Pswarm_t *pswarm, object_id_t nr_A, uint16_t max_colonies);
+
+/**
+ * @brief Add a deep-copy of a P colony to a swarm (see copyPcolony())
+ * The agents of the copy use the global environments of the swarm instead of the ones of the colony.
+ * The cycle detection and the leaping mode of the copy are disabled because the global environments are changed by the other colonies.
+ *
+ * @param pswarm The swarm
+ * @param pcol The P colony that will be copied (it can be destroyed afterwards)
+ *
+ * @return Pointer to the copy or NULL if the swarm already has max_colonies colonies
+ */
+Pcolony_t* pswarm_addColony(Pswarm_t *pswarm, Pcolony_t *pcol);
+
+/**
+ * @brief Destroy a swarm, it's colonies and it's global environments
+ *
+ * @param pswarm The swarm that will be destroyed
+ */
+void destroyPswarm(Pswarm_t *pswarm);
+
 /**
  * @brief Initialize an Agent object
  *
@@ -436,6 +1024,19 @@ void destroyAgent(Agent_t *agent);
  */
 void initProgram(Program_t *program, uint8_t nr_rules);
 
+#ifdef MAPPED_RULES
+/**
+ * @brief Initialize a program that uses rules stored in read-only memory owned by the caller (e.g. a mapped instance image)
+ * The rules are used in place: they are never copied, moved by packPcolony() or freed by destroyProgram(), so they have to stay valid
+ * until all of the colonies that use them (including their clones and forks) are destroyed. copyProgram() makes an owned copy of them.
+ *
+ * @param program The program that will be initialized
+ * @param nr_rules The number of rules of the program
+ * @param rules The rules of the program
+ */
+void initProgramWithRules(Program_t *program, uint8_t nr_rules, Rule_t *rules);
+#endif
+
 /**
  * @brief Create a deep-copy of the source program and store it into the destination program
  *
@@ -451,6 +1052,82 @@ void copyProgram(Program_t *destination, Program_t *source);
  */
 void destroyProgram(Program_t *program);
 
+#ifdef PRECOMPILED_PROGRAMS
+/**
+ * @brief Compile the requirements of a program (the objects needed by each rule, grouped by the multiset that has to provide them)
+ * agent_choseProgram() compiles each program the first time it is checked, so rule changes made afterwards
+ * have to be followed by clearCompiledProgram(). Each table is allocated with the exact number of entries that the program uses.
+ * Without PRECOMPILED_PROGRAMS (e.g. on the Kilobot) the programs are not kept compiled: each agent compiles the program that it
+ * checks or executes into a single set of tables.
+ *
+ * @param program The program that will be compiled
+ * @param pcol The P colony of the agent that owns the program
+ */
+void compileProgram(Program_t *program, Pcolony_t *pcol);
+#endif
+
+/**
+ * @brief Discard the compiled requirements of a program (they are rebuilt by agent_choseProgram() when needed)
+ * The requirements of a packed or forked colony are stored in it's arena or are shared with it's forks, so they are only detached
+ * (and the rebuilt requirements are stored separately)
+ *
+ * @param program The program whose requirements are discarded
+ * @param pcol The P colony of the agent that owns the program (NULL if the colony is not packed)
+ */
+void clearCompiledProgram(Program_t *program, Pcolony_t *pcol);
+
+/**
+ * @brief Discard all of the tables that are built from the programs of a P colony (they are rebuilt when needed)
+ * These are the guard trees, the dependency index and the leap limits, and without PRECOMPILED_PROGRAMS the compiled tables of the agents.
+ * Has to be called after the objects used by the programs are replaced or after programs are added or removed (e.g. by wildcard expansion)
+ *
+ * @param pcol The P colony (not packed)
+ */
+void clearPcolonyProgramTables(Pcolony_t *pcol);
+
+#ifdef GUARD_TREE
+/**
+ * @brief Discard the guard tree of an agent (it is rebuilt by the next call of agent_choseProgram())
+ * The tree stores the requirements that the programs of the agent share, so it has to be discarded after programs are added to the agent
+ * or after the objects used by it's programs are replaced
+ *
+ * @param agent The agent whose guard tree is discarded
+ */
+void clearAgentGuardTree(Agent_t *agent);
+#endif
+
+#ifdef INCREMENTAL_SELECTION
+/**
+ * @brief Discard the dependency index of a P colony (it is rebuilt by the next simulation step and all programs are checked again)
+ * The index lists the programs that use each object, so it has to be discarded after an object used by a program is replaced
+ * (e.g. by wildcard expansion) or after programs are added to an agent
+ *
+ * @param pcol The P colony whose index is discarded
+ */
+void clearPcolonyDependencyIndex(Pcolony_t *pcol);
+
+/**
+ * @brief Mark as dirty the programs of a P colony that use any of the changed objects of an environment
+ * Used to notify a colony of the changes made by other colonies to environments that they share (the bitset is not cleared)
+ *
+ * @param pcol The P colony
+ * @param target The environment that contains the changed objects (any target except MULTISET_TARGET_OBJ)
+ * @param changed Bitset of the changed objects (PRESENCE_NR_WORDS(nr_A) words)
+ */
+void pcolony_markChangedObjects(Pcolony_t *pcol, multiset_target_t target, presence_word_t *changed);
+#endif
+
+#ifdef CONCURRENT_ENVS
+/**
+ * @brief Recompute the object ids and the presence bits of a dense environment multiset from it's counts
+ * Concurrent updates of the same object can store it's id and presence bit in any order (see Pswarm.concurrent), so they are only
+ * reliable after this call. Has to be called while no process updates the multiset (the counts, the hash and the changed bits are exact)
+ *
+ * @param multiset The environment multiset
+ */
+void syncSharedMultisetEnv(multiset_env_t *multiset);
+#endif
+
 /**
  * @brief Initialize a Rule object with the specified parameters
  *
@@ -461,6 +1138,6 @@ void destroyProgram(Program_t *program);
  * @param alt_lhs The OBJECT_ID_ value for the left-hand-side part of the secondary rule (only set for conditional rules)
  * @param alt_rhs The OBJECT_ID_ value for the right-hand-side part of the secondary rule (only set for conditional rules)
  */
-void initRule(Rule_t *rule, rule_type_t type, uint8_t lhs, uint8_t rhs, uint8_t alt_lhs, uint8_t alt_rhs);
+void initRule(Rule_t *rule, rule_type_t type, object_id_t lhs, object_id_t rhs, object_id_t alt_lhs, object_id_t alt_rhs);
 
 #endif
@@ -25,33 +25,28 @@ void lulu_init(Pcolony_t *pcol) {
     //Pcolony.alphabet = ['e', 'f', 'l_p']
 
     //init environment
-        pcol->env.items[0].id = OBJECT_ID_E;
-        pcol->env.items[0].nr = 1;
-
-        pcol->env.items[1].id = OBJECT_ID_F;
-        pcol->env.items[1].nr = 2;
+        //the multisets are filled using setObjectCountFromMultisetEnv() because their layout depends on the build options
+        setObjectCountFromMultisetEnv(&pcol->env, OBJECT_ID_E, 1);
+        setObjectCountFromMultisetEnv(&pcol->env, OBJECT_ID_F, 2);
     //end init environment
 
     //init global pswarm environment
-        pcol->pswarm.global_env.items[0].id = OBJECT_ID_E;
-        pcol->pswarm.global_env.items[0].nr = 2;
+        setObjectCountFromMultisetEnv(&pcol->pswarm.global_env, OBJECT_ID_E, 2);
     //end init global pswarm environment
 
     //init INPUT global pswarm environment
-        pcol->pswarm.in_global_env.items[0].id = OBJECT_ID_E;
-        pcol->pswarm.in_global_env.items[0].nr = 2;
+        setObjectCountFromMultisetEnv(&pcol->pswarm.in_global_env, OBJECT_ID_E, 2);
     //end init global pswarm environment
 
     //init OUTPUT global pswarm environment
-        pcol->pswarm.out_global_env.items[0].id = OBJECT_ID_E;
-        pcol->pswarm.out_global_env.items[0].nr = 2;
+        setObjectCountFromMultisetEnv(&pcol->pswarm.out_global_env, OBJECT_ID_E, 2);
     //end init global pswarm environment
 
     //init agent command
     initAgent(&pcol->agents[AGENT_COMMAND], pcol, 2);
         //init obj multiset
-        pcol->agents[AGENT_COMMAND].obj.items[0] = OBJECT_ID_E;
-        pcol->agents[AGENT_COMMAND].obj.items[1] = OBJECT_ID_E;
+        addObjectToMultisetObj(&pcol->agents[AGENT_COMMAND].obj, OBJECT_ID_E);
+        addObjectToMultisetObj(&pcol->agents[AGENT_COMMAND].obj, OBJECT_ID_E);
 
         //init programs
         initProgram(&pcol->agents[AGENT_COMMAND].programs[0], pcol->n);
@@ -73,10 +68,10 @@ void lulu_destroy(Pcolony_t *pcol) {
 
 #ifdef NEEDING_WILDCARD_EXPANSION
     uint16_t expand_pcolony(Pcolony_t *pcol, uint16_t my_id) {
-        uint8_t obj_with_id[] = {OBJECT_ID_B_$id, OBJECT_ID_S_$id, OBJECT_ID_ID_$id};
+        object_id_t obj_with_id[] = {OBJECT_ID_B_$id, OBJECT_ID_S_$id, OBJECT_ID_ID_$id};
         uint8_t obj_with_id_size = 3;
 
-        uint8_t obj_with_any[] = {OBJECT_ID_B_$};
+        object_id_t obj_with_any[] = {OBJECT_ID_B_$};
         //is the $ object followed by a $ID object in the alphabet
         // 0 means that in the alphabet we have B_$, B_0 B_1, B_2, ...
         // 1 means that in the alphabet we have B_$, B_$ID, B_0 B_1, B_2, ...
@@ -0,0 +1,1104 @@
+/**
+ * @file lulu_parser.c
+ * @brief Runtime parser of Lulu input files
+ * The blocks of the input (pswarm = {...}, pi = {...}) are first split into their key = value; entries, which are then parsed in the
+ * order in which the P colony is built: the alphabet, the capacity and the agents of the colony, the environments and the agents.
+ * Object names are interned in a hash table, so each object of the input is resolved in constant time.
+ * The whole input is checked before the colony is initialized.
+ */
+#include "lulu_parser.h"
+#include "wild_expand.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// suffixes of the wildcarded objects
+#define WILD_ANY_SUFFIX "_*"
+#define WILD_ID_SUFFIX "_%id"
+// the largest alphabet that fits in object_id_t (including NO_OBJECT)
+#define MAX_NR_A ((uint32_t) (object_id_t) ~0)
+// nr of non-conditional rule types (RULE_TYPE_EVOLUTION .. RULE_TYPE_OUT_EXTEROCEPTIVE)
+#define NR_SIMPLE_RULE_TYPES (RULE_TYPE_OUT_EXTEROCEPTIVE - RULE_TYPE_NONE)
+// nr of environments that can be declared (env, global_env, in_global_env, out_global_env)
+#define NR_ENVS 4
+// size of the blocks that store the names
+#define NAME_BLOCK_SIZE 4096
+// room needed for the _i suffix of an expanded object (the largest robot id has 5 digits) and the terminating 0
+#define EXPANSION_SUFFIX_SIZE 7
+
+/**
+ * @brief Block of memory that stores names (names never move, so the name lists of the instance can point to them)
+ */
+struct _lulu_name_block {
+    struct _lulu_name_block *next;
+    char names[];
+};
+
+/**
+ * @brief Part of the input text
+ */
+typedef struct _lulu_span {
+    const char *start;
+    uint32_t length;
+} lulu_span_t;
+
+/**
+ * @brief A key = value; entry of a block
+ */
+typedef struct _lulu_entry {
+    lulu_span_t key;
+    const char *value; // start of the value in the input text
+} lulu_entry_t;
+
+/**
+ * @brief Growable array used while parsing
+ */
+typedef struct _lulu_list {
+    void *items;
+    uint32_t nr,
+             max;
+} lulu_list_t;
+
+/**
+ * @brief State of the parser
+ */
+typedef struct _lulu_parser {
+    const char *text,
+               *end,
+               *pos; // current position in the text
+
+    const char *error, // first error found in the input
+               *error_pos; // it's position in the text
+    lulu_span_t error_name; // name of the object / agent / entry of the error (length = 0 if there is none)
+
+    LuluInstance_t *instance;
+    uint32_t max_objects; // capacity of instance->object_names
+    char *free_name; // next free byte of the last name block
+    uint32_t nr_free_chars;
+    bool *is_wild_any; // is_wild_any[obj] = TRUE -> obj ends with _*
+
+    lulu_list_t swarm_entries, // lulu_entry_t
+                colony_entries, // lulu_entry_t
+                alphabet, // lulu_span_t, the objects of A
+                agents, // lulu_span_t, the agents of B
+                names, // lulu_span_t, scratch list
+                env_objects[NR_ENVS], // object_id_t, the objects of each environment
+                agent_objects, // object_id_t, n objects for each agent
+                nr_programs, // uint8_t, nr of programs of each agent
+                nr_wild_programs, // uint8_t, nr of programs of each agent that contain W_ALL wildcards
+                rules; // Rule_t, n rules for each program
+} lulu_parser_t;
+
+/**
+ * @brief Add an item at the end of a list
+ *
+ * @param list The list
+ * @param item_size The size of the items of the list
+ *
+ * @return The new (uninitialized) item
+ */
+static void* appendToList(lulu_list_t *list, uint32_t item_size) {
+    if (list->nr == list->max) {
+        list->max = list->max > 0 ? 2 * list->max : 16;
+        list->items = LULU_REALLOC(list->items, (size_t) list->max * item_size);
+    }
+    return (uint8_t *) list->items + (size_t) item_size * list->nr++;
+}
+
+/**
+ * @brief Free the items of a list
+ *
+ * @param list The list
+ */
+static void destroyList(lulu_list_t *list) {
+    LULU_FREE(list->items);
+    list->items = NULL;
+    list->nr = list->max = 0;
+}
+
+/**
+ * @brief Record an error (only the first error is kept)
+ *
+ * @param parser The parser
+ * @param position Where the error was found in the text (NULL if it has no position)
+ * @param error The description of the error
+ * @param name The name that caused the error (NULL if there is none)
+ *
+ * @return FALSE
+ */
+static bool setParseError(lulu_parser_t *parser, const char *position, const char *error, lulu_span_t *name) {
+    if (parser->error == NULL) {
+        parser->error = error;
+        parser->error_pos = position;
+        if (name != NULL)
+            parser->error_name = *name;
+    }
+    return FALSE;
+}
+
+/**
+ * @brief Compare a name from the text with a string
+ *
+ * @param span The name
+ * @param name The string (terminated by 0)
+ *
+ * @return TRUE if they are equal, FALSE otherwise
+ */
+static bool isSpanEqual(lulu_span_t *span, const char *name) {
+    return strncmp(span->start, name, span->length) == 0 && name[span->length] == '\0';
+}
+
+/**
+ * @brief Check whether a name ends with a suffix
+ *
+ * @param span The name
+ * @param suffix The suffix
+ *
+ * @return TRUE if the name is longer than the suffix and ends with it, FALSE otherwise
+ */
+static bool hasSuffix(lulu_span_t *span, const char *suffix) {
+    uint32_t length = strlen(suffix);
+
+    return span->length > length && strncmp(span->start + span->length - length, suffix, length) == 0;
+}
+
+/**
+ * @brief Skip white space and comments (from # to the end of the line)
+ *
+ * @param parser The parser
+ */
+static void skipSpace(lulu_parser_t *parser) {
+    while (parser->pos < parser->end) {
+        if (*parser->pos == '#')
+            while (parser->pos < parser->end && *parser->pos != '\n')
+                parser->pos++;
+        else if (isspace((unsigned char) *parser->pos))
+            parser->pos++;
+        else
+            break;
+    }
+}
+
+/**
+ * @brief Check whether the next character is c and skip it if it is
+ *
+ * @param parser The parser
+ * @param c The character
+ *
+ * @return TRUE if the next character was c, FALSE otherwise
+ */
+static bool isNextChar(lulu_parser_t *parser, char c) {
+    skipSpace(parser);
+    if (parser->pos < parser->end && *parser->pos == c) {
+        parser->pos++;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * @brief Skip the next character, which has to be c
+ *
+ * @param parser The parser
+ * @param c The character
+ * @param error The error that is recorded if the next character is not c
+ *
+ * @return TRUE if the next character was c, FALSE otherwise
+ */
+static bool expectChar(lulu_parser_t *parser, char c, const char *error) {
+    if (!isNextChar(parser, c))
+        return setParseError(parser, parser->pos, error, NULL);
+    return TRUE;
+}
+
+/**
+ * @brief Parse a name (objects, agents, keys and numbers are made of letters, digits, _, * and %)
+ *
+ * @param parser The parser
+ * @param name Will store the name
+ *
+ * @return TRUE if a name was found, FALSE otherwise
+ */
+static bool parseName(lulu_parser_t *parser, lulu_span_t *name) {
+    skipSpace(parser);
+    name->start = parser->pos;
+    while (parser->pos < parser->end &&
+            (isalnum((unsigned char) *parser->pos) || *parser->pos == '_' || *parser->pos == '*' || *parser->pos == '%'))
+        parser->pos++;
+    name->length = parser->pos - name->start;
+
+    if (name->length == 0)
+        return setParseError(parser, parser->pos, "expected a name", NULL);
+    return TRUE;
+}
+
+/**
+ * @brief Skip a value (a name, a {...} set or block or a (...) agent), without checking it's contents
+ *
+ * @param parser The parser
+ *
+ * @return TRUE if the end of the value was found, FALSE otherwise
+ */
+static bool skipValue(lulu_parser_t *parser) {
+    const char *start = parser->pos;
+    uint32_t depth = 0;
+
+    while (1) {
+        char c;
+
+        skipSpace(parser);
+        if (parser->pos >= parser->end)
+            return setParseError(parser, start, "unterminated value", NULL);
+        c = *parser->pos;
+        if (depth == 0 && (c == ';' || c == '}' || c == ')'))
+            return TRUE;
+
+        parser->pos++;
+        if (c == '{' || c == '(')
+            depth++;
+        else if ((c == '}' || c == ')') && --depth == 0)
+            return TRUE;
+    }
+}
+
+/**
+ * @brief Split a {key = value; ...} block into it's entries
+ *
+ * @param parser The parser
+ * @param value The start of the block
+ * @param entries Will store the entries (lulu_entry_t)
+ *
+ * @return TRUE if the block was parsed, FALSE otherwise
+ */
+static bool parseBlock(lulu_parser_t *parser, const char *value, lulu_list_t *entries) {
+    parser->pos = value;
+    if (!expectChar(parser, '{', "expected {"))
+        return FALSE;
+
+    while (!isNextChar(parser, '}')) {
+        lulu_entry_t *entry = (lulu_entry_t *) appendToList(entries, sizeof(lulu_entry_t));
+
+        if (!parseName(parser, &entry->key) || !expectChar(parser, '=', "expected ="))
+            return FALSE;
+        skipSpace(parser);
+        entry->value = parser->pos;
+        if (!skipValue(parser))
+            return FALSE;
+        isNextChar(parser, ';');
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief Find the value of an entry of a block
+ *
+ * @param parser The parser
+ * @param entries The entries of the block
+ * @param key The key of the entry
+ * @param block The start of the block (the position of the error if the entry is required)
+ * @param required If TRUE an error is recorded when the block has no such entry
+ *
+ * @return The start of the value or NULL if there is no such entry
+ */
+static const char* findEntry(lulu_parser_t *parser, lulu_list_t *entries, lulu_span_t *key, const char *block, bool required) {
+    lulu_entry_t *entry = (lulu_entry_t *) entries->items;
+
+    for (uint32_t i = 0; i < entries->nr; i++)
+        if (entry[i].key.length == key->length && strncmp(entry[i].key.start, key->start, key->length) == 0)
+            return entry[i].value;
+
+    if (required)
+        setParseError(parser, block, "missing definition of", key);
+    return NULL;
+}
+
+/**
+ * @brief Find the value of an entry of a block by it's key (see findEntry())
+ */
+static const char* findNamedEntry(lulu_parser_t *parser, lulu_list_t *entries, const char *key, const char *block, bool required) {
+    lulu_span_t span = {key, strlen(key)};
+
+    return findEntry(parser, entries, &span, block, required);
+}
+
+/**
+ * @brief Parse a {name, name, ...} set (a trailing comma is accepted)
+ *
+ * @param parser The parser
+ * @param value The start of the set
+ * @param names Will store the names (lulu_span_t), in the order in which they are listed
+ *
+ * @return TRUE if the set was parsed, FALSE otherwise
+ */
+static bool parseNameList(lulu_parser_t *parser, const char *value, lulu_list_t *names) {
+    parser->pos = value;
+    names->nr = 0;
+    if (!expectChar(parser, '{', "expected {"))
+        return FALSE;
+
+    while (!isNextChar(parser, '}')) {
+        if (!parseName(parser, (lulu_span_t *) appendToList(names, sizeof(lulu_span_t))))
+            return FALSE;
+        if (!isNextChar(parser, ','))
+            return expectChar(parser, '}', "expected , or }");
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief Hash of a name (FNV-1a)
+ *
+ * @param name The name
+ * @param length The length of the name
+ *
+ * @return The hash
+ */
+static uint32_t hashName(const char *name, uint32_t length) {
+    uint32_t hash = 2166136261u;
+
+    for (uint32_t i = 0; i < length; i++)
+        hash = (hash ^ (uint8_t) name[i]) * 16777619u;
+    return hash;
+}
+
+/**
+ * @brief Find the slot of a name in the name table of an instance
+ *
+ * @param instance The instance
+ * @param name The name
+ * @param length The length of the name
+ *
+ * @return The slot that stores the id of the object or the empty slot where it would be stored
+ */
+static object_id_t* findNameSlot(LuluInstance_t *instance, const char *name, uint32_t length) {
+    uint32_t mask = instance->name_table_size - 1,
+             slot = hashName(name, length) & mask;
+
+    while (instance->name_table[slot] != NO_OBJECT) {
+        const char *other = instance->object_names[instance->name_table[slot]];
+
+        if (strncmp(other, name, length) == 0 && other[length] == '\0')
+            break;
+        slot = (slot + 1) & mask;
+    }
+
+    return &instance->name_table[slot];
+}
+
+/**
+ * @brief Double the size of the name table of an instance
+ *
+ * @param instance The instance
+ */
+static void growNameTable(LuluInstance_t *instance) {
+    LULU_FREE(instance->name_table);
+    instance->name_table_size = instance->name_table_size > 0 ? 2 * instance->name_table_size : 256;
+    instance->name_table = (object_id_t *) LULU_MALLOC(sizeof(object_id_t) * instance->name_table_size);
+    memset(instance->name_table, NO_OBJECT, sizeof(object_id_t) * instance->name_table_size);
+
+    for (uint32_t obj = OBJECT_ID_E; obj < instance->nr_A; obj++)
+        *findNameSlot(instance, instance->object_names[obj], strlen(instance->object_names[obj])) = (object_id_t) obj;
+}
+
+/**
+ * @brief Get room for a name
+ *
+ * @param parser The parser
+ * @param length The maximum length of the name (without the terminating 0)
+ *
+ * @return The room, which is used once commitName() is called
+ */
+static char* allocName(lulu_parser_t *parser, uint32_t length) {
+    if (parser->nr_free_chars < length + 1) {
+        uint32_t size = length + 1 > NAME_BLOCK_SIZE ? length + 1 : NAME_BLOCK_SIZE;
+        lulu_name_block_t *block = (lulu_name_block_t *) LULU_MALLOC(sizeof(lulu_name_block_t) + size);
+
+        block->next = parser->instance->names;
+        parser->instance->names = block;
+        parser->free_name = block->names;
+        parser->nr_free_chars = size;
+    }
+    return parser->free_name;
+}
+
+/**
+ * @brief Keep the name stored in the room returned by allocName()
+ *
+ * @param parser The parser
+ * @param length The length of the name
+ */
+static void commitName(lulu_parser_t *parser, uint32_t length) {
+    parser->free_name += length + 1;
+    parser->nr_free_chars -= length + 1;
+}
+
+/**
+ * @brief Add an object to the alphabet (the objects that are already in the alphabet keep their id)
+ *
+ * @param parser The parser
+ * @param name The name of the object
+ * @param length The length of the name
+ * @param robot_id If >= 0, the object is the expansion name_robot_id of a wildcarded object
+ *
+ * @return The id of the object or NO_OBJECT if the alphabet is full
+ */
+static object_id_t addObject(lulu_parser_t *parser, const char *name, uint32_t length, int32_t robot_id) {
+    LuluInstance_t *instance = parser->instance;
+    char *stored = allocName(parser, length + EXPANSION_SUFFIX_SIZE);
+    object_id_t *slot;
+
+    memcpy(stored, name, length);
+    if (robot_id >= 0)
+        length += sprintf(stored + length, "_%ld", (long) robot_id);
+    stored[length] = '\0';
+
+    slot = findNameSlot(instance, stored, length);
+    if (*slot != NO_OBJECT)
+        return *slot;
+
+    if (instance->nr_A == MAX_NR_A) {
+        lulu_span_t span = {stored, length};
+
+        setParseError(parser, name, "the alphabet has too many objects (see OBJECT_ID_BITS), at", &span);
+        return NO_OBJECT;
+    }
+    if (instance->nr_A == parser->max_objects) {
+        parser->max_objects *= 2;
+        instance->object_names = (char **) LULU_REALLOC(instance->object_names, sizeof(char *) * parser->max_objects);
+    }
+    commitName(parser, length);
+    instance->object_names[instance->nr_A] = stored;
+    *slot = instance->nr_A++;
+
+    //keep the name table at most half full
+    if (2 * (uint32_t) instance->nr_A > instance->name_table_size)
+        growNameTable(instance);
+
+    return instance->nr_A - 1;
+}
+
+/**
+ * @brief Add a wildcarded object to the alphabet together with the other wildcard of the same object and the expansions
+ * The objects are laid out as expected by wild_expand.h: X_*, X_%id (the declared ones) followed by X_0 .. X_(nr_swarm_robots - 1)
+ *
+ * @param parser The parser
+ * @param wild_obj The wildcarded object (X_* or X_%id)
+ *
+ * @return TRUE if the objects were added, FALSE if the alphabet is full
+ */
+static bool addWildcardObject(lulu_parser_t *parser, lulu_span_t *wild_obj) {
+    LuluInstance_t *instance = parser->instance;
+    lulu_span_t *alphabet = (lulu_span_t *) parser->alphabet.items,
+                *any = NULL,
+                *id = NULL;
+    uint32_t base_length;
+
+    if (*findNameSlot(instance, wild_obj->start, wild_obj->length) != NO_OBJECT)
+        //already added together with the other wildcard of the same object
+        return TRUE;
+
+    base_length = wild_obj->length - strlen(hasSuffix(wild_obj, WILD_ANY_SUFFIX) ? WILD_ANY_SUFFIX : WILD_ID_SUFFIX);
+    for (uint32_t i = 0; i < parser->alphabet.nr; i++)
+        if (alphabet[i].length > base_length && strncmp(alphabet[i].start, wild_obj->start, base_length) == 0) {
+            lulu_span_t suffix = {alphabet[i].start + base_length, alphabet[i].length - base_length};
+
+            if (isSpanEqual(&suffix, WILD_ANY_SUFFIX))
+                any = &alphabet[i];
+            else if (isSpanEqual(&suffix, WILD_ID_SUFFIX))
+                id = &alphabet[i];
+        }
+
+    if (any != NULL) {
+        if (instance->obj_with_any_size == UINT8_MAX)
+            return setParseError(parser, any->start, "too many W_ALL wildcarded objects, at", any);
+        instance->is_obj_with_any_followed_by_id[instance->obj_with_any_size] = id != NULL;
+        instance->obj_with_any[instance->obj_with_any_size++] = addObject(parser, any->start, any->length, -1);
+    }
+    if (id != NULL) {
+        if (instance->obj_with_id_size == UINT8_MAX)
+            return setParseError(parser, id->start, "too many W_ID wildcarded objects, at", id);
+        instance->obj_with_id[instance->obj_with_id_size++] = addObject(parser, id->start, id->length, -1);
+    }
+    for (uint16_t robot_id = 0; robot_id < instance->nr_swarm_robots && parser->error == NULL; robot_id++)
+        addObject(parser, wild_obj->start, base_length, robot_id);
+
+    return parser->error == NULL;
+}
+
+/**
+ * @brief Build the alphabet of the instance: NO_OBJECT, e, f, the wildcarded objects with their expansions and the other objects of A
+ *
+ * @param parser The parser
+ * @param e The name of the e object
+ * @param f The name of the f object
+ *
+ * @return TRUE if the alphabet was built, FALSE otherwise
+ */
+static bool buildAlphabet(lulu_parser_t *parser, lulu_span_t *e, lulu_span_t *f) {
+    LuluInstance_t *instance = parser->instance;
+    lulu_span_t *alphabet = (lulu_span_t *) parser->alphabet.items;
+    uint32_t nr_wild_objects = 0;
+
+    parser->max_objects = 256;
+    instance->object_names = (char **) LULU_MALLOC(sizeof(char *) * parser->max_objects);
+    instance->object_names[NO_OBJECT] = "no_object";
+    instance->nr_A = 1;
+    growNameTable(instance);
+
+    if (addObject(parser, e->start, e->length, -1) != OBJECT_ID_E || addObject(parser, f->start, f->length, -1) != OBJECT_ID_F)
+        return setParseError(parser, f->start, "e and f have to be different objects", NULL);
+
+    for (uint32_t i = 0; i < parser->alphabet.nr; i++)
+        nr_wild_objects += hasSuffix(&alphabet[i], WILD_ANY_SUFFIX) || hasSuffix(&alphabet[i], WILD_ID_SUFFIX);
+    instance->obj_with_any = (object_id_t *) LULU_MALLOC(sizeof(object_id_t) * (nr_wild_objects + 1));
+    instance->is_obj_with_any_followed_by_id = (uint8_t *) LULU_MALLOC(sizeof(uint8_t) * (nr_wild_objects + 1));
+    instance->obj_with_id = (object_id_t *) LULU_MALLOC(sizeof(object_id_t) * (nr_wild_objects + 1));
+
+    //the wildcarded objects are added first, so that their expansions are consecutive even if some of them are also declared in A
+    for (uint32_t i = 0; i < parser->alphabet.nr; i++)
+        if ((hasSuffix(&alphabet[i], WILD_ANY_SUFFIX) || hasSuffix(&alphabet[i], WILD_ID_SUFFIX)) && !addWildcardObject(parser, &alphabet[i]))
+            return FALSE;
+    for (uint32_t i = 0; i < parser->alphabet.nr; i++)
+        if (addObject(parser, alphabet[i].start, alphabet[i].length, -1) == NO_OBJECT)
+            return FALSE;
+
+    parser->is_wild_any = (bool *) LULU_MALLOC(sizeof(bool) * instance->nr_A);
+    memset(parser->is_wild_any, FALSE, sizeof(bool) * instance->nr_A);
+    for (uint8_t i = 0; i < instance->obj_with_any_size; i++)
+        parser->is_wild_any[instance->obj_with_any[i]] = TRUE;
+
+    return TRUE;
+}
+
+/**
+ * @brief Parse the name of an object of the alphabet
+ *
+ * @param parser The parser
+ * @param obj Will store the id of the object
+ *
+ * @return TRUE if the object is in the alphabet, FALSE otherwise
+ */
+static bool parseObject(lulu_parser_t *parser, object_id_t *obj) {
+    lulu_span_t name;
+
+    if (!parseName(parser, &name))
+        return FALSE;
+    *obj = *findNameSlot(parser->instance, name.start, name.length);
+    if (*obj == NO_OBJECT)
+        return setParseError(parser, name.start, "unknown object (not declared in A)", &name);
+    return TRUE;
+}
+
+/**
+ * @brief Parse a {obj, obj, ...} multiset
+ *
+ * @param parser The parser
+ * @param value The start of the multiset
+ * @param objects Will store the ids of the objects (object_id_t), appended to the list
+ *
+ * @return TRUE if the multiset was parsed, FALSE otherwise
+ */
+static bool parseMultiset(lulu_parser_t *parser, const char *value, lulu_list_t *objects) {
+    lulu_span_t *names;
+
+    if (!parseNameList(parser, value, &parser->names))
+        return FALSE;
+
+    names = (lulu_span_t *) parser->names.items;
+    for (uint32_t i = 0; i < parser->names.nr; i++) {
+        object_id_t *obj = (object_id_t *) appendToList(objects, sizeof(object_id_t));
+
+        *obj = *findNameSlot(parser->instance, names[i].start, names[i].length);
+        if (*obj == NO_OBJECT)
+            return setParseError(parser, names[i].start, "unknown object (not declared in A)", &names[i]);
+    }
+
+    return TRUE;
+}
+
+/**
+ * @brief Parse the operator of a rule (the ruleNames[] of the non-conditional rule types)
+ *
+ * @param parser The parser
+ * @param type Will store the type of the rule
+ *
+ * @return TRUE if the operator is known, FALSE otherwise
+ */
+static bool parseRuleOperator(lulu_parser_t *parser, rule_type_t *type) {
+    skipSpace(parser);
+    for (uint8_t i = RULE_TYPE_EVOLUTION; i <= RULE_TYPE_OUT_EXTEROCEPTIVE; i++) {
+        size_t length = strlen(ruleNames[i]);
+
+        if ((size_t) (parser->end - parser->pos) >= length && strncmp(parser->pos, ruleNames[i], length) == 0) {
+            parser->pos += length;
+            *type = (rule_type_t) i;
+            return TRUE;
+        }
+    }
+
+    return setParseError(parser, parser->pos, "unknown rule type", NULL);
+}
+
+/**
+ * @brief Parse a rule (a->b) or a conditional rule (a->b/c<->d)
+ *
+ * @param parser The parser
+ * @param rule Will store the rule
+ *
+ * @return TRUE if the rule was parsed, FALSE otherwise
+ */
+static bool parseRule(lulu_parser_t *parser, Rule_t *rule) {
+    object_id_t objects[4] = {NO_OBJECT, NO_OBJECT, NO_OBJECT, NO_OBJECT};
+    rule_type_t types[2];
+    uint8_t nr_parts = 0;
+
+    do {
+        if (!parseObject(parser, &objects[2 * nr_parts]) || !parseRuleOperator(parser, &types[nr_parts]) ||
+                !parseObject(parser, &objects[2 * nr_parts + 1]))
+            return FALSE;
+        nr_parts++;
+    } while (nr_parts < 2 && isNextChar(parser, '/'));
+
+    if (nr_parts == 1)
+        initRule(rule, types[0], objects[0], objects[1], NO_OBJECT, NO_OBJECT);
+    else
+        //the conditional types are ordered by (first type, second type), see lookupFirst[] and lookupSecond[]
+        initRule(rule, (rule_type_t) (RULE_TYPE_CONDITIONAL_EVOLUTION_EVOLUTION +
+                    (types[0] - RULE_TYPE_EVOLUTION) * NR_SIMPLE_RULE_TYPES + (types[1] - RULE_TYPE_EVOLUTION)),
+                objects[0], objects[1], objects[2], objects[3]);
+
+    return TRUE;
+}
+
+/**
+ * @brief Parse an agent: ({obj, obj, ...}; <rule, rule, ...>, <rule, rule, ...>, ...)
+ *
+ * @param parser The parser
+ * @param value The start of the agent
+ * @param name The name of the agent
+ * @param n The capacity of the P colony (nr of objects of the agent and nr of rules of each program)
+ *
+ * @return TRUE if the agent was parsed, FALSE otherwise
+ */
+static bool parseAgent(lulu_parser_t *parser, const char *value, lulu_span_t *name, uint8_t n) {
+    uint32_t nr_objects = parser->agent_objects.nr,
+             nr_programs = 0,
+             nr_wild_programs = 0;
+
+    parser->pos = value;
+    if (!expectChar(parser, '(', "expected ( at the start of agent") || !parseMultiset(parser, parser->pos, &parser->agent_objects))
+        return FALSE;
+    if (parser->agent_objects.nr - nr_objects != n)
+        return setParseError(parser, value, "the number of objects is not n for agent", name);
+    if (!expectChar(parser, ';', "expected ; after the objects of the agent"))
+        return FALSE;
+
+    while (!isNextChar(parser, ')')) {
+        bool is_wild_any = FALSE;
+        const char *program = parser->pos;
+
+        if (!expectChar(parser, '<', "expected < at the start of a program"))
+            return FALSE;
+        for (uint8_t rule_nr = 0; rule_nr < n; rule_nr++) {
+            Rule_t *rule = (Rule_t *) appendToList(&parser->rules, sizeof(Rule_t));
+
+            if ((rule_nr > 0 && !expectChar(parser, ',', "the number of rules of a program is not n")) || !parseRule(parser, rule))
+                return FALSE;
+            is_wild_any |= parser->is_wild_any[rule->lhs] || parser->is_wild_any[rule->rhs] ||
+                parser->is_wild_any[rule->alt_lhs] || parser->is_wild_any[rule->alt_rhs];
+        }
+        if (!expectChar(parser, '>', "the number of rules of a program is not n"))
+            return FALSE;
+
+        nr_programs++;
+        nr_wild_programs += is_wild_any;
+        //room is reserved for the nr_swarm_robots - 1 expansions of each program with W_ALL wildcards (see expandPcolonyWildAny())
+        if (nr_programs + nr_wild_programs * (parser->instance->nr_swarm_robots - 1) > UINT8_MAX)
+            return setParseError(parser, program, "too many programs (after wildcard expansion) for agent", name);
+
+        if (!isNextChar(parser, ',')) {
+            if (!expectChar(parser, ')', "expected , or ) after a program"))
+                return FALSE;
+            break;
+        }
+    }
+
+    *(uint8_t *) appendToList(&parser->nr_programs, sizeof(uint8_t)) = nr_programs;
+    *(uint8_t *) appendToList(&parser->nr_wild_programs, sizeof(uint8_t)) = nr_wild_programs;
+
+    return TRUE;
+}
+
+/**
+ * @brief Parse the name of e or f (if the colony does not define it, the default name is used)
+ *
+ * @param parser The parser
+ * @param key The key of the entry (e / f)
+ * @param name Will store the name
+ *
+ * @return TRUE if the name was parsed, FALSE otherwise
+ */
+static bool parseSpecialObject(lulu_parser_t *parser, const char *key, lulu_span_t *name) {
+    const char *value = findNamedEntry(parser, &parser->colony_entries, key, NULL, FALSE);
+
+    if (value == NULL) {
+        name->start = key;
+        name->length = strlen(key);
+        return TRUE;
+    }
+    parser->pos = value;
+    return parseName(parser, name);
+}
+
+/**
+ * @brief Parse the capacity of the P colony (1 .. 255)
+ *
+ * @param parser The parser
+ * @param value The start of the value of n
+ * @param n Will store the capacity
+ *
+ * @return TRUE if the capacity was parsed, FALSE otherwise
+ */
+static bool parseCapacity(lulu_parser_t *parser, const char *value, uint8_t *n) {
+    lulu_span_t name;
+    uint32_t number = 0;
+
+    parser->pos = value;
+    if (!parseName(parser, &name))
+        return FALSE;
+    for (uint32_t i = 0; i < name.length && number <= UINT8_MAX; i++) {
+        if (!isdigit((unsigned char) name.start[i]))
+            return setParseError(parser, name.start, "n is not a number:", &name);
+        number = 10 * number + (name.start[i] - '0');
+    }
+    if (number == 0 || number > UINT8_MAX)
+        return setParseError(parser, name.start, "n has to be between 1 and 255, not", &name);
+
+    *n = (uint8_t) number;
+    return TRUE;
+}
+
+/**
+ * @brief Parse a P colony: the alphabet, the capacity, the agents and the environments
+ *
+ * @param parser The parser
+ * @param colony The start of the colony block
+ * @param global_envs The start of the global_env, in_global_env and out_global_env multisets of the swarm (NULL if not declared)
+ * @param n Will store the capacity of the colony
+ *
+ * @return TRUE if the colony was parsed, FALSE otherwise
+ */
+static bool parseColony(lulu_parser_t *parser, const char *colony, const char **global_envs, uint8_t *n) {
+    LuluInstance_t *instance = parser->instance;
+    lulu_span_t e, f, *agents;
+    const char *value;
+
+    if (!parseBlock(parser, colony, &parser->colony_entries))
+        return FALSE;
+
+    //the alphabet
+    value = findNamedEntry(parser, &parser->colony_entries, "A", colony, TRUE);
+    if (value == NULL || !parseNameList(parser, value, &parser->alphabet) ||
+            !parseSpecialObject(parser, "e", &e) || !parseSpecialObject(parser, "f", &f) || !buildAlphabet(parser, &e, &f))
+        return FALSE;
+
+    //the capacity
+    value = findNamedEntry(parser, &parser->colony_entries, "n", colony, TRUE);
+    if (value == NULL || !parseCapacity(parser, value, n))
+        return FALSE;
+
+    //the agents
+    value = findNamedEntry(parser, &parser->colony_entries, "B", colony, TRUE);
+    if (value == NULL || !parseNameList(parser, value, &parser->agents))
+        return FALSE;
+    if (parser->agents.nr == 0 || parser->agents.nr > UINT8_MAX)
+        return setParseError(parser, value, "the number of agents has to be between 1 and 255", NULL);
+
+    instance->nr_agents = parser->agents.nr;
+    instance->agent_names = (char **) LULU_MALLOC(sizeof(char *) * instance->nr_agents);
+    agents = (lulu_span_t *) parser->agents.items;
+    for (uint8_t agent_nr = 0; agent_nr < instance->nr_agents; agent_nr++) {
+        const char *agent = findEntry(parser, &parser->colony_entries, &agents[agent_nr], colony, TRUE);
+
+        if (agent == NULL || !parseAgent(parser, agent, &agents[agent_nr], *n))
+            return FALSE;
+        instance->agent_names[agent_nr] = allocName(parser, agents[agent_nr].length);
+        memcpy(instance->agent_names[agent_nr], agents[agent_nr].start, agents[agent_nr].length);
+        instance->agent_names[agent_nr][agents[agent_nr].length] = '\0';
+        commitName(parser, agents[agent_nr].length);
+    }
+
+    //the environments (the global environments are declared by the swarm)
+    value = findNamedEntry(parser, &parser->colony_entries, "env", colony, FALSE);
+    if (value != NULL && !parseMultiset(parser, value, &parser->env_objects[0]))
+        return FALSE;
+    for (uint8_t env = 1; env < NR_ENVS; env++)
+        if (global_envs[env - 1] != NULL && !parseMultiset(parser, global_envs[env - 1], &parser->env_objects[env]))
+            return FALSE;
+
+    return TRUE;
+}
+
+/**
+ * @brief Parse the whole input: a P colony (name = {...}) or a P swarm (pswarm = {...}) from which one colony is parsed
+ *
+ * @param parser The parser
+ * @param colony_name The name of the colony of the swarm (NULL for the first colony)
+ * @param n Will store the capacity of the colony
+ *
+ * @return TRUE if the input was parsed, FALSE otherwise
+ */
+static bool parseInstance(lulu_parser_t *parser, const char *colony_name, uint8_t *n) {
+    const char *global_envs[NR_ENVS - 1] = {NULL, NULL, NULL},
+               *colony,
+               *swarm,
+               *value;
+    lulu_span_t name;
+
+    parser->pos = parser->text;
+    if (!parseName(parser, &name) || !expectChar(parser, '=', "expected ="))
+        return FALSE;
+    skipSpace(parser);
+    colony = swarm = parser->pos;
+    if (!skipValue(parser))
+        return FALSE;
+    isNextChar(parser, ';');
+    skipSpace(parser);
+    if (parser->pos < parser->end)
+        return setParseError(parser, parser->pos, "unexpected text after the end of the instance", NULL);
+
+    if (isSpanEqual(&name, "pswarm")) {
+        lulu_span_t *colonies;
+
+        if (!parseBlock(parser, swarm, &parser->swarm_entries))
+            return FALSE;
+        value = findNamedEntry(parser, &parser->swarm_entries, "C", swarm, TRUE);
+        if (value == NULL || !parseNameList(parser, value, &parser->names))
+            return FALSE;
+
+        colonies = (lulu_span_t *) parser->names.items;
+        colony = NULL;
+        for (uint32_t i = 0; i < parser->names.nr && colony == NULL; i++)
+            if (colony_name == NULL || isSpanEqual(&colonies[i], colony_name)) {
+                colony = findEntry(parser, &parser->swarm_entries, &colonies[i], swarm, TRUE);
+                if (colony == NULL)
+                    return FALSE;
+            }
+        if (colony == NULL) {
+            lulu_span_t span = {colony_name, colony_name != NULL ? strlen(colony_name) : 0};
+
+            return setParseError(parser, value, "the swarm does not contain the colony", &span);
+        }
+
+        global_envs[0] = findNamedEntry(parser, &parser->swarm_entries, "global_env", swarm, FALSE);
+        global_envs[1] = findNamedEntry(parser, &parser->swarm_entries, "in_global_env", swarm, FALSE);
+        global_envs[2] = findNamedEntry(parser, &parser->swarm_entries, "out_global_env", swarm, FALSE);
+    }
+    else if (colony_name != NULL && !isSpanEqual(&name, colony_name))
+        return setParseError(parser, name.start, "the input does not contain the requested colony but", &name);
+
+    return parseColony(parser, colony, global_envs, n);
+}
+
+/**
+ * @brief Initialize a P colony with the parsed input
+ * The programs that contain W_ALL wildcards get room for their expansions, which is used by luluInstance_expandPcolony()
+ *
+ * @param parser The parser (after parseInstance())
+ * @param pcol The P colony that will be initialized
+ * @param n The capacity of the P colony
+ *
+ * @return TRUE if the colony was initialized, FALSE if an environment object exceeds the maximum count (pcol is not initialized)
+ */
+static bool buildPcolony(lulu_parser_t *parser, Pcolony_t *pcol, uint8_t n) {
+    LuluInstance_t *instance = parser->instance;
+    multiset_env_t *envs[NR_ENVS] = {&pcol->env, &pcol->pswarm.global_env, &pcol->pswarm.in_global_env, &pcol->pswarm.out_global_env};
+    object_id_t *agent_objects = (object_id_t *) parser->agent_objects.items;
+    uint8_t *nr_programs = (uint8_t *) parser->nr_programs.items,
+            *nr_wild_programs = (uint8_t *) parser->nr_wild_programs.items;
+    Rule_t *rule = (Rule_t *) parser->rules.items;
+    bool filled = TRUE;
+
+    initPcolony(pcol, instance->nr_A, instance->nr_agents, n);
+    for (uint8_t env = 0; env < NR_ENVS; env++) {
+        for (uint32_t i = 0; i < parser->env_objects[env].nr; i++)
+            filled &= incObjectCountFromMultisetEnv(envs[env], ((object_id_t *) parser->env_objects[env].items)[i]);
+        //an environment always has enough e objects, but the rules that take e from it need at least one copy to be present
+        if (getObjectCountFromMultisetEnv(envs[env], OBJECT_ID_E) == 0)
+            setObjectCountFromMultisetEnv(envs[env], OBJECT_ID_E, 1);
+    }
+
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++) {
+        Agent_t *agent = &pcol->agents[agent_nr];
+
+        initAgent(agent, pcol, nr_programs[agent_nr] + nr_wild_programs[agent_nr] * (instance->nr_swarm_robots - 1));
+        for (uint8_t i = 0; i < n; i++)
+            addObjectToMultisetObj(&agent->obj, *agent_objects++);
+
+        for (uint8_t prg_nr = 0; prg_nr < nr_programs[agent_nr]; prg_nr++) {
+            initProgram(&agent->programs[prg_nr], n);
+            for (uint8_t rule_nr = 0; rule_nr < n; rule_nr++, rule++)
+                initRule(&agent->programs[prg_nr].rules[rule_nr], (rule_type_t) rule->type, rule->lhs, rule->rhs, rule->alt_lhs, rule->alt_rhs);
+        }
+        agent->init_program_nr = nr_programs[agent_nr];
+        //the room reserved for the expansions is used only by luluInstance_expandPcolony(), so the colony can be simulated as it is
+        agent->nr_programs = agent->init_program_nr;
+    }
+
+    if (!filled) {
+        destroyPcolony(pcol);
+        return setParseError(parser, NULL, "an environment object exceeds the maximum count (see COUNT_BITS)", NULL);
+    }
+    return TRUE;
+}
+
+/**
+ * @brief Store the first error found by the parser in the instance, with the line where it was found
+ *
+ * @param parser The parser
+ */
+static void storeParseError(lulu_parser_t *parser) {
+    uint32_t line = 0;
+
+    if (parser->error_pos >= parser->text && parser->error_pos <= parser->end) {
+        line = 1;
+        for (const char *c = parser->text; c < parser->error_pos; c++)
+            line += *c == '\n';
+    }
+
+    parser->instance->error_line = line;
+    if (parser->error_name.length > 0)
+        snprintf(parser->instance->error, LULU_PARSER_ERROR_SIZE, "%s %.*s", parser->error,
+                (int) parser->error_name.length, parser->error_name.start);
+    else
+        snprintf(parser->instance->error, LULU_PARSER_ERROR_SIZE, "%s", parser->error);
+}
+
+bool initPcolonyFromLuluText(Pcolony_t *pcol, LuluInstance_t *instance, const char *text, size_t length, const char *colony_name,
+        uint16_t smallest_robot_uid, uint16_t nr_swarm_robots) {
+    lulu_parser_t parser;
+    uint8_t n = 0;
+    bool parsed = FALSE;
+
+    memset(&parser, 0, sizeof(lulu_parser_t));
+    memset(instance, 0, sizeof(LuluInstance_t));
+    parser.text = parser.pos = text;
+    parser.end = text + length;
+    parser.instance = instance;
+    instance->smallest_robot_uid = smallest_robot_uid;
+    instance->nr_swarm_robots = nr_swarm_robots;
+
+    if (nr_swarm_robots == 0)
+        setParseError(&parser, NULL, "the swarm has to contain at least one robot", NULL);
+    else
+        parsed = parseInstance(&parser, colony_name, &n) && buildPcolony(&parser, pcol, n);
+
+    if (!parsed) {
+        storeParseError(&parser);
+        destroyLuluInstance(instance);
+    }
+
+    destroyList(&parser.swarm_entries);
+    destroyList(&parser.colony_entries);
+    destroyList(&parser.alphabet);
+    destroyList(&parser.agents);
+    destroyList(&parser.names);
+    for (uint8_t env = 0; env < NR_ENVS; env++)
+        destroyList(&parser.env_objects[env]);
+    destroyList(&parser.agent_objects);
+    destroyList(&parser.nr_programs);
+    destroyList(&parser.nr_wild_programs);
+    destroyList(&parser.rules);
+    LULU_FREE(parser.is_wild_any);
+
+    return parsed;
+}
+
+bool initPcolonyFromLulu(Pcolony_t *pcol, LuluInstance_t *instance, const char *path, const char *colony_name,
+        uint16_t smallest_robot_uid, uint16_t nr_swarm_robots) {
+    FILE *file = fopen(path, "rb");
+    char *text = NULL;
+    long length = -1;
+    bool parsed = FALSE;
+
+    //the whole file is read at once, the parser only moves through memory
+    if (file != NULL && fseek(file, 0, SEEK_END) == 0 && (length = ftell(file)) >= 0 && fseek(file, 0, SEEK_SET) == 0) {
+        text = (char *) LULU_MALLOC(length + 1);
+        if (fread(text, 1, length, file) == (size_t) length)
+            parsed = initPcolonyFromLuluText(pcol, instance, text, length, colony_name, smallest_robot_uid, nr_swarm_robots);
+        else
+            length = -1;
+    }
+    if (file != NULL)
+        fclose(file);
+    LULU_FREE(text);
+
+    if (length < 0) {
+        memset(instance, 0, sizeof(LuluInstance_t));
+        snprintf(instance->error, LULU_PARSER_ERROR_SIZE, "could not read %s", path);
+    }
+
+    return parsed;
+}
+
+object_id_t luluInstance_getObjectId(LuluInstance_t *instance, const char *name) {
+    if (instance->name_table_size == 0)
+        return NO_OBJECT;
+    return *findNameSlot(instance, name, strlen(name));
+}
+
+uint16_t luluInstance_expandPcolony(LuluInstance_t *instance, Pcolony_t *pcol, uint16_t my_id) {
+    uint16_t my_symbolic_id = my_id - instance->smallest_robot_uid;
+
+    //do not expand the P colonies of robots that have a symbolic_id >= nr_swarm_robots
+    if (my_symbolic_id >= instance->nr_swarm_robots)
+        return my_symbolic_id;
+
+    //replace W_ID wildcarded objects with the object corresponding to the symbolic id
+    replacePcolonyWildID(pcol, instance->obj_with_id, instance->obj_with_id_size, my_symbolic_id);
+
+    //the programs with W_ALL wildcards are expanded into the room reserved by the parser (see expandPcolonyWildAny())
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++) {
+        Agent_t *agent = &pcol->agents[agent_nr];
+
+        for (uint8_t prg_nr = 0; prg_nr < agent->init_program_nr; prg_nr++)
+            for (uint8_t any_id = 0; any_id < instance->obj_with_any_size; any_id++)
+                if (isObjectInProgram(&agent->programs[prg_nr], instance->obj_with_any[any_id])) {
+                    agent->nr_programs += instance->nr_swarm_robots - 1;
+                    break;
+                }
+    }
+
+    //expand each W_ALL wildcarded object into nr_swarm_robots objects except my_symbolic_id
+    expandPcolonyWildAny(pcol, instance->obj_with_any, instance->is_obj_with_any_followed_by_id, instance->obj_with_any_size,
+            my_symbolic_id, instance->nr_swarm_robots);
+
+    return my_symbolic_id;
+}
+
+void destroyLuluInstance(LuluInstance_t *instance) {
+    LULU_FREE(instance->object_names);
+    LULU_FREE(instance->agent_names);
+    LULU_FREE(instance->obj_with_id);
+    LULU_FREE(instance->obj_with_any);
+    LULU_FREE(instance->is_obj_with_any_followed_by_id);
+    LULU_FREE(instance->name_table);
+    while (instance->names != NULL) {
+        lulu_name_block_t *next = instance->names->next;
+
+        LULU_FREE(instance->names);
+        instance->names = next;
+    }
+
+    instance->object_names = instance->agent_names = NULL;
+    instance->obj_with_id = instance->obj_with_any = NULL;
+    instance->is_obj_with_any_followed_by_id = NULL;
+    instance->name_table = NULL;
+    instance->name_table_size = 0;
+    instance->nr_A = 0;
+    instance->nr_agents = 0;
+    instance->obj_with_id_size = instance->obj_with_any_size = 0;
+}
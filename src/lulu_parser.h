@@ -0,0 +1,111 @@
+// vim:filetype=c
+/**
+ * @file lulu_parser.h
+ * @brief Runtime parser of Lulu input files
+ * Builds a P colony directly from the Lulu text format (pi = {...} or pswarm = {...}, see input_files/), without the C instance
+ * generated by lulu_c.py. The alphabet starts with NO_OBJECT, e and f, followed by the wildcarded objects of A (X_* and / or X_%id),
+ * each one followed by it's expansions X_0 .. X_(nr_swarm_robots - 1), and by the other objects of A. This is the layout expected by
+ * the functions of wild_expand.h (see luluInstance_expandPcolony()).
+ * Only available for the PC build.
+ */
+#ifndef LULU_PARSER_H
+#define LULU_PARSER_H
+
+#include "lulu.h"
+#include <stddef.h> //for size_t
+
+// size of the description of a parse error (see LuluInstance.error)
+#define LULU_PARSER_ERROR_SIZE 128
+
+typedef struct _lulu_name_block lulu_name_block_t;
+
+/**
+ * @brief Names and wildcard metadata of a parsed Lulu instance (what lulu_c.py writes into instance.h / instance.c)
+ */
+typedef struct _LuluInstance {
+    char **object_names; // object_names[obj] is the name of obj (object_names[NO_OBJECT] = "no_object")
+    char **agent_names; // agent_names[agent_nr] is the name of the agent
+    object_id_t nr_A; // size of the alphabet, including NO_OBJECT and the wildcard expansions
+    uint8_t nr_agents;
+
+    uint16_t smallest_robot_uid, // the smallest kilo_uid from the swarm
+             nr_swarm_robots; // the number of robots that make up the swarm (each wildcard is expanded into this many objects)
+
+    object_id_t *obj_with_id; // objects that end with _%id (each one is followed by it's expansions)
+    uint8_t obj_with_id_size;
+    object_id_t *obj_with_any; // objects that end with _* (each one is followed by the _%id object, if declared, and it's expansions)
+    uint8_t *is_obj_with_any_followed_by_id; // is_obj_with_any_followed_by_id[i] = 1 -> obj_with_any[i] is followed by an _%id object
+    uint8_t obj_with_any_size;
+
+    object_id_t *name_table; // open addressing hash table of the object ids, indexed by the hash of their names (NO_OBJECT = empty)
+    uint32_t name_table_size; // a power of 2
+    lulu_name_block_t *names; // blocks that store the object and agent names
+
+    char error[LULU_PARSER_ERROR_SIZE]; // description of the first error found in the input ("" if the input was parsed)
+    uint32_t error_line; // line of the input where the first error was found (0 if the error has no line)
+} LuluInstance_t;
+
+/**
+ * @brief Parse a Lulu input file and initialize a P colony with it's contents
+ * The wildcarded objects are not expanded, a colony that uses wildcards is expanded for one robot of the swarm with
+ * luluInstance_expandPcolony() (the agents get room for the expansions of their programs that contain W_ALL wildcards).
+ *
+ * @param pcol The P colony that will be initialized (destroyed with destroyPcolony())
+ * @param instance Will store the names and the wildcard metadata of the instance (destroyed with destroyLuluInstance())
+ * @param path Path of the Lulu input file
+ * @param colony_name Name of the colony of a P swarm that will be parsed (NULL for the first colony of the swarm or for a single P colony)
+ * @param smallest_robot_uid The smallest kilo_uid from the swarm
+ * @param nr_swarm_robots The number of robots that make up the swarm (at least 1)
+ *
+ * @return TRUE if the colony was initialized, FALSE otherwise (neither pcol nor instance are initialized, see LuluInstance.error)
+ */
+bool initPcolonyFromLulu(Pcolony_t *pcol, LuluInstance_t *instance, const char *path, const char *colony_name,
+        uint16_t smallest_robot_uid, uint16_t nr_swarm_robots);
+
+/**
+ * @brief Parse Lulu text that is stored in memory and initialize a P colony with it's contents (see initPcolonyFromLulu())
+ *
+ * @param pcol The P colony that will be initialized
+ * @param instance Will store the names and the wildcard metadata of the instance
+ * @param text The Lulu text (does not have to be terminated by 0)
+ * @param length The length of the text
+ * @param colony_name Name of the colony of a P swarm that will be parsed (NULL for the first colony)
+ * @param smallest_robot_uid The smallest kilo_uid from the swarm
+ * @param nr_swarm_robots The number of robots that make up the swarm (at least 1)
+ *
+ * @return TRUE if the colony was initialized, FALSE otherwise (neither pcol nor instance are initialized, see LuluInstance.error)
+ */
+bool initPcolonyFromLuluText(Pcolony_t *pcol, LuluInstance_t *instance, const char *text, size_t length, const char *colony_name,
+        uint16_t smallest_robot_uid, uint16_t nr_swarm_robots);
+
+/**
+ * @brief Find the id of an object by it's name
+ *
+ * @param instance The parsed instance
+ * @param name The name of the object (e.g. "l_m", "B_*" or "B_2")
+ *
+ * @return The id of the object or NO_OBJECT if the object is not in the alphabet
+ */
+object_id_t luluInstance_getObjectId(LuluInstance_t *instance, const char *name);
+
+/**
+ * @brief Expands and replaces wildcarded objects with the appropriate objects (the expand_pcolony() of a parsed instance)
+ * Objects that end with _%id are replaced with _i where i is the symbolic id of the robot, objects that end with _* are expanded into
+ * the objects of all of the other robots of the swarm. The colony of a robot that is not part of the swarm is not expanded.
+ *
+ * @param instance The parsed instance
+ * @param pcol The P colony initialized from the instance (not packed)
+ * @param my_id The kilo_uid of the robot
+ *
+ * @return The symbolic id that corresponds to this robot (my_id - smallest_robot_uid)
+ */
+uint16_t luluInstance_expandPcolony(LuluInstance_t *instance, Pcolony_t *pcol, uint16_t my_id);
+
+/**
+ * @brief Destroy a parsed instance (the colonies initialized from it are not destroyed)
+ *
+ * @param instance The instance that will be destroyed
+ */
+void destroyLuluInstance(LuluInstance_t *instance);
+
+#endif
@@ -3,27 +3,70 @@
 #define PCOL_SIM
 #endif
 #include "lulu.h"
-#include "instance.h"
+#ifdef SIM_RUNTIME_INSTANCE
+    #include "lulu_parser.h"
+    #ifdef SIM_IMAGE_CACHE
+        #include "instance_image.h"
+    #endif
+#else
+    #include "instance.h"
+#endif
+#ifdef SIM_ENSEMBLE
+    #include "ensemble.h"
+    #include <time.h> //for clock() used to measure the throughput of the ensemble
+#endif
+#ifdef SIM_PROCESSES
+    #include "swarm_process.h"
+#endif
+#ifdef SIM_CHECKPOINT
+    #include "checkpoint.h"
+#endif
 #include "debug_print.h"
-#include <stdlib.h> //for rand(), srand()
+#include <stdlib.h>
 #include <stdio.h>
 #include <string.h> //for strcpy
 
 static char outputBuffer[255];
 
+#ifdef SIM_RUNTIME_INSTANCE
+//the instance parsed from the Lulu file given on the command line takes the place of the one generated by lulu_c.py
+#ifdef SIM_IMAGE_CACHE
+//the expanded instance is mapped from it's cached image (see initPcolonyFromLuluCache())
+static InstanceImage_t luluInstance;
+#else
+static LuluInstance_t luluInstance;
+#endif
+static char **objectNames, **agentNames;
+
+static void lulu_destroy(Pcolony_t *pcol) {
+    destroyPcolony(pcol);
+#ifdef SIM_IMAGE_CACHE
+    destroyInstanceImage(&luluInstance);
+#else
+    destroyLuluInstance(&luluInstance);
+#endif
+}
+#endif
+
 char* printMultisetEnv(multiset_env_t *multiset) {
     memset(outputBuffer, '\0', 255);
-    for (uint8_t i = 0; i < multiset->size; i++)
+    for (object_id_t i = 0; i < multiset->size; i++)
         if (multiset->items[i].id != NO_OBJECT)
-            sprintf(outputBuffer, "%s '%s': %d, ", outputBuffer, objectNames[multiset->items[i].id], multiset->items[i].nr);
+            sprintf(outputBuffer, "%s '%s': %lu, ", outputBuffer, objectNames[multiset->items[i].id], (unsigned long) multiset->items[i].nr);
     return outputBuffer;
 }
 
 char* printMultisetObj(multiset_obj_t *multiset) {
     memset(outputBuffer, '\0', 255);
+#ifdef MULTISET_OBJ_COUNTED
+    for (uint8_t i = 0; i < multiset->nr_runs; i++)
+        for (uint8_t j = 0; j < multiset->items[i].nr; j++)
+            sprintf(outputBuffer, "%s '%s', ", outputBuffer, objectNames[multiset->items[i].id]);
+#else
     for (uint8_t i = 0; i < multiset->size; i++)
         if (multiset->items[i] != NO_OBJECT)
             sprintf(outputBuffer, "%s '%s', ", outputBuffer, objectNames[multiset->items[i]]);
+#endif
     return outputBuffer;
 }
 
@@ -54,9 +97,9 @@ char* printProgram(Program_t *program) {
 void printColonyState(Pcolony_t *pcol, bool with_programs) {
 
     printf("\n \e[32m   Pcolony.env = [%s]\e[0m", printMultisetEnv(&pcol->env));
-    printf("\n \e[34m   Pswarm.global_env = [%s]\e[0m", printMultisetEnv(&pcol->pswarm.global_env));
-    printf("\n \e[35m   Pswarm.in_global_env = [%s]\e[0m", printMultisetEnv(&pcol->pswarm.in_global_env));
-    printf("\n \e[36m   Pswarm.out_global_env = [%s]\e[0m", printMultisetEnv(&pcol->pswarm.out_global_env));
+    printf("\n \e[34m   Pswarm.global_env = [%s]\e[0m", printMultisetEnv(&pcol->swarm->global_env));
+    printf("\n \e[35m   Pswarm.in_global_env = [%s]\e[0m", printMultisetEnv(&pcol->swarm->in_global_env));
+    printf("\n \e[36m   Pswarm.out_global_env = [%s]\e[0m", printMultisetEnv(&pcol->swarm->out_global_env));
     for (uint8_t i = 0; i < pcol->nr_agents; i++) {
         printf("\n    %s.obj = [%s];", agentNames[i], printMultisetObj(&pcol->agents[i].obj));
         if (with_programs) {
@@ -67,13 +110,209 @@ void printColonyState(Pcolony_t *pcol, bool with_programs) {
     }
 }
 
+#ifdef LULU_COUNT_ALLOCS
+void printAllocationCount() {
+    printi("Heap allocations = %lu, deallocations = %lu", (unsigned long) lulu_nr_allocs, (unsigned long) lulu_nr_frees);
+}
+#endif
+
+#if defined(SIM_ENSEMBLE) || defined(SIM_PROCESSES)
+static const char *simStepResultNames[] = {"running", "finished", "error", "cycle"};
+#endif
+
+#ifdef SIM_ENSEMBLE
+#ifndef SIM_ENSEMBLE_MAX_STEPS
+    #define SIM_ENSEMBLE_MAX_STEPS 10000
+#endif
+
+/**
+ * @brief Run SIM_ENSEMBLE replicas of a P colony (each for at most SIM_ENSEMBLE_MAX_STEPS steps) and print the result of each replica
+ *
+ * @param pcol The initialized P colony
+ *
+ * @return The number of replicas that ended with an error
+ */
+uint32_t runEnsemble(Pcolony_t *pcol) {
+    Ensemble_t ensemble;
+    uint32_t nr_errors = 0;
+    uint64_t nr_steps = 0;
+    clock_t start;
+    double seconds;
+
+    initEnsemble(&ensemble, pcol, SIM_ENSEMBLE, 8312);
+#ifdef LULU_THREADS
+    if (!ensemble_setThreads(&ensemble, SIM_THREADS))
+        printw("Could not create all of the %d threads", SIM_THREADS);
+#endif
+
+    start = clock();
+    ensemble_run(&ensemble, SIM_ENSEMBLE_MAX_STEPS);
+    seconds = (double) (clock() - start) / CLOCKS_PER_SEC;
+
+    for (uint32_t i = 0; i < ensemble.nr_replicas; i++) {
+        printf("\nreplica %lu: %s after %lu steps", (unsigned long) i, simStepResultNames[ensemble.results[i]], (unsigned long) ensemble.nr_steps[i]);
+        nr_steps += ensemble.nr_steps[i];
+        if (ensemble.results[i] == SIM_STEP_RESULT_ERROR)
+            nr_errors++;
+    }
+    //clock() measures the CPU time of all threads
+    printf("\n%lu replicas, %lu running, %lu errors, %llu steps in %.3f s of CPU time\n", (unsigned long) ensemble.nr_replicas,
+            (unsigned long) ensemble.nr_running, (unsigned long) nr_errors, (unsigned long long) nr_steps, seconds);
+
+    destroyEnsemble(&ensemble);
+
+    return nr_errors;
+}
+#endif
+
+#ifdef SIM_SWARM
+#ifndef SIM_SWARM_MAX_STEPS
+    #define SIM_SWARM_MAX_STEPS 10000
+#endif
+/**
+ * @brief Run a swarm of SIM_SWARM copies of a P colony that share the global environments of the P colony
+ * The configuration of each colony is printed after each swarm step
+ * If SIM_PROCESSES is defined, the colonies are stepped by SIM_PROCESSES processes (for at most SIM_SWARM_MAX_STEPS steps)
+ * and only the results of the colonies and the final global environments are printed
+ *
+ * @param pcol The initialized P colony
+ *
+ * @return 1 if the simulation ended with an error, 0 otherwise
+ */
+int runSwarm(Pcolony_t *pcol) {
+    Pswarm_t pswarm;
+    sim_step_result_t result = SIM_STEP_RESULT_FINISHED;
+
+    initPswarm(&pswarm, pcol->nr_A, SIM_SWARM);
+    //the swarm starts with the global environments of the instance
+    destroyMultisetEnv(&pswarm.global_env);
+    destroyMultisetEnv(&pswarm.in_global_env);
+    destroyMultisetEnv(&pswarm.out_global_env);
+    copyMultisetEnv(&pswarm.global_env, &pcol->pswarm.global_env);
+    copyMultisetEnv(&pswarm.in_global_env, &pcol->pswarm.in_global_env);
+    copyMultisetEnv(&pswarm.out_global_env, &pcol->pswarm.out_global_env);
+    //each colony uses a different seed, so that identical colonies make different choices
+    for (uint16_t colony_nr = 0; colony_nr < SIM_SWARM; colony_nr++)
+        pcolony_setSeed(pswarm_addColony(&pswarm, pcol), 8312 + colony_nr);
+
+#ifdef SIM_PROCESSES
+    {
+        ProcessSwarm_t process_swarm;
+
+        result = SIM_STEP_RESULT_ERROR;
+        if (initProcessSwarm(&process_swarm, &pswarm, SIM_PROCESSES)) {
+#ifdef SIM_CONCURRENT
+            if (!processSwarm_setConcurrent(&process_swarm, TRUE))
+                printw("Concurrent steps require the dense environment layout, the colonies are stepped in turns");
+#endif
+            result = processSwarm_run(&process_swarm, SIM_SWARM_MAX_STEPS);
+            for (uint16_t colony_nr = 0; colony_nr < pswarm.nr_colonies; colony_nr++)
+                printf("\ncolony %d: %s after %lu steps%s", colony_nr, simStepResultNames[process_swarm.results[colony_nr]],
+                        (unsigned long) process_swarm.nr_steps[colony_nr],
+                        process_swarm.crashed[colony_nr % process_swarm.nr_processes] ? " (crashed)" : "");
+            printf("\n \e[34m   Pswarm.global_env = [%s]\e[0m", printMultisetEnv(&pswarm.global_env));
+            printf("\n \e[35m   Pswarm.in_global_env = [%s]\e[0m", printMultisetEnv(&pswarm.in_global_env));
+            printf("\n \e[36m   Pswarm.out_global_env = [%s]\e[0m\n", printMultisetEnv(&pswarm.out_global_env));
+            if (process_swarm.concurrent)
+                printf("%lu programs rolled back\n", (unsigned long) process_swarm.nr_rollbacks);
+            destroyProcessSwarm(&process_swarm);
+        }
+    }
+#else
+    uint32_t step_nr = 0;
+
+    while (result == SIM_STEP_RESULT_FINISHED) {
+        printi("Running swarm simulation step %lu", (unsigned long) step_nr);
+        result = pswarm_runSimulationStep(&pswarm);
+        for (uint16_t colony_nr = 0; colony_nr < pswarm.nr_colonies; colony_nr++) {
+            printf("\n  colony %d:", colony_nr);
+            printColonyState(&pswarm.colonies[colony_nr], FALSE);
+        }
+        step_nr++;
+    }
+#endif
+
+    if (result == SIM_STEP_RESULT_ERROR)
+        printe("Error encountered");
+    else
+        printi("Swarm simulation finished sucesfully");
+    destroyPswarm(&pswarm);
+
+    return result == SIM_STEP_RESULT_ERROR;
+}
+#endif
+
+#ifndef SIM_HISTORY_SIZE
+    #define SIM_HISTORY_SIZE 4096
+#endif
+#ifndef SIM_MAX_LEAP
+    #define SIM_MAX_LEAP 1000000
+#endif
+#ifndef SIM_CHECKPOINT_FILE
+    #define SIM_CHECKPOINT_FILE "simulator.ckpt"
+#endif
+
 int main(int argc, char **argv) {
     Pcolony_t pcol;
-    uint8_t step_nr = 0;
+    uint32_t step_nr = 0;
+#ifdef SIM_CHECKPOINT
+    uint32_t checkpoint_step_nr = 0;
+#endif
 
-    srand(8312);
+#ifdef SIM_RUNTIME_INSTANCE
+    {
+        //the robots of the swarm have kilo_uid smallest_robot_uid .. largest_robot_uid (the default is a swarm of one robot)
+        uint16_t smallest_robot_uid = 0, largest_robot_uid = 0;
 
+        if (argc < 2) {
+            fprintf(stderr, "Usage: %s lulu_file [smallest_robot_uid largest_robot_uid]\n", argv[0]);
+            return 1;
+        }
+        if (argc >= 4) {
+            smallest_robot_uid = (uint16_t) atoi(argv[2]);
+            largest_robot_uid = (uint16_t) atoi(argv[3]);
+            if (largest_robot_uid < smallest_robot_uid)
+                largest_robot_uid = smallest_robot_uid;
+        }
+#ifdef SIM_IMAGE_CACHE
+        if (!initPcolonyFromLuluCache(&pcol, &luluInstance, argv[1], NULL, smallest_robot_uid, largest_robot_uid - smallest_robot_uid + 1,
+                    smallest_robot_uid, SIM_IMAGE_CACHE)) {
+#else
+        if (!initPcolonyFromLulu(&pcol, &luluInstance, argv[1], NULL, smallest_robot_uid, largest_robot_uid - smallest_robot_uid + 1)) {
+#endif
+            if (luluInstance.error_line > 0)
+                fprintf(stderr, "%s:%lu: %s\n", argv[1], (unsigned long) luluInstance.error_line, luluInstance.error);
+            else
+                fprintf(stderr, "%s: %s\n", argv[1], luluInstance.error);
+            return 1;
+        }
+        objectNames = luluInstance.object_names;
+        agentNames = luluInstance.agent_names;
+    }
+#else
     lulu_init(&pcol);
+    //instances generated for the slot based layout write the multisets directly, so they are rebuilt for the layout of this build
+    if (!rebuildPcolonyMultisets(&pcol)) {
+        fprintf(stderr, "The initial multisets of the instance do not fit this build\n");
+        return 1;
+    }
+#endif
+    //fixed seed so that simulation runs are reproducible
+    pcolony_setSeed(&pcol, 8312);
+#ifdef CONFIG_HASH
+    //stop as soon as a configuration is repeated (only possible if no random choices are made)
+    pcolony_setHistorySize(&pcol, SIM_HISTORY_SIZE);
+#endif
+#ifdef STEP_LEAPING
+    //repeat runs of deterministic steps at once (only the configuration after each leap is printed)
+    pcolony_setLeaping(&pcol, SIM_MAX_LEAP);
+#endif
+#if defined(LULU_THREADS) && !defined(SIM_ENSEMBLE)
+    //check the programs of the agents in parallel (the results do not depend on the number of threads)
+    //an ensemble uses the threads to step different replicas instead
+    if (!pcolony_setThreads(&pcol, SIM_THREADS))
+        printw("Could not create all of the %d threads", SIM_THREADS);
+#endif
 
     printi("Initial configuration:");
     printColonyState(&pcol, TRUE);
@@ -83,28 +322,127 @@ int main(int argc, char **argv) {
     expand_pcolony(&pcol, 0);
     printColonyState(&pcol, TRUE);
 #endif
+#if defined(SIM_RUNTIME_INSTANCE) && !defined(SIM_IMAGE_CACHE)
+    if (luluInstance.obj_with_id_size > 0 || luluInstance.obj_with_any_size > 0) {
+        printi("Configuration after wildcard expansion:");
+        luluInstance_expandPcolony(&luluInstance, &pcol, luluInstance.smallest_robot_uid);
+        printColonyState(&pcol, TRUE);
+    }
+#endif
+
+#ifdef PCOLONY_ARENA
+    //the whole colony is stored in a single heap block (the programs are compiled now instead of in the first step)
+    packPcolony(&pcol);
+#endif
+
+#ifdef SIM_SWARM
+    {
+        int failed = runSwarm(&pcol);
+
+        lulu_destroy(&pcol);
+#ifdef LULU_COUNT_ALLOCS
+        printAllocationCount();
+#endif
+        return failed;
+    }
+#endif
+
+#ifdef SIM_ENSEMBLE
+    {
+        uint32_t nr_errors = runEnsemble(&pcol);
+
+        lulu_destroy(&pcol);
+#ifdef LULU_COUNT_ALLOCS
+        printAllocationCount();
+#endif
+        return nr_errors > 0;
+    }
+#endif
+
+#ifdef SIM_CHECKPOINT
+    {
+        //an interrupted run continues from the configuration of it's last checkpoint
+        FILE *checkpoint = fopen(SIM_CHECKPOINT_FILE, "rb");
+        uint64_t restored_step_nr;
+
+        if (checkpoint != NULL) {
+            fclose(checkpoint);
+            if (pcolony_restoreCheckpoint(&pcol, &restored_step_nr, SIM_CHECKPOINT_FILE)) {
+                step_nr = checkpoint_step_nr = (uint32_t) restored_step_nr;
+                printi("Resumed from the checkpoint of step %lu:", (unsigned long) step_nr);
+                printColonyState(&pcol, FALSE);
+            }
+        }
+    }
+#endif
 
     while (1) {
         sim_step_result_t result = SIM_STEP_RESULT_FINISHED;
 
-        printi("Running simulation step %d", step_nr);
+        printi("Running simulation step %lu", (unsigned long) step_nr);
+
+#ifdef LULU_COUNT_ALLOCS
+        uint32_t nr_allocs = lulu_nr_allocs;
+#endif
 
         result = pcolony_runSimulationStep(&pcol);
 
+#ifdef LULU_COUNT_ALLOCS
+        //programs are compiled during the first step, afterwards simulation steps should not allocate memory
+        if (step_nr > 0 && lulu_nr_allocs != nr_allocs)
+            printw("Simulation step %lu made %lu heap allocations", (unsigned long) step_nr, (unsigned long) (lulu_nr_allocs - nr_allocs));
+#endif
+
         printColonyState(&pcol, FALSE);
 
+#ifdef SIM_CHECKPOINT
+        //the next run starts from the initial configuration again
+        if (result != SIM_STEP_RESULT_FINISHED && result != SIM_STEP_RESULT_ERROR)
+            remove(SIM_CHECKPOINT_FILE);
+#endif
+
         if (result == SIM_STEP_RESULT_NO_MORE_EXECUTABLES) {
             printi("Simulation finished sucesfully");
             lulu_destroy(&pcol);
+#ifdef LULU_COUNT_ALLOCS
+            printAllocationCount();
+#endif
+            return 0;
+        }
+#ifdef CONFIG_HASH
+        else if (result == SIM_STEP_RESULT_CYCLE) {
+            if (pcol.cycle_period == 1)
+                printi("Simulation reached a fixed point at step %lu", (unsigned long) pcol.cycle_start);
+            else
+                printi("Simulation reached a cycle of period %lu that starts at step %lu", (unsigned long) pcol.cycle_period, (unsigned long) pcol.cycle_start);
+            lulu_destroy(&pcol);
+#ifdef LULU_COUNT_ALLOCS
+            printAllocationCount();
+#endif
             return 0;
         }
+#endif
         else if (result == SIM_STEP_RESULT_ERROR) {
             printe("Error encountered");
             lulu_destroy(&pcol);
+#ifdef LULU_COUNT_ALLOCS
+            printAllocationCount();
+#endif
             return 1;
         }
 
         step_nr++;
+#ifdef STEP_LEAPING
+        if (pcol.nr_leaped_steps > 0)
+            printi("Leaped over %lu steps", (unsigned long) pcol.nr_leaped_steps);
+        step_nr += pcol.nr_leaped_steps;
+#endif
+#ifdef SIM_CHECKPOINT
+        if (step_nr - checkpoint_step_nr >= SIM_CHECKPOINT) {
+            pcolony_writeCheckpoint(&pcol, step_nr, FALSE, SIM_CHECKPOINT_FILE);
+            checkpoint_step_nr = step_nr;
+        }
+#endif
     }
 
     lulu_destroy(&pcol);
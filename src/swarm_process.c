@@ -0,0 +1,487 @@
+/**
+ * @file swarm_process.c
+ * @brief Simulation of a swarm by several processes that share it's global environments
+ * The shared memory region holds the global environments, a turn counter that orders the colony steps, a barrier that ends each swarm step
+ * and the results of the colonies. The mutex of the region is robust, so a process that crashes while holding it does not block the others.
+ * Concurrent swarms do not use the turn counter. Their global environments are only modified with atomic operations and the changed objects
+ * are exchanged atomically between the processes, so the mutex is only taken at the end of each colony step and at the barrier.
+ */
+#ifdef LULU_PROCESSES
+    #define _GNU_SOURCE //for MAP_ANONYMOUS and robust mutexes with -std=c99
+    #include <pthread.h>
+    #include <errno.h>
+    #include <stdio.h> //for fflush
+    #include <unistd.h>
+    #include <sys/mman.h>
+    #include <sys/types.h>
+    #include <sys/wait.h>
+#endif
+#include "swarm_process.h"
+#include "debug_print.h"
+#include <stdlib.h>
+
+#ifdef LULU_PROCESSES
+struct _swarm_region {
+    pthread_mutex_t mutex; // robust and shared by the processes, protects the following fields
+    pthread_cond_t changed; // signaled when the turn, the barrier or the crashed processes change
+    uint64_t turn; // next colony step allowed to run (step_nr * nr_colonies + colony_nr)
+    uint32_t step_nr; // nr of swarm steps that all of the live processes have finished
+    uint16_t nr_executed[2]; // nr_executed[step_nr % 2] = nr of colonies that have executed programs in swarm step step_nr
+    bool error; // a colony step has failed
+    Pswarm_t pswarm; // global environments seen by the colonies (their arrays are stored in the region)
+    uint32_t *done_steps; // done_steps[i] = nr of swarm steps finished by process i
+#ifdef INCREMENTAL_SELECTION
+    // pending[(i * 3 + env) * PRESENCE_NR_WORDS(nr_A) + word] = objects of global environment env changed since the last turn of process i
+    presence_word_t *pending;
+#endif
+};
+
+/**
+ * @brief Reserve space in the shared memory region (8 byte aligned)
+ * The layout is computed twice, first without a region (base = NULL) in order to find the size of the region
+ *
+ * @param base Start of the region or NULL
+ * @param offset Offset of the first free byte (updated)
+ * @param size Number of bytes
+ *
+ * @return Pointer to the reserved space or NULL if base is NULL
+ */
+static void* takeRegionSpace(uint8_t *base, size_t *offset, size_t size) {
+    void *space = (base != NULL) ? base + *offset : NULL;
+
+    *offset += (size + 7) & ~((size_t) 7);
+
+    return space;
+}
+
+/**
+ * @brief Copy the contents of an environment multiset to another one of the same size
+ *
+ * @param destination The multiset that is overwritten
+ * @param source The multiset that is copied
+ */
+static void copyEnvContents(multiset_env_t *destination, multiset_env_t *source) {
+    for (object_id_t i = 0; i < source->size; i++)
+        destination->items[i] = source->items[i];
+#ifdef MULTISET_PRESENCE
+    for (object_id_t word = 0; word < PRESENCE_NR_WORDS(source->size); word++)
+        destination->presence[word] = source->presence[word];
+#endif
+#ifdef INCREMENTAL_SELECTION
+    for (object_id_t word = 0; word < PRESENCE_NR_WORDS(source->size); word++)
+        destination->changed[word] = source->changed[word];
+#endif
+#ifdef CONFIG_HASH
+    destination->hash = source->hash;
+#endif
+}
+
+/**
+ * @brief Place a copy of an environment multiset in the shared memory region
+ *
+ * @param destination The multiset header in the region
+ * @param source The multiset that is copied
+ * @param base Start of the region or NULL (see takeRegionSpace())
+ * @param offset Offset of the first free byte of the region (updated)
+ */
+static void placeEnv(multiset_env_t *destination, multiset_env_t *source, uint8_t *base, size_t *offset) {
+    multiset_env_t layout;
+
+    layout.size = source->size;
+    layout.items = (multiset_env_item_t *) takeRegionSpace(base, offset, sizeof(multiset_env_item_t) * source->size);
+#ifdef MULTISET_PRESENCE
+    layout.presence = (presence_word_t *) takeRegionSpace(base, offset, sizeof(presence_word_t) * PRESENCE_NR_WORDS(source->size));
+#endif
+#ifdef INCREMENTAL_SELECTION
+    layout.changed = (presence_word_t *) takeRegionSpace(base, offset, sizeof(presence_word_t) * PRESENCE_NR_WORDS(source->size));
+#endif
+    if (base == NULL)
+        return;
+
+    *destination = layout;
+    copyEnvContents(destination, source);
+}
+
+/**
+ * @brief Lay out the shared memory region of a process swarm
+ *
+ * @param swarm The process swarm
+ * @param base Start of the region or NULL (see takeRegionSpace())
+ *
+ * @return The size of the region
+ */
+static size_t layOutRegion(ProcessSwarm_t *swarm, uint8_t *base) {
+    swarm_region_t *region = (swarm_region_t *) base;
+    Pswarm_t *pswarm = swarm->pswarm,
+             unused,
+             *envs = (region != NULL) ? &region->pswarm : &unused; // placeEnv() does not write to unused
+    size_t offset = 0;
+    uint32_t *done_steps;
+
+    takeRegionSpace(base, &offset, sizeof(swarm_region_t));
+    swarm->crashed = (bool *) takeRegionSpace(base, &offset, sizeof(bool) * swarm->nr_processes);
+    done_steps = (uint32_t *) takeRegionSpace(base, &offset, sizeof(uint32_t) * swarm->nr_processes);
+    swarm->results = (sim_step_result_t *) takeRegionSpace(base, &offset, sizeof(sim_step_result_t) * pswarm->nr_colonies);
+    swarm->nr_steps = (uint32_t *) takeRegionSpace(base, &offset, sizeof(uint32_t) * pswarm->nr_colonies);
+    if (region != NULL)
+        region->done_steps = done_steps;
+#ifdef INCREMENTAL_SELECTION
+    {
+        presence_word_t *pending = (presence_word_t *) takeRegionSpace(base, &offset,
+                sizeof(presence_word_t) * swarm->nr_processes * 3 * PRESENCE_NR_WORDS(pswarm->global_env.size));
+
+        if (region != NULL)
+            region->pending = pending;
+    }
+#endif
+    placeEnv(&envs->global_env, &pswarm->global_env, base, &offset);
+    placeEnv(&envs->in_global_env, &pswarm->in_global_env, base, &offset);
+    placeEnv(&envs->out_global_env, &pswarm->out_global_env, base, &offset);
+
+    return offset;
+}
+
+bool initProcessSwarm(ProcessSwarm_t *swarm, Pswarm_t *pswarm, uint16_t nr_processes) {
+    pthread_mutexattr_t mutex_attr;
+    pthread_condattr_t cond_attr;
+    swarm_region_t *region;
+
+    swarm->pswarm = pswarm;
+    swarm->concurrent = FALSE;
+    swarm->nr_rollbacks = 0;
+    //each process steps at least one colony
+    swarm->nr_processes = (nr_processes < pswarm->nr_colonies) ? nr_processes : pswarm->nr_colonies;
+    swarm->region_size = layOutRegion(swarm, NULL);
+    region = (swarm_region_t *) mmap(NULL, swarm->region_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (region == MAP_FAILED) {
+        printe("Could not map %lu bytes of shared memory", (unsigned long) swarm->region_size);
+        swarm->region = NULL;
+        return FALSE;
+    }
+    swarm->region = region;
+    layOutRegion(swarm, (uint8_t *) region);
+
+    pthread_mutexattr_init(&mutex_attr);
+    pthread_mutexattr_setpshared(&mutex_attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&mutex_attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(&region->mutex, &mutex_attr);
+    pthread_mutexattr_destroy(&mutex_attr);
+    pthread_condattr_init(&cond_attr);
+    pthread_condattr_setpshared(&cond_attr, PTHREAD_PROCESS_SHARED);
+    pthread_cond_init(&region->changed, &cond_attr);
+    pthread_condattr_destroy(&cond_attr);
+
+    region->turn = 0;
+    region->step_nr = 0;
+    region->nr_executed[0] = region->nr_executed[1] = 0;
+    region->error = FALSE;
+    region->pswarm.colonies = NULL;
+    region->pswarm.nr_colonies = 0;
+    region->pswarm.max_colonies = 0;
+#ifdef CONCURRENT_ENVS
+    region->pswarm.concurrent = FALSE;
+    region->pswarm.nr_rollbacks = 0;
+#endif
+    for (uint16_t process_nr = 0; process_nr < swarm->nr_processes; process_nr++) {
+        swarm->crashed[process_nr] = FALSE;
+        region->done_steps[process_nr] = 0;
+    }
+    for (uint16_t colony_nr = 0; colony_nr < pswarm->nr_colonies; colony_nr++) {
+        swarm->results[colony_nr] = SIM_STEP_RESULT_FINISHED;
+        swarm->nr_steps[colony_nr] = 0;
+    }
+#ifdef INCREMENTAL_SELECTION
+    {
+        multiset_env_t *envs[] = {&region->pswarm.global_env, &region->pswarm.in_global_env, &region->pswarm.out_global_env};
+        object_id_t nr_words = PRESENCE_NR_WORDS(envs[0]->size);
+
+        //the objects changed before the run are pending for all processes
+        for (uint16_t process_nr = 0; process_nr < swarm->nr_processes; process_nr++)
+            for (uint8_t i = 0; i < 3; i++)
+                for (object_id_t word = 0; word < nr_words; word++)
+                    region->pending[(process_nr * 3 + i) * nr_words + word] = envs[i]->changed[word];
+        for (uint8_t i = 0; i < 3; i++)
+            for (object_id_t word = 0; word < nr_words; word++)
+                envs[i]->changed[word] = 0;
+    }
+#endif
+
+    return TRUE;
+}
+
+bool processSwarm_setConcurrent(ProcessSwarm_t *swarm, bool concurrent) {
+#ifdef CONCURRENT_ENVS
+    swarm->concurrent = concurrent;
+    swarm->region->pswarm.concurrent = concurrent;
+    return TRUE;
+#else
+    //the slots of the sparse layout are shared by different objects, so a count cannot be updated with a single atomic operation
+    return !concurrent;
+#endif
+}
+
+void destroyProcessSwarm(ProcessSwarm_t *swarm) {
+    if (swarm->region != NULL) {
+        pthread_cond_destroy(&swarm->region->changed);
+        pthread_mutex_destroy(&swarm->region->mutex);
+        munmap(swarm->region, swarm->region_size);
+    }
+    swarm->region = NULL;
+    swarm->results = NULL;
+    swarm->nr_steps = NULL;
+    swarm->crashed = NULL;
+    swarm->nr_processes = 0;
+}
+
+/**
+ * @brief Lock the mutex of the shared memory region (and make it consistent if it's previous owner has crashed)
+ *
+ * @param region The shared memory region
+ */
+static void lockRegion(swarm_region_t *region) {
+    if (pthread_mutex_lock(&region->mutex) == EOWNERDEAD)
+        pthread_mutex_consistent(&region->mutex);
+}
+
+/**
+ * @brief Wait for a change of the shared memory region (the mutex has to be locked)
+ *
+ * @param region The shared memory region
+ */
+static void waitRegion(swarm_region_t *region) {
+    if (pthread_cond_wait(&region->changed, &region->mutex) == EOWNERDEAD)
+        pthread_mutex_consistent(&region->mutex);
+}
+
+#ifdef CONCURRENT_ENVS
+/**
+ * @brief Make the ids and presence bits of the global environments of the region consistent with their counts after concurrent updates
+ *
+ * @param region The shared memory region
+ */
+static void syncSharedEnvs(swarm_region_t *region) {
+    syncSharedMultisetEnv(&region->pswarm.global_env);
+    syncSharedMultisetEnv(&region->pswarm.in_global_env);
+    syncSharedMultisetEnv(&region->pswarm.out_global_env);
+}
+#endif
+
+/**
+ * @brief End the current swarm step if all of the live processes have finished it (the mutex has to be locked)
+ *
+ * @param swarm The process swarm
+ */
+static void tryReleaseBarrier(ProcessSwarm_t *swarm) {
+    swarm_region_t *region = swarm->region;
+
+    for (uint16_t process_nr = 0; process_nr < swarm->nr_processes; process_nr++)
+        if (!swarm->crashed[process_nr] && region->done_steps[process_nr] <= region->step_nr)
+            return;
+
+#ifdef CONCURRENT_ENVS
+    //no process is executing programs until the barrier is released
+    if (swarm->concurrent)
+        syncSharedEnvs(region);
+#endif
+    region->step_nr++;
+    region->nr_executed[region->step_nr % 2] = 0;
+    pthread_cond_broadcast(&region->changed);
+}
+
+/**
+ * @brief Wait until it is the turn of a colony step, skipping the colonies of the crashed processes
+ *
+ * @param swarm The process swarm
+ * @param turn The colony step (step_nr * nr_colonies + colony_nr)
+ */
+static void waitForTurn(ProcessSwarm_t *swarm, uint64_t turn) {
+    swarm_region_t *region = swarm->region;
+
+    lockRegion(region);
+    while (region->turn != turn) {
+        if (swarm->crashed[(region->turn % swarm->pswarm->nr_colonies) % swarm->nr_processes]) {
+            region->turn++;
+            pthread_cond_broadcast(&region->changed);
+        }
+        else
+            waitRegion(region);
+    }
+    pthread_mutex_unlock(&region->mutex);
+}
+
+#ifdef INCREMENTAL_SELECTION
+/**
+ * @brief Mark as dirty the programs of the colonies of a process that use global objects changed by the previous colony steps
+ * The pending changes are taken atomically because the processes of a concurrent swarm publish their changes at any time
+ *
+ * @param swarm The process swarm
+ * @param process_nr The process
+ * @param taken Space for PRESENCE_NR_WORDS(nr_A) words
+ */
+static void applyPendingChanges(ProcessSwarm_t *swarm, uint16_t process_nr, presence_word_t *taken) {
+    object_id_t nr_words = PRESENCE_NR_WORDS(swarm->region->pswarm.global_env.size);
+
+    for (uint8_t i = 0; i < 3; i++) {
+        presence_word_t *pending = &swarm->region->pending[(process_nr * 3 + i) * nr_words];
+
+        for (object_id_t word = 0; word < nr_words; word++)
+            taken[word] = __atomic_exchange_n(&pending[word], 0, __ATOMIC_RELAXED);
+        for (uint16_t colony_nr = process_nr; colony_nr < swarm->pswarm->nr_colonies; colony_nr += swarm->nr_processes)
+            pcolony_markChangedObjects(&swarm->pswarm->colonies[colony_nr], MULTISET_TARGET_GLOBAL_ENV + i, taken);
+    }
+}
+
+/**
+ * @brief Move the objects changed by a colony step from the global environments to the pending changes of all processes
+ *
+ * @param swarm The process swarm
+ */
+static void publishChanges(ProcessSwarm_t *swarm) {
+    swarm_region_t *region = swarm->region;
+    multiset_env_t *envs[] = {&region->pswarm.global_env, &region->pswarm.in_global_env, &region->pswarm.out_global_env};
+    object_id_t nr_words = PRESENCE_NR_WORDS(envs[0]->size);
+
+    for (uint8_t i = 0; i < 3; i++)
+        for (object_id_t word = 0; word < nr_words; word++) {
+            presence_word_t changed = __atomic_exchange_n(&envs[i]->changed[word], 0, __ATOMIC_RELAXED);
+
+            if (changed == 0)
+                continue;
+            for (uint16_t process_nr = 0; process_nr < swarm->nr_processes; process_nr++)
+                __atomic_fetch_or(&region->pending[(process_nr * 3 + i) * nr_words + word], changed, __ATOMIC_RELAXED);
+        }
+}
+#endif
+
+/**
+ * @brief Step the colonies of one worker process (colonies process_nr, process_nr + nr_processes, ...) until the swarm stops
+ *
+ * @param swarm The process swarm
+ * @param process_nr The number of the process
+ * @param max_steps The maximum number of swarm steps
+ */
+static void runWorker(ProcessSwarm_t *swarm, uint16_t process_nr, uint32_t max_steps) {
+    swarm_region_t *region = swarm->region;
+    Pswarm_t *pswarm = swarm->pswarm;
+    bool running = TRUE;
+#ifdef INCREMENTAL_SELECTION
+    presence_word_t *taken = (presence_word_t *) LULU_MALLOC(sizeof(presence_word_t) * PRESENCE_NR_WORDS(region->pswarm.global_env.size));
+#endif
+
+    //the colonies of this process use the global environments of the region
+    for (uint16_t colony_nr = process_nr; colony_nr < pswarm->nr_colonies; colony_nr += swarm->nr_processes)
+        pswarm->colonies[colony_nr].swarm = &region->pswarm;
+
+    for (uint32_t step_nr = 0; step_nr < max_steps && running; step_nr++) {
+        for (uint16_t colony_nr = process_nr; colony_nr < pswarm->nr_colonies; colony_nr += swarm->nr_processes) {
+            sim_step_result_t result = SIM_STEP_RESULT_FINISHED;
+
+            if (!swarm->concurrent)
+                waitForTurn(swarm, (uint64_t) step_nr * pswarm->nr_colonies + colony_nr);
+            //the colonies that follow a failed colony are not stepped (see pswarm_runSimulationStep())
+            if (!region->error) {
+#ifdef INCREMENTAL_SELECTION
+                applyPendingChanges(swarm, process_nr, taken);
+#endif
+                printi("Running colony %d", colony_nr);
+                result = pcolony_runSimulationStep(&pswarm->colonies[colony_nr]);
+                swarm->results[colony_nr] = result;
+                swarm->nr_steps[colony_nr]++;
+#ifdef INCREMENTAL_SELECTION
+                publishChanges(swarm);
+#endif
+            }
+
+            lockRegion(region);
+            if (result == SIM_STEP_RESULT_ERROR) {
+                printe("Colony %d failed, STOP_SIM", colony_nr);
+                region->error = TRUE;
+            }
+            else if (result == SIM_STEP_RESULT_FINISHED && !region->error)
+                region->nr_executed[step_nr % 2]++;
+            region->turn++;
+            pthread_cond_broadcast(&region->changed);
+            pthread_mutex_unlock(&region->mutex);
+        }
+
+        //barrier: the step ends when all of the live processes have finished it
+        lockRegion(region);
+        region->done_steps[process_nr] = step_nr + 1;
+        tryReleaseBarrier(swarm);
+        while (region->step_nr == step_nr)
+            waitRegion(region);
+        running = !region->error && region->nr_executed[step_nr % 2] > 0;
+        pthread_mutex_unlock(&region->mutex);
+    }
+#ifdef INCREMENTAL_SELECTION
+    LULU_FREE(taken);
+#endif
+}
+
+/**
+ * @brief Record that a worker process has crashed, so that the other processes skip it's colonies and do not wait for it at the barrier
+ *
+ * @param swarm The process swarm
+ * @param process_nr The number of the crashed process
+ */
+static void markProcessCrashed(ProcessSwarm_t *swarm, uint16_t process_nr) {
+    swarm_region_t *region = swarm->region;
+
+    printw("Process %d of the swarm has crashed", process_nr);
+    lockRegion(region);
+    swarm->crashed[process_nr] = TRUE;
+    tryReleaseBarrier(swarm);
+    pthread_cond_broadcast(&region->changed);
+    pthread_mutex_unlock(&region->mutex);
+}
+
+sim_step_result_t processSwarm_run(ProcessSwarm_t *swarm, uint32_t max_steps) {
+    swarm_region_t *region = swarm->region;
+    pid_t *pids = (pid_t *) LULU_MALLOC(sizeof(pid_t) * swarm->nr_processes);
+    uint16_t nr_crashed = 0;
+    pid_t pid;
+    int status;
+
+    //the buffered output would be written again by each child
+    fflush(stdout);
+    for (uint16_t process_nr = 0; process_nr < swarm->nr_processes; process_nr++) {
+        pids[process_nr] = fork();
+        if (pids[process_nr] == 0) {
+            runWorker(swarm, process_nr, max_steps);
+            fflush(stdout);
+            _exit(0);
+        }
+        if (pids[process_nr] < 0)
+            markProcessCrashed(swarm, process_nr);
+    }
+
+    //the parent only supervises the workers
+    while ((pid = waitpid(-1, &status, 0)) > 0)
+        for (uint16_t process_nr = 0; process_nr < swarm->nr_processes; process_nr++)
+            if (pids[process_nr] == pid && (!WIFEXITED(status) || WEXITSTATUS(status) != 0))
+                markProcessCrashed(swarm, process_nr);
+    LULU_FREE(pids);
+
+#ifdef CONCURRENT_ENVS
+    //a process may have crashed while executing a program
+    if (swarm->concurrent) {
+        syncSharedEnvs(region);
+        swarm->nr_rollbacks = region->pswarm.nr_rollbacks;
+    }
+#endif
+    //the swarm receives the final global environments
+    copyEnvContents(&swarm->pswarm->global_env, &region->pswarm.global_env);
+    copyEnvContents(&swarm->pswarm->in_global_env, &region->pswarm.in_global_env);
+    copyEnvContents(&swarm->pswarm->out_global_env, &region->pswarm.out_global_env);
+
+    for (uint16_t process_nr = 0; process_nr < swarm->nr_processes; process_nr++)
+        if (swarm->crashed[process_nr])
+            nr_crashed++;
+    if (region->error || nr_crashed == swarm->nr_processes)
+        return SIM_STEP_RESULT_ERROR;
+    if (region->step_nr > 0 && region->nr_executed[(region->step_nr - 1) % 2] == 0)
+        return SIM_STEP_RESULT_NO_MORE_EXECUTABLES;
+
+    return SIM_STEP_RESULT_FINISHED;
+}
+#endif
@@ -0,0 +1,91 @@
+// vim:filetype=c
+/**
+ * @file swarm_process.h
+ * @brief Simulation of a swarm by several processes that share it's global environments
+ * The colonies of the swarm are distributed over worker processes (colony i is stepped by process i % nr_processes) and the
+ * global environments are placed in a memory region that is shared by all processes, so the swarm can use every core without
+ * threads and a crashing process only stops it's own colonies.
+ * The processes either step the colonies in turns (identical to pswarm_runSimulationStep()) or all at the same time, updating the global
+ * environments with atomic operations (see processSwarm_setConcurrent()).
+ * Only available for the PC build, if the library is built with LULU_PROCESSES.
+ */
+#ifndef SWARM_PROCESS_H
+#define SWARM_PROCESS_H
+
+#include "lulu.h"
+
+#ifdef LULU_PROCESSES
+#include <stddef.h> //for size_t
+
+typedef struct _swarm_region swarm_region_t;
+
+/**
+ * @brief Swarm that is simulated by several processes
+ */
+typedef struct _ProcessSwarm {
+    Pswarm_t *pswarm; // the simulated swarm (it's colonies are not modified, it's global environments receive the final configuration)
+    uint16_t nr_processes;
+    bool concurrent; // the processes step their colonies at the same time (see processSwarm_setConcurrent())
+    uint32_t nr_rollbacks; // nr of programs rolled back by concurrent execution (set by processSwarm_run())
+
+    swarm_region_t *region; // memory region shared by the processes (global environments, step coordination and results)
+    size_t region_size;
+
+    sim_step_result_t *results; // result of the last simulation step of each colony (stored in region)
+    uint32_t *nr_steps; // nr of simulation steps made by each colony (stored in region)
+    bool *crashed; // crashed[i] = TRUE -> process i has crashed and it's colonies were not stepped afterwards (stored in region)
+} ProcessSwarm_t;
+
+/**
+ * @brief Initialize the simulation of a swarm by several processes
+ * The global environments of the swarm are copied to a shared memory region, so they have to be filled before this call
+ *
+ * @param swarm The process swarm that will be initialized
+ * @param pswarm The swarm (initialized with initPswarm(), with all of it's colonies)
+ * @param nr_processes The number of worker processes (at most the number of colonies)
+ *
+ * @return TRUE if the shared memory region was created, FALSE otherwise
+ */
+bool initProcessSwarm(ProcessSwarm_t *swarm, Pswarm_t *pswarm, uint16_t nr_processes);
+
+/**
+ * @brief Destroy a process swarm (the swarm that it simulates is not destroyed)
+ *
+ * @param swarm The process swarm that will be destroyed
+ */
+void destroyProcessSwarm(ProcessSwarm_t *swarm);
+
+/**
+ * @brief Let the processes of a swarm step their colonies at the same time instead of waiting for their turns
+ * Consumptions from the global environments become atomic compare-and-decrement operations and productions atomic adds, so the agents of
+ * different processes execute their programs without a lock. A program whose global objects were consumed by another process after it
+ * was chosen is rolled back and it's agent does not execute anything in that step (see agent_executeProgram()).
+ * The results depend on the timing of the processes, so they are not reproducible.
+ * Requires the dense environment layout (MULTISET_ENV_DENSE), in which each count is a single word.
+ *
+ * @param swarm The process swarm (before processSwarm_run())
+ * @param concurrent TRUE for concurrent steps, FALSE for steps in turns (default)
+ *
+ * @return TRUE if the mode was set, FALSE if concurrent steps are not supported by the environment layout
+ */
+bool processSwarm_setConcurrent(ProcessSwarm_t *swarm, bool concurrent);
+
+/**
+ * @brief Run the swarm in nr_processes forked processes for at most max_steps swarm steps
+ * Unless the swarm is concurrent, each swarm step is identical to pswarm_runSimulationStep(): the colonies are stepped one after the other
+ * in the order in which they were added to the swarm (each process waits for the turn of it's colonies).
+ * In both modes the processes meet at a shared barrier at the end of the step.
+ * If a process crashes, it's colonies are skipped and the other processes continue.
+ * The configurations of the colonies stay in the worker processes, only the results and the global environments are available afterwards.
+ * Can be called only once for a process swarm.
+ *
+ * @param swarm The process swarm
+ * @param max_steps The maximum number of swarm steps
+ *
+ * @return SIM_STEP_RESULT_ERROR if the step of a colony failed or if the processes could not be created,
+ * SIM_STEP_RESULT_NO_MORE_EXECUTABLES if no colony had an executable program, SIM_STEP_RESULT_FINISHED if max_steps steps were made
+ */
+sim_step_result_t processSwarm_run(ProcessSwarm_t *swarm, uint32_t max_steps);
+#endif
+
+#endif
@@ -6,9 +6,12 @@ const uint8_t OBJECT_IS_PROGRAM_RHS     = 1<<1; //Right Hand Side object is the
 const uint8_t OBJECT_IS_PROGRAM_ALT_LHS = 1<<2; //Alternative Left Hand Side is the searched object
 const uint8_t OBJECT_IS_PROGRAM_ALT_RHS = 1<<3; //Alternative Right Hand Side is the searched object
 
-bool replaceObjInProgram(Program_t *program, uint8_t initial_obj, uint8_t final_obj) {
+bool replaceObjInProgram(Program_t *program, object_id_t initial_obj, object_id_t final_obj) {
     bool initialObjectFound = FALSE;
 
+    //the requirements of the program have to be compiled again (the program does not belong to a packed colony)
+    clearCompiledProgram(program, NULL);
+
     for (uint8_t rule_nr = 0; rule_nr < program->nr_rules; rule_nr++) {
         if (program->rules[rule_nr].lhs == initial_obj) {
             initialObjectFound = TRUE;
@@ -31,7 +34,7 @@ bool replaceObjInProgram(Program_t *program, uint8_t initial_obj, uint8_t final_
     return initialObjectFound;
 }
 
-bool isWildcardAnyInProgram(Program_t *program, uint8_t obj_any[], uint8_t obj_any_size) {
+bool isWildcardAnyInProgram(Program_t *program, object_id_t obj_any[], uint8_t obj_any_size) {
     for (uint8_t i = 0; i < obj_any_size; i++)
         if (isObjectInProgram(program, obj_any[i]))
             return TRUE;
@@ -39,14 +42,14 @@ bool isWildcardAnyInProgram(Program_t *program, uint8_t obj_any[], uint8_t obj_a
     return FALSE;
 }
 
-bool isObjectInProgram(Program_t *program, uint8_t obj) {
+bool isObjectInProgram(Program_t *program, object_id_t obj) {
     for (uint8_t rule_nr = 0; rule_nr < program->nr_rules; rule_nr++)
         if (isObjectInRule(&program->rules[rule_nr], obj))
             return TRUE;
     return FALSE;
 }
 
-uint8_t isObjectInRule(Rule_t *rule, uint8_t obj) {
+uint8_t isObjectInRule(Rule_t *rule, object_id_t obj) {
     uint8_t response = 0;
 
     if (rule->lhs == obj)
@@ -61,7 +64,7 @@ uint8_t isObjectInRule(Rule_t *rule, uint8_t obj) {
     return response;
 }
 
-void replacePcolonyWildID(Pcolony_t *pcol, uint8_t obj_with_id[], uint8_t obj_with_id_size, uint8_t my_symbolic_id) {
+void replacePcolonyWildID(Pcolony_t *pcol, object_id_t obj_with_id[], uint8_t obj_with_id_size, object_id_t my_symbolic_id) {
     Agent_t *agent;
 
     for (uint8_t i = 0; i < obj_with_id_size; i++) {
@@ -79,17 +82,18 @@ void replacePcolonyWildID(Pcolony_t *pcol, uint8_t obj_with_id[], uint8_t obj_wi
                 replaceObjInProgram(&agent->programs[program_nr], obj_with_id[i], obj_with_id[i] + 1 + my_symbolic_id);
         }
     }
+    //the programs have changed so the tables built from them have to be rebuilt
+    clearPcolonyProgramTables(pcol);
 }
 
-void expandPcolonyWildAny(Pcolony_t *pcol, uint8_t obj_with_any[], uint8_t is_obj_with_any_followed_by_id[], uint8_t obj_with_any_size, uint8_t my_symbolic_id, uint8_t nr_swarm_robots) {
+void expandPcolonyWildAny(Pcolony_t *pcol, object_id_t obj_with_any[], uint8_t is_obj_with_any_followed_by_id[], uint8_t obj_with_any_size, object_id_t my_symbolic_id, object_id_t nr_swarm_robots) {
     for (uint8_t any_id = 0; any_id < obj_with_any_size; any_id++) {
         //if for e.g B_W_ALL exists in the environment, then replace it with the expansion
         if (areObjectsInMultisetEnv(&pcol->env, obj_with_any[any_id], NO_OBJECT)) {
-            for (uint8_t robot_id = 0; robot_id < nr_swarm_robots; robot_id++)
+            for (object_id_t robot_id = 0; robot_id < nr_swarm_robots; robot_id++)
                 if (robot_id != my_symbolic_id)
-                    setObjectCountFromMultisetEnv(&pcol->env,
-                            obj_with_any[any_id] + is_obj_with_any_followed_by_id[any_id] + 1 + robot_id,
-                            COUNT_INCREMENT);
+                    incObjectCountFromMultisetEnv(&pcol->env,
+                            obj_with_any[any_id] + is_obj_with_any_followed_by_id[any_id] + 1 + robot_id);
 
             //now that we replaced this wildcarded object with it's expansions, we can remove it from this multiset
             setObjectCountFromMultisetEnv(&pcol->env, obj_with_any[any_id], 0);
@@ -97,11 +101,10 @@ void expandPcolonyWildAny(Pcolony_t *pcol, uint8_t obj_with_any[], uint8_t is_ob
 
         //if for e.g B_W_ALL exists in the global swarm environment, then replace it with the expansion
         if (areObjectsInMultisetEnv(&pcol->pswarm.global_env, obj_with_any[any_id], NO_OBJECT)) {
-            for (uint8_t robot_id = 0; robot_id < nr_swarm_robots; robot_id++)
+            for (object_id_t robot_id = 0; robot_id < nr_swarm_robots; robot_id++)
                 if (robot_id != my_symbolic_id)
-                    setObjectCountFromMultisetEnv(&pcol->pswarm.global_env,
-                            obj_with_any[any_id] + is_obj_with_any_followed_by_id[any_id] + 1 + robot_id,
-                            COUNT_INCREMENT);
+                    incObjectCountFromMultisetEnv(&pcol->pswarm.global_env,
+                            obj_with_any[any_id] + is_obj_with_any_followed_by_id[any_id] + 1 + robot_id);
 
             //now that we replaced this wildcarded object with it's expansions, we can remove it from this multiset
             setObjectCountFromMultisetEnv(&pcol->pswarm.global_env, obj_with_any[any_id], 0);
@@ -112,10 +115,9 @@ void expandPcolonyWildAny(Pcolony_t *pcol, uint8_t obj_with_any[], uint8_t is_ob
             if (areObjectsInMultisetObj(&pcol->agents[agent_nr].obj, obj_with_any[any_id], NO_OBJECT)) {
                 //we remove this wildcarded object from the multiset to free up space for the generated objects (as multisetObj is of limited capacity)
                 setObjectCountFromMultisetObj(&pcol->agents[agent_nr].obj, obj_with_any[any_id], 0);
-                for (uint8_t robot_id = 0; robot_id < nr_swarm_robots; robot_id++)
-                    setObjectCountFromMultisetObj(&pcol->agents[agent_nr].obj,
-                            obj_with_any[any_id] + is_obj_with_any_followed_by_id[any_id] + 1 + robot_id,
-                            COUNT_INCREMENT);
+                for (object_id_t robot_id = 0; robot_id < nr_swarm_robots; robot_id++)
+                    addObjectToMultisetObj(&pcol->agents[agent_nr].obj,
+                            obj_with_any[any_id] + is_obj_with_any_followed_by_id[any_id] + 1 + robot_id);
 
             }
         }
@@ -130,7 +132,7 @@ void expandPcolonyWildAny(Pcolony_t *pcol, uint8_t obj_with_any[], uint8_t is_ob
             for (uint8_t program_nr = 0; program_nr < pcol->agents[agent_nr].nr_programs; program_nr++) {
 
                 if (isWildcardAnyInProgram(&pcol->agents[agent_nr].programs[program_nr], obj_with_any, obj_with_any_size)) {
-                    for (uint8_t robot_id = 0; robot_id < nr_swarm_robots; robot_id++)
+                    for (object_id_t robot_id = 0; robot_id < nr_swarm_robots; robot_id++)
                         if (robot_id != my_symbolic_id) {
                             //create a copy of the current program and place it at the end of the initialized program list for this agent
                             copyProgram(&pcol->agents[agent_nr].programs[pcol->agents[agent_nr].init_program_nr],
@@ -157,7 +159,7 @@ void expandPcolonyWildAny(Pcolony_t *pcol, uint8_t obj_with_any[], uint8_t is_ob
             if (nr_expanded_programs > 0) {
                 //construct a new program list for this agent that does not contain empty (no rules) programs - programs that were originally
                 //wildcard-any programs and were expanded and afterwards deleted
-                Program_t *new_programs = (Program_t *) malloc(sizeof(Program_t) * (pcol->agents[agent_nr].nr_programs - nr_expanded_programs));
+                Program_t *new_programs = (Program_t *) LULU_MALLOC(sizeof(Program_t) * (pcol->agents[agent_nr].nr_programs - nr_expanded_programs));
                 uint8_t current_pos = 0;
                 for (uint8_t i = 0; i < pcol->agents[agent_nr].nr_programs; i++)
                     if (pcol->agents[agent_nr].programs[i].nr_rules > 0) {
@@ -165,7 +167,7 @@ void expandPcolonyWildAny(Pcolony_t *pcol, uint8_t obj_with_any[], uint8_t is_ob
                         destroyProgram(&pcol->agents[agent_nr].programs[i]);
                     }
                 //remove the old list
-                free(pcol->agents[agent_nr].programs);
+                LULU_FREE(pcol->agents[agent_nr].programs);
                 //assign the new list (will be cleared by destroyAgent() just as the original list)
                 pcol->agents[agent_nr].programs = new_programs;
                 //we removed the wildcard any programs
@@ -173,4 +175,6 @@ void expandPcolonyWildAny(Pcolony_t *pcol, uint8_t obj_with_any[], uint8_t is_ob
             }
         }
     }
+    //the programs have changed so the tables built from them have to be rebuilt
+    clearPcolonyProgramTables(pcol);
 }
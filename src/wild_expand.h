@@ -10,6 +10,7 @@ extern const uint8_t OBJECT_IS_RULE_ALT_RHS; //Alternative Right Hand Side is th
 /**
  * @brief Replaces one symbolic object from a program with another object
  * This method replaces all instances of the initial_obj found in the program
+ * The program must not belong to a packed or forked P colony (see packPcolony()), whose rules and compiled programs are read-only
  *
  * @param program The program where the inital object resides
  * @param initial_obj The id of the symbolic object that will be replaced
@@ -18,7 +19,7 @@ extern const uint8_t OBJECT_IS_RULE_ALT_RHS; //Alternative Right Hand Side is th
  * @return TRUE / FALSE depending on the success of the operation
  * @see replaceObjInMultisetEnv replaceObjInMultisetEnv
  */
-bool replaceObjInProgram(Program_t *program, uint8_t initial_obj, uint8_t final_obj);
+bool replaceObjInProgram(Program_t *program, object_id_t initial_obj, object_id_t final_obj);
 
 /**
  * @brief Check that the provided symbolic objects is present in the program
@@ -28,7 +29,7 @@ bool replaceObjInProgram(Program_t *program, uint8_t initial_obj, uint8_t final_
  *
  * @return TRUE / FALSE depending on the presence of the object in the program
  */
-uint8_t isObjectInProgram(Program_t *program, uint8_t obj);
+uint8_t isObjectInProgram(Program_t *program, object_id_t obj);
 
 /**
  * @brief Check that the provided symbolic object is present in the rule
@@ -38,7 +39,7 @@ uint8_t isObjectInProgram(Program_t *program, uint8_t obj);
  *
  * @return OBJECT_IS_RULE_* values (in a bitwise or combination, depending on the presence of the object) e.g. OBJECT_IS_RULE_LHS | OBJECT_IS_RULE_ALT_RHS
  */
-uint8_t isObjectInRule(Rule_t *rule, uint8_t obj);
+uint8_t isObjectInRule(Rule_t *rule, object_id_t obj);
 
 /**
  * @brief Replaces the W_ID wildcard object into the object corresponding to the symbolic id, in all structures of the Pcolony
@@ -50,7 +51,7 @@ uint8_t isObjectInRule(Rule_t *rule, uint8_t obj);
  * @param obj_with_id_size The size (number of elements) in the obj_with_id array
  * @param my_symbolic_id The computed symbolic id of this robot
  */
-void replacePcolonyWildID(Pcolony_t *pcol, uint8_t obj_with_id[], uint8_t obj_with_id_size, uint8_t my_symbolic_id);
+void replacePcolonyWildID(Pcolony_t *pcol, object_id_t obj_with_id[], uint8_t obj_with_id_size, object_id_t my_symbolic_id);
 
 /**
  * @brief Expands the W_ALL wildcard object into all of the objects (0 -> nr_swarm_robots) except my_symbolic_id in all of the structures of the Pcolony
@@ -64,4 +65,4 @@ void replacePcolonyWildID(Pcolony_t *pcol, uint8_t obj_with_id[], uint8_t obj_wi
  * @param my_symbolic_id The computed symbolic id of this robot
  * @param nr_swarm_robots The total number of swarm robots. This number is used for the actual expansion (0 .. nr_swarm_robots - 1)
  */
-void expandPcolonyWildAny(Pcolony_t *pcol, uint8_t obj_with_any[], uint8_t is_obj_with_any_followed_by_id[], uint8_t obj_with_any_size, uint8_t my_symbolic_id, uint8_t nr_swarm_robots);
+void expandPcolonyWildAny(Pcolony_t *pcol, object_id_t obj_with_any[], uint8_t is_obj_with_any_followed_by_id[], uint8_t obj_with_any_size, object_id_t my_symbolic_id, object_id_t nr_swarm_robots);
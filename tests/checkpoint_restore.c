@@ -0,0 +1,243 @@
+/**
+ * @file checkpoint_restore.c
+ * @brief Checks that a run resumed from a checkpoint ends like the uninterrupted run and that corrupted checkpoints are rejected
+ * Each Lulu file given as argument is parsed and expanded for the first robot of a swarm of 3 robots and simulated with a fixed seed.
+ * A checkpoint written after half of the steps is restored into a fresh colony (with a different seed) and used to initialize a new colony
+ * with initPcolonyFromCheckpoint(), and both have to end with the configuration of the uninterrupted run. Copies of the checkpoint with
+ * an invalid rule type, an invalid or repeated environment object or a missing end have to be rejected without modifying the colony.
+ * The sections of the checkpoint are corrupted using the layout of src/checkpoint.c, so it is included instead of being linked.
+ *
+ * Usage: test_checkpoint nr_steps lulu_file...
+ */
+#include "../src/checkpoint.c"
+#include "test_common.h"
+
+#define TEST_CHECKPOINT_PATH "build/test_checkpoint.ckpt"
+#define TEST_CORRUPTED_PATH "build/test_checkpoint_corrupted.ckpt"
+
+/**
+ * @brief Ways in which the tests corrupt a checkpoint
+ */
+typedef enum _corruption {
+    CORRUPTION_RULE_TYPE, // the first rule gets a type that is not part of rule_type_t
+    CORRUPTION_NO_OBJECT, // the first environment object is NO_OBJECT
+    CORRUPTION_REPEATED_OBJECT, // the second object of an environment is the first one again
+    CORRUPTION_TRUNCATED, // the last 8 bytes are missing
+    NR_CORRUPTIONS
+} corruption_t;
+
+static const char *corruptionNames[] = {"an invalid rule type", "a NO_OBJECT environment object", "a repeated environment object", "a missing end"};
+
+/**
+ * @brief Run the simulation steps of a colony until it has made nr_steps steps or a step did not finish
+ *
+ * @param pcol The P colony
+ * @param step_nr Number of steps made so far (updated)
+ * @param nr_steps Number of steps after which the run stops
+ *
+ * @return The result of the last step (SIM_STEP_RESULT_FINISHED if no step was made)
+ */
+static sim_step_result_t runSteps(Pcolony_t *pcol, uint64_t *step_nr, uint64_t nr_steps) {
+    sim_step_result_t result = SIM_STEP_RESULT_FINISHED;
+
+    while (*step_nr < nr_steps && result == SIM_STEP_RESULT_FINISHED) {
+        result = pcolony_runSimulationStep(pcol);
+        (*step_nr)++;
+    }
+    return result;
+}
+
+/**
+ * @brief Continue the run of a colony restored from a checkpoint and compute the digest of it's final configuration
+ *
+ * @param pcol The restored P colony
+ * @param step_nr Step number stored in the checkpoint
+ * @param nr_steps Number of steps after which the run stops
+ * @param checkpoint_result Result of the last step made before the checkpoint (the run is not continued if it did not finish)
+ *
+ * @return The digest of the final configuration, the number of steps and the result of the last step
+ */
+static uint64_t resumeColony(Pcolony_t *pcol, uint64_t step_nr, uint64_t nr_steps, sim_step_result_t checkpoint_result) {
+    sim_step_result_t result = checkpoint_result;
+    uint64_t digest;
+
+    if (result == SIM_STEP_RESULT_FINISHED)
+        result = runSteps(pcol, &step_nr, nr_steps);
+
+    digest = getConfigurationDigest(pcol);
+    addToDigest(&digest, step_nr);
+    addToDigest(&digest, result);
+    return digest;
+}
+
+/**
+ * @brief Write a corrupted copy of a checkpoint
+ *
+ * @param path Path of the checkpoint
+ * @param corrupted_path Path of the corrupted copy
+ * @param corruption How the copy is corrupted
+ *
+ * @return TRUE if the copy was written, FALSE if the checkpoint cannot be corrupted this way (e.g. no environment has two objects)
+ */
+static bool writeCorruptedCheckpoint(const char *path, const char *corrupted_path, corruption_t corruption) {
+    FILE *file = fopen(path, "rb");
+    uint8_t *data;
+    checkpoint_header_t *header;
+    checkpoint_layout_t layout;
+    checkpoint_item_t *items;
+    size_t size;
+    bool corrupted = FALSE;
+
+    if (file == NULL)
+        return FALSE;
+    fseek(file, 0, SEEK_END);
+    size = (size_t) ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data = (uint8_t *) malloc(size);
+    if (fread(data, 1, size, file) != size) {
+        fclose(file);
+        free(data);
+        return FALSE;
+    }
+    fclose(file);
+
+    header = (checkpoint_header_t *) data;
+    getCheckpointLayout(header, &layout);
+    items = (checkpoint_item_t *) (data + layout.items);
+    switch (corruption) {
+        case CORRUPTION_RULE_TYPE:
+            if (header->nr_rules > 0) {
+                ((checkpoint_rule_t *) (data + layout.rules))->type = RULE_TYPE_CONDITIONAL_OUT_EXTEROCEPTIVE_OUT_EXTEROCEPTIVE + 1;
+                corrupted = TRUE;
+            }
+            break;
+        case CORRUPTION_NO_OBJECT:
+            if (header->nr_items[0] + header->nr_items[1] + header->nr_items[2] + header->nr_items[3] > 0) {
+                items[0].obj = NO_OBJECT;
+                corrupted = TRUE;
+            }
+            break;
+        case CORRUPTION_REPEATED_OBJECT:
+            for (uint8_t env = 0; env < CHECKPOINT_NR_ENVS && !corrupted; env++) {
+                if (header->nr_items[env] > 1) {
+                    items[1].obj = items[0].obj;
+                    corrupted = TRUE;
+                }
+                items += header->nr_items[env];
+            }
+            break;
+        case CORRUPTION_TRUNCATED:
+            size -= 8;
+            corrupted = TRUE;
+            break;
+        default:
+            break;
+    }
+
+    file = (corrupted) ? fopen(corrupted_path, "wb") : NULL;
+    if (file != NULL) {
+        corrupted = fwrite(data, 1, size, file) == size;
+        fclose(file);
+    }
+    free(data);
+    return corrupted && file != NULL;
+}
+
+/**
+ * @brief Check that the corrupted copies of a checkpoint are rejected and do not modify the colony that they are restored into
+ *
+ * @param path Path of the Lulu file (the colony is initialized from it)
+ *
+ * @return The number of corrupted copies that were accepted or that modified the colony
+ */
+static uint32_t checkCorruptedCheckpoints(const char *path) {
+    uint32_t nr_failures = 0;
+    Pcolony_t pcol, loaded;
+    uint64_t digest, step_nr;
+    uint32_t rng_state;
+
+    if (!initTestPcolony(&pcol, path))
+        return 1;
+    digest = getConfigurationDigest(&pcol);
+    rng_state = pcol.rng_state;
+
+    for (corruption_t corruption = 0; corruption < NR_CORRUPTIONS; corruption++) {
+        if (!writeCorruptedCheckpoint(TEST_CHECKPOINT_PATH, TEST_CORRUPTED_PATH, corruption))
+            continue;
+
+        //the rules are only used by initPcolonyFromCheckpoint()
+        if (corruption != CORRUPTION_RULE_TYPE && pcolony_restoreCheckpoint(&pcol, &step_nr, TEST_CORRUPTED_PATH)) {
+            fprintf(stderr, "%s: a checkpoint with %s was restored\n", path, corruptionNames[corruption]);
+            nr_failures++;
+        }
+        if (getConfigurationDigest(&pcol) != digest || pcol.rng_state != rng_state) {
+            fprintf(stderr, "%s: a checkpoint with %s modified the colony\n", path, corruptionNames[corruption]);
+            nr_failures++;
+        }
+        if (initPcolonyFromCheckpoint(&loaded, &step_nr, TEST_CORRUPTED_PATH)) {
+            fprintf(stderr, "%s: a colony was initialized from a checkpoint with %s\n", path, corruptionNames[corruption]);
+            destroyPcolony(&loaded);
+            nr_failures++;
+        }
+    }
+
+    remove(TEST_CORRUPTED_PATH);
+    destroyPcolony(&pcol);
+    return nr_failures;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s nr_steps lulu_file...\n", argv[0]);
+        return 2;
+    }
+    uint64_t nr_steps = strtoull(argv[1], NULL, 10);
+    uint32_t nr_failures = 0;
+
+    for (int arg_nr = 2; arg_nr < argc; arg_nr++) {
+        const char *path = argv[arg_nr];
+        Pcolony_t pcol, restored;
+        uint64_t step_nr = 0, checkpoint_step_nr, expected;
+        sim_step_result_t checkpoint_result;
+
+        if (!initTestPcolony(&pcol, path))
+            return 2;
+        checkpoint_result = runSteps(&pcol, &step_nr, nr_steps / 2);
+        if (!pcolony_writeCheckpoint(&pcol, step_nr, TRUE, TEST_CHECKPOINT_PATH))
+            return 2;
+        expected = resumeColony(&pcol, step_nr, nr_steps, checkpoint_result);
+        destroyPcolony(&pcol);
+
+        //the seed of the colony is replaced by the state of the generator stored in the checkpoint
+        if (!initTestPcolony(&restored, path))
+            return 2;
+        pcolony_setSeed(&restored, TEST_SEED + 1);
+        if (!pcolony_restoreCheckpoint(&restored, &checkpoint_step_nr, TEST_CHECKPOINT_PATH)) {
+            fprintf(stderr, "%s: the checkpoint was not restored\n", path);
+            nr_failures++;
+        }
+        else if (resumeColony(&restored, checkpoint_step_nr, nr_steps, checkpoint_result) != expected) {
+            fprintf(stderr, "%s: the restored colony ends with a different configuration\n", path);
+            nr_failures++;
+        }
+        destroyPcolony(&restored);
+
+        if (!initPcolonyFromCheckpoint(&restored, &checkpoint_step_nr, TEST_CHECKPOINT_PATH)) {
+            fprintf(stderr, "%s: no colony was initialized from the checkpoint\n", path);
+            nr_failures++;
+        }
+        else {
+            if (resumeColony(&restored, checkpoint_step_nr, nr_steps, checkpoint_result) != expected) {
+                fprintf(stderr, "%s: the colony initialized from the checkpoint ends with a different configuration\n", path);
+                nr_failures++;
+            }
+            destroyPcolony(&restored);
+        }
+
+        nr_failures += checkCorruptedCheckpoints(path);
+        remove(TEST_CHECKPOINT_PATH);
+    }
+
+    printf("%d Lulu files, %lu checkpoint failures\n", argc - 2, (unsigned long) nr_failures);
+    return nr_failures > 0;
+}
@@ -0,0 +1,160 @@
+/**
+ * @file determinism.c
+ * @brief Checks that the final configurations of a model do not depend on how the colony was built or stepped
+ * Each Lulu file given as argument is parsed and expanded for the first robot of a swarm of 3 robots and simulated with a fixed seed.
+ * The final configuration of the fresh colony has to be identical to the ones of it's copy, clone, packed version and fork (if the library
+ * is built with PCOLONY_ARENA, including the clone of a packed colony that recompiled a program), and two ensembles with the same seed
+ * have to end with identical replicas. Mismatches make the test fail.
+ * If the library is built with LULU_THREADS, the colonies and the second ensemble are stepped by TEST_THREADS threads, so the digests that
+ * are printed for each model can be compared with the ones of a sequential build (see the check target of the Makefile).
+ *
+ * Usage: test_determinism nr_steps lulu_file...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "ensemble.h"
+#include "test_common.h"
+
+#define TEST_NR_REPLICAS 8
+#ifndef TEST_THREADS
+    #define TEST_THREADS 4
+#endif
+
+/**
+ * @brief Run a colony for at most nr_steps simulation steps and compute the digest of it's final configuration
+ *
+ * @param pcol The P colony
+ * @param nr_steps The maximum number of steps
+ *
+ * @return The digest of the final configuration, the number of steps and the result of the last step
+ */
+static uint64_t runColony(Pcolony_t *pcol, uint32_t nr_steps) {
+    sim_step_result_t result = SIM_STEP_RESULT_FINISHED;
+    uint32_t step_nr = 0;
+    uint64_t digest;
+
+#ifdef LULU_THREADS
+    if (!pcolony_setThreads(pcol, TEST_THREADS))
+        fprintf(stderr, "Could not create all of the %d threads\n", TEST_THREADS);
+#endif
+    while (step_nr < nr_steps && result == SIM_STEP_RESULT_FINISHED) {
+        result = pcolony_runSimulationStep(pcol);
+        step_nr++;
+    }
+
+    digest = getConfigurationDigest(pcol);
+    addToDigest(&digest, step_nr);
+    addToDigest(&digest, result);
+    return digest;
+}
+
+/**
+ * @brief Run an ensemble of replicas of a colony and compute the digest of all of their final configurations
+ *
+ * @param pcol The P colony that is replicated
+ * @param nr_steps The maximum number of steps made by each replica
+ * @param nr_threads The number of threads that step the replicas (ignored if the library is built without LULU_THREADS)
+ *
+ * @return The digest of the final configurations, numbers of steps and results of the replicas
+ */
+static uint64_t runEnsemble(Pcolony_t *pcol, uint32_t nr_steps, uint8_t nr_threads) {
+    Ensemble_t ensemble;
+    uint64_t digest = TEST_DIGEST_INIT;
+
+    initEnsemble(&ensemble, pcol, TEST_NR_REPLICAS, TEST_SEED);
+#ifdef LULU_THREADS
+    if (!ensemble_setThreads(&ensemble, nr_threads))
+        fprintf(stderr, "Could not create all of the %d threads\n", nr_threads);
+#else
+    (void) nr_threads;
+#endif
+    ensemble_run(&ensemble, nr_steps);
+
+    for (uint32_t i = 0; i < ensemble.nr_replicas; i++) {
+        addToDigest(&digest, getConfigurationDigest(&ensemble.replicas[i]));
+        addToDigest(&digest, ensemble.nr_steps[i]);
+        addToDigest(&digest, ensemble.results[i]);
+    }
+    destroyEnsemble(&ensemble);
+
+    return digest;
+}
+
+/**
+ * @brief Compare the digest of a variant of a colony with the digest of the fresh colony
+ *
+ * @param path Path of the Lulu file (used in the messages)
+ * @param variant Name of the variant
+ * @param digest Digest of the variant
+ * @param expected Digest of the fresh colony
+ *
+ * @return 1 if the digests differ, 0 otherwise
+ */
+static uint32_t checkDigest(const char *path, const char *variant, uint64_t digest, uint64_t expected) {
+    if (digest == expected)
+        return 0;
+
+    fprintf(stderr, "%s: the final configuration of the %s colony differs (%016llx != %016llx)\n", path, variant,
+            (unsigned long long) digest, (unsigned long long) expected);
+    return 1;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s nr_steps lulu_file...\n", argv[0]);
+        return 2;
+    }
+    uint32_t nr_steps = (uint32_t) strtoul(argv[1], NULL, 10);
+    uint32_t nr_mismatches = 0;
+
+    for (int arg_nr = 2; arg_nr < argc; arg_nr++) {
+        const char *path = argv[arg_nr];
+        Pcolony_t pcol, variant;
+        uint64_t expected, ensemble_digest;
+
+        if (!initTestPcolony(&pcol, path))
+            return 2;
+
+        //every variant starts from the initial configuration of the fresh colony, with the same seed
+        copyPcolony(&variant, &pcol);
+        expected = runColony(&pcol, nr_steps);
+        destroyPcolony(&pcol);
+        nr_mismatches += checkDigest(path, "copied", runColony(&variant, nr_steps), expected);
+        destroyPcolony(&variant);
+
+#ifdef PCOLONY_ARENA
+        if (!initTestPcolony(&pcol, path))
+            return 2;
+        clonePcolony(&variant, &pcol);
+        nr_mismatches += checkDigest(path, "cloned", runColony(&variant, nr_steps), expected);
+        destroyPcolony(&variant);
+
+        //a program that is recompiled after packing is stored outside of the arena, so the clone gets a copy of it
+        packPcolony(&pcol);
+        if (pcol.nr_agents > 0 && pcol.agents[0].nr_programs > 0) {
+            clearCompiledProgram(&pcol.agents[0].programs[0], &pcol);
+            compileProgram(&pcol.agents[0].programs[0], &pcol);
+        }
+        clonePcolony(&variant, &pcol);
+        nr_mismatches += checkDigest(path, "recompiled clone", runColony(&variant, nr_steps), expected);
+        destroyPcolony(&variant);
+
+        forkPcolony(&variant, &pcol);
+        nr_mismatches += checkDigest(path, "forked", runColony(&variant, nr_steps), expected);
+        nr_mismatches += checkDigest(path, "packed", runColony(&pcol, nr_steps), expected);
+        //the fork is destroyed last, so the shared tables are freed by a fork
+        destroyPcolony(&pcol);
+        destroyPcolony(&variant);
+#endif
+
+        if (!initTestPcolony(&pcol, path))
+            return 2;
+        ensemble_digest = runEnsemble(&pcol, nr_steps, 1);
+        nr_mismatches += checkDigest(path, "ensemble", runEnsemble(&pcol, nr_steps, TEST_THREADS), ensemble_digest);
+        destroyPcolony(&pcol);
+
+        printf("%s %016llx %016llx\n", path, (unsigned long long) expected, (unsigned long long) ensemble_digest);
+    }
+
+    return nr_mismatches > 0;
+}
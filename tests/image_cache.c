@@ -0,0 +1,376 @@
+/**
+ * @file image_cache.c
+ * @brief Checks that colonies initialized from cached instance images run like the parsed and expanded colonies and that the cache is
+ * keyed and validated correctly
+ * Each Lulu file given as argument is parsed and expanded for the first robot of a swarm of 3 robots and simulated with a fixed seed.
+ * The colony initialized with initPcolonyFromLuluCache() has to end with the same configuration, both when the image is built (miss) and
+ * when it is mapped again (hit). A different robot id, swarm size or model text has to build a different image, and images with an
+ * invalid rule type, an invalid or repeated environment object, a missing end or the key of another robot have to be rejected and rebuilt.
+ * The sections of the image are corrupted using the layout of src/instance_image.c, so it is included instead of being linked.
+ *
+ * Usage: test_image nr_steps lulu_file...
+ */
+#include "../src/instance_image.c"
+#include "test_common.h"
+#include <errno.h>
+
+#define TEST_CACHE_DIR "build/test_image_cache"
+// copy of the Lulu file with a different text (and so a different model hash)
+#define TEST_MODEL_COPY_PATH "build/test_image_model.lulu"
+
+/**
+ * @brief Ways in which the tests corrupt an image
+ */
+typedef enum _corruption {
+    CORRUPTION_RULE_TYPE, // the first rule gets a type that is not part of rule_type_t
+    CORRUPTION_NO_OBJECT, // the first environment object is NO_OBJECT
+    CORRUPTION_REPEATED_OBJECT, // the second object of an environment is the first one again
+    CORRUPTION_TRUNCATED, // the last 8 bytes are missing
+    CORRUPTION_OTHER_ROBOT, // the image of the second robot of the swarm
+    NR_CORRUPTIONS
+} corruption_t;
+
+static const char *corruptionNames[] = {"an invalid rule type", "a NO_OBJECT environment object", "a repeated environment object",
+    "a missing end", "the key of another robot"};
+
+/**
+ * @brief Read a whole file
+ *
+ * @param path Path of the file
+ * @param size Will store the size of the file
+ *
+ * @return The contents of the file (freed with free()), NULL if it could not be read
+ */
+static uint8_t* readFile(const char *path, size_t *size) {
+    FILE *file = fopen(path, "rb");
+    uint8_t *data;
+
+    if (file == NULL)
+        return NULL;
+    fseek(file, 0, SEEK_END);
+    *size = (size_t) ftell(file);
+    fseek(file, 0, SEEK_SET);
+    data = (uint8_t *) malloc(*size + 1);
+    if (fread(data, 1, *size, file) != *size) {
+        fclose(file);
+        free(data);
+        return NULL;
+    }
+    fclose(file);
+    return data;
+}
+
+/**
+ * @brief Get the path of a cached image (named like in initPcolonyFromLuluCache())
+ *
+ * @param image_path Will store the path (at least sizeof(TEST_CACHE_DIR) + 48 bytes)
+ * @param lulu_path Path of the Lulu file
+ * @param robot_id Symbolic id of the robot
+ * @param nr_swarm_robots The number of robots that make up the swarm
+ */
+static void getTestImagePath(char *image_path, const char *lulu_path, uint16_t robot_id, uint16_t nr_swarm_robots) {
+    size_t length = 0;
+    uint8_t *text = readFile(lulu_path, &length);
+
+    snprintf(image_path, sizeof(TEST_CACHE_DIR) + 48, "%s/%016llx-%u-%u.img", TEST_CACHE_DIR,
+            (unsigned long long) getLuluModelHash((const char *) text, length, NULL), (unsigned) robot_id, (unsigned) nr_swarm_robots);
+    free(text);
+}
+
+/**
+ * @brief Get the inode of a file
+ *
+ * @param path Path of the file
+ *
+ * @return The inode of the file, 0 if it does not exist
+ */
+static ino_t getInode(const char *path) {
+    struct stat status;
+
+    return (stat(path, &status) == 0) ? status.st_ino : 0;
+}
+
+/**
+ * @brief Run a colony for a number of steps (or until a step did not finish) and compute the digest of it's final configuration
+ *
+ * @param pcol The P colony (seeded with TEST_SEED)
+ * @param nr_steps Number of steps after which the run stops
+ *
+ * @return The digest of the final configuration, the number of steps and the result of the last step
+ */
+static uint64_t runColony(Pcolony_t *pcol, uint64_t nr_steps) {
+    sim_step_result_t result = SIM_STEP_RESULT_FINISHED;
+    uint64_t step_nr = 0, digest;
+
+    while (step_nr < nr_steps && result == SIM_STEP_RESULT_FINISHED) {
+        result = pcolony_runSimulationStep(pcol);
+        step_nr++;
+    }
+
+    digest = getConfigurationDigest(pcol);
+    addToDigest(&digest, step_nr);
+    addToDigest(&digest, result);
+    return digest;
+}
+
+/**
+ * @brief Initialize a colony from the image cache for the first robot of the swarm and run it
+ *
+ * @param path Path of the Lulu file
+ * @param nr_swarm_robots The number of robots that make up the swarm
+ * @param my_id The kilo_uid of the robot
+ * @param nr_steps Number of steps after which the run stops
+ * @param digest Will store the digest of the final configuration (see runColony())
+ *
+ * @return TRUE if the colony was initialized, FALSE otherwise
+ */
+static bool runCachedColony(const char *path, uint16_t nr_swarm_robots, uint16_t my_id, uint64_t nr_steps, uint64_t *digest) {
+    Pcolony_t pcol;
+    InstanceImage_t image;
+
+    if (!initPcolonyFromLuluCache(&pcol, &image, path, NULL, 0, nr_swarm_robots, my_id, TEST_CACHE_DIR)) {
+        fprintf(stderr, "%s:%lu: %s\n", path, (unsigned long) image.error_line, image.error);
+        return FALSE;
+    }
+    pcolony_setSeed(&pcol, TEST_SEED);
+    *digest = runColony(&pcol, nr_steps);
+
+    //the colony may use the rules of the image in place (MAPPED_RULES)
+    destroyPcolony(&pcol);
+    destroyInstanceImage(&image);
+    return TRUE;
+}
+
+/**
+ * @brief Write a whole file
+ *
+ * @param path Path of the file
+ * @param data The contents of the file
+ * @param size The size of the contents
+ *
+ * @return TRUE if the file was written, FALSE otherwise
+ */
+static bool writeFile(const char *path, const uint8_t *data, size_t size) {
+    FILE *file = fopen(path, "wb");
+    bool written;
+
+    if (file == NULL)
+        return FALSE;
+    written = fwrite(data, 1, size, file) == size;
+    fclose(file);
+    return written;
+}
+
+/**
+ * @brief Corrupt a cached image in place
+ *
+ * @param image_path Path of the image
+ * @param other_image_path Path of the image of the second robot of the swarm (used by CORRUPTION_OTHER_ROBOT)
+ * @param corruption How the image is corrupted
+ *
+ * @return TRUE if the image was corrupted, FALSE if it cannot be corrupted this way (e.g. no environment has two objects)
+ */
+static bool corruptImage(const char *image_path, const char *other_image_path, corruption_t corruption) {
+    size_t size;
+    uint8_t *data = readFile((corruption == CORRUPTION_OTHER_ROBOT) ? other_image_path : image_path, &size);
+    image_header_t *header;
+    image_layout_t layout;
+    image_item_t *items;
+    bool corrupted = FALSE;
+
+    if (data == NULL)
+        return FALSE;
+    header = (image_header_t *) data;
+    getImageLayout(header, &layout);
+    items = (image_item_t *) (data + layout.items);
+    switch (corruption) {
+        case CORRUPTION_RULE_TYPE:
+            if (header->nr_rules > 0) {
+                ((Rule_t *) (data + layout.rules))->type = RULE_TYPE_CONDITIONAL_OUT_EXTEROCEPTIVE_OUT_EXTEROCEPTIVE + 1;
+                corrupted = TRUE;
+            }
+            break;
+        case CORRUPTION_NO_OBJECT:
+            if (header->nr_items[0] + header->nr_items[1] + header->nr_items[2] + header->nr_items[3] > 0) {
+                items[0].obj = NO_OBJECT;
+                corrupted = TRUE;
+            }
+            break;
+        case CORRUPTION_REPEATED_OBJECT:
+            for (uint8_t env = 0; env < IMAGE_NR_ENVS && !corrupted; env++) {
+                if (header->nr_items[env] > 1) {
+                    items[1].obj = items[0].obj;
+                    corrupted = TRUE;
+                }
+                items += header->nr_items[env];
+            }
+            break;
+        case CORRUPTION_TRUNCATED:
+            size -= 8;
+            corrupted = TRUE;
+            break;
+        case CORRUPTION_OTHER_ROBOT:
+            corrupted = TRUE;
+            break;
+        default:
+            break;
+    }
+
+    //written in place (same inode), so that a rebuilt image can be told apart by it's inode
+    corrupted = corrupted && writeFile(image_path, data, size);
+    free(data);
+    return corrupted;
+}
+
+/**
+ * @brief Check that the cache builds, maps, keys and rebuilds the images of a Lulu file correctly
+ *
+ * @param path Path of the Lulu file
+ * @param nr_steps Number of steps of each run
+ * @param expected Digest of the run of the parsed and expanded colony
+ *
+ * @return The number of failed checks
+ */
+static uint32_t checkImageCache(const char *path, uint64_t nr_steps, uint64_t expected) {
+    char image_path[sizeof(TEST_CACHE_DIR) + 48],
+         other_image_path[sizeof(TEST_CACHE_DIR) + 48],
+         key_path[sizeof(TEST_CACHE_DIR) + 48];
+    uint32_t nr_failures = 0;
+    uint64_t digest, unused_digest;
+    ino_t inode;
+    InstanceImage_t image;
+    uint8_t *text;
+    size_t length;
+
+    getTestImagePath(image_path, path, 0, TEST_NR_SWARM_ROBOTS);
+    getTestImagePath(other_image_path, path, 1, TEST_NR_SWARM_ROBOTS);
+    remove(image_path);
+    remove(other_image_path);
+
+    //miss: the image is built from the parsed colony
+    if (!runCachedColony(path, TEST_NR_SWARM_ROBOTS, 0, nr_steps, &digest))
+        return nr_failures + 1;
+    inode = getInode(image_path);
+    if (inode == 0) {
+        fprintf(stderr, "%s: the image was not cached\n", path);
+        nr_failures++;
+    }
+    if (digest != expected) {
+        fprintf(stderr, "%s: the colony initialized from the built image ends with a different configuration\n", path);
+        nr_failures++;
+    }
+
+    //hit: the cached image is mapped, not rebuilt
+    if (!runCachedColony(path, TEST_NR_SWARM_ROBOTS, 0, nr_steps, &digest))
+        return nr_failures + 1;
+    if (getInode(image_path) != inode) {
+        fprintf(stderr, "%s: the cached image was rebuilt\n", path);
+        nr_failures++;
+    }
+    if (digest != expected) {
+        fprintf(stderr, "%s: the colony initialized from the cached image ends with a different configuration\n", path);
+        nr_failures++;
+    }
+
+    //a different robot id, swarm size or model text is a miss
+    if (!runCachedColony(path, TEST_NR_SWARM_ROBOTS, 1, nr_steps, &unused_digest))
+        return nr_failures + 1;
+    if (getInode(other_image_path) == 0) {
+        fprintf(stderr, "%s: no image was built for another robot\n", path);
+        nr_failures++;
+    }
+    getTestImagePath(key_path, path, 0, TEST_NR_SWARM_ROBOTS + 1);
+    remove(key_path);
+    if (!runCachedColony(path, TEST_NR_SWARM_ROBOTS + 1, 0, nr_steps, &unused_digest))
+        return nr_failures + 1;
+    if (getInode(key_path) == 0) {
+        fprintf(stderr, "%s: no image was built for another swarm size\n", path);
+        nr_failures++;
+    }
+    remove(key_path);
+    text = readFile(path, &length);
+    if (text == NULL)
+        return nr_failures + 1;
+    text[length++] = '\n';
+    if (!writeFile(TEST_MODEL_COPY_PATH, text, length))
+        nr_failures++;
+    free(text);
+    getTestImagePath(key_path, TEST_MODEL_COPY_PATH, 0, TEST_NR_SWARM_ROBOTS);
+    remove(key_path);
+    if (!runCachedColony(TEST_MODEL_COPY_PATH, TEST_NR_SWARM_ROBOTS, 0, nr_steps, &digest))
+        return nr_failures + 1;
+    if (getInode(key_path) == 0 || strcmp(key_path, image_path) == 0) {
+        fprintf(stderr, "%s: no image was built for another model text\n", path);
+        nr_failures++;
+    }
+    if (digest != expected) {
+        fprintf(stderr, "%s: the colony initialized from the image of the copied model ends with a different configuration\n", path);
+        nr_failures++;
+    }
+    remove(key_path);
+    remove(TEST_MODEL_COPY_PATH);
+    if (getInode(image_path) != inode) {
+        fprintf(stderr, "%s: the cached image was rebuilt for another key\n", path);
+        nr_failures++;
+    }
+
+    //corrupted images are rejected and rebuilt
+    for (corruption_t corruption = 0; corruption < NR_CORRUPTIONS; corruption++) {
+        if (!corruptImage(image_path, other_image_path, corruption))
+            continue;
+        inode = getInode(image_path);
+
+        //the key is only checked by the cache
+        if (corruption != CORRUPTION_OTHER_ROBOT && initInstanceImage(&image, image_path)) {
+            fprintf(stderr, "%s: an image with %s was mapped\n", path, corruptionNames[corruption]);
+            destroyInstanceImage(&image);
+            nr_failures++;
+        }
+        if (!runCachedColony(path, TEST_NR_SWARM_ROBOTS, 0, nr_steps, &digest))
+            return nr_failures + 1;
+        if (getInode(image_path) == inode) {
+            fprintf(stderr, "%s: an image with %s was not rebuilt\n", path, corruptionNames[corruption]);
+            nr_failures++;
+        }
+        if (digest != expected) {
+            fprintf(stderr, "%s: the colony initialized from the image rebuilt after %s ends with a different configuration\n",
+                    path, corruptionNames[corruption]);
+            nr_failures++;
+        }
+    }
+
+    remove(image_path);
+    remove(other_image_path);
+    return nr_failures;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s nr_steps lulu_file...\n", argv[0]);
+        return 2;
+    }
+    uint64_t nr_steps = strtoull(argv[1], NULL, 10);
+    uint32_t nr_failures = 0;
+
+    if (mkdir(TEST_CACHE_DIR, 0755) != 0 && errno != EEXIST) {
+        fprintf(stderr, "Could not create %s\n", TEST_CACHE_DIR);
+        return 2;
+    }
+
+    for (int arg_nr = 2; arg_nr < argc; arg_nr++) {
+        const char *path = argv[arg_nr];
+        Pcolony_t pcol;
+        uint64_t expected;
+
+        if (!initTestPcolony(&pcol, path))
+            return 2;
+        expected = runColony(&pcol, nr_steps);
+        destroyPcolony(&pcol);
+
+        nr_failures += checkImageCache(path, nr_steps, expected);
+    }
+
+    rmdir(TEST_CACHE_DIR);
+    printf("%d Lulu files, %lu image failures\n", argc - 2, (unsigned long) nr_failures);
+    return nr_failures > 0;
+}
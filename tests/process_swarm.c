@@ -0,0 +1,199 @@
+/**
+ * @file process_swarm.c
+ * @brief Checks that a swarm stepped in turns by several processes ends like the same swarm stepped by pswarm_runSimulationStep()
+ * Each Lulu file given as argument is parsed and expanded for the first robot of a swarm of 3 robots, and a swarm of TEST_NR_COLONIES
+ * copies of the colony (colony i is seeded with TEST_SEED + i) is run for at most nr_steps swarm steps, once with
+ * pswarm_runSimulationStep() and once with processSwarm_run(). The result of the swarm, the final global environments and the number of
+ * steps and the result of each colony have to be identical. Then the process of one colony is crashed before it's first step, and the
+ * remaining processes have to end like a swarm without that colony.
+ *
+ * Usage: test_process_swarm nr_steps lulu_file...
+ */
+#include "swarm_process.h"
+#include "test_common.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+// nr of colonies of each swarm (each one is stepped by it's own process)
+#define TEST_NR_COLONIES 3
+// colony whose process is crashed
+#define TEST_CRASHED_COLONY 1
+
+/**
+ * @brief Initialize a swarm of copies of a colony that starts with the global environments of the colony
+ *
+ * @param pswarm The swarm that will be initialized
+ * @param pcol The colony (initialized with initTestPcolony())
+ * @param skipped_colony Number of the copy that is not added to the swarm (TEST_NR_COLONIES to add all of them)
+ */
+static void initTestPswarm(Pswarm_t *pswarm, Pcolony_t *pcol, uint16_t skipped_colony) {
+    initPswarm(pswarm, pcol->nr_A, TEST_NR_COLONIES);
+    destroyMultisetEnv(&pswarm->global_env);
+    destroyMultisetEnv(&pswarm->in_global_env);
+    destroyMultisetEnv(&pswarm->out_global_env);
+    copyMultisetEnv(&pswarm->global_env, &pcol->pswarm.global_env);
+    copyMultisetEnv(&pswarm->in_global_env, &pcol->pswarm.in_global_env);
+    copyMultisetEnv(&pswarm->out_global_env, &pcol->pswarm.out_global_env);
+    //the seeds do not depend on the skipped colony, so that the other colonies make the same choices
+    for (uint16_t colony_nr = 0; colony_nr < TEST_NR_COLONIES; colony_nr++)
+        if (colony_nr != skipped_colony)
+            pcolony_setSeed(pswarm_addColony(pswarm, pcol), TEST_SEED + colony_nr);
+}
+
+/**
+ * @brief Compute the digest of the global environments of a swarm
+ *
+ * @param pswarm The swarm
+ *
+ * @return The digest of the counts of all of the objects of the three global environments
+ */
+static uint64_t getGlobalEnvsDigest(Pswarm_t *pswarm) {
+    multiset_env_t *envs[] = {&pswarm->global_env, &pswarm->in_global_env, &pswarm->out_global_env};
+    uint64_t digest = TEST_DIGEST_INIT;
+
+    for (uint8_t env_nr = 0; env_nr < sizeof(envs) / sizeof(envs[0]); env_nr++)
+        for (object_id_t obj = 0; obj < envs[env_nr]->size; obj++)
+            addToDigest(&digest, getObjectCountFromMultisetEnv(envs[env_nr], obj));
+
+    return digest;
+}
+
+/**
+ * @brief Run a swarm with pswarm_runSimulationStep() for at most nr_steps steps
+ *
+ * @param pswarm The swarm
+ * @param nr_steps The maximum number of swarm steps
+ * @param step_nr Will store the number of swarm steps that were made
+ *
+ * @return The result of the last swarm step
+ */
+static sim_step_result_t runReferenceSwarm(Pswarm_t *pswarm, uint32_t nr_steps, uint32_t *step_nr) {
+    sim_step_result_t result = SIM_STEP_RESULT_FINISHED;
+
+    for (*step_nr = 0; *step_nr < nr_steps && result == SIM_STEP_RESULT_FINISHED; (*step_nr)++)
+        result = pswarm_runSimulationStep(pswarm);
+    return result;
+}
+
+/**
+ * @brief Check that the result of each colony of a process swarm agrees with the result of the reference swarm
+ * The last step of a colony finished if the swarm was stopped by nr_steps, none did if no colony had an executable program, and only the
+ * last stepped colony failed if the swarm failed
+ *
+ * @param path Path of the Lulu file (used in the messages)
+ * @param swarm The process swarm (after processSwarm_run())
+ * @param result Result of the reference swarm
+ * @param nr_steps Number of steps made by the reference swarm
+ * @param crashed_colony Colony whose process was crashed (TEST_NR_COLONIES if none)
+ *
+ * @return The number of failed checks
+ */
+static uint32_t checkColonyResults(const char *path, ProcessSwarm_t *swarm, sim_step_result_t result, uint32_t nr_steps,
+        uint16_t crashed_colony) {
+    uint32_t nr_failures = 0;
+    uint16_t nr_finished = 0, nr_failed = 0;
+
+    for (uint16_t colony_nr = 0; colony_nr < swarm->pswarm->nr_colonies; colony_nr++) {
+        bool crashed = swarm->crashed[colony_nr % swarm->nr_processes];
+
+        if (crashed != (colony_nr == crashed_colony)) {
+            fprintf(stderr, "%s: the process of colony %d %s\n", path, colony_nr, crashed ? "has crashed" : "has not crashed");
+            nr_failures++;
+        }
+        if (crashed)
+            continue;
+        //the colonies that follow a failed colony are not stepped in the last step
+        if (swarm->nr_steps[colony_nr] != nr_steps && (result != SIM_STEP_RESULT_ERROR || swarm->nr_steps[colony_nr] + 1 != nr_steps)) {
+            fprintf(stderr, "%s: colony %d made %lu steps instead of %lu\n", path, colony_nr, (unsigned long) swarm->nr_steps[colony_nr],
+                    (unsigned long) nr_steps);
+            nr_failures++;
+        }
+        if (swarm->results[colony_nr] == SIM_STEP_RESULT_FINISHED)
+            nr_finished++;
+        else if (swarm->results[colony_nr] == SIM_STEP_RESULT_ERROR)
+            nr_failed++;
+    }
+
+    if ((result == SIM_STEP_RESULT_FINISHED && nr_finished == 0) || (result == SIM_STEP_RESULT_NO_MORE_EXECUTABLES && nr_finished > 0) ||
+            (result == SIM_STEP_RESULT_ERROR) != (nr_failed == 1) || nr_failed > 1) {
+        fprintf(stderr, "%s: the results of the colonies do not agree with the result of the swarm\n", path);
+        nr_failures++;
+    }
+    return nr_failures;
+}
+
+/**
+ * @brief Run a swarm with processSwarm_run() and compare it with a swarm run by pswarm_runSimulationStep()
+ *
+ * @param path Path of the Lulu file
+ * @param pcol The colony (initialized with initTestPcolony())
+ * @param nr_steps The maximum number of swarm steps
+ * @param crashed_colony Colony whose process is crashed before it's first step (TEST_NR_COLONIES to crash none)
+ *
+ * @return The number of failed checks
+ */
+static uint32_t checkProcessSwarm(const char *path, Pcolony_t *pcol, uint32_t nr_steps, uint16_t crashed_colony) {
+    Pswarm_t reference, pswarm;
+    ProcessSwarm_t swarm;
+    sim_step_result_t expected_result, result;
+    uint32_t expected_nr_steps, nr_failures = 0;
+    Agent_t *agents = NULL;
+
+    //the colony of the crashed process is missing from the reference swarm
+    initTestPswarm(&reference, pcol, crashed_colony);
+    expected_result = runReferenceSwarm(&reference, nr_steps, &expected_nr_steps);
+
+    initTestPswarm(&pswarm, pcol, TEST_NR_COLONIES);
+    if (!initProcessSwarm(&swarm, &pswarm, TEST_NR_COLONIES)) {
+        fprintf(stderr, "%s: the shared memory region was not created\n", path);
+        destroyPswarm(&reference);
+        destroyPswarm(&pswarm);
+        return 1;
+    }
+    //the process dereferences NULL in it's first step, the colony is restored in this process afterwards
+    if (crashed_colony < TEST_NR_COLONIES) {
+        agents = pswarm.colonies[crashed_colony].agents;
+        pswarm.colonies[crashed_colony].agents = NULL;
+    }
+    result = processSwarm_run(&swarm, nr_steps);
+    if (crashed_colony < TEST_NR_COLONIES)
+        pswarm.colonies[crashed_colony].agents = agents;
+
+    if (result != expected_result) {
+        fprintf(stderr, "%s: the process swarm ended with result %d instead of %d\n", path, result, expected_result);
+        nr_failures++;
+    }
+    if (getGlobalEnvsDigest(&pswarm) != getGlobalEnvsDigest(&reference)) {
+        fprintf(stderr, "%s: the process swarm ends with different global environments\n", path);
+        nr_failures++;
+    }
+    nr_failures += checkColonyResults(path, &swarm, expected_result, expected_nr_steps, crashed_colony);
+
+    destroyProcessSwarm(&swarm);
+    destroyPswarm(&pswarm);
+    destroyPswarm(&reference);
+    return nr_failures;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s nr_steps lulu_file...\n", argv[0]);
+        return 2;
+    }
+    uint32_t nr_steps = (uint32_t) strtoul(argv[1], NULL, 10);
+    uint32_t nr_failures = 0;
+
+    for (int arg_nr = 2; arg_nr < argc; arg_nr++) {
+        const char *path = argv[arg_nr];
+        Pcolony_t pcol;
+
+        if (!initTestPcolony(&pcol, path))
+            return 2;
+        nr_failures += checkProcessSwarm(path, &pcol, nr_steps, TEST_NR_COLONIES);
+        nr_failures += checkProcessSwarm(path, &pcol, nr_steps, TEST_CRASHED_COLONY);
+        destroyPcolony(&pcol);
+    }
+
+    printf("%d Lulu files, %lu process swarm failures\n", argc - 2, (unsigned long) nr_failures);
+    return nr_failures > 0;
+}
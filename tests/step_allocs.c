@@ -0,0 +1,98 @@
+/**
+ * @file step_allocs.c
+ * @brief Checks that simulation steps do not allocate heap memory
+ * Each Lulu file given as argument is parsed and expanded for the first robot of a swarm of 3 robots and simulated for a number of steps.
+ * Programs are compiled and the step tables are built during the first step, so any heap allocation made by a later step is reported and
+ * makes the test fail. If the library is built with PCOLONY_ARENA the packed colony is checked too.
+ * Has to be built with LULU_COUNT_ALLOCS (see the check target of the Makefile).
+ *
+ * Usage: test_step_allocs nr_steps lulu_file...
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include "test_common.h"
+
+#ifndef LULU_COUNT_ALLOCS
+    #error "step_allocs.c has to be built with LULU_COUNT_ALLOCS"
+#endif
+
+/**
+ * @brief Run the simulation steps of a colony and count the steps that allocate memory
+ *
+ * @param pcol The P colony (before it's first simulation step)
+ * @param nr_steps The maximum number of steps
+ * @param path Path of the Lulu file (used in the messages)
+ * @param variant Name of the colony variant (used in the messages)
+ *
+ * @return The number of steps (after the first one) that allocated memory
+ */
+static uint32_t checkSteps(Pcolony_t *pcol, uint32_t nr_steps, const char *path, const char *variant) {
+    uint32_t nr_failed_steps = 0;
+
+    for (uint32_t step_nr = 0; step_nr < nr_steps; step_nr++) {
+        uint32_t nr_allocs = lulu_nr_allocs;
+        sim_step_result_t result = pcolony_runSimulationStep(pcol);
+
+        //programs are compiled during the first step, afterwards simulation steps should not allocate memory
+        if (step_nr > 0 && lulu_nr_allocs != nr_allocs) {
+            fprintf(stderr, "%s (%s): step %lu made %lu heap allocations\n", path, variant, (unsigned long) step_nr,
+                    (unsigned long) (lulu_nr_allocs - nr_allocs));
+            nr_failed_steps++;
+        }
+
+        if (result != SIM_STEP_RESULT_FINISHED)
+            break;
+    }
+
+    return nr_failed_steps;
+}
+
+/**
+ * @brief Initialize a colony from a Lulu file (see initTestPcolony()) with leaping enabled if the library supports it
+ *
+ * @param pcol The P colony that will be initialized
+ * @param path Path of the Lulu file
+ *
+ * @return TRUE if the colony was initialized, FALSE otherwise
+ */
+static bool initLeapingTestPcolony(Pcolony_t *pcol, const char *path) {
+    if (!initTestPcolony(pcol, path))
+        return FALSE;
+#ifdef STEP_LEAPING
+    pcolony_setLeaping(pcol, 16);
+#endif
+    return TRUE;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s nr_steps lulu_file...\n", argv[0]);
+        return 2;
+    }
+    uint32_t nr_steps = (uint32_t) strtoul(argv[1], NULL, 10);
+    uint32_t nr_failed_steps = 0;
+
+    for (int arg_nr = 2; arg_nr < argc; arg_nr++) {
+        Pcolony_t pcol;
+
+        if (!initLeapingTestPcolony(&pcol, argv[arg_nr]))
+            return 2;
+        nr_failed_steps += checkSteps(&pcol, nr_steps, argv[arg_nr], "unpacked");
+        destroyPcolony(&pcol);
+
+#ifdef PCOLONY_ARENA
+        if (!initLeapingTestPcolony(&pcol, argv[arg_nr]))
+            return 2;
+        packPcolony(&pcol);
+        nr_failed_steps += checkSteps(&pcol, nr_steps, argv[arg_nr], "packed");
+        destroyPcolony(&pcol);
+#endif
+    }
+
+    if (lulu_nr_allocs != lulu_nr_frees) {
+        fprintf(stderr, "%lu heap allocations but %lu deallocations\n", (unsigned long) lulu_nr_allocs, (unsigned long) lulu_nr_frees);
+        return 1;
+    }
+    printf("%d Lulu files, %lu steps that allocated memory\n", argc - 2, (unsigned long) nr_failed_steps);
+    return nr_failed_steps > 0;
+}
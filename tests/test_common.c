@@ -0,0 +1,43 @@
+/**
+ * @file test_common.c
+ * @brief Helpers shared by the tests
+ */
+#include "test_common.h"
+#include "lulu_parser.h"
+#include <stdio.h>
+
+bool initTestPcolony(Pcolony_t *pcol, const char *path) {
+    LuluInstance_t instance;
+
+    if (!initPcolonyFromLulu(pcol, &instance, path, NULL, 0, TEST_NR_SWARM_ROBOTS)) {
+        fprintf(stderr, "%s:%lu: %s\n", path, (unsigned long) instance.error_line, instance.error);
+        return FALSE;
+    }
+    if (instance.obj_with_id_size > 0 || instance.obj_with_any_size > 0)
+        luluInstance_expandPcolony(&instance, pcol, instance.smallest_robot_uid);
+    destroyLuluInstance(&instance);
+
+    pcolony_setSeed(pcol, TEST_SEED);
+    return TRUE;
+}
+
+void addToDigest(uint64_t *digest, uint64_t value) {
+    for (uint8_t i = 0; i < 8; i++) {
+        *digest ^= (value >> (8 * i)) & 0xFF;
+        *digest *= 0x100000001B3ULL;
+    }
+}
+
+uint64_t getConfigurationDigest(Pcolony_t *pcol) {
+    multiset_env_t *envs[] = {&pcol->env, &pcol->swarm->global_env, &pcol->swarm->in_global_env, &pcol->swarm->out_global_env};
+    uint64_t digest = TEST_DIGEST_INIT;
+
+    for (uint8_t env_nr = 0; env_nr < sizeof(envs) / sizeof(envs[0]); env_nr++)
+        for (object_id_t obj = 0; obj < pcol->nr_A; obj++)
+            addToDigest(&digest, getObjectCountFromMultisetEnv(envs[env_nr], obj));
+    for (uint8_t agent_nr = 0; agent_nr < pcol->nr_agents; agent_nr++)
+        for (object_id_t obj = 0; obj < pcol->nr_A; obj++)
+            addToDigest(&digest, getObjectCountFromMultisetObj(&pcol->agents[agent_nr].obj, obj));
+
+    return digest;
+}
@@ -0,0 +1,46 @@
+// vim:filetype=c
+/**
+ * @file test_common.h
+ * @brief Helpers shared by the tests: colonies initialized from Lulu files and digests of their configurations
+ */
+#ifndef TEST_COMMON_H
+#define TEST_COMMON_H
+
+#include "lulu.h"
+
+// the colonies of the tests are expanded for the first robot of a swarm of this many robots
+#define TEST_NR_SWARM_ROBOTS 3
+// fixed seed so that failures are reproducible
+#define TEST_SEED 8312
+// initial value of the digests (64 bit FNV-1a offset basis)
+#define TEST_DIGEST_INIT 0xCBF29CE484222325ULL
+
+/**
+ * @brief Initialize a colony from a Lulu file, expanded for the first robot of the swarm and seeded with TEST_SEED
+ * The parse errors are printed on stderr
+ *
+ * @param pcol The P colony that will be initialized
+ * @param path Path of the Lulu file
+ *
+ * @return TRUE if the colony was initialized, FALSE otherwise
+ */
+bool initTestPcolony(Pcolony_t *pcol, const char *path);
+
+/**
+ * @brief Add a value to a 64 bit FNV-1a digest
+ *
+ * @param digest The digest
+ * @param value The value
+ */
+void addToDigest(uint64_t *digest, uint64_t value);
+
+/**
+ * @brief Compute the digest of the configuration of a colony (independent of the layout of it's multisets)
+ *
+ * @param pcol The P colony
+ *
+ * @return The digest of all of the environments seen by the colony and of the objects of it's agents
+ */
+uint64_t getConfigurationDigest(Pcolony_t *pcol);
+
+#endif